@@ -12,23 +12,172 @@
 #include <windows.h>
 #include <winsock2.h>
 #include <ws2tcpip.h>
+#include <winternl.h>
 #include <iphlpapi.h>
+// IcmpSendEcho2 takes a real PIO_APC_ROUTINE once this is defined
+#define PIO_APC_ROUTINE_DEFINED
 #include <icmpapi.h>
+#include <windns.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <float.h>
+#include <math.h>
 
 #pragma comment(lib, "ws2_32.lib")
 #pragma comment(lib, "iphlpapi.lib")
+#pragma comment(lib, "dnsapi.lib")
 
 #define MAX_TARGET_LEN 256
 #define MAX_LOG_MSG 0xFF
 #define PING_DATA_SIZE 32
 #define MAX_BACKUP_DNS 8
+// IcmpSendEcho2 wants room for the reply, the echoed data, an ICMP error and the IO_STATUS_BLOCK
+#define PING_REPLY_SIZE (sizeof(ICMP_ECHO_REPLY) + PING_DATA_SIZE + 8 + sizeof(IO_STATUS_BLOCK))
+// Probes are carved from slabs of this many, then recycled through a free list
+#define ENGINE_SLAB_PROBES 1024
+// Upper bound for the configurable engine batch size
+#define ENGINE_MAX_BATCH 256
+// Resolver cache: fixed number of slots, a name may live in any of the probe window after its hash
+#define RESOLVER_CACHE_SLOTS 16384
+#define RESOLVER_PROBE_WINDOW 8
+#define RESOLVER_MIN_TTL_S 1
+#define RESOLVER_MAX_TTL_S 3600
+// Only a name DNS says does not exist or has no A record is cached negatively for long
+#define RESOLVER_NEGATIVE_TTL_S 30
+// Timeouts and server failures are retried on the next probe after this
+#define RESOLVER_TRANSIENT_TTL_S 1
+// Names answered outside DNS (hosts file, NetBIOS) carry no TTL
+#define RESOLVER_DEFAULT_TTL_S 60
+// Concurrent lookups the asynchronous resolver may have outstanding
+#define RESOLVER_MAX_THREADS 64
+#define RESOLVER_INFLIGHT_BUCKETS 1024
+// The high resolution timer fires this early, the rest of the way to the tick is spun
+// Classic timers are not spun at all, their lateness shows up as send error
+#define SCHEDULE_SPIN_NS 50000ULL
+// Scheduling wheel: level 0 ticks every 2^16 ns (65.5 us), five levels of 256 slots reach past a year
+#define WHEEL_TICK_SHIFT 16
+#define WHEEL_LEVEL_BITS 8
+#define WHEEL_LEVELS 5
+#define WHEEL_SLOTS (1 << WHEEL_LEVEL_BITS)
+#define WHEEL_SLOT_MASK (WHEEL_SLOTS - 1)
+// Scheduled targets are carved from slabs of this many, at most SCHEDULE_MAX_SLABS slabs
+#define SCHEDULE_SLAB_ENTRIES 4096
+#define SCHEDULE_MAX_SLABS 1024
+// Statistics shards, one per recording thread, threads beyond these share a locked overflow shard
+#define STATS_SHARDS 64
+// Per-target statistics: fixed table of 32 byte entries, never more than half full
+// About 57 MiB of address space, 8 MiB entries, 1 MiB histogram_of and 48 MiB histograms, plus series slabs as targets arrive
+#define TARGET_STATS_BITS 18 // ping_record_t has 18 bits for the slot, the other 14 carry the reset epoch
+#define TARGET_STATS_EPOCH_MASK ((1u << (32 - TARGET_STATS_BITS)) - 1)
+#define TARGET_STATS_SLOTS (1 << TARGET_STATS_BITS)
+#define TARGET_STATS_MAX (TARGET_STATS_SLOTS / 2)
+#define TARGET_STATS_LOCKS 256
+// A reset clears only the blocks of this many slots that were claimed since the last one
+#define TARGET_STATS_BLOCK 64
+#define TARGET_STATS_DIRTY_WORDS (TARGET_STATS_SLOTS / TARGET_STATS_BLOCK / 32)
+// RTT histograms: each power of two split in 2^sub bits buckets, over nanoseconds >> unit shift
+#define PING_HISTOGRAM_MAX_BUCKETS 1024
+// Global: 32 buckets per power of two from 1 ns to 68.7 s, none wider than 3.2% of its value
+#define GLOBAL_HIST_SUB_BITS 5
+#define GLOBAL_HIST_UNIT_SHIFT 0
+#define GLOBAL_HIST_BUCKETS 1024
+// Per target: 8 buckets per power of two from 1 us to 68.7 s, 16 bit counts, 384 bytes a target
+#define TARGET_HIST_SUB_BITS 3
+#define TARGET_HIST_UNIT_SHIFT 10
+#define TARGET_HIST_BUCKETS 192
+// Quantile sketches: bin i holds (gamma^(i-1), gamma^i] ns, gamma = (1 + a) / (1 - a) for a relative accuracy a
+#define SKETCH_ACCURACY_PPM 10000
+#define SKETCH_GAMMA 1.02020202020202
+#define SKETCH_LOG_GAMMA 0.020000666706669435
+// 1280 bins reach past 68.7 s at 1%, so sketches from any host line up bin for bin
+#define PING_SKETCH_BINS 1280
+// Serialised: 48 byte header, then a varint index gap and varint count per non-empty bin
+#define PING_SKETCH_MAX_BYTES (48 + PING_SKETCH_BINS * 12)
+#define SKETCH_MAGIC 0x4B535044 // "DPSK"
+#define SKETCH_VERSION 1
+// Per target a window of bins slides with the data, anything below it folds into its lowest bin
+#define SKETCH_TARGET_BINS 256
+// Recent samples per target for windowed health analysis and ping_get_history, windows never reach back further than these
+#define PING_HISTORY_SAMPLES 320
+#define HEALTH_RING_SAMPLES PING_HISTORY_SAMPLES
+#define HEALTH_WINDOWS 2
+#define HEALTH_SHORT_WINDOW 0
+#define HEALTH_LONG_WINDOW 1
+#define HEALTH_MIN_SAMPLES 10
+#define HEALTH_NO_DELTA MAXDWORD
+// Probe records: status 0 for a reply, IP_STATUS_BASE + n for IP status n, PING_RECORD_OTHER for any other error
+#define PING_RECORD_OK 0
+#define PING_RECORD_OTHER 0xFF
+#define PING_RECORD_SEND_MASK ((1ULL << 56) - 1)
+// CUSUM change detection, an alarm once the log-likelihood ratio reaches ln(1e5), held until it halves
+#define CHANGE_THRESHOLD 11.51f
+#define CHANGE_WARMUP 8
+#define CHANGE_LOSS_FLOOR 0.01f
+#define CHANGE_LOSS_JUMP 0.2f
+#define CHANGE_RTT_SHIFT 2.0f
+#define CHANGE_RTT_Z_CAP 3.0f
+#define CHANGE_RTT_DEV_FLOOR 0.1f
+#define CHANGE_RTT_OFFSET_US 5000.0f
+#define PING_BREACH_LOSS 0x1
+#define PING_BREACH_LATENCY 0x2
+#define PING_BREACH_JITTER 0x4
+#define PING_BREACH_FORCED 0x8
+// Countermeasure worker states, a trigger only ever moves IDLE or an expired COOLDOWN to QUEUED
+#define PING_COUNTERMEASURE_IDLE 0
+#define PING_COUNTERMEASURE_QUEUED 1
+#define PING_COUNTERMEASURE_RUNNING 2
+#define PING_COUNTERMEASURE_COOLDOWN 3
+// Countermeasures a run applied, bit id - 1 of each, the built-in ones take the first ids
+#define PING_ACTION_DNS_SWITCH 0x1
+#define PING_ACTION_ROUTE_REFRESH 0x2
+#define PING_ACTION_DNS_FLUSH 0x4
+#define PING_ACTION_COUNT 3
+#define PING_MAX_COUNTERMEASURES 16
+#define PING_COUNTERMEASURE_NAME_LEN 32
+// Execution times of countermeasures, microsecond units up to hours
+#define ACTION_HIST_SUB_BITS 4
+#define ACTION_HIST_UNIT_SHIFT 10
+#define ACTION_HIST_BUCKETS 512
+// A target's sketch and sample ring are carved from slabs of this many as targets arrive
+#define SERIES_SLAB_TARGETS 64
+#define SERIES_MAX_SLABS (TARGET_STATS_MAX / SERIES_SLAB_TARGETS)
+// Log records waiting for the drain thread, a power of two, callers drop rather than wait when it is full
+#define LOG_RING_RECORDS 1024
+// The drain thread looks at the ring this often even when nobody wakes it
+#define LOG_DRAIN_IDLE_MS 100
+// log_stop waits this long for callers between claiming a slot and publishing it, then counts them dropped
+#define LOG_STOP_WAIT_MS 100
+// Binary log files: distinct format strings per file, and bytes gathered before one write
+#define LOG_MAX_FORMATS 1024
+// Formats passed to ping_log are copied here once by content, past either limit messages are formatted at the call
+#define LOG_INTERN_FORMATS 256
+#define LOG_INTERN_BYTES 0x4000
+#define LOG_FILE_BUFFER 0x10000
+#define LOG_FILE_MAGIC "DBJLOG1\n"
+#define LOG_FILE_MAGIC_SIZE 8
+#define LOG_FILE_FORMAT 1
+#define LOG_FILE_MESSAGE 2
+#define LOG_FILE_TEXT 3
+// How a captured argument is stored, the format string tells the order
+#define LOG_ARG_NONE 0
+#define LOG_ARG_INT 1 // 4 bytes
+#define LOG_ARG_INT64 2 // 8 bytes
+#define LOG_ARG_SIZE 3 // size_t, 8 bytes whatever the build
+#define LOG_ARG_DOUBLE 4
+#define LOG_ARG_POINTER 5 // 8 bytes
+#define LOG_ARG_STRING 6 // WORD length, then the bytes without a terminator
+
+#define CONFIG_MAX_FILE 0x10000
+#define CONFIG_MAX_TEXT 4096 // every key with its comment, as the defaults are written
+#define CONFIG_BACKUP_DNS_KEY "BackupDns"
+#define CONFIG_READER_SHARDS 16
+#define CONFIG_RELOAD_QUIET_MS 100 // editors save in several writes, reload once they stop
+#define CONFIG_SAVE_QUIET_MS 200 // a burst of ping_set_config calls is saved once, after the last
 
  // Log levels
 typedef enum {
@@ -56,8 +205,93 @@ typedef struct {
 	bool enable_logging;
 	char backup_dns[MAX_BACKUP_DNS][16];
 	DWORD backup_dns_count;
+	DWORD engine_batch_size;
+	char resolver_dns[16];
+	DWORD resolver_threads;
+	DWORD short_window_ms;
+	DWORD long_window_ms;
+	DWORD countermeasure_cooldown_ms;
+	DWORD countermeasure_settle_ms;
+	DWORD scheduled_completions;
 } ping_config_t;
 
+// First problem found in a configuration file, and how many there were
+typedef struct {
+	DWORD line;
+	DWORD column;
+	DWORD errors; // bad values and lines, the file fails to parse
+	DWORD warnings; // unknown keys, skipped, the file still parses
+	char message[128]; // the first error, or the first warning if there was no error
+} ping_config_error_t;
+
+// Where an INI key lands in ping_config_t, the parser and the writer both walk these
+typedef enum {
+	CONFIG_DWORD,
+	CONFIG_BOOL,
+	CONFIG_STRING
+} config_type_t;
+
+typedef struct {
+	const char* section;
+	const char* key;
+	config_type_t type;
+	size_t offset;
+	size_t size;
+	const char* comment;
+} config_key_t;
+
+// Published configuration, never written again once readers can see it
+typedef struct {
+	ping_config_t config;
+	ULONGLONG version;
+} config_snapshot_t;
+
+// Readers inside a snapshot by phase parity, one line per shard
+typedef struct DECLSPEC_ALIGN(SYSTEM_CACHE_ALIGNMENT_SIZE) {
+	volatile LONG readers[2];
+} config_readers_t;
+
+// What a reader holds between config_acquire and config_release
+typedef struct {
+	const config_snapshot_t* snapshot;
+	volatile LONG* readers;
+} config_ref_t;
+
+// Size and last write of dbj_ping.ini, a change notification only rereads it when they moved
+typedef struct {
+	FILETIME last_write;
+	ULONGLONG size;
+} config_stamp_t;
+
+// Configuration counters since the DLL was loaded
+typedef struct {
+	ULONGLONG version; // of the snapshot readers get now
+	ULONGLONG reloads; // snapshots published because dbj_ping.ini changed
+	ULONGLONG reload_failures; // changes that could not be read or parsed, the running snapshot stayed
+	ULONGLONG reclaimed; // snapshots freed after their last reader left
+	ULONGLONG saves; // writes of a whole configuration file
+} ping_config_stats_t;
+
+// Current snapshot behind one pointer: readers count themselves in and out, writers swap, wait the old readers out and free
+typedef struct {
+	config_snapshot_t* volatile current;
+	volatile LONG phase; // readers count under phase & 1, a writer flips it and waits for the old half to empty
+	config_readers_t shards[CONFIG_READER_SHARDS];
+	SRWLOCK publish_lock; // writers only, readers never take it
+	SRWLOCK save_lock; // savers in turn, taken before publish_lock and held over the disk writes
+	ULONGLONG version;
+	config_stamp_t stamp; // of the file as last loaded or saved
+	HANDLE thread;
+	HANDLE stop_event;
+	HANDLE change; // change notification on the directory of dbj_ping.ini
+	HANDLE save_event; // ping_set_config published a snapshot the watcher has to save
+	volatile LONG save_pending;
+	volatile LONG64 reloads;
+	volatile LONG64 reload_failures;
+	volatile LONG64 reclaimed;
+	volatile LONG64 saves;
+} config_state_t;
+
 // Ping statistics
 typedef struct {
 	DWORD packets_sent;
@@ -81,6 +315,586 @@ typedef struct {
 	SYSTEMTIME timestamp;
 } ping_result_t;
 
+// Ping result with nanosecond timing on the monotonic clock
+typedef struct {
+	ping_result_t base;
+	ULONGLONG rtt_ns;
+	ULONGLONG send_time_ns;
+	ULONGLONG recv_time_ns;
+} ping_result_ex_t;
+
+// Asynchronous probe completion
+typedef struct {
+	ULONGLONG ticket;
+	ping_result_t result;
+	ULONGLONG rtt_ns;
+	ULONGLONG send_time_ns;
+} ping_completion_t;
+
+// In-flight echo request issued through IcmpSendEcho2
+typedef struct DECLSPEC_ALIGN(MEMORY_ALLOCATION_ALIGNMENT) ping_probe {
+	SLIST_ENTRY entry; // must stay first, SLIST entries need allocation alignment
+	struct ping_probe* next;
+	ULONGLONG ticket;
+	ping_result_ex_t outcome;
+	volatile LONG* pending;
+	void (*on_complete)(struct ping_probe* probe);
+	IPAddr addr;
+	DWORD resolve_status;
+	bool resolved; // addr and resolve_status are valid, probe_start will not resolve again
+	struct resolver_batch* lookups; // batch probes parked in the resolver, NULL for engine probes
+	ULONGLONG deadline_ns; // send deadline for scheduled probes, 0 otherwise
+	char target[MAX_TARGET_LEN];
+	BYTE reply_buffer[PING_REPLY_SIZE];
+} ping_probe_t;
+
+// Probe engine throughput counters, engine_calls counts the wake, wait and send calls the engine makes,
+// tallied at each call site rather than measured as kernel transitions
+typedef struct {
+	ULONGLONG probes_submitted;
+	ULONGLONG probes_completed;
+	ULONGLONG engine_calls;
+	double elapsed_ms;
+	double probes_per_second;
+	double engine_calls_per_probe;
+} ping_engine_stats_t;
+
+// Slab of probes with their reply buffers, allocated once and reused
+typedef struct ping_probe_slab {
+	struct ping_probe_slab* next;
+	ping_probe_t probes[ENGINE_SLAB_PROBES];
+} ping_probe_slab_t;
+
+// Submit/complete engine, one thread drives every asynchronous probe
+typedef struct {
+	SLIST_HEADER submissions;
+	SLIST_HEADER free_probes;
+	ping_probe_slab_t* slabs;
+	HANDLE thread;
+	HANDLE wake_event;
+	HANDLE completion_event; // manual reset, signalled while completions are queued
+	SRWLOCK completion_lock;
+	ping_probe_t* completion_head;
+	ping_probe_t* completion_tail;
+	ping_probe_t* staged_head; // engine thread only, published in batches
+	ping_probe_t* staged_tail;
+	DWORD staged_count;
+	DWORD staged_scheduled;
+	DWORD scheduled_queued; // under completion_lock
+	volatile LONG64 scheduled_dropped;
+	volatile LONG inflight;
+	volatile LONG resolving; // probes parked in the asynchronous resolver
+	volatile LONG stop;
+	volatile LONG64 next_ticket;
+	volatile LONG64 probes_submitted;
+	volatile LONG64 probes_completed;
+	volatile LONG64 engine_calls; // wake, wait and send calls on the engine paths
+	LARGE_INTEGER stats_start;
+} ping_engine_t;
+
+// Periodic probing counters, send error is the send stamp minus the deadline
+typedef struct {
+	bool running;
+	ULONGLONG start_ns;
+	ULONGLONG interval_ns;
+	ULONGLONG probes_sent;
+	ULONGLONG deadlines_missed;
+	double mean_send_error_us;
+	double max_send_error_us;
+	ULONGLONG targets;
+	ULONGLONG timer_events;
+	double timer_ns_per_probe;
+	double add_ns_per_target;
+	ULONGLONG completions_dropped; // scheduled results dropped past Engine ScheduledCompletions
+} ping_schedule_stats_t;
+
+// One scheduled target, lives in a timing wheel slot between its deadlines
+typedef struct DECLSPEC_ALIGN(MEMORY_ALLOCATION_ALIGNMENT) schedule_entry {
+	SLIST_ENTRY entry; // must stay first, free list and additions queue
+	struct schedule_entry* next; // wheel slot
+	ULONGLONG start_ns; // deadline of probe 0, phase included
+	ULONGLONG interval_ns;
+	ULONGLONG deadline_ns;
+	ULONGLONG sequence;
+	DWORD count; // 0 probes until removed
+	DWORD index; // position in the entry table, low half of the schedule id
+	DWORD generation; // high half of the schedule id, bumped on every reuse
+	volatile LONG cancelled;
+	char* target;
+} schedule_entry_t;
+
+// Hierarchical timing wheel, level n slots span WHEEL_SLOTS^n ticks
+typedef struct {
+	schedule_entry_t* slots[WHEEL_LEVELS][WHEEL_SLOTS];
+	DWORD occupied[WHEEL_SLOTS / 32]; // level 0 slots holding entries
+	ULONGLONG now_tick; // next tick to fire
+	ULONGLONG entries;
+} timing_wheel_t;
+
+// Periodic prober, deadlines are absolute on the monotonic clock so errors never accumulate
+typedef struct {
+	SRWLOCK control_lock; // start, add and stop, never held by the scheduler thread
+	SRWLOCK table_lock; // entry slabs and generations
+	SLIST_HEADER free_entries;
+	SLIST_HEADER additions;
+	schedule_entry_t* slabs[SCHEDULE_MAX_SLABS];
+	DWORD slab_count;
+	timing_wheel_t wheel; // scheduler thread only
+	HANDLE thread;
+	HANDLE timer;
+	HANDLE stop_event;
+	HANDLE wake_event; // auto reset, set when additions arrive on an empty queue
+	bool high_resolution;
+	volatile LONG active; // scheduled targets not yet retired
+	volatile LONG64 phase_seed;
+	ULONGLONG start_ns;
+	ULONGLONG interval_ns;
+	volatile LONG64 probes_sent; // written by the engine thread
+	volatile LONG64 deadlines_missed;
+	volatile LONG64 send_error_sum_ns;
+	volatile LONG64 send_error_max_ns;
+	volatile LONG64 timer_events;
+	volatile LONG64 timer_ns; // wheel upkeep and spin for fired deadlines
+	volatile LONG64 targets_added;
+	volatile LONG64 add_ns; // wheel insertion of new targets
+} ping_schedule_t;
+
+// Resolver cache counters
+typedef struct {
+	ULONGLONG hits;
+	ULONGLONG negative_hits;
+	ULONGLONG misses;
+	ULONGLONG lookups;
+	ULONGLONG bypassed;
+	ULONGLONG evictions;
+	ULONGLONG coalesced;
+	DWORD entries;
+} ping_resolver_stats_t;
+
+// Cached name, positive or negative, an empty name marks a free slot
+typedef struct {
+	ULONG hash;
+	IPAddr addr;
+	DWORD status;
+	ULONGLONG expires_ns;
+	char name[MAX_TARGET_LEN];
+} resolver_entry_t;
+
+// TTL-aware resolver cache in front of DNS
+typedef struct {
+	SRWLOCK lock;
+	resolver_entry_t entries[RESOLVER_CACHE_SLOTS];
+	DWORD entry_count;
+	volatile LONG64 hits;
+	volatile LONG64 negative_hits;
+	volatile LONG64 misses;
+	volatile LONG64 lookups;
+	volatile LONG64 bypassed;
+	volatile LONG64 evictions;
+	volatile LONG64 coalesced;
+} resolver_cache_t;
+
+// One name being looked up, every probe that asked for it meanwhile waits on it
+typedef struct resolver_request {
+	struct resolver_request* next; // work queue
+	struct resolver_request* chain; // in-flight bucket
+	ULONG hash;
+	ping_probe_t* waiters;
+	char name[MAX_TARGET_LEN];
+} resolver_request_t;
+
+// Cache misses of one ping_execute_batch call, the caller waits until the last is answered
+typedef struct resolver_batch {
+	volatile LONG outstanding;
+	HANDLE done; // manual reset, set when outstanding drops to 0
+} resolver_batch_t;
+
+// Worker threads resolving for the probe engine, started on demand
+typedef struct {
+	SRWLOCK lock;
+	CONDITION_VARIABLE work_ready;
+	resolver_request_t* queue_head;
+	resolver_request_t* queue_tail;
+	resolver_request_t* inflight[RESOLVER_INFLIGHT_BUCKETS];
+	HANDLE threads[RESOLVER_MAX_THREADS];
+	DWORD thread_count;
+	DWORD active; // lookups outstanding, bounded by resolver_threads
+	bool stop;
+} resolver_pool_t;
+
+// Loss, RTT and jitter over one window of recent samples
+typedef struct {
+	DWORD window_ms; // the configured span, or less when the window holds all HEALTH_RING_SAMPLES of the ring
+	DWORD samples;
+	DWORD lost;
+	double loss_percent;
+	double mean_rtt;
+	double stddev_rtt;
+	double jitter; // mean RFC 3550 transit difference between consecutive replies
+} ping_window_stats_t;
+
+// Statistics of one target address
+typedef struct {
+	char target_ip[16];
+	DWORD packets_sent;
+	DWORD packets_received;
+	DWORD packets_lost;
+	double min_rtt;
+	double max_rtt;
+	double avg_rtt;
+	double jitter;
+	double rtt_p50;
+	double rtt_p99;
+	double rtt_p999;
+	ping_window_stats_t short_window;
+	ping_window_stats_t long_window;
+	DWORD change; // PING_BREACH_LOSS and PING_BREACH_LATENCY the change detector holds
+	double change_confidence; // 1 - bound on the false alarm probability of the strongest score
+	DWORD change_detected_ms; // monotonic time of the last alarm
+	DWORD change_delay_ms; // from the estimated onset to that alarm
+	DWORD change_alarms;
+	bool degraded; // a window is past a threshold or a change is held, what health analysis acts on
+} ping_target_stats_t;
+
+// Raw RTT histogram, merge histograms from several processes with ping_merge_rtt_histograms
+typedef struct {
+	DWORD sub_bucket_bits;
+	DWORD unit_shift;
+	DWORD bucket_count;
+	ULONGLONG total_count;
+	ULONGLONG min_rtt_ns;
+	ULONGLONG max_rtt_ns;
+	ULONGLONG counts[PING_HISTOGRAM_MAX_BUCKETS];
+} ping_rtt_histogram_t;
+
+// Relative-error quantile sketch, bins[i] counts RTTs in (gamma^(i-1), gamma^i] ns
+typedef struct {
+	DWORD accuracy_ppm;
+	DWORD reserved;
+	ULONGLONG count;
+	ULONGLONG min_rtt_ns;
+	ULONGLONG max_rtt_ns;
+	ULONGLONG sum_rtt_ns;
+	ULONGLONG bins[PING_SKETCH_BINS];
+} ping_sketch_t;
+
+// One probe outcome packed for storage, 16 bytes, ping_record_to_result makes a ping_result_ex_t of it
+typedef struct {
+	ULONGLONG send_ns : 56; // monotonic like send_time_ns, wraps after 2.28 years
+	ULONGLONG status : 8;
+	DWORD target : 18; // slot in the per-target table
+	DWORD epoch : 14; // resets of the table when recorded, a record from before the last one is stale
+	DWORD rtt_us; // 0 unless status is PING_RECORD_OK
+} ping_record_t;
+
+// Read-only view of a target's history ring, record i of count is records[(first + i) % capacity]
+typedef struct {
+	const ping_record_t* records;
+	DWORD capacity;
+	DWORD first; // the oldest
+	DWORD count;
+	LONG64 generation; // records ever written to the ring when the view was taken
+	const volatile LONG64* current; // the ring's generation now, bumped before a record is overwritten
+} ping_history_t;
+
+// Running sums over one window, kept in step as samples enter and leave
+typedef struct {
+	WORD tail; // oldest sample in the window
+	WORD samples;
+	WORD lost;
+	WORD deltas;
+	DWORD prev_rtt_us; // the reply before tail, the one tail's delta was taken against
+	bool has_prev;
+	ULONGLONG rtt_sum_us;
+	ULONGLONG rtt_sum_sq_us; // integer sums, so taking a sample out never drifts
+	ULONGLONG delta_sum_us;
+} health_window_t;
+
+// Ring of a target's recent samples, the windows are spans of it ending at the newest
+typedef struct {
+	volatile LONG64 generation; // records ever written, survives a reset so views of the old target go stale
+	WORD head; // where the next sample goes
+	WORD size;
+	DWORD last_rtt_us;
+	bool has_last;
+	health_window_t windows[HEALTH_WINDOWS];
+	ping_record_t records[HEALTH_RING_SAMPLES]; // handed out as they are by ping_get_history
+} target_ring_t;
+
+// One target's sketch, a window of SKETCH_TARGET_BINS bins starting at offset
+typedef struct {
+	WORD offset;
+	bool used;
+	DWORD bins[SKETCH_TARGET_BINS];
+} target_sketch_t;
+
+// CUSUM scores of a target, loss as Bernoulli trials and RTT on a log scale
+typedef struct {
+	float rtt_mean; // ln(rtt_us + CHANGE_RTT_OFFSET_US) baseline
+	float rtt_dev;
+	float loss_rate; // baseline loss, 0..1
+	float rtt_score;
+	float loss_score;
+	WORD warmup; // replies seen while the RTT baseline forms
+	WORD flags; // PING_BREACH_* alarmed and not yet back under half the threshold
+	DWORD alarms;
+	DWORD rtt_onset_ms; // when the score last left zero
+	DWORD loss_onset_ms;
+	DWORD detected_ms;
+	DWORD delay_ms;
+} change_detector_t;
+
+// Per-target state too big for the table, allocated once a target has results
+typedef struct {
+	target_sketch_t sketch;
+	target_ring_t ring;
+	change_detector_t detector;
+} target_series_t;
+
+// One target's RTT histogram, every count is halved when one would overflow
+typedef struct {
+	WORD counts[TARGET_HIST_BUCKETS];
+} target_histogram_t;
+
+// Per-target table occupancy, untracked counts results dropped because the table was full
+typedef struct {
+	DWORD targets;
+	DWORD capacity;
+	ULONGLONG untracked;
+	ULONGLONG memory_bytes;
+} ping_target_table_stats_t;
+
+// One target's statistics, 32 bytes so two share a cache line
+typedef struct {
+	volatile LONG addr; // IPAddr, 0 marks a free slot
+	DWORD packets_sent;
+	DWORD packets_received;
+	DWORD min_rtt_ns; // saturates at 4.29 s, past any echo timeout
+	DWORD max_rtt_ns;
+	float jitter; // milliseconds
+	ULONGLONG rtt_sum_ns;
+} target_stats_entry_t;
+
+// Open addressing by address with linear probing, entries are never removed before a reset
+typedef struct {
+	target_stats_entry_t entries[TARGET_STATS_SLOTS];
+	SRWLOCK locks[TARGET_STATS_LOCKS]; // striped by slot, guards the counters, not the key
+	DWORD histogram_of[TARGET_STATS_SLOTS]; // 1 + index into histograms and series, 0 until the first result
+	target_histogram_t histograms[TARGET_STATS_MAX]; // demand-zero, pages are touched as targets arrive
+	target_series_t* volatile series_slabs[SERIES_MAX_SLABS]; // allocated as targets arrive, kept until cleanup
+	volatile LONG dirty[TARGET_STATS_DIRTY_WORDS]; // bit per TARGET_STATS_BLOCK slots, set once a slot in it is claimed
+	volatile LONG histograms_used;
+	volatile LONG entry_count;
+	volatile LONG resets; // records carry the low bits, a slot may hold another address after a reset
+	volatile LONG64 untracked;
+} target_stats_table_t;
+
+// Statistics one recording thread owns, readers merge every shard
+typedef struct DECLSPEC_ALIGN(SYSTEM_CACHE_ALIGNMENT_SIZE) {
+	volatile LONG sequence; // odd while the owner writes, readers retry
+	volatile LONG owner; // thread id, 0 while unclaimed
+	LONG epoch; // written before the last reset when it differs from g_stats_epoch
+	ULONGLONG packets_sent;
+	ULONGLONG packets_received;
+	ULONGLONG packets_lost;
+	ULONGLONG rtt_sum_ns;
+	ULONGLONG min_rtt_ns;
+	ULONGLONG max_rtt_ns;
+	double jitter;
+	// Outside the sequence, readers sum the counts as they find them
+	ULONGLONG rtt_histogram[GLOBAL_HIST_BUCKETS];
+} stats_shard_t;
+
+// Where countermeasures stand and how they went
+typedef struct {
+	DWORD state; // PING_COUNTERMEASURE_*
+	DWORD pending_reasons; // PING_BREACH_* waiting for the worker
+	DWORD last_reasons; // PING_BREACH_* that caused the last run
+	DWORD last_actions; // bit id - 1 of each countermeasure the last run applied
+	DWORD cooldown_remaining_ms;
+	ULONGLONG triggers;
+	ULONGLONG runs;
+	ULONGLONG coalesced; // triggers folded into a queued or running one
+	ULONGLONG suppressed; // triggers that arrived during the cooldown
+	double last_duration_ms;
+	SYSTEMTIME last_completed;
+	DWORD action_status[PING_MAX_COUNTERMEASURES]; // by id - 1 for the last run, ERROR_CANCELLED if it did not run, ERROR_TIMEOUT if not back in time
+	double action_ms[PING_MAX_COUNTERMEASURES];
+} ping_countermeasure_status_t;
+
+// A countermeasure, returns a Win32 status, runs on a thread pool thread
+typedef DWORD(__stdcall* ping_countermeasure_fn)(void* context);
+
+// Registration of a countermeasure
+typedef struct {
+	char name[PING_COUNTERMEASURE_NAME_LEN];
+	ping_countermeasure_fn run;
+	void* context;
+	DWORD cost; // cheaper ones run first, those of equal cost run concurrently
+	DWORD timeout_ms; // the run is not waited for longer, it is left to finish on its own
+	DWORD cooldown_ms; // after its own last run, on top of the shared cooldown
+	DWORD triggers; // PING_BREACH_* it answers
+} ping_countermeasure_t;
+
+// A registered countermeasure and how its runs went
+typedef struct {
+	ping_countermeasure_t countermeasure;
+	ULONGLONG runs;
+	ULONGLONG failures;
+	ULONGLONG timeouts;
+	ULONGLONG skipped; // in its cooldown, or a timed out run had not returned yet
+	DWORD last_status;
+	double last_ms;
+	ping_rtt_histogram_t execution_times;
+} ping_countermeasure_info_t;
+
+// A log sink, called on the drain thread one message at a time, time is UTC
+typedef void(__stdcall* ping_log_sink_fn)(void* context, log_kind_t kind, const FILETIME* time, const char* text);
+
+// Log ring counters, dropped messages found the ring full
+typedef struct {
+	ULONGLONG enqueued;
+	ULONGLONG written;
+	ULONGLONG dropped;
+	DWORD capacity;
+	DWORD pending;
+} ping_log_stats_t;
+
+// One log message in the ring, sequence is its position while free and position + 1 once written
+typedef struct DECLSPEC_ALIGN(SYSTEM_CACHE_ALIGNMENT_SIZE) {
+	volatile LONG64 sequence;
+	ULONGLONG time; // FILETIME of the call
+	const char* format; // kept by address, formatted by the drain thread; NULL when data already holds text
+	log_kind_t kind;
+	WORD size; // bytes of data in use
+	BYTE data[MAX_LOG_MSG]; // the arguments as log_capture packs them
+} log_record_t;
+
+// One conversion of a format string
+typedef struct {
+	const char* start; // the '%'
+	DWORD length;
+	BYTE arg; // LOG_ARG_*
+	BYTE stars; // '*' width and precision, each an int argument before the value
+} log_spec_t;
+
+// Header of every record in a binary log file after the magic, little-endian
+typedef struct {
+	BYTE type; // LOG_FILE_*
+	BYTE kind;
+	WORD size; // bytes that follow
+	DWORD format_id;
+	ULONGLONG time; // FILETIME, 0 for a format definition
+} log_file_record_t;
+
+// The binary file sink, only written under the exclusive sink lock
+typedef struct {
+	HANDLE file;
+	DWORD used;
+	DWORD format_count;
+	const char* formats[LOG_MAX_FORMATS]; // by id, open addressed by address in format_slots
+	WORD format_slots[LOG_MAX_FORMATS * 2]; // 1 + id, 0 for free
+	BYTE buffer[LOG_FILE_BUFFER];
+} log_binary_t;
+
+// Ring position on a line of its own, producers and the drain thread do not share one
+typedef struct DECLSPEC_ALIGN(SYSTEM_CACHE_ALIGNMENT_SIZE) {
+	volatile LONG64 position;
+} log_cursor_t;
+
+// Bounded multi-producer ring, callers claim a slot with one compare-exchange and never block
+typedef struct {
+	log_record_t records[LOG_RING_RECORDS];
+	log_cursor_t enqueue;
+	log_cursor_t dequeue; // only the drain thread moves it
+	volatile LONG64 dropped;
+	volatile LONG running; // callers write through the sink themselves while 0
+	volatile LONG sleeping; // the drain thread waits for wake_event
+	HANDLE thread;
+	HANDLE stop_event;
+	HANDLE wake_event;
+	SRWLOCK sink_lock; // held while writing, a sink is only swapped between messages
+	ping_log_sink_fn sink; // NULL writes to the Windows Event Log
+	void* context;
+	HANDLE file; // owned by the file sink
+	log_binary_t* binary; // when set, records are written undecoded instead of to the sink
+	HANDLE event_source; // registered once for the drain thread
+} log_ring_t;
+
+// Copies of the callers' formats, never freed, so the drain thread and binary files may keep them by address
+typedef struct {
+	SRWLOCK lock;
+	DWORD count;
+	DWORD used; // bytes of text
+	DWORD hashes[LOG_INTERN_FORMATS];
+	WORD offsets[LOG_INTERN_FORMATS]; // into text
+	WORD slots[LOG_INTERN_FORMATS * 2]; // open addressed by hash, 1 + index, 0 for free
+	char text[LOG_INTERN_BYTES];
+} log_intern_t;
+
+// Countermeasure worker, triggers only flip state and signal it, only the worker writes dns_index
+typedef struct {
+	volatile LONG state; // PING_COUNTERMEASURE_*
+	volatile LONG pending; // PING_BREACH_* gathered while QUEUED
+	volatile LONG last_reasons;
+	volatile LONG last_actions;
+	volatile LONG dns_index;
+	volatile LONG64 last_run; // FILETIME of the last start
+	volatile LONG64 last_completed; // FILETIME
+	volatile LONG64 last_duration_ns;
+	volatile LONG64 cooldown_until_ns; // monotonic
+	volatile LONG64 triggers;
+	volatile LONG64 runs;
+	volatile LONG64 coalesced;
+	volatile LONG64 suppressed;
+	volatile LONG target; // IPAddr of the target that triggered, 0 if forced or several did
+	volatile LONG action_status[PING_MAX_COUNTERMEASURES];
+	volatile LONG64 action_ns[PING_MAX_COUNTERMEASURES];
+	HANDLE thread;
+	HANDLE wake_event;
+	HANDLE stop_event;
+} countermeasure_state_t;
+
+// A registry slot, the counters are written by whichever thread finishes a run
+typedef struct {
+	ping_countermeasure_t countermeasure;
+	bool used;
+	DWORD generation; // runs of an earlier registration in the slot record nothing
+	bool running; // a timed out run has not returned, the countermeasure is skipped until it does
+	ULONGLONG last_end_ns;
+	ULONGLONG runs;
+	ULONGLONG failures;
+	ULONGLONG timeouts;
+	ULONGLONG skipped;
+	DWORD last_status;
+	ULONGLONG last_ns;
+	ULONGLONG min_ns;
+	ULONGLONG max_ns;
+	ULONGLONG execution_times[ACTION_HIST_BUCKETS];
+} countermeasure_entry_t;
+
+typedef struct {
+	SRWLOCK lock;
+	countermeasure_entry_t entries[PING_MAX_COUNTERMEASURES];
+	PTP_CLEANUP_GROUP cleanup_group; // closing it waits for runs left behind by a timeout
+	TP_CALLBACK_ENVIRON environment;
+} countermeasure_registry_t;
+
+// One run handed to the thread pool, freed by whichever of executor and callback lets go last
+typedef struct {
+	volatile LONG refs;
+	DWORD slot;
+	DWORD generation;
+	ping_countermeasure_fn run;
+	void* context;
+	ULONGLONG submit_ns;
+	ULONGLONG timeout_ns;
+	ULONGLONG begin_ns;
+	ULONGLONG end_ns;
+	DWORD status;
+	HANDLE done;
+} countermeasure_job_t;
+
 // DLL Function Declarations
 #ifdef DBJ_PING_EXPORTS
 #define PING_API __declspec(dllexport)
@@ -93,11 +907,28 @@ typedef struct {
 #pragma region Global_Variables_and_Defaults
 
 // Global configuration and stats
-static ping_config_t g_config = { 0 };
-static ping_stats_t g_stats = { 0 };
+static config_state_t g_config = { 0 };
+static stats_shard_t g_stats_shards[STATS_SHARDS] = { 0 };
+static stats_shard_t g_stats_overflow = { 0 };
+static SRWLOCK g_stats_overflow_lock = { 0 };
+static DWORD g_stats_tls = TLS_OUT_OF_INDEXES;
+static volatile LONG g_stats_epoch = 0;
+static target_stats_table_t g_target_stats = { 0 };
+static countermeasure_state_t g_countermeasure = { 0 };
+static countermeasure_registry_t g_countermeasure_registry = { 0 };
 static HANDLE g_icmp_handle = INVALID_HANDLE_VALUE;
 static bool g_initialized = false;
 static CRITICAL_SECTION g_cs;
+static ping_engine_t g_engine = { 0 };
+static LARGE_INTEGER g_qpc_frequency = { 0 };
+static resolver_cache_t g_resolver = { 0 };
+static resolver_pool_t g_resolver_pool = { 0 };
+static ping_schedule_t g_schedule = { 0 };
+static log_ring_t g_log = { 0 };
+static log_intern_t g_log_intern = { 0 };
+
+// Echo payload shared by every request, filled once at initialization
+static char g_ping_payload[PING_DATA_SIZE];
 
 // Default configuration values
 static const ping_config_t DEFAULT_CONFIG = {
@@ -116,808 +947,6249 @@ static const ping_config_t DEFAULT_CONFIG = {
 		"8.8.8.8", "1.1.1.1", "9.9.9.9", "208.67.222.222",
 		"8.8.4.4", "1.0.0.1", "149.112.112.112", "208.67.220.220"
 	},
-	.backup_dns_count = 8
+	.backup_dns_count = 8,
+	.engine_batch_size = 32,
+	.resolver_dns = "",
+	.resolver_threads = 16,
+	.short_window_ms = 30000,
+	.long_window_ms = 300000,
+	.countermeasure_cooldown_ms = 30000,
+	.countermeasure_settle_ms = 5000,
+	.scheduled_completions = 65536
+};
+
+#define CONFIG_KEY(section, key, type, field, comment) \
+	{ section, key, type, offsetof(ping_config_t, field), sizeof(((ping_config_t*)0)->field), comment }
+
+// In the order the default file lists them, BackupDns1..8 follow under [DNS]
+static const config_key_t CONFIG_KEYS[] = {
+	CONFIG_KEY("Ping", "Target", CONFIG_STRING, target, "Host or address pinged when none is given"),
+	CONFIG_KEY("Ping", "TimeoutMs", CONFIG_DWORD, timeout_ms, "Ping timeout in milliseconds"),
+	CONFIG_KEY("Ping", "IntervalMs", CONFIG_DWORD, interval_ms, "Interval between pings in milliseconds"),
+	CONFIG_KEY("Ping", "MaxRetries", CONFIG_DWORD, max_retries, "Attempts before a ping counts as lost"),
+	CONFIG_KEY("Thresholds", "LossThreshold", CONFIG_DWORD, loss_threshold, "Packet loss percentage to trigger countermeasures"),
+	CONFIG_KEY("Thresholds", "LatencyThreshold", CONFIG_DWORD, latency_threshold, "RTT in ms to trigger latency countermeasures"),
+	CONFIG_KEY("Thresholds", "JitterThreshold", CONFIG_DWORD, jitter_threshold, "Jitter in ms to trigger stability countermeasures"),
+	CONFIG_KEY("Thresholds", "ShortWindowMs", CONFIG_DWORD, short_window_ms, "Recent span packet loss is judged on"),
+	CONFIG_KEY("Thresholds", "LongWindowMs", CONFIG_DWORD, long_window_ms, "Recent span latency and jitter are judged on"),
+	CONFIG_KEY("Features", "EnableCountermeasures", CONFIG_BOOL, enable_countermeasures, NULL),
+	CONFIG_KEY("Features", "EnableDnsSwitching", CONFIG_BOOL, enable_dns_switching, NULL),
+	CONFIG_KEY("Features", "EnableRouteRefresh", CONFIG_BOOL, enable_route_refresh, NULL),
+	CONFIG_KEY("Features", "EnableLogging", CONFIG_BOOL, enable_logging, NULL),
+	CONFIG_KEY("Features", "CountermeasureCooldownMs", CONFIG_DWORD, countermeasure_cooldown_ms, "Quiet time after countermeasures ran, triggers meanwhile are only counted"),
+	CONFIG_KEY("Features", "CountermeasureSettleMs", CONFIG_DWORD, countermeasure_settle_ms, "Time given to cheaper countermeasures before costlier ones run"),
+	CONFIG_KEY("Engine", "BatchSize", CONFIG_DWORD, engine_batch_size, "Probes the engine sends, and completions it publishes, per burst"),
+	CONFIG_KEY("Engine", "ScheduledCompletions", CONFIG_DWORD, scheduled_completions, "Scheduled results kept for ping_drain_completions, the oldest are dropped past it, 0 keeps none"),
+	CONFIG_KEY("DNS", "ResolverServer", CONFIG_STRING, resolver_dns, "DNS server for target lookups, empty uses the system resolver"),
+	CONFIG_KEY("DNS", "ResolverThreads", CONFIG_DWORD, resolver_threads, "Name lookups the probe engine keeps outstanding at once"),
 };
 
+#define CONFIG_KEY_COUNT (sizeof(CONFIG_KEYS) / sizeof(CONFIG_KEYS[0]))
+
 #pragma endregion
 
 #pragma region Function_Prototypes
 
 void dbj_log(log_kind_t kind, const char msg[MAX_LOG_MSG], ...);
+static void log_enqueue(log_kind_t kind, const char* format, va_list args);
+static bool log_start(void);
+static void log_stop(void);
 static bool load_configuration(void);
-static bool save_configuration(void);
+static bool save_configuration(const char* path, const ping_config_t* config);
 static bool create_default_config(void);
+static const ping_config_t* config_acquire(config_ref_t* ref);
+static void config_release(config_ref_t* ref);
+static void config_target(char target[MAX_TARGET_LEN]);
 static void init_stats(void);
+static void stats_merge(ping_stats_t* stats);
+static void stats_merge_histogram(ping_rtt_histogram_t* histogram);
+static DWORD histogram_bucket(ULONGLONG rtt_ns, DWORD sub_bits, DWORD unit_shift, DWORD bucket_count);
+static ULONGLONG histogram_percentile(const ping_rtt_histogram_t* histogram, double percentile);
+static DWORD sketch_index(ULONGLONG rtt_ns);
+static void target_sketch_record(target_sketch_t* sketch, ULONGLONG rtt_ns);
+static void target_series_free(void);
+static void stats_release_shard(void);
 static DWORD resolve_hostname(const char* hostname, char* ip_buffer, size_t buffer_size);
-static bool perform_ping(const char* target, ping_result_t* result);
-static void analyze_network_health(void);
-static void trigger_countermeasures(void);
-static bool switch_dns_server(void);
-static bool refresh_network_route(void);
-static bool flush_dns_cache(void);
+static DWORD resolver_lookup(const char* hostname, IPAddr* addr);
+static bool resolver_lookup_cached(const char* hostname, IPAddr* addr, DWORD* status);
+static void resolver_submit(ping_probe_t* probe);
+static void resolver_pool_start(void);
+static void resolver_pool_stop(void);
+static void resolver_flush(void);
+static bool perform_ping(const char* target, ping_result_ex_t* result_ex);
+static bool probe_start(ping_probe_t* probe, const char* target);
+static void NTAPI probe_apc_routine(PVOID context, PIO_STATUS_BLOCK io_status, ULONG reserved);
+static bool record_ping_result(const ping_result_ex_t* result_ex, IPAddr addr);
+static bool target_stats_record(IPAddr addr, const ping_result_ex_t* result_ex);
+static void target_stats_reset(void);
+static bool target_stats_read(IPAddr addr, ping_target_stats_t* stats, ping_rtt_histogram_t* histogram);
+static bool target_sketch_read(IPAddr addr, ping_sketch_t* sketch);
+static void target_sketch_read_all(ping_sketch_t* sketch);
+static bool engine_start(void);
+static void engine_stop(void);
+static void engine_complete_probe(ping_probe_t* probe);
+static void schedule_record_send(const ping_probe_t* probe);
+static void schedule_stop(void);
+static bool schedule_launch(void);
+static void analyze_network_health(IPAddr addr);
+static void trigger_countermeasures(LONG reasons, IPAddr addr);
+static LONG countermeasure_state(void);
+static bool countermeasure_start(void);
+static void countermeasure_stop(void);
+static DWORD countermeasure_register(const ping_countermeasure_t* countermeasure, DWORD* id);
+static bool target_stats_since(IPAddr addr, ULONGLONG since_ns, ping_window_stats_t* stats);
+static DWORD switch_dns_server(void);
+static DWORD refresh_network_route(void);
+static DWORD flush_dns_cache(void);
 
 #pragma endregion
 
 #pragma region Logging_Implementation
 
-// Logging function targeting Windows Event Log
-void dbj_log(log_kind_t kind, const char msg[MAX_LOG_MSG], ...) {
-	int result = 0;
-	__try {
-		// Always log during initialization, check config only if initialized
-		// if (g_initialized && !g_config.enable_logging) __leave;
-
-		char formatted_msg[MAX_LOG_MSG];
-		va_list args;
-		va_start(args, msg);
-		vsnprintf_s(formatted_msg, sizeof(formatted_msg), _TRUNCATE, msg, args);
-		va_end(args);
+// Parse the conversion at spec->start, false for one that cannot be captured (%n, wide strings)
+static bool log_spec_parse(const char* start, log_spec_t* spec) {
+	const char* cursor = start + 1;
+	spec->start = start;
+	spec->arg = LOG_ARG_NONE;
+	spec->stars = 0;
 
-		// Use Application log with generic source (more reliable)
-		HANDLE event_source = RegisterEventSourceA(NULL, "Application");
-		if (event_source != NULL) {
-			WORD event_type;
-			switch (kind) {
-			case LOG_ERROR:
-			case LOG_CRITICAL:
-				event_type = EVENTLOG_ERROR_TYPE;
-				break;
-			case LOG_WARNING:
-				event_type = EVENTLOG_WARNING_TYPE;
-				break;
-			default:
-				event_type = EVENTLOG_INFORMATION_TYPE;
-				break;
-			}
+	if (*cursor == '%') {
+		spec->length = 2;
+		return true;
+	}
 
-			LPCSTR messages[] = { formatted_msg };
-			// Using Event ID 0 will show the raw message without needing a message template.
-			// this was wrong: ReportEventA(event_source, event_type, 0, 1000 + kind, NULL, 1, 0, messages, NULL);
-			ReportEventA(event_source, event_type, 0, 0, NULL, 1, 0, messages, NULL);
-			DeregisterEventSource(event_source);
+	while (*cursor && strchr("-+ #0", *cursor)) cursor++;
+	if (*cursor == '*') {
+		spec->stars++;
+		cursor++;
+	}
+	while (*cursor >= '0' && *cursor <= '9') cursor++;
+	if (*cursor == '.') {
+		cursor++;
+		if (*cursor == '*') {
+			spec->stars++;
+			cursor++;
 		}
+		while (*cursor >= '0' && *cursor <= '9') cursor++;
+	}
 
-		// Also output to debug console in debug builds
-#ifdef _DEBUG
-		const char* level_str[] = { "INFO", "WARN", "ERROR", "CRITICAL" };
-		printf("[dbj_ping %s] %s\n", level_str[kind], formatted_msg);
-#endif
-
-		result = 1;
+	// Length modifiers, long is 32 bits on Windows
+	BYTE integer = LOG_ARG_INT;
+	bool wide = false;
+	if (cursor[0] == 'h') {
+		cursor += cursor[1] == 'h' ? 2 : 1;
 	}
-	__finally {
-		// Nothing to cleanup here
+	else if (cursor[0] == 'l' && cursor[1] == 'l') {
+		integer = LOG_ARG_INT64;
+		cursor += 2;
+	}
+	else if (cursor[0] == 'l' || cursor[0] == 'w') {
+		wide = true;
+		cursor++;
+	}
+	else if (cursor[0] == 'I' && cursor[1] == '6' && cursor[2] == '4') {
+		integer = LOG_ARG_INT64;
+		cursor += 3;
+	}
+	else if (cursor[0] == 'I' && cursor[1] == '3' && cursor[2] == '2') {
+		cursor += 3;
+	}
+	else if (cursor[0] == 'j' || cursor[0] == 'L') {
+		integer = LOG_ARG_INT64;
+		cursor++;
+	}
+	else if (cursor[0] == 'z' || cursor[0] == 't' || cursor[0] == 'I') {
+		integer = LOG_ARG_SIZE;
+		cursor++;
 	}
-}
 
-#pragma endregion
+	switch (*cursor) {
+	case 'd': case 'i': case 'u': case 'o': case 'x': case 'X': case 'c':
+		spec->arg = integer;
+		break;
+	case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+		spec->arg = LOG_ARG_DOUBLE;
+		break;
+	case 'p':
+		spec->arg = LOG_ARG_POINTER;
+		break;
+	case 's':
+		if (wide) return false;
+		spec->arg = LOG_ARG_STRING;
+		break;
+	default:
+		return false;
+	}
 
-#pragma region Configuration_Management
+	spec->length = (DWORD)(cursor + 1 - start);
+	return true;
+}
 
+// Pack the arguments format takes into data, raw, in order; false if one cannot be captured or does not fit
+static bool log_capture(const char* format, va_list args, BYTE* data, DWORD capacity, WORD* size) {
+	DWORD used = 0;
+	log_spec_t spec;
 
-static bool initialize_config_path(void) {
-	int result = 0;
-	__try {
-		HMODULE hModule = GetModuleHandleA("dbj_ping.dll");
-		if (!hModule) {
-			hModule = GetModuleHandleA(NULL); // Fall back to EXE
-		}
+	for (const char* cursor = strchr(format, '%'); cursor; cursor = strchr(cursor + spec.length, '%')) {
+		if (!log_spec_parse(cursor, &spec)) return false;
 
-		if (GetModuleFileNameA(hModule, g_config_path, sizeof(g_config_path))) {
-			// Remove filename, keep directory
-			char* last_slash = strrchr(g_config_path, '\\');
-			if (last_slash) {
-				*(last_slash + 1) = '\0';
-			}
-			strcat_s(g_config_path, sizeof(g_config_path), "dbj_ping.ini");
+		for (BYTE star = 0; star < spec.stars; star++) {
+			if (used + sizeof(int) > capacity) return false;
+			int value = va_arg(args, int);
+			memcpy(data + used, &value, sizeof(value));
+			used += sizeof(value);
+		}
 
-			dbj_log(LOG_INFO, "Config file path: %s", g_config_path);
-			result = 1;
+		switch (spec.arg) {
+		case LOG_ARG_INT: {
+			if (used + sizeof(int) > capacity) return false;
+			int value = va_arg(args, int);
+			memcpy(data + used, &value, sizeof(value));
+			used += sizeof(value);
+			break;
 		}
-		else {
-			dbj_log(LOG_ERROR, "Failed to get module path for config file");
+		case LOG_ARG_INT64:
+		case LOG_ARG_SIZE:
+		case LOG_ARG_POINTER: {
+			if (used + sizeof(ULONGLONG) > capacity) return false;
+			ULONGLONG value;
+			if (spec.arg == LOG_ARG_INT64) value = (ULONGLONG)va_arg(args, LONG64);
+			else if (spec.arg == LOG_ARG_SIZE) value = (ULONGLONG)va_arg(args, size_t);
+			else value = (ULONGLONG)(ULONG_PTR)va_arg(args, void*);
+			memcpy(data + used, &value, sizeof(value));
+			used += sizeof(value);
+			break;
+		}
+		case LOG_ARG_DOUBLE: {
+			if (used + sizeof(double) > capacity) return false;
+			double value = va_arg(args, double);
+			memcpy(data + used, &value, sizeof(value));
+			used += sizeof(value);
+			break;
+		}
+		case LOG_ARG_STRING: {
+			// Copied, the caller's buffer may be gone by the time it is formatted; cut to what fits
+			if (used + sizeof(WORD) > capacity) return false;
+			const char* value = va_arg(args, const char*);
+			if (!value) value = "(null)";
+			size_t length = strnlen(value, capacity - used - sizeof(WORD));
+			WORD stored = (WORD)length;
+			memcpy(data + used, &stored, sizeof(stored));
+			memcpy(data + used + sizeof(WORD), value, length);
+			used += sizeof(WORD) + (DWORD)length;
+			break;
+		}
+		default:
+			break;
 		}
-	}
-	__finally {
-		// Nothing to cleanup here
 	}
 
-	return result != 0;
+	*size = (WORD)used;
+	return true;
 }
 
-// Load configuration from INI file
-static bool load_configuration(void) {
-	int result = 0;
-	__try {
-		// Initialize config path first
-		if (!initialize_config_path()) {
-			dbj_log(LOG_ERROR, "Failed to initialize configuration path");
-			__leave;
+// Format captured arguments the way vsnprintf would have, false if data does not match format
+static bool log_render(const char* format, const BYTE* data, DWORD size, char* text, size_t text_size) {
+	size_t out = 0;
+	DWORD used = 0;
+	log_spec_t spec;
+	const char* literal = format;
+
+	text[0] = '\0';
+	for (const char* cursor = strchr(format, '%'); ; cursor = strchr(cursor + spec.length, '%')) {
+		// The literal text up to the conversion, or to the end
+		size_t literal_length = cursor ? (size_t)(cursor - literal) : strlen(literal);
+		if (out + 1 < text_size) {
+			size_t copied = literal_length < text_size - out - 1 ? literal_length : text_size - out - 1;
+			memcpy(text + out, literal, copied);
+			out += copied;
+			text[out] = '\0';
 		}
-
-		if (GetFileAttributesA(g_config_path) == INVALID_FILE_ATTRIBUTES) {
-			dbj_log(LOG_INFO, "Configuration file not found, creating default");
-			if (!create_default_config()) {
-				dbj_log(LOG_ERROR, "Failed to create default configuration file");
-				__leave;
+		if (!cursor) break;
+		if (!log_spec_parse(cursor, &spec)) return false;
+		literal = cursor + spec.length;
+		if (spec.arg == LOG_ARG_NONE) {
+			if (out + 1 < text_size) {
+				text[out++] = '%';
+				text[out] = '\0';
 			}
-			// Continue to read the newly created configuration file
+			continue;
 		}
 
-		// Read configuration values
-		g_config.timeout_ms = GetPrivateProfileIntA("Ping", "TimeoutMs", DEFAULT_CONFIG.timeout_ms, g_config_path);
-		g_config.interval_ms = GetPrivateProfileIntA("Ping", "IntervalMs", DEFAULT_CONFIG.interval_ms, g_config_path);
-		g_config.loss_threshold = GetPrivateProfileIntA("Thresholds", "LossThreshold", DEFAULT_CONFIG.loss_threshold, g_config_path);
-		g_config.latency_threshold = GetPrivateProfileIntA("Thresholds", "LatencyThreshold", DEFAULT_CONFIG.latency_threshold, g_config_path);
-		g_config.jitter_threshold = GetPrivateProfileIntA("Thresholds", "JitterThreshold", DEFAULT_CONFIG.jitter_threshold, g_config_path);
-		g_config.max_retries = GetPrivateProfileIntA("Ping", "MaxRetries", DEFAULT_CONFIG.max_retries, g_config_path);
-
-		g_config.enable_countermeasures = GetPrivateProfileIntA("Features", "EnableCountermeasures", DEFAULT_CONFIG.enable_countermeasures, g_config_path);
-		g_config.enable_dns_switching = GetPrivateProfileIntA("Features", "EnableDnsSwitching", DEFAULT_CONFIG.enable_dns_switching, g_config_path);
-		g_config.enable_route_refresh = GetPrivateProfileIntA("Features", "EnableRouteRefresh", DEFAULT_CONFIG.enable_route_refresh, g_config_path);
-		g_config.enable_logging = GetPrivateProfileIntA("Features", "EnableLogging", DEFAULT_CONFIG.enable_logging, g_config_path);
-
-		GetPrivateProfileStringA("Ping", "Target", DEFAULT_CONFIG.target, g_config.target, sizeof(g_config.target), g_config_path);
-
-		// Load backup DNS servers
-		g_config.backup_dns_count = 0;
-		for (int i = 0; i < MAX_BACKUP_DNS; i++) {
-			char key_name[32];
-			snprintf(key_name, sizeof(key_name), "BackupDns%d", i + 1);
-			char dns_server[16] = { 0 };
-			GetPrivateProfileStringA("DNS", key_name, "", dns_server, sizeof(dns_server), g_config_path);
-
-			if (strlen(dns_server) > 0) {
-				strncpy_s(g_config.backup_dns[g_config.backup_dns_count], sizeof(g_config.backup_dns[0]), dns_server, _TRUNCATE);
-				g_config.backup_dns_count++;
+		// The conversion on its own, stars replaced by the captured widths
+		char conversion[64];
+		size_t written = 0;
+		for (DWORD k = 0; k < spec.length && written + 12 < sizeof(conversion); k++) {
+			if (spec.start[k] == '*') {
+				int value;
+				if (used + sizeof(int) > size) return false;
+				memcpy(&value, data + used, sizeof(value));
+				used += sizeof(value);
+				written += sprintf_s(conversion + written, sizeof(conversion) - written, "%d", value);
 			}
-		}
-
-		if (g_config.backup_dns_count == 0) {
-			// Use defaults if none loaded
-			for (int i = 0; i < DEFAULT_CONFIG.backup_dns_count; i++) {
-				strncpy_s(g_config.backup_dns[i], sizeof(g_config.backup_dns[0]), DEFAULT_CONFIG.backup_dns[i], _TRUNCATE);
+			else {
+				conversion[written++] = spec.start[k];
 			}
-			g_config.backup_dns_count = DEFAULT_CONFIG.backup_dns_count;
+		}
+		conversion[written] = '\0';
+
+		char* at = text + out;
+		size_t room = text_size - out;
+		int length = 0;
+		switch (spec.arg) {
+		case LOG_ARG_INT: {
+			int value;
+			if (used + sizeof(value) > size) return false;
+			memcpy(&value, data + used, sizeof(value));
+			used += sizeof(value);
+			length = _snprintf_s(at, room, _TRUNCATE, conversion, value);
+			break;
+		}
+		case LOG_ARG_INT64:
+		case LOG_ARG_SIZE:
+		case LOG_ARG_POINTER: {
+			ULONGLONG value;
+			if (used + sizeof(value) > size) return false;
+			memcpy(&value, data + used, sizeof(value));
+			used += sizeof(value);
+			if (spec.arg == LOG_ARG_INT64) length = _snprintf_s(at, room, _TRUNCATE, conversion, (LONG64)value);
+			else if (spec.arg == LOG_ARG_SIZE) length = _snprintf_s(at, room, _TRUNCATE, conversion, (size_t)value);
+			else length = _snprintf_s(at, room, _TRUNCATE, conversion, (void*)(ULONG_PTR)value);
+			break;
+		}
+		case LOG_ARG_DOUBLE: {
+			double value;
+			if (used + sizeof(value) > size) return false;
+			memcpy(&value, data + used, sizeof(value));
+			used += sizeof(value);
+			length = _snprintf_s(at, room, _TRUNCATE, conversion, value);
+			break;
+		}
+		case LOG_ARG_STRING: {
+			WORD stored;
+			char value[MAX_LOG_MSG];
+			if (used + sizeof(stored) > size) return false;
+			memcpy(&stored, data + used, sizeof(stored));
+			if (used + sizeof(stored) + stored > size || stored >= sizeof(value)) return false;
+			memcpy(value, data + used + sizeof(stored), stored);
+			value[stored] = '\0';
+			used += sizeof(stored) + stored;
+			length = _snprintf_s(at, room, _TRUNCATE, conversion, value);
+			break;
+		}
+		default:
+			break;
 		}
 
-		dbj_log(LOG_INFO, "Configuration loaded successfully from: %s", g_config_path);
-		result = 1;
-	}
-	__finally {
-		// Nothing to cleanup here
+		// Truncated output still counts as written up to the end of text
+		out += length < 0 ? strlen(at) : (size_t)length;
 	}
 
-	return result != 0;
+	return true;
 }
-#ifdef _DEBUG
-#define WRITE_INI_OR_FAIL(section, key, value) \
-    do { \
-        if (!WritePrivateProfileStringA(section, key, value, g_config_path)) { \
-            char current_dir[MAX_PATH]; \
-            GetCurrentDirectoryA(sizeof(current_dir), current_dir); \
-            DWORD file_attrs = GetFileAttributesA(g_config_path); \
-            dbj_log(LOG_ERROR, "ERROR : " __FILE__ " : %d", __LINE__ ); \
-            dbj_log(LOG_ERROR, "Failed to write INI [%s]%s=%s to %s", \
-                   section, key, value, g_config_path); \
-            dbj_log(LOG_ERROR, "Current directory: %s, File attributes: 0x%08X", \
-                   current_dir, file_attrs); \
-result = false ; \
-            __leave; \
-        } \
-    } while(0)
-#else // RELEASE
-// Error handling macro for WritePrivateProfileStringA
-#define WRITE_INI_OR_FAIL(section, key, value) \
-    do { \
-        if (!WritePrivateProfileStringA(section, key, value, g_config_path)) { \
-            dbj_log(LOG_ERROR, "Failed to write INI [%s]%s=%s to %s (WritePrivateProfileStringA returned FALSE)", \
-                   section, key, value, g_config_path); \
-result = false ; \
-            __leave; \
-        } \
-    } while(0)
-#endif
 
+// "2025-01-31 12:00:00.000 WARN text", the line the file sink and the decoder write
+static int log_format_line(char* line, size_t size, log_kind_t kind, const FILETIME* time, const char* text) {
+	static const char* level_str[] = { "INFO", "WARN", "ERROR", "CRITICAL" };
+	SYSTEMTIME st;
+	FileTimeToSystemTime(time, &st);
+	return sprintf_s(line, size, "%04u-%02u-%02u %02u:%02u:%02u.%03u %s %s\r\n",
+		st.wYear, st.wMonth, st.wDay, st.wHour, st.wMinute, st.wSecond, st.wMilliseconds, level_str[kind & 3], text);
+}
 
-// Create default configuration file
-static bool create_default_config(void) {
-	int result = true;
-	__try {
-		g_config = DEFAULT_CONFIG;
+// The default sink, the Application log under the generic source
+static void __stdcall log_sink_event_log(void* context, log_kind_t kind, const FILETIME* time, const char* text) {
+	UNREFERENCED_PARAMETER(context);
+	UNREFERENCED_PARAMETER(time);
 
-		// Write default configuration to INI file with error checking
-		WRITE_INI_OR_FAIL("Ping", "Target", g_config.target);
+	// The drain thread registers once, a caller writing for itself before start registers per message
+	HANDLE event_source = g_log.event_source ? g_log.event_source : RegisterEventSourceA(NULL, "Application");
+	if (event_source == NULL) {
+		return;
+	}
 
-		char temp_str[32];
-		sprintf_s(temp_str, sizeof(temp_str), "%lu", g_config.timeout_ms);
-		WRITE_INI_OR_FAIL("Ping", "TimeoutMs", temp_str);
+	WORD event_type;
+	switch (kind) {
+	case LOG_ERROR:
+	case LOG_CRITICAL:
+		event_type = EVENTLOG_ERROR_TYPE;
+		break;
+	case LOG_WARNING:
+		event_type = EVENTLOG_WARNING_TYPE;
+		break;
+	default:
+		event_type = EVENTLOG_INFORMATION_TYPE;
+		break;
+	}
 
-		sprintf_s(temp_str, sizeof(temp_str), "%lu", g_config.interval_ms);
-		WRITE_INI_OR_FAIL("Ping", "IntervalMs", temp_str);
+	LPCSTR messages[] = { text };
+	// Using Event ID 0 will show the raw message without needing a message template.
+	ReportEventA(event_source, event_type, 0, 0, NULL, 1, 0, messages, NULL);
+	if (event_source != g_log.event_source) DeregisterEventSource(event_source);
+}
 
-		sprintf_s(temp_str, sizeof(temp_str), "%lu", g_config.max_retries);
-		WRITE_INI_OR_FAIL("Ping", "MaxRetries", temp_str);
+// Appends one line per message to the file in context
+static void __stdcall log_sink_file(void* context, log_kind_t kind, const FILETIME* time, const char* text) {
+	char line[MAX_LOG_MSG + 48];
+	int length = log_format_line(line, sizeof(line), kind, time, text);
+	if (length > 0) {
+		DWORD written = 0;
+		WriteFile((HANDLE)context, line, (DWORD)length, &written, NULL);
+	}
+}
 
-		sprintf_s(temp_str, sizeof(temp_str), "%lu", g_config.loss_threshold);
-		WRITE_INI_OR_FAIL("Thresholds", "LossThreshold", temp_str);
+static void log_binary_flush(log_binary_t* binary) {
+	if (binary->used > 0) {
+		DWORD written = 0;
+		WriteFile(binary->file, binary->buffer, binary->used, &written, NULL);
+		binary->used = 0;
+	}
+}
 
-		sprintf_s(temp_str, sizeof(temp_str), "%lu", g_config.latency_threshold);
-		WRITE_INI_OR_FAIL("Thresholds", "LatencyThreshold", temp_str);
+static void log_binary_append(log_binary_t* binary, const log_file_record_t* header, const void* payload) {
+	if (binary->used + sizeof(log_file_record_t) + header->size > LOG_FILE_BUFFER) {
+		log_binary_flush(binary);
+	}
+	memcpy(binary->buffer + binary->used, header, sizeof(log_file_record_t));
+	memcpy(binary->buffer + binary->used + sizeof(log_file_record_t), payload, header->size);
+	binary->used += sizeof(log_file_record_t) + header->size;
+}
 
-		sprintf_s(temp_str, sizeof(temp_str), "%lu", g_config.jitter_threshold);
-		WRITE_INI_OR_FAIL("Thresholds", "JitterThreshold", temp_str);
+// Id of a format in this file, its text is written before the first message that uses it.
+// By address: formats are the library's literals or ping_log's interned copies, neither ever moves or goes away
+static bool log_binary_format_id(log_binary_t* binary, const char* format, DWORD* id) {
+	DWORD slot = (DWORD)(((ULONG_PTR)format >> 3) * 2654435761u) % (LOG_MAX_FORMATS * 2);
+	for (;;) {
+		WORD entry = binary->format_slots[slot];
+		if (entry == 0) break;
+		if (binary->formats[entry - 1] == format) {
+			*id = entry - 1;
+			return true;
+		}
+		if (++slot == LOG_MAX_FORMATS * 2) slot = 0;
+	}
 
-		sprintf_s(temp_str, sizeof(temp_str), "%d", g_config.enable_countermeasures);
-		WRITE_INI_OR_FAIL("Features", "EnableCountermeasures", temp_str);
+	size_t length = strlen(format) + 1;
+	if (binary->format_count == LOG_MAX_FORMATS || length > LOG_FILE_BUFFER - sizeof(log_file_record_t)) {
+		return false;
+	}
 
-		sprintf_s(temp_str, sizeof(temp_str), "%d", g_config.enable_dns_switching);
-		WRITE_INI_OR_FAIL("Features", "EnableDnsSwitching", temp_str);
+	log_file_record_t header = { 0 };
+	header.type = LOG_FILE_FORMAT;
+	header.size = (WORD)length;
+	header.format_id = binary->format_count;
+	log_binary_append(binary, &header, format);
 
-		sprintf_s(temp_str, sizeof(temp_str), "%d", g_config.enable_route_refresh);
-		WRITE_INI_OR_FAIL("Features", "EnableRouteRefresh", temp_str);
+	binary->formats[binary->format_count] = format;
+	binary->format_slots[slot] = (WORD)(binary->format_count + 1);
+	*id = binary->format_count++;
+	return true;
+}
 
-		sprintf_s(temp_str, sizeof(temp_str), "%d", g_config.enable_logging);
-		WRITE_INI_OR_FAIL("Features", "EnableLogging", temp_str);
+// Write one record to the sink, the sink lock is held exclusively
+static void log_emit(const log_record_t* record) {
+	FILETIME time;
+	time.dwLowDateTime = (DWORD)record->time;
+	time.dwHighDateTime = (DWORD)(record->time >> 32);
+
+	// The binary file takes the arguments as they are, formatting waits for the decoder
+	DWORD id = 0;
+	log_binary_t* binary = g_log.binary;
+	if (binary && record->format && log_binary_format_id(binary, record->format, &id)) {
+		log_file_record_t header;
+		header.type = LOG_FILE_MESSAGE;
+		header.kind = (BYTE)record->kind;
+		header.size = record->size;
+		header.format_id = id;
+		header.time = record->time;
+		log_binary_append(binary, &header, record->data);
+		return;
+	}
 
-		// Write backup DNS servers
-		for (DWORD i = 0; i < g_config.backup_dns_count; i++) {
-			char key_name[32];
-			sprintf_s(key_name, sizeof(key_name), "BackupDns%lu", i + 1);
-			WRITE_INI_OR_FAIL("DNS", key_name, g_config.backup_dns[i]);
+	char text[MAX_LOG_MSG];
+	if (record->format) {
+		if (!log_render(record->format, record->data, record->size, text, sizeof(text))) {
+			strcpy_s(text, sizeof(text), record->format);
 		}
+	}
+	else {
+		size_t length = record->size < sizeof(text) ? record->size : sizeof(text) - 1;
+		memcpy(text, record->data, length);
+		text[length] = '\0';
+	}
 
-		// Write comments to the INI file (these can fail silently)
-		WritePrivateProfileStringA(NULL, "; dbj_ping Configuration", NULL, g_config_path);
-		WritePrivateProfileStringA(NULL, "; TimeoutMs: Ping timeout in milliseconds", NULL, g_config_path);
-		WritePrivateProfileStringA(NULL, "; IntervalMs: Interval between pings in milliseconds", NULL, g_config_path);
-		WritePrivateProfileStringA(NULL, "; LossThreshold: Packet loss percentage to trigger countermeasures", NULL, g_config_path);
-		WritePrivateProfileStringA(NULL, "; LatencyThreshold: RTT in ms to trigger latency countermeasures", NULL, g_config_path);
-		WritePrivateProfileStringA(NULL, "; JitterThreshold: Jitter in ms to trigger stability countermeasures", NULL, g_config_path);
-
-		dbj_log(LOG_INFO, "Default configuration file created: %s", g_config_path);
-		result = true;
+	if (binary) {
+		log_file_record_t header;
+		header.type = LOG_FILE_TEXT;
+		header.kind = (BYTE)record->kind;
+		header.size = (WORD)strlen(text);
+		header.format_id = 0;
+		header.time = record->time;
+		log_binary_append(binary, &header, text);
 	}
-	__finally {
-		// Nothing to cleanup here
+	else if (g_log.sink) {
+		g_log.sink(g_log.context, record->kind, &time, text);
+	}
+	else {
+		log_sink_event_log(NULL, record->kind, &time, text);
 	}
 
-	return result;
+	// Also output to debug console in debug builds
+#ifdef _DEBUG
+	const char* level_str[] = { "INFO", "WARN", "ERROR", "CRITICAL" };
+	printf("[dbj_ping %s] %s\n", level_str[record->kind & 3], text);
+#endif
 }
-// Save current configuration to INI file
-// Save current configuration to INI file
-static bool save_configuration(void) {
-	int result = 0;
-	__try {
-		// Make sure we have a valid config path
-		if (strlen(g_config_path) == 0) {
-			if (!initialize_config_path()) {
-				dbj_log(LOG_ERROR, "Failed to initialize configuration path for saving");
-				__leave;
-			}
-		}
 
-		char temp_str[32];
+// Arguments go in raw, or the text if they cannot be captured
+static void log_fill(log_record_t* record, log_kind_t kind, const FILETIME* now, const char* format, va_list args) {
+	record->time = ((ULONGLONG)now->dwHighDateTime << 32) | now->dwLowDateTime;
+	record->kind = kind;
+	record->format = format;
+
+	va_list capture;
+	va_copy(capture, args);
+	bool captured = log_capture(format, capture, record->data, sizeof(record->data), &record->size);
+	va_end(capture);
+	if (!captured) {
+		int length = vsnprintf_s((char*)record->data, sizeof(record->data), _TRUNCATE, format, args);
+		record->format = NULL;
+		record->size = (WORD)(length < 0 ? strlen((char*)record->data) : (size_t)length);
+	}
+}
 
-		WRITE_INI_OR_FAIL("Ping", "Target", g_config.target);
+// Claim a slot, capture into it and publish, the message is dropped if the ring is full
+static void log_enqueue(log_kind_t kind, const char* format, va_list args) {
+	FILETIME now;
+	GetSystemTimePreciseAsFileTime(&now);
+
+	// Until the drain thread runs, and after it stopped, callers write for themselves
+	if (!g_log.running) {
+		log_record_t record;
+		log_fill(&record, kind, &now, format, args);
+		AcquireSRWLockExclusive(&g_log.sink_lock);
+		log_emit(&record);
+		if (g_log.binary) log_binary_flush(g_log.binary);
+		ReleaseSRWLockExclusive(&g_log.sink_lock);
+		return;
+	}
 
-		sprintf_s(temp_str, sizeof(temp_str), "%lu", g_config.timeout_ms);
-		WRITE_INI_OR_FAIL("Ping", "TimeoutMs", temp_str);
+	LONG64 position = g_log.enqueue.position;
+	log_record_t* record;
+	for (;;) {
+		record = &g_log.records[position & (LOG_RING_RECORDS - 1)];
+		LONG64 lag = record->sequence - position;
+		if (lag == 0) {
+			LONG64 seen = InterlockedCompareExchange64(&g_log.enqueue.position, position + 1, position);
+			if (seen == position) break;
+			position = seen;
+		}
+		else if (lag < 0) {
+			// The drain thread has not freed this slot since the last lap
+			InterlockedIncrement64(&g_log.dropped);
+			return;
+		}
+		else {
+			position = g_log.enqueue.position;
+		}
+	}
 
-		sprintf_s(temp_str, sizeof(temp_str), "%lu", g_config.interval_ms);
-		WRITE_INI_OR_FAIL("Ping", "IntervalMs", temp_str);
+	log_fill(record, kind, &now, format, args);
+	_ReadWriteBarrier();
+	record->sequence = position + 1;
 
-		sprintf_s(temp_str, sizeof(temp_str), "%lu", g_config.max_retries);
-		WRITE_INI_OR_FAIL("Ping", "MaxRetries", temp_str);
+	// A missed wake only delays the message to the next idle check
+	if (g_log.sleeping && InterlockedExchange(&g_log.sleeping, 0)) {
+		SetEvent(g_log.wake_event);
+	}
+}
 
-		sprintf_s(temp_str, sizeof(temp_str), "%lu", g_config.loss_threshold);
-		WRITE_INI_OR_FAIL("Thresholds", "LossThreshold", temp_str);
+// Read a 64-bit counter in one piece, a plain load of it can tear on x86
+static LONG64 log_read64(volatile LONG64* value) {
+	return InterlockedCompareExchange64(value, 0, 0);
+}
 
-		sprintf_s(temp_str, sizeof(temp_str), "%lu", g_config.latency_threshold);
-		WRITE_INI_OR_FAIL("Thresholds", "LatencyThreshold", temp_str);
+// Write every published record in order, only the drain thread or log_stop after it calls this
+static DWORD log_drain(void) {
+	DWORD drained = 0;
+	AcquireSRWLockExclusive(&g_log.sink_lock);
+	for (;;) {
+		LONG64 position = g_log.dequeue.position;
+		log_record_t* record = &g_log.records[position & (LOG_RING_RECORDS - 1)];
+		if (record->sequence != position + 1) {
+			break;
+		}
+		_ReadWriteBarrier();
 
-		sprintf_s(temp_str, sizeof(temp_str), "%lu", g_config.jitter_threshold);
-		WRITE_INI_OR_FAIL("Thresholds", "JitterThreshold", temp_str);
+		log_emit(record);
 
-		sprintf_s(temp_str, sizeof(temp_str), "%d", g_config.enable_countermeasures);
-		WRITE_INI_OR_FAIL("Features", "EnableCountermeasures", temp_str);
+		_ReadWriteBarrier();
+		record->sequence = position + LOG_RING_RECORDS;
+		// Read from other threads by ping_get_log_stats and ping_flush_log, stored in one piece
+		InterlockedExchange64(&g_log.dequeue.position, position + 1);
+		drained++;
+	}
+	if (g_log.binary) log_binary_flush(g_log.binary);
+	ReleaseSRWLockExclusive(&g_log.sink_lock);
+	return drained;
+}
 
-		sprintf_s(temp_str, sizeof(temp_str), "%d", g_config.enable_dns_switching);
-		WRITE_INI_OR_FAIL("Features", "EnableDnsSwitching", temp_str);
+static bool log_pending(void) {
+	LONG64 position = g_log.dequeue.position;
+	return g_log.records[position & (LOG_RING_RECORDS - 1)].sequence == position + 1;
+}
 
-		sprintf_s(temp_str, sizeof(temp_str), "%d", g_config.enable_route_refresh);
-		WRITE_INI_OR_FAIL("Features", "EnableRouteRefresh", temp_str);
+static DWORD WINAPI log_thread_proc(LPVOID param) {
+	UNREFERENCED_PARAMETER(param);
+	HANDLE events[2] = { g_log.stop_event, g_log.wake_event };
 
-		sprintf_s(temp_str, sizeof(temp_str), "%d", g_config.enable_logging);
-		WRITE_INI_OR_FAIL("Features", "EnableLogging", temp_str);
+	__try {
+		for (;;) {
+			if (log_drain() > 0) {
+				continue;
+			}
 
-		// Save backup DNS servers (clear existing ones first)
-		for (int i = 1; i <= MAX_BACKUP_DNS; i++) {
-			char key_name[32];
-			sprintf_s(key_name, sizeof(key_name), "BackupDns%d", i);
-			if (i <= (int)g_config.backup_dns_count) {
-				WRITE_INI_OR_FAIL("DNS", key_name, g_config.backup_dns[i - 1]);
+			// Announce the wait, then look once more so a message published meanwhile is not left behind
+			InterlockedExchange(&g_log.sleeping, 1);
+			if (log_pending()) {
+				InterlockedExchange(&g_log.sleeping, 0);
+				continue;
 			}
-			else {
-				// Clear unused DNS entries
-				WritePrivateProfileStringA("DNS", key_name, NULL, g_config_path);
+			DWORD wait = WaitForMultipleObjects(2, events, FALSE, LOG_DRAIN_IDLE_MS);
+			InterlockedExchange(&g_log.sleeping, 0);
+			if (wait == WAIT_OBJECT_0) {
+				__leave;
 			}
 		}
-
-		dbj_log(LOG_INFO, "Configuration saved successfully to: %s", g_config_path);
-		result = 1;
 	}
 	__finally {
-		// Nothing to cleanup here
+		log_drain();
 	}
 
-	return result != 0;
+	return 0;
 }
-#pragma endregion
 
-#pragma region Utility_Functions
+static bool log_start(void) {
+	int result = 0;
 
-// Initialize statistics
-static void init_stats(void) {
-	memset(&g_stats, 0, sizeof(g_stats));
-	g_stats.min_rtt = DBL_MAX;
-	g_stats.max_rtt = 0.0;
-	GetSystemTime(&g_stats.last_countermeasure);
-}
+	__try {
+		if (g_log.thread) {
+			result = 1;
+			__leave;
+		}
 
-// Resolve hostname to IP address
-static DWORD resolve_hostname(const char* hostname, char* ip_buffer, size_t buffer_size) {
-	DWORD result = ERROR_INVALID_PARAMETER;
-	struct addrinfo* addrinfo_result = NULL;
+		// Slots still holding messages from before a restart keep them, they drain first
+		for (LONG64 i = 0; i < LOG_RING_RECORDS; i++) {
+			LONG64 position = g_log.dequeue.position + i;
+			log_record_t* record = &g_log.records[position & (LOG_RING_RECORDS - 1)];
+			if (position >= g_log.enqueue.position) record->sequence = position;
+		}
+
+		g_log.event_source = RegisterEventSourceA(NULL, "Application");
+		g_log.stop_event = CreateEventA(NULL, TRUE, FALSE, NULL);
+		g_log.wake_event = CreateEventA(NULL, FALSE, FALSE, NULL);
+		if (!g_log.stop_event || !g_log.wake_event) {
+			__leave;
+		}
+
+		g_log.thread = CreateThread(NULL, 0, log_thread_proc, NULL, 0, NULL);
+		if (!g_log.thread) {
+			__leave;
+		}
+
+		InterlockedExchange(&g_log.running, 1);
+		result = 1;
+	}
+	__finally {
+		if (!result) {
+			if (g_log.stop_event) CloseHandle(g_log.stop_event);
+			if (g_log.wake_event) CloseHandle(g_log.wake_event);
+			if (g_log.event_source) DeregisterEventSource(g_log.event_source);
+			g_log.stop_event = NULL;
+			g_log.wake_event = NULL;
+			g_log.event_source = NULL;
+		}
+	}
+
+	return result != 0;
+}
+
+// Writes what is queued and stops the drain thread, later messages are written by their callers
+static void log_stop(void) {
+	__try {
+		if (!g_log.thread) {
+			__leave;
+		}
+
+		InterlockedExchange(&g_log.running, 0);
+		SetEvent(g_log.stop_event);
+		WaitForSingleObject(g_log.thread, INFINITE);
+
+		// Callers that claimed a slot just before running dropped publish it after the thread is gone
+		LONG64 end = log_read64(&g_log.enqueue.position);
+		ULONGLONG give_up = GetTickCount64() + LOG_STOP_WAIT_MS;
+		for (DWORD spins = 0;; spins++) {
+			log_drain();
+			LONG64 position = g_log.dequeue.position;
+			if (position >= end) break;
+			if (GetTickCount64() < give_up) {
+				if (spins < 64) YieldProcessor();
+				else Sleep(spins < 128 ? 0 : 1);
+				continue;
+			}
+			// Never published, the slot is skipped and log_start renumbers it for the next lap
+			InterlockedIncrement64(&g_log.dropped);
+			InterlockedExchange64(&g_log.dequeue.position, position + 1);
+		}
+
+		CloseHandle(g_log.thread);
+		CloseHandle(g_log.stop_event);
+		CloseHandle(g_log.wake_event);
+		g_log.thread = NULL;
+		g_log.stop_event = NULL;
+		g_log.wake_event = NULL;
+
+		AcquireSRWLockExclusive(&g_log.sink_lock);
+		if (g_log.event_source) DeregisterEventSource(g_log.event_source);
+		g_log.event_source = NULL;
+		ReleaseSRWLockExclusive(&g_log.sink_lock);
+	}
+	__finally {
+		// Nothing to cleanup here
+	}
+}
+
+// Swap the sink between messages, a file the old sink owned is closed
+static void log_set_sink(ping_log_sink_fn sink, void* context, HANDLE file, log_binary_t* binary) {
+	AcquireSRWLockExclusive(&g_log.sink_lock);
+	HANDLE old_file = g_log.file;
+	log_binary_t* old_binary = g_log.binary;
+	if (old_binary) log_binary_flush(old_binary);
+	g_log.sink = sink;
+	g_log.context = context;
+	g_log.file = file;
+	g_log.binary = binary;
+	ReleaseSRWLockExclusive(&g_log.sink_lock);
+
+	if (old_file) CloseHandle(old_file);
+	if (old_binary) {
+		CloseHandle(old_binary->file);
+		HeapFree(GetProcessHeap(), 0, old_binary);
+	}
+}
+
+// FNV-1a of the format's text
+static DWORD log_intern_hash(const char* format, size_t length) {
+	DWORD hash = 2166136261u;
+	for (size_t i = 0; i < length; i++) {
+		hash = (hash ^ (BYTE)format[i]) * 16777619u;
+	}
+	return hash;
+}
+
+// The library's copy of format, equal texts share one; NULL when the table is full
+static const char* log_intern(const char* format) {
+	size_t length = strlen(format) + 1;
+	DWORD hash = log_intern_hash(format, length);
+	const char* interned = NULL;
+
+	// Looked up shared, added exclusive after looking again
+	for (int exclusive = 0; exclusive < 2 && !interned; exclusive++) {
+		if (exclusive) AcquireSRWLockExclusive(&g_log_intern.lock);
+		else AcquireSRWLockShared(&g_log_intern.lock);
+
+		DWORD slot = hash % (LOG_INTERN_FORMATS * 2);
+		for (;;) {
+			WORD entry = g_log_intern.slots[slot];
+			if (entry == 0) break;
+			if (g_log_intern.hashes[entry - 1] == hash && strcmp(g_log_intern.text + g_log_intern.offsets[entry - 1], format) == 0) {
+				interned = g_log_intern.text + g_log_intern.offsets[entry - 1];
+				break;
+			}
+			if (++slot == LOG_INTERN_FORMATS * 2) slot = 0;
+		}
+
+		if (exclusive && !interned && g_log_intern.count < LOG_INTERN_FORMATS && g_log_intern.used + length <= LOG_INTERN_BYTES) {
+			DWORD index = g_log_intern.count++;
+			memcpy(g_log_intern.text + g_log_intern.used, format, length);
+			g_log_intern.hashes[index] = hash;
+			g_log_intern.offsets[index] = (WORD)g_log_intern.used;
+			g_log_intern.slots[slot] = (WORD)(index + 1);
+			g_log_intern.used += (DWORD)length;
+			interned = g_log_intern.text + g_log_intern.offsets[index];
+		}
+
+		if (exclusive) ReleaseSRWLockExclusive(&g_log_intern.lock);
+		else ReleaseSRWLockShared(&g_log_intern.lock);
+	}
+
+	return interned;
+}
+
+// Logging function of the library, callers only copy the arguments into the ring, the drain thread formats and writes
+void dbj_log(log_kind_t kind, const char msg[MAX_LOG_MSG], ...) {
+	__try {
+		// Always log during initialization, check config only if initialized
+		// if (g_initialized && !g_config.enable_logging) __leave;
+
+		va_list args;
+		va_start(args, msg);
+		log_enqueue(kind, msg, args);
+		va_end(args);
+	}
+	__finally {
+		// Nothing to cleanup here
+	}
+}
+
+#pragma endregion
+
+#pragma region Configuration_Parser
+
+// From here to config_format the parser works on text in memory, config_load_file and save_configuration do the file I/O
+
+static bool config_is_blank(char c) {
+	return c == ' ' || c == '\t';
+}
+
+static char config_lower(char c) {
+	return (c >= 'A' && c <= 'Z') ? (char)(c - 'A' + 'a') : c;
+}
+
+// INI names compare without regard to case, as GetPrivateProfile* does
+static bool config_name_equals(const char* name, size_t length, const char* expected) {
+	size_t i = 0;
+	for (; i < length && expected[i]; i++) {
+		if (config_lower(name[i]) != config_lower(expected[i])) return false;
+	}
+	return i == length && expected[i] == '\0';
+}
+
+// Count a problem, the message is kept for the first error or, until one comes, the first warning
+static void config_problem(ping_config_error_t* error, bool fatal, DWORD line, DWORD column, const char* format, va_list args) {
+	bool first = error->errors == 0 && (fatal || error->warnings == 0);
+	if (fatal) error->errors++;
+	else error->warnings++;
+	if (!first) return;
+
+	error->line = line;
+	error->column = column;
+	vsnprintf(error->message, sizeof(error->message), format, args);
+}
+
+static void config_error(ping_config_error_t* error, DWORD line, DWORD column, const char* format, ...) {
+	va_list args;
+	va_start(args, format);
+	config_problem(error, true, line, column, format, args);
+	va_end(args);
+}
+
+// Keys this version does not know, a newer version's or a typo, must not cost the rest of the file
+static void config_warning(ping_config_error_t* error, DWORD line, DWORD column, const char* format, ...) {
+	va_list args;
+	va_start(args, format);
+	config_problem(error, false, line, column, format, args);
+	va_end(args);
+}
+
+// Section name as the key table spells it, NULL for sections the library does not read
+static const char* config_section(const char* name, size_t length) {
+	for (size_t i = 0; i < CONFIG_KEY_COUNT; i++) {
+		if (config_name_equals(name, length, CONFIG_KEYS[i].section)) return CONFIG_KEYS[i].section;
+	}
+	return NULL;
+}
+
+// Index into CONFIG_KEYS, or CONFIG_KEY_COUNT + n for BackupDns<n + 1>, -1 if unknown
+static int config_key(const char* section, const char* name, size_t length) {
+	for (size_t i = 0; i < CONFIG_KEY_COUNT; i++) {
+		if (CONFIG_KEYS[i].section == section && config_name_equals(name, length, CONFIG_KEYS[i].key)) return (int)i;
+	}
+
+	const size_t prefix = sizeof(CONFIG_BACKUP_DNS_KEY) - 1;
+	if (strcmp(section, "DNS") != 0 || length <= prefix || !config_name_equals(name, prefix, CONFIG_BACKUP_DNS_KEY)) return -1;
+
+	unsigned slot = 0;
+	for (size_t i = prefix; i < length; i++) {
+		if (name[i] < '0' || name[i] > '9' || slot > MAX_BACKUP_DNS) return -1;
+		slot = slot * 10 + (unsigned)(name[i] - '0');
+	}
+	return (slot >= 1 && slot <= MAX_BACKUP_DNS) ? (int)(CONFIG_KEY_COUNT + slot - 1) : -1;
+}
+
+static bool config_number(const char* value, size_t length, DWORD* number) {
+	unsigned long long total = 0;
+	if (length == 0) return false;
+	for (size_t i = 0; i < length; i++) {
+		if (value[i] < '0' || value[i] > '9') return false;
+		total = total * 10 + (unsigned)(value[i] - '0');
+		if (total > MAXDWORD) return false;
+	}
+	*number = (DWORD)total;
+	return true;
+}
+
+// One pass over the whole file: absent keys keep their defaults, and so do keys with bad values.
+// False on errors only, unknown keys are counted as warnings and skipped
+static bool config_parse(const char* text, size_t size, ping_config_t* config, ping_config_error_t* error) {
+	char backup_dns[MAX_BACKUP_DNS][sizeof(config->backup_dns[0])] = { 0 };
+	bool seen[CONFIG_KEY_COUNT + MAX_BACKUP_DNS] = { 0 };
+	const char* section = NULL;
+	DWORD line = 0;
+	size_t pos = 0;
+
+	*config = DEFAULT_CONFIG;
+	memset(error, 0, sizeof(*error));
+	if (size >= 3 && memcmp(text, "\xEF\xBB\xBF", 3) == 0) pos = 3;
+
+	while (pos < size) {
+		const size_t begin = pos;
+		const char* newline = (const char*)memchr(text + pos, '\n', size - pos);
+		size_t last = newline ? (size_t)(newline - text) : size;
+		pos = newline ? last + 1 : size;
+		line++;
+
+		size_t first = begin;
+		while (first < last && config_is_blank(text[first])) first++;
+		while (last > first && (config_is_blank(text[last - 1]) || text[last - 1] == '\r')) last--;
+		if (first == last || text[first] == ';' || text[first] == '#') continue;
+
+		const DWORD column = (DWORD)(first - begin) + 1;
+		if (text[first] == '[') {
+			const char* close = (const char*)memchr(text + first, ']', last - first);
+			if (!close) {
+				config_error(error, line, column, "missing ']' after the section name");
+				section = NULL;
+				continue;
+			}
+			size_t name = first + 1, name_end = (size_t)(close - text);
+			while (name < name_end && config_is_blank(text[name])) name++;
+			while (name_end > name && config_is_blank(text[name_end - 1])) name_end--;
+			section = config_section(text + name, name_end - name);
+			continue;
+		}
+
+		// Other tools may keep their own sections in the file
+		if (!section) continue;
+
+		const char* equals = (const char*)memchr(text + first, '=', last - first);
+		if (!equals) {
+			config_error(error, line, column, "expected key=value or [section]");
+			continue;
+		}
+
+		size_t key_end = (size_t)(equals - text);
+		while (key_end > first && config_is_blank(text[key_end - 1])) key_end--;
+		if (key_end == first) {
+			config_error(error, line, column, "missing the key name before '='");
+			continue;
+		}
+
+		size_t value = (size_t)(equals - text) + 1;
+		while (value < last && config_is_blank(text[value])) value++;
+		size_t value_end = last;
+		if (value_end - value >= 2 && text[value] == '"' && text[value_end - 1] == '"') {
+			value++;
+			value_end--;
+		}
+		const DWORD value_column = (DWORD)(value - begin) + 1;
+		const size_t length = value_end - value;
+
+		const int index = config_key(section, text + first, key_end - first);
+		if (index < 0) {
+			config_warning(error, line, column, "unknown key %.*s in [%s] skipped", (int)(key_end - first), text + first, section);
+			continue;
+		}
+
+		// The first occurrence wins, as it did with GetPrivateProfile*
+		if (seen[index]) continue;
+		seen[index] = true;
+
+		if (index >= (int)CONFIG_KEY_COUNT) {
+			if (length >= sizeof(backup_dns[0])) {
+				config_error(error, line, value_column, "%.*s is longer than %u characters", (int)(key_end - first), text + first, (unsigned)sizeof(backup_dns[0]) - 1);
+				continue;
+			}
+			memcpy(backup_dns[index - CONFIG_KEY_COUNT], text + value, length);
+			continue;
+		}
+
+		const config_key_t* key = &CONFIG_KEYS[index];
+		char* field = (char*)config + key->offset;
+		DWORD number = 0;
+		size_t number_length;
+		switch (key->type) {
+		case CONFIG_DWORD:
+		case CONFIG_BOOL:
+			// "3000 ; ms" is 3000, as GetPrivateProfileInt read it
+			number_length = length;
+			for (size_t i = 0; i < length; i++) {
+				if (text[value + i] == ';' || text[value + i] == '#') {
+					number_length = i;
+					break;
+				}
+			}
+			while (number_length > 0 && config_is_blank(text[value + number_length - 1])) number_length--;
+			if (!config_number(text + value, number_length, &number)) {
+				config_error(error, line, value_column, "%s expects a number up to %lu, found \"%.*s\"", key->key, (unsigned long)MAXDWORD, (int)length, text + value);
+			}
+			else if (key->type == CONFIG_BOOL) {
+				*(bool*)field = number != 0;
+			}
+			else {
+				*(DWORD*)field = number;
+			}
+			break;
+		case CONFIG_STRING:
+			if (length >= key->size) {
+				config_error(error, line, value_column, "%s is longer than %u characters", key->key, (unsigned)key->size - 1);
+				break;
+			}
+			memcpy(field, text + value, length);
+			field[length] = '\0';
+			break;
+		}
+	}
+
+	// Empty slots close up, and with none at all the defaults stay
+	DWORD count = 0;
+	for (int i = 0; i < MAX_BACKUP_DNS; i++) {
+		if (backup_dns[i][0] == '\0') continue;
+		memcpy(config->backup_dns[count++], backup_dns[i], sizeof(backup_dns[i]));
+	}
+	if (count > 0) {
+		for (DWORD i = count; i < MAX_BACKUP_DNS; i++) memset(config->backup_dns[i], 0, sizeof(config->backup_dns[i]));
+		config->backup_dns_count = count;
+	}
+
+	return error->errors == 0;
+}
+
+// The whole file as it is written to disk, the length written or 0 if it did not fit
+static size_t config_format(const ping_config_t* config, char* text, size_t size) {
+	const char* section = NULL;
+	size_t used = 0;
+	int length = snprintf(text, size, "; dbj_ping Configuration\r\n");
+
+	for (size_t i = 0; length >= 0 && (size_t)length < size - used; i++) {
+		used += (size_t)length;
+		if (i == CONFIG_KEY_COUNT + MAX_BACKUP_DNS) return used;
+
+		if (i >= CONFIG_KEY_COUNT) {
+			const DWORD slot = (DWORD)(i - CONFIG_KEY_COUNT);
+			length = slot < config->backup_dns_count
+				? snprintf(text + used, size - used, CONFIG_BACKUP_DNS_KEY "%lu=%s\r\n", (unsigned long)slot + 1, config->backup_dns[slot])
+				: 0;
+			continue;
+		}
+
+		const config_key_t* key = &CONFIG_KEYS[i];
+		const char* field = (const char*)config + key->offset;
+		char value[MAX_TARGET_LEN];
+		if (key->type == CONFIG_STRING) snprintf(value, sizeof(value), "%s", field);
+		else if (key->type == CONFIG_BOOL) snprintf(value, sizeof(value), "%d", *(const bool*)field ? 1 : 0);
+		else snprintf(value, sizeof(value), "%lu", (unsigned long)*(const DWORD*)field);
+
+		length = snprintf(text + used, size - used, "%s%s%s%s%s%s%s=%s\r\n",
+			section == key->section ? "" : "\r\n[", section == key->section ? "" : key->section, section == key->section ? "" : "]\r\n",
+			key->comment ? "; " : "", key->comment ? key->comment : "", key->comment ? "\r\n" : "",
+			key->key, value);
+		section = key->section;
+	}
+
+	return 0;
+}
+
+// Read the file in one call and parse it, ERROR_INVALID_DATA with the first problem in error
+static DWORD config_load_file(const char* path, ping_config_t* config, ping_config_error_t* error) {
+	DWORD result = ERROR_EXCEPTION_IN_SERVICE;
+	HANDLE file = INVALID_HANDLE_VALUE;
+	char* text = NULL;
+
+	__try {
+		file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (file == INVALID_HANDLE_VALUE) {
+			result = GetLastError();
+			__leave;
+		}
+
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(file, &size)) {
+			result = GetLastError();
+			__leave;
+		}
+		if (size.QuadPart > CONFIG_MAX_FILE) {
+			memset(error, 0, sizeof(*error));
+			config_error(error, 0, 0, "file is larger than %u bytes", (unsigned)CONFIG_MAX_FILE);
+			result = ERROR_FILE_TOO_LARGE;
+			__leave;
+		}
+
+		text = (char*)HeapAlloc(GetProcessHeap(), 0, (SIZE_T)size.QuadPart + 1);
+		if (!text) {
+			result = ERROR_NOT_ENOUGH_MEMORY;
+			__leave;
+		}
+
+		DWORD read = 0;
+		if (!ReadFile(file, text, (DWORD)size.QuadPart, &read, NULL)) {
+			result = GetLastError();
+			__leave;
+		}
+
+		result = config_parse(text, read, config, error) ? ERROR_SUCCESS : ERROR_INVALID_DATA;
+	}
+	__finally {
+		if (text) HeapFree(GetProcessHeap(), 0, text);
+		if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+	}
+
+	return result;
+}
+
+#pragma endregion
+
+#pragma region Configuration_Management
+
+
+static bool initialize_config_path(void) {
+	int result = 0;
+	__try {
+		HMODULE hModule = GetModuleHandleA("dbj_ping.dll");
+		if (!hModule) {
+			hModule = GetModuleHandleA(NULL); // Fall back to EXE
+		}
+
+		if (GetModuleFileNameA(hModule, g_config_path, sizeof(g_config_path))) {
+			// Remove filename, keep directory
+			char* last_slash = strrchr(g_config_path, '\\');
+			if (last_slash) {
+				*(last_slash + 1) = '\0';
+			}
+			strcat_s(g_config_path, sizeof(g_config_path), "dbj_ping.ini");
+
+			dbj_log(LOG_INFO, "Config file path: %s", g_config_path);
+			result = 1;
+		}
+		else {
+			dbj_log(LOG_ERROR, "Failed to get module path for config file");
+		}
+	}
+	__finally {
+		// Nothing to cleanup here
+	}
+
+	return result != 0;
+}
+
+// Pin the current snapshot: two interlocked operations on a line of this processor's shard, no lock
+static const ping_config_t* config_acquire(config_ref_t* ref) {
+	config_readers_t* shard = &g_config.shards[GetCurrentProcessorNumber() % CONFIG_READER_SHARDS];
+	for (;;) {
+		const LONG phase = g_config.phase;
+		ref->readers = &shard->readers[phase & 1];
+		InterlockedIncrement(ref->readers);
+		// A writer that flipped the phase meanwhile may not wait for this half, count again under the new one
+		if (g_config.phase == phase) break;
+		InterlockedDecrement(ref->readers);
+	}
+
+	ref->snapshot = g_config.current;
+	return ref->snapshot ? &ref->snapshot->config : &DEFAULT_CONFIG;
+}
+
+static void config_release(config_ref_t* ref) {
+	InterlockedDecrement(ref->readers);
+	ref->readers = NULL;
+}
+
+// Configured target, copied out as nobody keeps pointers into a snapshot past config_release
+static void config_target(char target[MAX_TARGET_LEN]) {
+	config_ref_t ref;
+	strcpy_s(target, MAX_TARGET_LEN, config_acquire(&ref)->target);
+	config_release(&ref);
+}
+
+// Return once every reader that could have seen the snapshot just replaced has left, publish_lock held
+static void config_synchronize(void) {
+	const LONG phase = InterlockedIncrement(&g_config.phase) - 1;
+	for (int i = 0; i < CONFIG_READER_SHARDS; i++) {
+		for (DWORD spins = 0; g_config.shards[i].readers[phase & 1] != 0; spins++) {
+			if (spins < 64) YieldProcessor();
+			else Sleep(spins < 128 ? 0 : 1);
+		}
+	}
+}
+
+// Publish a copy of config and free the snapshot it replaces, NULL retires the current one; publish_lock held
+static bool config_swap(const ping_config_t* config) {
+	config_snapshot_t* snapshot = NULL;
+	if (config) {
+		snapshot = (config_snapshot_t*)HeapAlloc(GetProcessHeap(), 0, sizeof(config_snapshot_t));
+		if (!snapshot) return false;
+		snapshot->config = *config;
+		snapshot->version = ++g_config.version;
+	}
+
+	config_snapshot_t* old = (config_snapshot_t*)InterlockedExchangePointer((PVOID volatile*)&g_config.current, snapshot);
+	if (old) {
+		config_synchronize();
+		HeapFree(GetProcessHeap(), 0, old);
+		InterlockedIncrement64(&g_config.reclaimed);
+	}
+	return true;
+}
+
+static bool config_stamp(config_stamp_t* stamp) {
+	WIN32_FILE_ATTRIBUTE_DATA data;
+	if (!GetFileAttributesExA(g_config_path, GetFileExInfoStandard, &data)) return false;
+	stamp->last_write = data.ftLastWriteTime;
+	stamp->size = ((ULONGLONG)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+	return true;
+}
+
+// Reread dbj_ping.ini if it moved since it was last loaded or saved, a file with problems leaves the running snapshot
+// The file is read and parsed unlocked, publish_lock is taken to look at the stamp and again to swap
+static void config_reload(void) {
+	bool lock_held = false;
+
+	__try {
+		// The configuration set through the API is newer, it is about to overwrite the file
+		AcquireSRWLockExclusive(&g_config.publish_lock);
+		bool pending = g_config.save_pending != 0;
+		config_stamp_t known = g_config.stamp;
+		ULONGLONG version = g_config.version;
+		ReleaseSRWLockExclusive(&g_config.publish_lock);
+		if (pending) __leave;
+
+		config_stamp_t stamp;
+		if (!config_stamp(&stamp)) __leave;
+		if (CompareFileTime(&stamp.last_write, &known.last_write) == 0 && stamp.size == known.size) __leave;
+
+		ping_config_t config;
+		ping_config_error_t error;
+		DWORD status = config_load_file(g_config_path, &config, &error);
+		if (status == ERROR_INVALID_DATA || (status == ERROR_SUCCESS && error.warnings > 0)) {
+			// As at startup: bad values keep their defaults, unknown keys are skipped, the rest applies
+			dbj_log(LOG_WARNING, "%s:%lu:%lu: %s (%lu errors, %lu warnings, those keys keep their defaults)",
+				g_config_path, error.line, error.column, error.message, error.errors, error.warnings);
+		}
+		else if (status != ERROR_SUCCESS) {
+			// Possibly caught halfway through a replace, the next notification tries again
+			InterlockedIncrement64(&g_config.reload_failures);
+			dbj_log(LOG_WARNING, "Failed to reread %s: %lu", g_config_path, status);
+			__leave;
+		}
+
+		AcquireSRWLockExclusive(&g_config.publish_lock);
+		lock_held = true;
+		// Published or saved while the file was read, what was read may be older than either
+		if (g_config.save_pending || g_config.version != version ||
+			CompareFileTime(&g_config.stamp.last_write, &known.last_write) != 0 || g_config.stamp.size != known.size) {
+			__leave;
+		}
+
+		bool resolver_changed = !g_config.current || strcmp(g_config.current->config.resolver_dns, config.resolver_dns) != 0;
+		if (!config_swap(&config)) {
+			InterlockedIncrement64(&g_config.reload_failures);
+			__leave;
+		}
+		g_config.stamp = stamp;
+		if (resolver_changed) resolver_flush();
+		InterlockedIncrement64(&g_config.reloads);
+		dbj_log(LOG_INFO, "Configuration version %llu reloaded from: %s", g_config.version, g_config_path);
+	}
+	__finally {
+		if (lock_held) ReleaseSRWLockExclusive(&g_config.publish_lock);
+	}
+}
+
+// Save the current snapshot to dbj_ping.ini, publish_lock is held only to copy it and to record the stamp
+// Savers take turns, so the tmp file is never shared and an older copy never lands after a newer one
+static bool config_save_current(bool pending_only) {
+	bool saved = false;
+
+	AcquireSRWLockExclusive(&g_config.save_lock);
+	__try {
+		AcquireSRWLockExclusive(&g_config.publish_lock);
+		bool due = InterlockedExchange(&g_config.save_pending, 0) || !pending_only;
+		ping_config_t config = g_config.current ? g_config.current->config : DEFAULT_CONFIG;
+		ReleaseSRWLockExclusive(&g_config.publish_lock);
+
+		if (!due || !save_configuration(g_config_path, &config)) __leave;
+		saved = true;
+
+		AcquireSRWLockExclusive(&g_config.publish_lock);
+		config_stamp(&g_config.stamp);
+		ReleaseSRWLockExclusive(&g_config.publish_lock);
+	}
+	__finally {
+		ReleaseSRWLockExclusive(&g_config.save_lock);
+	}
+
+	return saved;
+}
+
+// Write the current snapshot if ping_set_config left it unsaved
+static void config_flush(void) {
+	config_save_current(true);
+}
+
+// Reloads dbj_ping.ini once changes in its directory have been quiet for CONFIG_RELOAD_QUIET_MS,
+// and saves what ping_set_config published once it has not been called for CONFIG_SAVE_QUIET_MS
+static DWORD WINAPI config_watch_proc(LPVOID param) {
+	UNREFERENCED_PARAMETER(param);
+	HANDLE handles[3] = { g_config.stop_event, g_config.change, g_config.save_event };
+	ULONGLONG save_due = 0;
+
+	__try {
+		for (;;) {
+			DWORD timeout = INFINITE;
+			if (g_config.save_pending) {
+				ULONGLONG now = GetTickCount64();
+				timeout = save_due > now ? (DWORD)(save_due - now) : 0;
+			}
+
+			DWORD wait = WaitForMultipleObjects(3, handles, FALSE, timeout);
+			if (wait == WAIT_OBJECT_0 + 2) {
+				save_due = GetTickCount64() + CONFIG_SAVE_QUIET_MS;
+				continue;
+			}
+			if (wait == WAIT_TIMEOUT) {
+				config_flush();
+				continue;
+			}
+
+			while (wait == WAIT_OBJECT_0 + 1) {
+				if (!FindNextChangeNotification(g_config.change)) {
+					dbj_log(LOG_ERROR, "Configuration change notification failed: %lu", GetLastError());
+					__leave;
+				}
+				wait = WaitForMultipleObjects(2, handles, FALSE, CONFIG_RELOAD_QUIET_MS);
+			}
+			if (wait != WAIT_TIMEOUT) __leave;
+
+			config_reload();
+		}
+	}
+	__finally {
+		// A burst cut short by ping_cleanup is still saved
+		config_flush();
+	}
+
+	return 0;
+}
+
+// Watch dbj_ping.ini for edits, without a watcher the configuration only changes through ping_set_config and saves at once
+static void config_start(void) {
+	char directory[MAX_PATH];
+	strcpy_s(directory, sizeof(directory), g_config_path);
+	char* last_slash = strrchr(directory, '\\');
+	if (last_slash) *last_slash = '\0';
+
+	g_config.change = FindFirstChangeNotificationA(directory, FALSE,
+		FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_FILE_NAME);
+	if (g_config.change == INVALID_HANDLE_VALUE) {
+		g_config.change = NULL;
+		dbj_log(LOG_WARNING, "Not watching %s for changes: %lu", directory, GetLastError());
+		return;
+	}
+
+	g_config.stop_event = CreateEventA(NULL, TRUE, FALSE, NULL);
+	g_config.save_event = CreateEventA(NULL, FALSE, FALSE, NULL);
+	if (g_config.stop_event && g_config.save_event) {
+		g_config.thread = CreateThread(NULL, 0, config_watch_proc, NULL, 0, NULL);
+	}
+	if (!g_config.thread) {
+		dbj_log(LOG_WARNING, "Configuration watcher did not start: %lu", GetLastError());
+		if (g_config.stop_event) CloseHandle(g_config.stop_event);
+		if (g_config.save_event) CloseHandle(g_config.save_event);
+		FindCloseChangeNotification(g_config.change);
+		g_config.stop_event = NULL;
+		g_config.save_event = NULL;
+		g_config.change = NULL;
+	}
+}
+
+// Stop watching and retire the snapshot, readers from here on get the defaults
+static void config_stop(void) {
+	if (g_config.thread) {
+		SetEvent(g_config.stop_event);
+		WaitForSingleObject(g_config.thread, INFINITE);
+		CloseHandle(g_config.thread);
+		CloseHandle(g_config.stop_event);
+		CloseHandle(g_config.save_event);
+		FindCloseChangeNotification(g_config.change);
+		g_config.thread = NULL;
+		g_config.stop_event = NULL;
+		g_config.save_event = NULL;
+		g_config.change = NULL;
+	}
+
+	AcquireSRWLockExclusive(&g_config.publish_lock);
+	config_swap(NULL);
+	ReleaseSRWLockExclusive(&g_config.publish_lock);
+}
+
+// Load configuration from INI file, one read and one pass, and publish it as the first snapshot
+static bool load_configuration(void) {
+	int result = 0;
+	__try {
+		// Initialize config path first
+		if (!initialize_config_path()) {
+			dbj_log(LOG_ERROR, "Failed to initialize configuration path");
+			__leave;
+		}
+
+		ping_config_t config;
+		ping_config_error_t error;
+		DWORD status = config_load_file(g_config_path, &config, &error);
+		if (status == ERROR_FILE_NOT_FOUND) {
+			dbj_log(LOG_INFO, "Configuration file not found, creating default");
+			if (!create_default_config()) {
+				dbj_log(LOG_ERROR, "Failed to create default configuration file");
+				__leave;
+			}
+			config = DEFAULT_CONFIG;
+		}
+		else if (status == ERROR_INVALID_DATA || (status == ERROR_SUCCESS && error.warnings > 0)) {
+			dbj_log(LOG_WARNING, "%s:%lu:%lu: %s (%lu errors, %lu warnings, those keys keep their defaults)",
+				g_config_path, error.line, error.column, error.message, error.errors, error.warnings);
+		}
+		else if (status != ERROR_SUCCESS) {
+			dbj_log(LOG_ERROR, "Failed to read configuration %s: %lu %s", g_config_path, status, status == ERROR_FILE_TOO_LARGE ? error.message : "");
+			__leave;
+		}
+
+		AcquireSRWLockExclusive(&g_config.publish_lock);
+		config_stamp(&g_config.stamp);
+		bool published = config_swap(&config);
+		ReleaseSRWLockExclusive(&g_config.publish_lock);
+		if (!published) {
+			dbj_log(LOG_ERROR, "Out of memory for the configuration snapshot");
+			__leave;
+		}
+
+		dbj_log(LOG_INFO, "Configuration loaded successfully from: %s", g_config_path);
+		result = 1;
+	}
+	__finally {
+		// Nothing to cleanup here
+	}
+
+	return result != 0;
+}
+// Write the whole file beside path and rename it over, readers and a crash mid-save find the old file or the new one
+static bool save_configuration(const char* path, const ping_config_t* config) {
+	int result = false;
+	HANDLE file = INVALID_HANDLE_VALUE;
+	char temp_path[MAX_PATH] = { 0 };
+	__try {
+		char text[CONFIG_MAX_TEXT];
+		size_t length = config_format(config, text, sizeof(text));
+		if (length == 0) {
+			dbj_log(LOG_ERROR, "Configuration does not fit in %u bytes", (unsigned)sizeof(text));
+			__leave;
+		}
+
+		if (sprintf_s(temp_path, sizeof(temp_path), "%s.tmp", path) < 0) {
+			temp_path[0] = '\0';
+			dbj_log(LOG_ERROR, "Configuration path too long: %s", path);
+			__leave;
+		}
+
+		file = CreateFileA(temp_path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (file == INVALID_HANDLE_VALUE) {
+			dbj_log(LOG_ERROR, "Failed to create %s: %lu", temp_path, GetLastError());
+			__leave;
+		}
+
+		// On disk before the rename, or a power cut could leave the new name on an empty file
+		DWORD written = 0;
+		if (!WriteFile(file, text, (DWORD)length, &written, NULL) || written != length || !FlushFileBuffers(file)) {
+			dbj_log(LOG_ERROR, "Failed to write %s: %lu", temp_path, GetLastError());
+			__leave;
+		}
+		CloseHandle(file);
+		file = INVALID_HANDLE_VALUE;
+
+		if (!MoveFileExA(temp_path, path, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+			dbj_log(LOG_ERROR, "Failed to replace %s: %lu", path, GetLastError());
+			__leave;
+		}
+
+		InterlockedIncrement64(&g_config.saves);
+		result = true;
+	}
+	__finally {
+		if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+		if (!result && temp_path[0]) DeleteFileA(temp_path);
+	}
+
+	return result;
+}
+
+// Create default configuration file
+static bool create_default_config(void) {
+	if (!save_configuration(g_config_path, &DEFAULT_CONFIG)) return false;
+
+	dbj_log(LOG_INFO, "Default configuration file created: %s", g_config_path);
+	return true;
+}
+
+#pragma endregion
+
+#pragma region Utility_Functions
+
+// Initialize statistics, shards written before this read as empty
+static void init_stats(void) {
+	FILETIME now;
+	GetSystemTimeAsFileTime(&now);
+
+	InterlockedIncrement(&g_stats_epoch);
+	target_stats_reset();
+	InterlockedExchange(&g_countermeasure.dns_index, 0);
+	InterlockedExchange64(&g_countermeasure.last_run, ((LONG64)now.dwHighDateTime << 32) | now.dwLowDateTime);
+	InterlockedExchange64(&g_countermeasure.triggers, 0);
+	InterlockedExchange64(&g_countermeasure.runs, 0);
+	InterlockedExchange64(&g_countermeasure.coalesced, 0);
+	InterlockedExchange64(&g_countermeasure.suppressed, 0);
+}
+
+// Monotonic clock in nanoseconds
+static ULONGLONG monotonic_ns(void) {
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+
+	// Split the conversion so counter * 1e9 cannot overflow
+	ULONGLONG ticks = (ULONGLONG)counter.QuadPart;
+	ULONGLONG frequency = (ULONGLONG)g_qpc_frequency.QuadPart;
+	return (ticks / frequency) * 1000000000ULL + (ticks % frequency) * 1000000000ULL / frequency;
+}
+
+// Nanosecond RTT from the send/receive stamps, bounded by the kernel's whole-ms RTT
+static void set_rtt_ns(ping_result_ex_t* result_ex, ULONG kernel_rtt_ms) {
+	ULONGLONG rtt_ns = result_ex->recv_time_ns - result_ex->send_time_ns;
+
+	// A late wakeup on our side must not show up as network latency,
+	// fall back to the middle of the kernel's millisecond when we overshoot it
+	if (rtt_ns > ((ULONGLONG)kernel_rtt_ms + 1) * 1000000ULL) {
+		rtt_ns = (ULONGLONG)kernel_rtt_ms * 1000000ULL + 500000ULL;
+	}
+
+	result_ex->rtt_ns = rtt_ns;
+}
+
+// Shard of the calling thread, claimed on first use and released when the thread exits
+static stats_shard_t* stats_shard(void) {
+	stats_shard_t* shard = (stats_shard_t*)TlsGetValue(g_stats_tls);
+	if (shard) {
+		return shard;
+	}
+
+	LONG thread_id = (LONG)GetCurrentThreadId();
+	shard = &g_stats_overflow;
+	for (int i = 0; i < STATS_SHARDS; i++) {
+		if (g_stats_shards[i].owner == 0 && InterlockedCompareExchange(&g_stats_shards[i].owner, thread_id, 0) == 0) {
+			shard = &g_stats_shards[i];
+			break;
+		}
+	}
+
+	TlsSetValue(g_stats_tls, shard);
+	return shard;
+}
+
+// DLL_THREAD_DETACH, the counts stay and the next thread to claim the shard adds to them
+static void stats_release_shard(void) {
+	if (g_stats_tls == TLS_OUT_OF_INDEXES) {
+		return;
+	}
+
+	stats_shard_t* shard = (stats_shard_t*)TlsGetValue(g_stats_tls);
+	if (shard && shard != &g_stats_overflow) {
+		InterlockedExchange(&shard->owner, 0);
+	}
+	TlsSetValue(g_stats_tls, NULL);
+}
+
+// Fold one ping result into the statistics, returns true when health analysis of addr is due
+static bool record_ping_result(const ping_result_ex_t* result_ex, IPAddr addr) {
+	bool lock_held = false;
+	const ping_result_t* result = &result_ex->base;
+
+	__try {
+		stats_shard_t* shard = stats_shard();
+		if (shard == &g_stats_overflow) {
+			AcquireSRWLockExclusive(&g_stats_overflow_lock);
+			lock_held = true;
+		}
+
+		// Plain writes, nobody else writes this shard. x86 and x64 keep stores in order,
+		// the compiler barriers keep the sequence bumps around the data for readers
+		shard->sequence++;
+		_ReadWriteBarrier();
+
+		LONG epoch = g_stats_epoch;
+		if (shard->epoch != epoch) {
+			shard->epoch = epoch;
+			shard->packets_sent = 0;
+			shard->packets_received = 0;
+			shard->packets_lost = 0;
+			shard->rtt_sum_ns = 0;
+			shard->min_rtt_ns = ULLONG_MAX;
+			shard->max_rtt_ns = 0;
+			shard->jitter = 0.0;
+			memset(shard->rtt_histogram, 0, sizeof(shard->rtt_histogram));
+		}
+
+		shard->packets_sent++;
+
+		if (result->success) {
+			shard->packets_received++;
+
+			// RTT statistics at nanosecond resolution, jitter in milliseconds
+			ULONGLONG rtt_ns = result_ex->rtt_ns;
+			if (rtt_ns < shard->min_rtt_ns) shard->min_rtt_ns = rtt_ns;
+			if (rtt_ns > shard->max_rtt_ns) shard->max_rtt_ns = rtt_ns;
+			shard->rtt_sum_ns += rtt_ns;
+			shard->rtt_histogram[histogram_bucket(rtt_ns, GLOBAL_HIST_SUB_BITS, GLOBAL_HIST_UNIT_SHIFT, GLOBAL_HIST_BUCKETS)]++;
+
+			// Simple jitter calculation (standard deviation approximation)
+			if (shard->packets_received > 1) {
+				double avg_rtt = (double)shard->rtt_sum_ns / (double)shard->packets_received / 1000000.0;
+				double diff = (double)rtt_ns / 1000000.0 - avg_rtt;
+				shard->jitter = (shard->jitter * 0.9) + (fabs(diff) * 0.1);
+			}
+		}
+		else {
+			shard->packets_lost++;
+		}
+
+		_ReadWriteBarrier();
+		shard->sequence++;
+	}
+	__finally {
+		if (lock_held) ReleaseSRWLockExclusive(&g_stats_overflow_lock);
+	}
+
+	return target_stats_record(addr, result_ex);
+}
+
+// Consistent copy of one shard, retried while its owner is mid-update
+static void stats_read_shard(const stats_shard_t* shard, stats_shard_t* copy) {
+	for (;;) {
+		LONG sequence = shard->sequence;
+		if (sequence & 1) {
+			YieldProcessor();
+			continue;
+		}
+
+		_ReadWriteBarrier();
+		memcpy(copy, (const void*)shard, offsetof(stats_shard_t, rtt_histogram));
+		_ReadWriteBarrier();
+
+		if (shard->sequence == sequence) {
+			return;
+		}
+	}
+}
+
+// Merge every shard written since the last reset, nothing the writers take is held
+static void stats_merge(ping_stats_t* stats) {
+	ULONGLONG sent = 0, received = 0, lost = 0, rtt_sum_ns = 0;
+	ULONGLONG min_rtt_ns = ULLONG_MAX, max_rtt_ns = 0;
+	double jitter_sum = 0.0;
+	LONG epoch = g_stats_epoch;
+
+	for (int i = 0; i <= STATS_SHARDS; i++) {
+		const stats_shard_t* shard = (i < STATS_SHARDS) ? &g_stats_shards[i] : &g_stats_overflow;
+		stats_shard_t copy;
+		stats_read_shard(shard, &copy);
+		if (copy.epoch != epoch || copy.packets_sent == 0) {
+			continue;
+		}
+
+		sent += copy.packets_sent;
+		received += copy.packets_received;
+		lost += copy.packets_lost;
+		rtt_sum_ns += copy.rtt_sum_ns;
+		if (copy.min_rtt_ns < min_rtt_ns) min_rtt_ns = copy.min_rtt_ns;
+		if (copy.max_rtt_ns > max_rtt_ns) max_rtt_ns = copy.max_rtt_ns;
+		// Each shard's jitter weighs in by the replies behind it
+		jitter_sum += copy.jitter * (double)copy.packets_received;
+	}
+
+	memset(stats, 0, sizeof(ping_stats_t));
+	stats->packets_sent = (DWORD)sent;
+	stats->packets_received = (DWORD)received;
+	stats->packets_lost = (DWORD)lost;
+	stats->min_rtt = received > 0 ? (double)min_rtt_ns / 1000000.0 : DBL_MAX;
+	stats->max_rtt = (double)max_rtt_ns / 1000000.0;
+	stats->avg_rtt = received > 0 ? (double)rtt_sum_ns / (double)received / 1000000.0 : 0.0;
+	stats->jitter = received > 0 ? jitter_sum / (double)received : 0.0;
+
+	stats->countermeasures_active = countermeasure_state() != PING_COUNTERMEASURE_IDLE;
+	stats->current_dns_index = (DWORD)g_countermeasure.dns_index;
+
+	LONG64 last_run = g_countermeasure.last_run;
+	FILETIME last_run_time;
+	last_run_time.dwLowDateTime = (DWORD)last_run;
+	last_run_time.dwHighDateTime = (DWORD)(last_run >> 32);
+	FileTimeToSystemTime(&last_run_time, &stats->last_countermeasure);
+}
+
+// Sum the shards' RTT histograms, a shard being written meanwhile may be off by its last reply
+static void stats_merge_histogram(ping_rtt_histogram_t* histogram) {
+	LONG epoch = g_stats_epoch;
+
+	memset(histogram, 0, sizeof(ping_rtt_histogram_t));
+	histogram->sub_bucket_bits = GLOBAL_HIST_SUB_BITS;
+	histogram->unit_shift = GLOBAL_HIST_UNIT_SHIFT;
+	histogram->bucket_count = GLOBAL_HIST_BUCKETS;
+	histogram->min_rtt_ns = ULLONG_MAX;
+
+	for (int i = 0; i <= STATS_SHARDS; i++) {
+		const stats_shard_t* shard = (i < STATS_SHARDS) ? &g_stats_shards[i] : &g_stats_overflow;
+		stats_shard_t copy;
+		stats_read_shard(shard, &copy);
+		if (copy.epoch != epoch || copy.packets_received == 0) {
+			continue;
+		}
+
+		if (copy.min_rtt_ns < histogram->min_rtt_ns) histogram->min_rtt_ns = copy.min_rtt_ns;
+		if (copy.max_rtt_ns > histogram->max_rtt_ns) histogram->max_rtt_ns = copy.max_rtt_ns;
+		for (int b = 0; b < GLOBAL_HIST_BUCKETS; b++) {
+			ULONGLONG count = shard->rtt_histogram[b];
+			histogram->counts[b] += count;
+			histogram->total_count += count;
+		}
+	}
+
+	if (histogram->total_count == 0) {
+		histogram->min_rtt_ns = 0;
+	}
+}
+
+// Resolve hostname to IP address
+static DWORD resolve_hostname(const char* hostname, char* ip_buffer, size_t buffer_size) {
+	DWORD result = ERROR_INVALID_PARAMETER;
+
+	__try {
+		IN_ADDR addr = { 0 };
+		DWORD status = resolver_lookup(hostname, &addr.s_addr);
+		if (status != ERROR_SUCCESS) {
+			dbj_log(LOG_ERROR, "Name resolution failed for %s: %lu", hostname, status);
+			__leave;
+		}
+
+		inet_ntop(AF_INET, &addr, ip_buffer, buffer_size);
+
+		result = ERROR_SUCCESS;
+	}
+	__finally {
+		// Nothing to cleanup here
+	}
+
+	return result;
+}
+
+#pragma endregion
+
+#pragma region RTT_Histograms
+
+static DWORD histogram_msb(ULONGLONG value) {
+	DWORD bit = 0;
+	if ((DWORD)(value >> 32)) {
+		_BitScanReverse(&bit, (DWORD)(value >> 32));
+		return bit + 32;
+	}
+	_BitScanReverse(&bit, (DWORD)value);
+	return bit;
+}
+
+// Bucket of an RTT: linear below 2^sub_bits units, then 2^sub_bits buckets per power of two
+static DWORD histogram_bucket(ULONGLONG rtt_ns, DWORD sub_bits, DWORD unit_shift, DWORD bucket_count) {
+	ULONGLONG value = rtt_ns >> unit_shift;
+	DWORD bucket = (DWORD)value;
+
+	if (value >= (1ULL << sub_bits)) {
+		DWORD msb = histogram_msb(value);
+		bucket = ((msb - sub_bits + 1) << sub_bits) + (DWORD)((value >> (msb - sub_bits)) & ((1ULL << sub_bits) - 1));
+	}
+
+	// Anything past the last bucket is counted there
+	return (value >= (1ULL << 40) || bucket >= bucket_count) ? bucket_count - 1 : bucket;
+}
+
+// Lowest RTT in nanoseconds that lands in bucket
+static ULONGLONG histogram_bucket_low(DWORD bucket, DWORD sub_bits, DWORD unit_shift) {
+	DWORD sub_count = 1u << sub_bits;
+	if (bucket < sub_count) {
+		return (ULONGLONG)bucket << unit_shift;
+	}
+
+	DWORD octave = bucket >> sub_bits;
+	return ((ULONGLONG)(sub_count + (bucket & (sub_count - 1))) << (octave - 1)) << unit_shift;
+}
+
+// RTT in nanoseconds at or below which percentile of the replies fall, the bucket's upper edge
+// clamped to the exact min and max, so it never under-reports by more than a bucket width
+static ULONGLONG histogram_percentile(const ping_rtt_histogram_t* histogram, double percentile) {
+	if (histogram->total_count == 0) {
+		return 0;
+	}
+
+	ULONGLONG rank = (ULONGLONG)ceil(percentile / 100.0 * (double)histogram->total_count);
+	if (rank < 1) rank = 1;
+	if (rank > histogram->total_count) rank = histogram->total_count;
+
+	ULONGLONG seen = 0;
+	for (DWORD i = 0; i < histogram->bucket_count; i++) {
+		seen += histogram->counts[i];
+		if (seen < rank) {
+			continue;
+		}
+
+		ULONGLONG value = histogram_bucket_low(i + 1, histogram->sub_bucket_bits, histogram->unit_shift) - 1;
+		if (value > histogram->max_rtt_ns) value = histogram->max_rtt_ns;
+		if (value < histogram->min_rtt_ns) value = histogram->min_rtt_ns;
+		return value;
+	}
+
+	return histogram->max_rtt_ns;
+}
+
+static bool histogram_layout_valid(const ping_rtt_histogram_t* histogram) {
+	return histogram->sub_bucket_bits <= 16 && histogram->unit_shift <= 32 &&
+		histogram->bucket_count > 0 && histogram->bucket_count <= PING_HISTOGRAM_MAX_BUCKETS;
+}
+
+// Add from into into, buckets are moved by their midpoint when the layouts differ
+static void histogram_merge(ping_rtt_histogram_t* into, const ping_rtt_histogram_t* from) {
+	if (into->bucket_count == 0) {
+		into->sub_bucket_bits = from->sub_bucket_bits;
+		into->unit_shift = from->unit_shift;
+		into->bucket_count = from->bucket_count;
+		into->min_rtt_ns = ULLONG_MAX;
+	}
+
+	if (from->total_count == 0) {
+		if (into->total_count == 0) into->min_rtt_ns = 0;
+		return;
+	}
+	if (into->total_count == 0 || from->min_rtt_ns < into->min_rtt_ns) into->min_rtt_ns = from->min_rtt_ns;
+	if (from->max_rtt_ns > into->max_rtt_ns) into->max_rtt_ns = from->max_rtt_ns;
+
+	bool same_layout = into->sub_bucket_bits == from->sub_bucket_bits &&
+		into->unit_shift == from->unit_shift && into->bucket_count == from->bucket_count;
+
+	for (DWORD i = 0; i < from->bucket_count; i++) {
+		if (from->counts[i] == 0) {
+			continue;
+		}
+
+		DWORD bucket = i;
+		if (!same_layout) {
+			ULONGLONG low = histogram_bucket_low(i, from->sub_bucket_bits, from->unit_shift);
+			ULONGLONG high = histogram_bucket_low(i + 1, from->sub_bucket_bits, from->unit_shift);
+			bucket = histogram_bucket(low + (high - low) / 2, into->sub_bucket_bits, into->unit_shift, into->bucket_count);
+		}
+		into->counts[bucket] += from->counts[i];
+	}
+	into->total_count += from->total_count;
+}
+
+#pragma endregion
+
+#pragma region Quantile_Sketches
+
+// Bin of an RTT, everything at or below 1 ns shares bin 0
+static DWORD sketch_index(ULONGLONG rtt_ns) {
+	if (rtt_ns <= 1) {
+		return 0;
+	}
+
+	double index = ceil(log((double)rtt_ns) / SKETCH_LOG_GAMMA);
+	return index >= PING_SKETCH_BINS - 1 ? PING_SKETCH_BINS - 1 : (DWORD)index;
+}
+
+// Estimate for every RTT in a bin, within the accuracy of all of them
+static double sketch_bin_value(DWORD index) {
+	return index == 0 ? 1.0 : 2.0 * exp(index * SKETCH_LOG_GAMMA) / (SKETCH_GAMMA + 1.0);
+}
+
+static void sketch_init(ping_sketch_t* sketch) {
+	memset(sketch, 0, sizeof(ping_sketch_t));
+	sketch->accuracy_ppm = SKETCH_ACCURACY_PPM;
+}
+
+static void sketch_add(ping_sketch_t* into, ULONGLONG count, ULONGLONG min_rtt_ns, ULONGLONG max_rtt_ns, ULONGLONG sum_rtt_ns) {
+	if (count == 0) {
+		return;
+	}
+	if (into->count == 0 || min_rtt_ns < into->min_rtt_ns) into->min_rtt_ns = min_rtt_ns;
+	if (max_rtt_ns > into->max_rtt_ns) into->max_rtt_ns = max_rtt_ns;
+	into->sum_rtt_ns += sum_rtt_ns;
+	into->count += count;
+}
+
+// RTT in nanoseconds at quantile (0..1), within the sketch's relative accuracy
+static double sketch_quantile(const ping_sketch_t* sketch, double quantile) {
+	if (sketch->count == 0) {
+		return 0.0;
+	}
+
+	double rank = quantile * (double)(sketch->count - 1);
+	ULONGLONG seen = 0;
+	for (DWORD i = 0; i < PING_SKETCH_BINS; i++) {
+		seen += sketch->bins[i];
+		if ((double)seen <= rank) {
+			continue;
+		}
+
+		double value = sketch_bin_value(i);
+		if (value < (double)sketch->min_rtt_ns) value = (double)sketch->min_rtt_ns;
+		if (value > (double)sketch->max_rtt_ns) value = (double)sketch->max_rtt_ns;
+		return value;
+	}
+
+	return (double)sketch->max_rtt_ns;
+}
+
+// Count an RTT into a target's window, sliding it when the RTT falls outside
+static void target_sketch_record(target_sketch_t* sketch, ULONGLONG rtt_ns) {
+	DWORD index = sketch_index(rtt_ns);
+
+	if (!sketch->used) {
+		// Most of the window above the first RTT, the tail of an RTT distribution is on the high side
+		DWORD offset = index > SKETCH_TARGET_BINS / 4 ? index - SKETCH_TARGET_BINS / 4 : 0;
+		if (offset > PING_SKETCH_BINS - SKETCH_TARGET_BINS) offset = PING_SKETCH_BINS - SKETCH_TARGET_BINS;
+		sketch->offset = (WORD)offset;
+		sketch->used = true;
+	}
+
+	if (index >= (DWORD)sketch->offset + SKETCH_TARGET_BINS) {
+		// Slide up, the bins falling out at the bottom fold into the new lowest one
+		DWORD shift = index - (sketch->offset + SKETCH_TARGET_BINS - 1);
+		DWORD folded = 0;
+		for (DWORD i = 0; i <= shift && i < SKETCH_TARGET_BINS; i++) {
+			folded += sketch->bins[i];
+		}
+		if (shift < SKETCH_TARGET_BINS) {
+			memmove(&sketch->bins[0], &sketch->bins[shift], (SKETCH_TARGET_BINS - shift) * sizeof(DWORD));
+			memset(&sketch->bins[SKETCH_TARGET_BINS - shift], 0, shift * sizeof(DWORD));
+		}
+		else {
+			memset(sketch->bins, 0, sizeof(sketch->bins));
+		}
+		sketch->bins[0] = folded;
+		sketch->offset = (WORD)(sketch->offset + shift);
+	}
+	else if (index < sketch->offset) {
+		// Slide down while the highest bin in use still fits, past that fold into the lowest bin
+		DWORD highest = SKETCH_TARGET_BINS - 1;
+		while (highest > 0 && sketch->bins[highest] == 0) highest--;
+		if (sketch->offset + highest - index < SKETCH_TARGET_BINS) {
+			DWORD shift = sketch->offset - index;
+			memmove(&sketch->bins[shift], &sketch->bins[0], (SKETCH_TARGET_BINS - shift) * sizeof(DWORD));
+			memset(&sketch->bins[0], 0, shift * sizeof(DWORD));
+			sketch->offset = (WORD)index;
+		}
+		else {
+			index = sketch->offset;
+		}
+	}
+
+	sketch->bins[index - sketch->offset]++;
+}
+
+static BYTE* sketch_put_varint(BYTE* out, ULONGLONG value) {
+	while (value >= 0x80) {
+		*out++ = (BYTE)(value | 0x80);
+		value >>= 7;
+	}
+	*out++ = (BYTE)value;
+	return out;
+}
+
+static const BYTE* sketch_get_varint(const BYTE* in, const BYTE* end, ULONGLONG* value) {
+	ULONGLONG result = 0;
+	for (int shift = 0; shift < 64 && in < end; shift += 7) {
+		BYTE b = *in++;
+		result |= (ULONGLONG)(b & 0x7F) << shift;
+		if (!(b & 0x80)) {
+			*value = result;
+			return in;
+		}
+	}
+	return NULL;
+}
+
+// Stable layout, little-endian as Windows is throughout:
+// magic u32, version u8, 3 reserved bytes, accuracy_ppm u32, count u64, min u64, max u64, sum u64,
+// pair count u32, then per non-empty bin a varint gap from the previous bin (the first is absolute) and a varint count
+static DWORD sketch_serialize(const ping_sketch_t* sketch, BYTE* buffer, DWORD size, DWORD* written) {
+	DWORD pairs = 0;
+	DWORD needed = 48;
+	BYTE scratch[20];
+	DWORD previous = 0;
+
+	for (DWORD i = 0; i < PING_SKETCH_BINS; i++) {
+		if (sketch->bins[i] == 0) continue;
+		needed += (DWORD)(sketch_put_varint(scratch, pairs ? i - previous : i) - scratch);
+		needed += (DWORD)(sketch_put_varint(scratch, sketch->bins[i]) - scratch);
+		previous = i;
+		pairs++;
+	}
+
+	*written = needed;
+	if (!buffer || size < needed) {
+		return ERROR_INSUFFICIENT_BUFFER;
+	}
+
+	DWORD magic = SKETCH_MAGIC;
+	memcpy(buffer + 0, &magic, 4);
+	buffer[4] = SKETCH_VERSION;
+	buffer[5] = buffer[6] = buffer[7] = 0;
+	memcpy(buffer + 8, &sketch->accuracy_ppm, 4);
+	memcpy(buffer + 12, &sketch->count, 8);
+	memcpy(buffer + 20, &sketch->min_rtt_ns, 8);
+	memcpy(buffer + 28, &sketch->max_rtt_ns, 8);
+	memcpy(buffer + 36, &sketch->sum_rtt_ns, 8);
+	memcpy(buffer + 44, &pairs, 4);
+
+	BYTE* out = buffer + 48;
+	DWORD written_pairs = 0;
+	for (DWORD i = 0; i < PING_SKETCH_BINS; i++) {
+		if (sketch->bins[i] == 0) continue;
+		out = sketch_put_varint(out, written_pairs ? i - previous : i);
+		out = sketch_put_varint(out, sketch->bins[i]);
+		previous = i;
+		written_pairs++;
+	}
+
+	return ERROR_SUCCESS;
+}
+
+// Add a serialised sketch into into, nothing is touched unless all of it checks out
+static DWORD sketch_merge_serialized(ping_sketch_t* into, const BYTE* data, DWORD size) {
+	DWORD magic, accuracy_ppm, pairs;
+	ULONGLONG count, min_rtt_ns, max_rtt_ns, sum_rtt_ns;
+
+	if (size < 48) {
+		return ERROR_INVALID_DATA;
+	}
+
+	memcpy(&magic, data + 0, 4);
+	memcpy(&accuracy_ppm, data + 8, 4);
+	memcpy(&count, data + 12, 8);
+	memcpy(&min_rtt_ns, data + 20, 8);
+	memcpy(&max_rtt_ns, data + 28, 8);
+	memcpy(&sum_rtt_ns, data + 36, 8);
+	memcpy(&pairs, data + 44, 4);
+
+	if (magic != SKETCH_MAGIC || data[4] != SKETCH_VERSION || pairs > PING_SKETCH_BINS) {
+		return ERROR_INVALID_DATA;
+	}
+	// Bins only line up between sketches of the same accuracy
+	if (accuracy_ppm != SKETCH_ACCURACY_PPM || (into->accuracy_ppm != 0 && into->accuracy_ppm != accuracy_ppm)) {
+		return ERROR_NOT_SUPPORTED;
+	}
+
+	// First pass checks, second pass adds
+	for (int pass = 0; pass < 2; pass++) {
+		const BYTE* in = data + 48;
+		const BYTE* end = data + size;
+		ULONGLONG index = 0, total = 0;
+
+		for (DWORD p = 0; p < pairs; p++) {
+			ULONGLONG gap, bin_count;
+			in = sketch_get_varint(in, end, &gap);
+			if (!in) return ERROR_INVALID_DATA;
+			in = sketch_get_varint(in, end, &bin_count);
+			if (!in) return ERROR_INVALID_DATA;
+
+			if (p > 0 && gap == 0) return ERROR_INVALID_DATA;
+			index += gap;
+			if (index >= PING_SKETCH_BINS || bin_count == 0) return ERROR_INVALID_DATA;
+
+			total += bin_count;
+			if (pass == 1) into->bins[index] += bin_count;
+		}
+
+		if (pass == 0 && (in != end || total != count)) {
+			return ERROR_INVALID_DATA;
+		}
+	}
+
+	into->accuracy_ppm = accuracy_ppm;
+	sketch_add(into, count, min_rtt_ns, max_rtt_ns, sum_rtt_ns);
+	return ERROR_SUCCESS;
+}
+
+#pragma endregion
+
+#pragma region Target_Statistics
+
+// Slot of addr, claimed when insert is set and the table has room, NULL otherwise
+static target_stats_entry_t* target_stats_slot(IPAddr addr, bool insert) {
+	if (addr == 0 || addr == INADDR_NONE) {
+		return NULL;
+	}
+
+	DWORD slot = ((DWORD)addr * 2654435761u) >> (32 - TARGET_STATS_BITS);
+	for (DWORD i = 0; i < TARGET_STATS_SLOTS; i++) {
+		target_stats_entry_t* entry = &g_target_stats.entries[slot];
+		LONG key = entry->addr;
+		if (key == (LONG)addr) {
+			return entry;
+		}
+
+		if (key == 0) {
+			if (!insert) {
+				return NULL;
+			}
+			if (g_target_stats.entry_count >= TARGET_STATS_MAX) {
+				InterlockedIncrement64(&g_target_stats.untracked);
+				return NULL;
+			}
+
+			// Keys are claimed without the stripe lock, a racing insert of the same address wins the same slot
+			LONG prior = InterlockedCompareExchange(&entry->addr, (LONG)addr, 0);
+			if (prior == 0) {
+				// Marked after the claim, one racing a reset is left for the next one to clear
+				DWORD block = slot / TARGET_STATS_BLOCK;
+				InterlockedOr(&g_target_stats.dirty[block / 32], (LONG)(1u << (block % 32)));
+				InterlockedIncrement(&g_target_stats.entry_count);
+				return entry;
+			}
+			if (prior == (LONG)addr) {
+				return entry;
+			}
+		}
+
+		slot = (slot + 1) & (TARGET_STATS_SLOTS - 1);
+	}
+
+	return NULL;
+}
+
+static SRWLOCK* target_stats_lock(const target_stats_entry_t* entry) {
+	return &g_target_stats.locks[(entry - g_target_stats.entries) & (TARGET_STATS_LOCKS - 1)];
+}
+
+// Series number index, its slab allocated on first use, NULL if that fails
+static target_series_t* target_series_get(DWORD index) {
+	target_series_t* slab = g_target_stats.series_slabs[index / SERIES_SLAB_TARGETS];
+	if (!slab) {
+		target_series_t* fresh = (target_series_t*)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(target_series_t) * SERIES_SLAB_TARGETS);
+		if (!fresh) {
+			return NULL;
+		}
+
+		slab = (target_series_t*)InterlockedCompareExchangePointer((PVOID volatile*)&g_target_stats.series_slabs[index / SERIES_SLAB_TARGETS], fresh, NULL);
+		if (slab) {
+			HeapFree(GetProcessHeap(), 0, fresh);
+		}
+		else {
+			slab = fresh;
+		}
+	}
+
+	return &slab[index % SERIES_SLAB_TARGETS];
+}
+
+// Series of the target in slot if it has one, without allocating
+static target_series_t* target_series_find(DWORD slot) {
+	DWORD index = g_target_stats.histogram_of[slot];
+	if (!index) {
+		return NULL;
+	}
+
+	target_series_t* slab = g_target_stats.series_slabs[(index - 1) / SERIES_SLAB_TARGETS];
+	return slab ? &slab[(index - 1) % SERIES_SLAB_TARGETS] : NULL;
+}
+
+static void target_series_free(void) {
+	for (int i = 0; i < SERIES_MAX_SLABS; i++) {
+		target_series_t* slab = (target_series_t*)InterlockedExchangePointer((PVOID volatile*)&g_target_stats.series_slabs[i], NULL);
+		if (slab) HeapFree(GetProcessHeap(), 0, slab);
+	}
+}
+
+// Pack a result for storage, RTT rounded to the microsecond and the status to one byte
+static void probe_record_make(const ping_result_ex_t* result_ex, ULONGLONG send_ns, DWORD target, ping_record_t* record) {
+	memset(record, 0, sizeof(ping_record_t));
+	record->send_ns = send_ns & PING_RECORD_SEND_MASK;
+	record->target = target;
+	record->epoch = (DWORD)g_target_stats.resets & TARGET_STATS_EPOCH_MASK;
+	if (result_ex->base.success) {
+		ULONGLONG rtt_us = (result_ex->rtt_ns + 500) / 1000;
+		record->status = PING_RECORD_OK;
+		record->rtt_us = rtt_us > MAXDWORD ? MAXDWORD : (DWORD)rtt_us;
+	}
+	else if (result_ex->base.status > IP_STATUS_BASE && result_ex->base.status < IP_STATUS_BASE + PING_RECORD_OTHER) {
+		record->status = result_ex->base.status - IP_STATUS_BASE;
+	}
+	else {
+		record->status = PING_RECORD_OTHER;
+	}
+}
+
+// The API's result for a record, ERROR_NOT_FOUND with target_ip empty when its slot was reset since
+static DWORD probe_record_result(const ping_record_t* record, ping_result_ex_t* result_ex) {
+	memset(result_ex, 0, sizeof(ping_result_ex_t));
+	ping_result_t* result = &result_ex->base;
+	result->success = record->status == PING_RECORD_OK;
+	result->status = result->success ? IP_SUCCESS : record->status == PING_RECORD_OTHER ? IP_GENERAL_FAILURE : IP_STATUS_BASE + (DWORD)record->status;
+	result_ex->send_time_ns = record->send_ns;
+	if (result->success) {
+		result_ex->rtt_ns = (ULONGLONG)record->rtt_us * 1000ULL;
+		result_ex->recv_time_ns = result_ex->send_time_ns + result_ex->rtt_ns;
+		result->rtt_ms = record->rtt_us / 1000;
+	}
+
+	// Wall clock of the send, back from now by the monotonic time since
+	ULONGLONG now_ns = monotonic_ns() & PING_RECORD_SEND_MASK;
+	ULONGLONG age_ns = now_ns > result_ex->send_time_ns ? now_ns - result_ex->send_time_ns : 0;
+	FILETIME now;
+	GetSystemTimeAsFileTime(&now);
+	ULARGE_INTEGER at;
+	at.LowPart = now.dwLowDateTime;
+	at.HighPart = now.dwHighDateTime;
+	at.QuadPart -= age_ns / 100;
+	now.dwLowDateTime = at.LowPart;
+	now.dwHighDateTime = at.HighPart;
+	FileTimeToSystemTime(&now, &result->timestamp);
+
+	// The slot may have gone to another address since, only the epoch tells
+	bool current = record->epoch == ((DWORD)g_target_stats.resets & TARGET_STATS_EPOCH_MASK);
+	LONG addr = current ? g_target_stats.entries[record->target].addr : 0;
+	if (!addr) {
+		return ERROR_NOT_FOUND;
+	}
+
+	IN_ADDR in_addr;
+	in_addr.s_addr = (ULONG)addr;
+	inet_ntop(AF_INET, &in_addr, result->target_ip, sizeof(result->target_ip));
+	return ERROR_SUCCESS;
+}
+
+// |D| between two replies as RFC 3550 defines it
+static DWORD health_delta(DWORD rtt_us, DWORD prev_rtt_us) {
+	return rtt_us > prev_rtt_us ? rtt_us - prev_rtt_us : prev_rtt_us - rtt_us;
+}
+
+static void health_window_add(health_window_t* window, const ping_record_t* record, DWORD delta_us) {
+	window->samples++;
+	if (record->status != PING_RECORD_OK) {
+		window->lost++;
+	}
+	else {
+		window->rtt_sum_us += record->rtt_us;
+		window->rtt_sum_sq_us += (ULONGLONG)record->rtt_us * record->rtt_us;
+	}
+	if (delta_us != HEALTH_NO_DELTA) {
+		window->deltas++;
+		window->delta_sum_us += delta_us;
+	}
+}
+
+// Take the oldest sample out of window, its delta is taken again from the reply before it
+static void health_window_drop(health_window_t* window, const target_ring_t* ring) {
+	const ping_record_t* record = &ring->records[window->tail];
+	window->samples--;
+	if (record->status != PING_RECORD_OK) {
+		window->lost--;
+	}
+	else {
+		window->rtt_sum_us -= record->rtt_us;
+		window->rtt_sum_sq_us -= (ULONGLONG)record->rtt_us * record->rtt_us;
+		if (window->has_prev) {
+			window->deltas--;
+			window->delta_sum_us -= health_delta(record->rtt_us, window->prev_rtt_us);
+		}
+		window->prev_rtt_us = record->rtt_us;
+		window->has_prev = true;
+	}
+	if (++window->tail == HEALTH_RING_SAMPLES) window->tail = 0;
+}
+
+// Append a record, every window gains it and sheds what fell out of its span, O(1) amortised
+static void target_ring_record(target_ring_t* ring, const ping_record_t* record) {
+	config_ref_t ref;
+	const ping_config_t* config = config_acquire(&ref);
+	const DWORD spans[HEALTH_WINDOWS] = { config->short_window_ms, config->long_window_ms };
+	config_release(&ref);
+
+	// The reply before this record, a window starting here takes its first delta against it
+	DWORD prev_rtt_us = ring->last_rtt_us;
+	bool has_prev = ring->has_last;
+	DWORD delta_us = HEALTH_NO_DELTA;
+	if (record->status == PING_RECORD_OK) {
+		if (has_prev) delta_us = health_delta(record->rtt_us, prev_rtt_us);
+		ring->last_rtt_us = record->rtt_us;
+		ring->has_last = true;
+	}
+
+	// A full ring overwrites its oldest record, windows still holding it let go first
+	if (ring->size == HEALTH_RING_SAMPLES) {
+		for (int w = 0; w < HEALTH_WINDOWS; w++) {
+			if (ring->windows[w].samples > 0 && ring->windows[w].tail == ring->head) {
+				health_window_drop(&ring->windows[w], ring);
+			}
+		}
+	}
+	else {
+		ring->size++;
+	}
+
+	// Bumped first, a view reading the slot concurrently sees the count move past it
+	InterlockedIncrement64(&ring->generation);
+	ring->records[ring->head] = *record;
+	for (int w = 0; w < HEALTH_WINDOWS; w++) {
+		health_window_t* window = &ring->windows[w];
+		if (window->samples == 0) {
+			window->tail = ring->head;
+			window->prev_rtt_us = prev_rtt_us;
+			window->has_prev = has_prev;
+		}
+		health_window_add(window, record, delta_us);
+
+		// Signed, a result recorded out of order must not age out everything
+		while (window->samples > 0 &&
+			(LONGLONG)((ULONGLONG)record->send_ns - (ULONGLONG)ring->records[window->tail].send_ns) > (LONGLONG)spans[w] * 1000000LL) {
+			health_window_drop(window, ring);
+		}
+	}
+
+	if (++ring->head == HEALTH_RING_SAMPLES) ring->head = 0;
+}
+
+// A window is capped at the ring's HEALTH_RING_SAMPLES records, one that fills the ring
+// reports the span those records cover rather than the configured one
+static DWORD health_window_span_ms(const target_ring_t* ring, const health_window_t* window, DWORD span_ms) {
+	if (window->samples < HEALTH_RING_SAMPLES) {
+		return span_ms;
+	}
+
+	WORD newest = ring->head ? ring->head - 1 : HEALTH_RING_SAMPLES - 1;
+	ULONGLONG covered_ns = ((ULONGLONG)ring->records[newest].send_ns - (ULONGLONG)ring->records[window->tail].send_ns) & PING_RECORD_SEND_MASK;
+	DWORD covered_ms = (DWORD)(covered_ns / 1000000ULL);
+	return covered_ms < span_ms ? covered_ms : span_ms;
+}
+
+static void health_window_read(const health_window_t* window, DWORD window_ms, ping_window_stats_t* stats) {
+	memset(stats, 0, sizeof(ping_window_stats_t));
+	stats->window_ms = window_ms;
+	stats->samples = window->samples;
+	stats->lost = window->lost;
+	if (window->samples > 0) {
+		stats->loss_percent = (double)window->lost / window->samples * 100.0;
+	}
+
+	DWORD replies = (DWORD)window->samples - window->lost;
+	if (replies > 0) {
+		double mean_us = (double)window->rtt_sum_us / replies;
+		double variance_us = (double)window->rtt_sum_sq_us / replies - mean_us * mean_us;
+		stats->mean_rtt = mean_us / 1000.0;
+		stats->stddev_rtt = variance_us > 0.0 ? sqrt(variance_us) / 1000.0 : 0.0;
+	}
+	if (window->deltas > 0) {
+		stats->jitter = (double)window->delta_sum_us / window->deltas / 1000.0;
+	}
+}
+
+// Thresholds a target is past: loss on the short window catches an outage within seconds,
+// latency and jitter on the long window so a brief spike does not count
+static DWORD health_check(const ping_config_t* config, const ping_target_stats_t* stats) {
+	DWORD breached = 0;
+	const ping_window_stats_t* recent = &stats->short_window;
+	const ping_window_stats_t* sustained = &stats->long_window;
+
+	if (recent->samples >= HEALTH_MIN_SAMPLES && recent->loss_percent > config->loss_threshold) {
+		breached |= PING_BREACH_LOSS;
+	}
+	if (sustained->samples - sustained->lost >= HEALTH_MIN_SAMPLES) {
+		if (sustained->mean_rtt > config->latency_threshold) breached |= PING_BREACH_LATENCY;
+		if (sustained->jitter > config->jitter_threshold) breached |= PING_BREACH_JITTER;
+	}
+
+	return breached;
+}
+
+// One CUSUM step, the score restarts at zero and remembers when it last did
+static float change_score(float score, float llr, DWORD at_ms, DWORD* onset_ms) {
+	float next = score + llr;
+	if (next <= 0.0f) return 0.0f;
+	if (score == 0.0f) *onset_ms = at_ms;
+	return next > CHANGE_THRESHOLD ? CHANGE_THRESHOLD : next; // capped, a long outage takes no longer to recover from
+}
+
+static void change_alarm(change_detector_t* detector, WORD breach, DWORD at_ms, DWORD onset_ms) {
+	detector->flags |= breach;
+	detector->alarms++;
+	detector->detected_ms = at_ms;
+	detector->delay_ms = at_ms - onset_ms;
+}
+
+// Feed one probe outcome, O(1), returns the PING_BREACH_* bits that alarmed on it
+static DWORD change_detector_record(change_detector_t* detector, DWORD at_ms, bool success, ULONGLONG rtt_ns) {
+	WORD before = detector->flags;
+
+	// Loss: baseline p0 against p0 + CHANGE_LOSS_JUMP, the baseline only learns while nothing is suspected
+	float p0 = detector->loss_rate > CHANGE_LOSS_FLOOR ? detector->loss_rate : CHANGE_LOSS_FLOOR;
+	float p1 = p0 + CHANGE_LOSS_JUMP > 0.99f ? 0.99f : p0 + CHANGE_LOSS_JUMP;
+	float loss_llr = success ? logf((1.0f - p1) / (1.0f - p0)) : logf(p1 / p0);
+	detector->loss_score = change_score(detector->loss_score, loss_llr, at_ms, &detector->loss_onset_ms);
+	if (detector->loss_score == 0.0f) {
+		detector->loss_rate += ((success ? 0.0f : 1.0f) - detector->loss_rate) / 16.0f;
+	}
+	if (detector->loss_score < CHANGE_THRESHOLD / 2.0f) {
+		detector->flags &= ~PING_BREACH_LOSS;
+	}
+	else if (detector->loss_score >= CHANGE_THRESHOLD && !(detector->flags & PING_BREACH_LOSS)) {
+		change_alarm(detector, PING_BREACH_LOSS, at_ms, detector->loss_onset_ms);
+	}
+
+	if (success) {
+		// RTT: a shift of CHANGE_RTT_SHIFT deviations up, on a log scale so the spread is proportional,
+		// offset so microseconds of scheduling noise on a LAN or loopback target never add up to an alarm
+		float x = logf((float)(rtt_ns / 1000ULL) + CHANGE_RTT_OFFSET_US);
+		if (detector->warmup < CHANGE_WARMUP) {
+			detector->warmup++;
+			detector->rtt_mean += (x - detector->rtt_mean) / detector->warmup;
+			detector->rtt_dev += (fabsf(x - detector->rtt_mean) - detector->rtt_dev) / detector->warmup;
+		}
+		else {
+			float sigma = 1.25f * detector->rtt_dev; // mean deviation to standard deviation
+			if (sigma < CHANGE_RTT_DEV_FLOOR) sigma = CHANGE_RTT_DEV_FLOOR;
+			float z = (x - detector->rtt_mean) / sigma;
+			if (z > CHANGE_RTT_Z_CAP) z = CHANGE_RTT_Z_CAP;
+			detector->rtt_score = change_score(detector->rtt_score, CHANGE_RTT_SHIFT * z - CHANGE_RTT_SHIFT * CHANGE_RTT_SHIFT / 2.0f, at_ms, &detector->rtt_onset_ms);
+
+			// Learning only at a zero score would censor the baseline low, half the threshold is still quiet;
+			// after an alarm it learns slowly, a lasting shift becomes the new normal in a few hundred replies
+			float rate = 0.0f;
+			if (detector->flags & PING_BREACH_LATENCY) rate = 1.0f / 256.0f;
+			else if (detector->rtt_score < CHANGE_THRESHOLD / 2.0f) rate = 1.0f / 32.0f;
+			detector->rtt_dev += (fabsf(x - detector->rtt_mean) - detector->rtt_dev) * rate;
+			detector->rtt_mean += (x - detector->rtt_mean) * rate;
+			if (detector->rtt_score < CHANGE_THRESHOLD / 2.0f) {
+				detector->flags &= ~PING_BREACH_LATENCY;
+			}
+			else if (detector->rtt_score >= CHANGE_THRESHOLD && !(detector->flags & PING_BREACH_LATENCY)) {
+				change_alarm(detector, PING_BREACH_LATENCY, at_ms, detector->rtt_onset_ms);
+			}
+		}
+	}
+
+	return detector->flags & ~before;
+}
+
+// Fold a result into its target's entry, returns true on every 5th result of that target or a change alarm
+static bool target_stats_record(IPAddr addr, const ping_result_ex_t* result_ex) {
+	bool analysis_due = false;
+	SRWLOCK* lock = NULL;
+
+	__try {
+		// A reset between claiming the slot and locking it clears the key, look again once
+		for (int attempt = 0; attempt < 2; attempt++) {
+			target_stats_entry_t* entry = target_stats_slot(addr, true);
+			if (!entry) {
+				__leave;
+			}
+
+			lock = target_stats_lock(entry);
+			AcquireSRWLockExclusive(lock);
+			if (entry->addr != (LONG)addr) {
+				ReleaseSRWLockExclusive(lock);
+				lock = NULL;
+				continue;
+			}
+
+			// The first result gives the target a histogram and series, unless every one is taken
+			DWORD slot = (DWORD)(entry - g_target_stats.entries);
+			if (g_target_stats.histogram_of[slot] == 0 && g_target_stats.histograms_used < TARGET_STATS_MAX) {
+				LONG index = InterlockedIncrement(&g_target_stats.histograms_used);
+				if (index <= TARGET_STATS_MAX) g_target_stats.histogram_of[slot] = (DWORD)index;
+			}
+			target_series_t* series = g_target_stats.histogram_of[slot] ? target_series_get(g_target_stats.histogram_of[slot] - 1) : NULL;
+
+			// Windows run on the time the probe went out, results measured elsewhere bring their own
+			ULONGLONG at_ns = result_ex->send_time_ns ? result_ex->send_time_ns : monotonic_ns();
+			DWORD changed = 0;
+			if (series) {
+				ping_record_t record;
+				probe_record_make(result_ex, at_ns, slot, &record);
+				target_ring_record(&series->ring, &record);
+				changed = change_detector_record(&series->detector, (DWORD)(at_ns / 1000000ULL), result_ex->base.success, result_ex->rtt_ns);
+			}
+
+			entry->packets_sent++;
+			if (result_ex->base.success) {
+				// Only the compact min and max saturate, the sum, histogram and sketch see the full RTT
+				ULONGLONG rtt_ns = result_ex->rtt_ns;
+				DWORD rtt_capped = rtt_ns > MAXDWORD ? MAXDWORD : (DWORD)rtt_ns;
+				entry->packets_received++;
+				if (entry->packets_received == 1 || rtt_capped < entry->min_rtt_ns) entry->min_rtt_ns = rtt_capped;
+				if (rtt_capped > entry->max_rtt_ns) entry->max_rtt_ns = rtt_capped;
+				entry->rtt_sum_ns += rtt_ns;
+
+				if (g_target_stats.histogram_of[slot]) {
+					WORD* counts = g_target_stats.histograms[g_target_stats.histogram_of[slot] - 1].counts;
+					DWORD bucket = histogram_bucket(rtt_ns, TARGET_HIST_SUB_BITS, TARGET_HIST_UNIT_SHIFT, TARGET_HIST_BUCKETS);
+					if (++counts[bucket] == MAXWORD) {
+						for (int i = 0; i < TARGET_HIST_BUCKETS; i++) counts[i] >>= 1;
+					}
+				}
+				if (series) target_sketch_record(&series->sketch, rtt_ns);
+
+				// Same jitter estimate as the global statistics
+				if (entry->packets_received > 1) {
+					double avg_rtt = (double)entry->rtt_sum_ns / (double)entry->packets_received / 1000000.0;
+					double diff = (double)rtt_ns / 1000000.0 - avg_rtt;
+					entry->jitter = (float)((entry->jitter * 0.9) + (fabs(diff) * 0.1));
+				}
+			}
+
+			analysis_due = changed != 0 || entry->packets_sent % 5 == 0;
+			__leave;
+		}
+	}
+	__finally {
+		if (lock) ReleaseSRWLockExclusive(lock);
+	}
+
+	return analysis_due;
+}
+
+// Snapshot of one target and its RTT histogram, false when nothing was recorded for it
+static bool target_stats_read(IPAddr addr, ping_target_stats_t* stats, ping_rtt_histogram_t* histogram) {
+	bool found = false;
+	SRWLOCK* lock = NULL;
+
+	__try {
+		target_stats_entry_t* entry = target_stats_slot(addr, false);
+		if (!entry) {
+			__leave;
+		}
+
+		lock = target_stats_lock(entry);
+		AcquireSRWLockShared(lock);
+		if (entry->addr != (LONG)addr) {
+			__leave;
+		}
+
+		memset(histogram, 0, sizeof(ping_rtt_histogram_t));
+		histogram->sub_bucket_bits = TARGET_HIST_SUB_BITS;
+		histogram->unit_shift = TARGET_HIST_UNIT_SHIFT;
+		histogram->bucket_count = TARGET_HIST_BUCKETS;
+		if (entry->packets_received > 0) {
+			histogram->min_rtt_ns = entry->min_rtt_ns;
+			histogram->max_rtt_ns = entry->max_rtt_ns;
+		}
+
+		DWORD histogram_index = g_target_stats.histogram_of[entry - g_target_stats.entries];
+		if (histogram_index) {
+			const WORD* counts = g_target_stats.histograms[histogram_index - 1].counts;
+			for (int i = 0; i < TARGET_HIST_BUCKETS; i++) {
+				histogram->counts[i] = counts[i];
+				histogram->total_count += counts[i];
+			}
+		}
+
+		memset(stats, 0, sizeof(ping_target_stats_t));
+		IN_ADDR in_addr;
+		in_addr.s_addr = addr;
+		inet_ntop(AF_INET, &in_addr, stats->target_ip, sizeof(stats->target_ip));
+		stats->packets_sent = entry->packets_sent;
+		stats->packets_received = entry->packets_received;
+		stats->packets_lost = entry->packets_sent - entry->packets_received;
+		stats->min_rtt = entry->packets_received > 0 ? entry->min_rtt_ns / 1000000.0 : DBL_MAX;
+		stats->max_rtt = entry->max_rtt_ns / 1000000.0;
+		stats->avg_rtt = entry->packets_received > 0 ? (double)entry->rtt_sum_ns / entry->packets_received / 1000000.0 : 0.0;
+		stats->jitter = entry->jitter;
+		stats->rtt_p50 = histogram_percentile(histogram, 50.0) / 1000000.0;
+		stats->rtt_p99 = histogram_percentile(histogram, 99.0) / 1000000.0;
+		stats->rtt_p999 = histogram_percentile(histogram, 99.9) / 1000000.0;
+
+		config_ref_t ref;
+		const ping_config_t* config = config_acquire(&ref);
+		const target_series_t* series = target_series_find((DWORD)(entry - g_target_stats.entries));
+		if (series) {
+			const target_ring_t* ring = &series->ring;
+			health_window_read(&ring->windows[HEALTH_SHORT_WINDOW],
+				health_window_span_ms(ring, &ring->windows[HEALTH_SHORT_WINDOW], config->short_window_ms), &stats->short_window);
+			health_window_read(&ring->windows[HEALTH_LONG_WINDOW],
+				health_window_span_ms(ring, &ring->windows[HEALTH_LONG_WINDOW], config->long_window_ms), &stats->long_window);
+
+			const change_detector_t* detector = &series->detector;
+			float score = detector->rtt_score > detector->loss_score ? detector->rtt_score : detector->loss_score;
+			stats->change = detector->flags;
+			stats->change_confidence = 1.0 - exp(-(double)score);
+			stats->change_detected_ms = detector->detected_ms;
+			stats->change_delay_ms = detector->delay_ms;
+			stats->change_alarms = detector->alarms;
+		}
+		stats->degraded = (health_check(config, stats) | stats->change) != 0;
+		config_release(&ref);
+		found = true;
+	}
+	__finally {
+		if (lock) ReleaseSRWLockShared(lock);
+	}
+
+	return found;
+}
+
+// Add the window of the target in slot into sketch, the slot's stripe lock is held
+static void target_sketch_add(ping_sketch_t* sketch, DWORD slot) {
+	const target_stats_entry_t* entry = &g_target_stats.entries[slot];
+	const target_series_t* series = target_series_find(slot);
+	if (!series || entry->packets_received == 0) {
+		return;
+	}
+
+	const target_sketch_t* window = &series->sketch;
+	ULONGLONG count = 0;
+	for (DWORD i = 0; i < SKETCH_TARGET_BINS; i++) {
+		sketch->bins[window->offset + i] += window->bins[i];
+		count += window->bins[i];
+	}
+	sketch_add(sketch, count, entry->min_rtt_ns, entry->max_rtt_ns, entry->rtt_sum_ns);
+}
+
+// Sketch of one target, false when nothing was recorded for it
+static bool target_sketch_read(IPAddr addr, ping_sketch_t* sketch) {
+	bool found = false;
+	SRWLOCK* lock = NULL;
+
+	__try {
+		target_stats_entry_t* entry = target_stats_slot(addr, false);
+		if (!entry) {
+			__leave;
+		}
+
+		lock = target_stats_lock(entry);
+		AcquireSRWLockShared(lock);
+		if (entry->addr != (LONG)addr) {
+			__leave;
+		}
+
+		sketch_init(sketch);
+		target_sketch_add(sketch, (DWORD)(entry - g_target_stats.entries));
+		found = true;
+	}
+	__finally {
+		if (lock) ReleaseSRWLockShared(lock);
+	}
+
+	return found;
+}
+
+// Every target's sketch in one, a walk over the whole table
+static void target_sketch_read_all(ping_sketch_t* sketch) {
+	sketch_init(sketch);
+
+	for (DWORD slot = 0; slot < TARGET_STATS_SLOTS; slot++) {
+		if (g_target_stats.histogram_of[slot] == 0) {
+			continue;
+		}
+
+		SRWLOCK* lock = target_stats_lock(&g_target_stats.entries[slot]);
+		AcquireSRWLockShared(lock);
+		target_sketch_add(sketch, slot);
+		ReleaseSRWLockShared(lock);
+	}
+}
+
+// Loss, RTT and jitter of the target's samples sent at or after since_ns, a walk back from the newest
+static bool target_stats_since(IPAddr addr, ULONGLONG since_ns, ping_window_stats_t* stats) {
+	bool found = false;
+	SRWLOCK* lock = NULL;
+
+	__try {
+		target_stats_entry_t* entry = target_stats_slot(addr, false);
+		if (!entry) {
+			__leave;
+		}
+
+		lock = target_stats_lock(entry);
+		AcquireSRWLockShared(lock);
+		const target_series_t* series = entry->addr == (LONG)addr ? target_series_find((DWORD)(entry - g_target_stats.entries)) : NULL;
+		if (!series) {
+			__leave;
+		}
+
+		// Walking back each reply's delta comes from the next older one, past since only to close the last
+		health_window_t window = { 0 };
+		const target_ring_t* ring = &series->ring;
+		ULONGLONG since = since_ns & PING_RECORD_SEND_MASK;
+		ULONGLONG oldest_ns = since;
+		DWORD newer_rtt_us = 0;
+		bool newer = false;
+		WORD at = ring->head;
+		for (WORD n = 0; n < ring->size; n++) {
+			at = at ? at - 1 : HEALTH_RING_SAMPLES - 1;
+			const ping_record_t* record = &ring->records[at];
+			bool inside = (LONGLONG)((ULONGLONG)record->send_ns - since) >= 0;
+			if (inside) {
+				health_window_add(&window, record, HEALTH_NO_DELTA);
+				oldest_ns = record->send_ns;
+			}
+			if (record->status == PING_RECORD_OK) {
+				if (newer) {
+					window.deltas++;
+					window.delta_sum_us += health_delta(newer_rtt_us, record->rtt_us);
+				}
+				newer_rtt_us = record->rtt_us;
+				newer = inside;
+			}
+			if (!inside && !newer) {
+				break;
+			}
+		}
+
+		// Every record of a full ring inside the span, the span reaches back only as far as the oldest
+		ULONGLONG reach_ns = window.samples == HEALTH_RING_SAMPLES ? oldest_ns : since;
+		health_window_read(&window, (DWORD)((((monotonic_ns() & PING_RECORD_SEND_MASK) - reach_ns) & PING_RECORD_SEND_MASK) / 1000000ULL), stats);
+		found = true;
+	}
+	__finally {
+		if (lock) ReleaseSRWLockShared(lock);
+	}
+
+	return found;
+}
+
+// View of the target's history ring, false when nothing was recorded for it
+static bool target_history_read(IPAddr addr, ping_history_t* history) {
+	bool found = false;
+	SRWLOCK* lock = NULL;
+
+	__try {
+		target_stats_entry_t* entry = target_stats_slot(addr, false);
+		if (!entry) {
+			__leave;
+		}
+
+		lock = target_stats_lock(entry);
+		AcquireSRWLockShared(lock);
+		const target_series_t* series = entry->addr == (LONG)addr ? target_series_find((DWORD)(entry - g_target_stats.entries)) : NULL;
+		if (!series) {
+			__leave;
+		}
+
+		// Head, size and generation move together under the stripe lock, the records are left where they are
+		const target_ring_t* ring = &series->ring;
+		history->records = ring->records;
+		history->capacity = HEALTH_RING_SAMPLES;
+		history->first = (ring->head + HEALTH_RING_SAMPLES - ring->size) % HEALTH_RING_SAMPLES;
+		history->count = ring->size;
+		history->generation = ring->generation;
+		history->current = &ring->generation;
+		found = true;
+	}
+	__finally {
+		if (lock) ReleaseSRWLockShared(lock);
+	}
+
+	return found;
+}
+
+// Forget every target, recorders holding a slot find its key gone and claim a fresh one
+static void target_stats_reset(void) {
+	for (int i = 0; i < TARGET_STATS_LOCKS; i++) {
+		AcquireSRWLockExclusive(&g_target_stats.locks[i]);
+	}
+
+	// Untouched blocks are still zero, with few targets this is a few KiB rather than the whole table
+	for (int i = 0; i < TARGET_STATS_DIRTY_WORDS; i++) {
+		DWORD bits = (DWORD)InterlockedExchange(&g_target_stats.dirty[i], 0);
+		DWORD bit;
+		while (_BitScanForward(&bit, bits)) {
+			bits &= bits - 1;
+			DWORD first = ((DWORD)i * 32 + bit) * TARGET_STATS_BLOCK;
+			memset(&g_target_stats.entries[first], 0, sizeof(target_stats_entry_t) * TARGET_STATS_BLOCK);
+			memset(&g_target_stats.histogram_of[first], 0, sizeof(DWORD) * TARGET_STATS_BLOCK);
+		}
+	}
+	// Only histograms handed out since the last reset were touched
+	LONG used = g_target_stats.histograms_used;
+	if (used > TARGET_STATS_MAX) used = TARGET_STATS_MAX;
+	memset(g_target_stats.histograms, 0, sizeof(target_histogram_t) * (size_t)used);
+	// A series may go to another target, its generation moves a whole ring on so every view of it is stale
+	for (LONG i = 0; i < used; i += SERIES_SLAB_TARGETS) {
+		target_series_t* slab = g_target_stats.series_slabs[i / SERIES_SLAB_TARGETS];
+		for (int j = 0; slab && j < SERIES_SLAB_TARGETS; j++) {
+			LONG64 generation = InterlockedExchangeAdd64(&slab[j].ring.generation, HEALTH_RING_SAMPLES) + HEALTH_RING_SAMPLES;
+			memset(&slab[j], 0, sizeof(target_series_t));
+			InterlockedExchange64(&slab[j].ring.generation, generation);
+		}
+	}
+	InterlockedExchange(&g_target_stats.histograms_used, 0);
+	InterlockedExchange(&g_target_stats.entry_count, 0);
+	InterlockedExchange64(&g_target_stats.untracked, 0);
+	InterlockedIncrement(&g_target_stats.resets);
+
+	for (int i = TARGET_STATS_LOCKS - 1; i >= 0; i--) {
+		ReleaseSRWLockExclusive(&g_target_stats.locks[i]);
+	}
+}
+
+// Address a result was recorded under, INADDR_NONE when the target never resolved
+static IPAddr result_address(const ping_result_t* result) {
+	return result->target_ip[0] ? inet_addr(result->target_ip) : INADDR_NONE;
+}
+
+// Address a probe was sent to, INADDR_NONE when it never resolved
+static IPAddr probe_address(const ping_probe_t* probe) {
+	return (probe->resolved && probe->resolve_status == ERROR_SUCCESS) ? probe->addr : INADDR_NONE;
+}
+
+#pragma endregion
+
+#pragma region Resolver_Cache
+
+// FNV-1a over the lower-cased name, DNS names compare case-insensitively
+static ULONG resolver_hash(const char* hostname) {
+	ULONG hash = 2166136261u;
+	for (const unsigned char* p = (const unsigned char*)hostname; *p; p++) {
+		unsigned char c = *p;
+		if (c >= 'A' && c <= 'Z') c = (unsigned char)(c - 'A' + 'a');
+		hash ^= c;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+// Ask DNS for an A record, TTL is the shortest along the answer chain
+static DWORD resolver_query(const char* hostname, IPAddr* addr, DWORD* ttl_s) {
+	DWORD result = DNS_INFO_NO_RECORDS;
+	PDNS_RECORD records = NULL;
+	struct addrinfo* addrinfo_result = NULL;
+
+	__try {
+		InterlockedIncrement64(&g_resolver.lookups);
+
+		IP4_ARRAY servers = { 0 };
+		PIP4_ARRAY extra = NULL;
+		DWORD options = DNS_QUERY_STANDARD;
+		config_ref_t ref;
+		IPAddr resolver_addr = INADDR_NONE;
+		const ping_config_t* config = config_acquire(&ref);
+		if (strlen(config->resolver_dns) > 0) resolver_addr = inet_addr(config->resolver_dns);
+		config_release(&ref);
+		if (resolver_addr != INADDR_NONE) {
+			servers.AddrCount = 1;
+			servers.AddrArray[0] = resolver_addr;
+			extra = &servers;
+			options |= DNS_QUERY_BYPASS_CACHE;
+		}
+
+		DNS_STATUS status = DnsQuery_A(hostname, DNS_TYPE_A, options, extra, &records, NULL);
+		if (status == 0) {
+			DWORD ttl = RESOLVER_MAX_TTL_S;
+			for (PDNS_RECORD record = records; record; record = record->pNext) {
+				if (record->Flags.S.Section != DnsSectionAnswer) continue;
+
+				if (record->dwTtl < ttl) ttl = record->dwTtl;
+				if (record->wType == DNS_TYPE_A) {
+					*addr = record->Data.A.IpAddress;
+					*ttl_s = ttl;
+					result = ERROR_SUCCESS;
+					__leave;
+				}
+			}
+		}
+		else {
+			result = (DWORD)status;
+		}
+
+		// Names outside DNS (hosts file, NetBIOS, localhost) still resolve the way they always did
+		if (extra) {
+			__leave;
+		}
+
+		struct addrinfo hints = { 0 };
+		hints.ai_family = AF_INET;
+		hints.ai_socktype = SOCK_RAW;
+
+		if (getaddrinfo(hostname, NULL, &hints, &addrinfo_result) == 0) {
+			*addr = ((struct sockaddr_in*)addrinfo_result->ai_addr)->sin_addr.s_addr;
+			*ttl_s = RESOLVER_DEFAULT_TTL_S;
+			result = ERROR_SUCCESS;
+		}
+	}
+	__finally {
+		if (records) DnsRecordListFree(records, DnsFreeRecordList);
+		if (addrinfo_result) freeaddrinfo(addrinfo_result);
+	}
+
+	return result;
+}
+
+// Look the name up in its probe window, negative entries are hits too
+static bool resolver_cache_get(const char* hostname, ULONG hash, ULONGLONG now, IPAddr* addr, DWORD* status) {
+	bool found = false;
+	bool lock_held = false;
+
+	__try {
+		AcquireSRWLockShared(&g_resolver.lock);
+		lock_held = true;
+
+		for (DWORD i = 0; i < RESOLVER_PROBE_WINDOW; i++) {
+			const resolver_entry_t* entry = &g_resolver.entries[(hash + i) & (RESOLVER_CACHE_SLOTS - 1)];
+			if (entry->hash != hash || entry->expires_ns <= now || _stricmp(entry->name, hostname) != 0) {
+				continue;
+			}
+
+			*addr = entry->addr;
+			*status = entry->status;
+			found = true;
+			__leave;
+		}
+	}
+	__finally {
+		if (lock_held) ReleaseSRWLockShared(&g_resolver.lock);
+	}
+
+	return found;
+}
+
+// NXDOMAIN and NODATA are answers about the name, anything else may clear up on its own
+static bool resolver_status_negative(DWORD status) {
+	return status == DNS_ERROR_RCODE_NAME_ERROR || status == DNS_INFO_NO_RECORDS;
+}
+
+// Store an answer, replacing the same name, a free slot, or the entry closest to expiry
+static void resolver_cache_put(const char* hostname, ULONG hash, ULONGLONG now, IPAddr addr, DWORD status, DWORD ttl_s) {
+	bool lock_held = false;
+
+	__try {
+		if (status == ERROR_SUCCESS) {
+			if (ttl_s < RESOLVER_MIN_TTL_S) ttl_s = RESOLVER_MIN_TTL_S;
+			if (ttl_s > RESOLVER_MAX_TTL_S) ttl_s = RESOLVER_MAX_TTL_S;
+		}
+		else {
+			ttl_s = resolver_status_negative(status) ? RESOLVER_NEGATIVE_TTL_S : RESOLVER_TRANSIENT_TTL_S;
+		}
+
+		AcquireSRWLockExclusive(&g_resolver.lock);
+		lock_held = true;
+
+		resolver_entry_t* victim = NULL;
+		for (DWORD i = 0; i < RESOLVER_PROBE_WINDOW; i++) {
+			resolver_entry_t* entry = &g_resolver.entries[(hash + i) & (RESOLVER_CACHE_SLOTS - 1)];
+
+			if (entry->name[0] == '\0' || (entry->hash == hash && _stricmp(entry->name, hostname) == 0)) {
+				victim = entry;
+				break;
+			}
+			if (!victim || entry->expires_ns < victim->expires_ns) {
+				victim = entry;
+			}
+		}
+
+		if (victim->name[0] == '\0') {
+			g_resolver.entry_count++;
+		}
+		else if (victim->expires_ns > now && _stricmp(victim->name, hostname) != 0) {
+			InterlockedIncrement64(&g_resolver.evictions);
+		}
+
+		victim->hash = hash;
+		victim->addr = addr;
+		victim->status = status;
+		victim->expires_ns = now + (ULONGLONG)ttl_s * 1000000000ULL;
+		strncpy_s(victim->name, sizeof(victim->name), hostname, _TRUNCATE);
+	}
+	__finally {
+		if (lock_held) ReleaseSRWLockExclusive(&g_resolver.lock);
+	}
+}
+
+// Answer from a literal address or the cache without blocking, false on a miss
+static bool resolver_lookup_cached(const char* hostname, IPAddr* addr, DWORD* status) {
+	IN_ADDR literal;
+	if (inet_pton(AF_INET, hostname, &literal) == 1) {
+		*addr = literal.s_addr;
+		*status = ERROR_SUCCESS;
+		InterlockedIncrement64(&g_resolver.bypassed);
+		return true;
+	}
+
+	if (resolver_cache_get(hostname, resolver_hash(hostname), monotonic_ns(), addr, status)) {
+		InterlockedIncrement64(*status == ERROR_SUCCESS ? &g_resolver.hits : &g_resolver.negative_hits);
+		return true;
+	}
+
+	InterlockedIncrement64(&g_resolver.misses);
+	return false;
+}
+
+// Resolve and cache the answer, the caller already missed the cache
+static DWORD resolver_resolve(const char* hostname, IPAddr* addr) {
+	DWORD ttl_s = 0;
+	ULONGLONG now = monotonic_ns();
+
+	*addr = INADDR_NONE;
+	DWORD status = resolver_query(hostname, addr, &ttl_s);
+	resolver_cache_put(hostname, resolver_hash(hostname), now, *addr, status, ttl_s);
+
+	return status;
+}
+
+// Resolve through the cache, blocking on a miss
+static DWORD resolver_lookup(const char* hostname, IPAddr* addr) {
+	DWORD status = ERROR_SUCCESS;
+
+	if (resolver_lookup_cached(hostname, addr, &status)) {
+		return status;
+	}
+
+	return resolver_resolve(hostname, addr);
+}
+
+static DWORD resolver_thread_limit(void) {
+	config_ref_t ref;
+	DWORD threads = config_acquire(&ref)->resolver_threads;
+	config_release(&ref);
+	if (threads < 1) return 1;
+	if (threads > RESOLVER_MAX_THREADS) return RESOLVER_MAX_THREADS;
+	return threads;
+}
+
+// Hand resolved probes back to the engine, they re-enter as ordinary submissions
+// Batch probes stay with their caller, the last one answered releases it
+static void resolver_deliver(ping_probe_t* waiters, IPAddr addr, DWORD status) {
+	bool wake = false;
+
+	while (waiters) {
+		ping_probe_t* probe = waiters;
+		waiters = waiters->next;
+
+		probe->addr = addr;
+		probe->resolve_status = status;
+		probe->resolved = true;
+
+		if (probe->lookups) {
+			resolver_batch_t* lookups = probe->lookups;
+			if (InterlockedDecrement(&lookups->outstanding) == 0) {
+				SetEvent(lookups->done);
+			}
+			continue;
+		}
+
+		InterlockedDecrement(&g_engine.resolving);
+		if (InterlockedPushEntrySList(&g_engine.submissions, &probe->entry) == NULL) {
+			wake = true;
+		}
+	}
+
+	if (wake) {
+		InterlockedIncrement64(&g_engine.engine_calls);
+		SetEvent(g_engine.wake_event);
+	}
+}
+
+static DWORD WINAPI resolver_thread_proc(LPVOID param) {
+	UNREFERENCED_PARAMETER(param);
+
+	__try {
+		for (;;) {
+			AcquireSRWLockExclusive(&g_resolver_pool.lock);
+			while (!g_resolver_pool.stop &&
+				(!g_resolver_pool.queue_head || g_resolver_pool.active >= resolver_thread_limit())) {
+				SleepConditionVariableSRW(&g_resolver_pool.work_ready, &g_resolver_pool.lock, INFINITE, 0);
+			}
+
+			resolver_request_t* request = g_resolver_pool.queue_head;
+			if (!request) {
+				// Stopping and nothing left to cancel
+				ReleaseSRWLockExclusive(&g_resolver_pool.lock);
+				break;
+			}
+
+			g_resolver_pool.queue_head = request->next;
+			if (!g_resolver_pool.queue_head) g_resolver_pool.queue_tail = NULL;
+			g_resolver_pool.active++;
+			bool cancelled = g_resolver_pool.stop;
+			ReleaseSRWLockExclusive(&g_resolver_pool.lock);
+
+			IPAddr addr = INADDR_NONE;
+			DWORD status = cancelled ? ERROR_CANCELLED : resolver_resolve(request->name, &addr);
+
+			// Once out of the in-flight table no more waiters can join
+			AcquireSRWLockExclusive(&g_resolver_pool.lock);
+			resolver_request_t** link = &g_resolver_pool.inflight[request->hash & (RESOLVER_INFLIGHT_BUCKETS - 1)];
+			while (*link != request) link = &(*link)->chain;
+			*link = request->chain;
+			g_resolver_pool.active--;
+			ReleaseSRWLockExclusive(&g_resolver_pool.lock);
+			WakeConditionVariable(&g_resolver_pool.work_ready);
+
+			resolver_deliver(request->waiters, addr, status);
+			HeapFree(GetProcessHeap(), 0, request);
+		}
+	}
+	__finally {
+		// Nothing to cleanup here
+	}
+
+	return 0;
+}
+
+// Park a probe until its name resolves, probes for a name already being looked up join that lookup
+static void resolver_submit(ping_probe_t* probe) {
+	bool lock_held = false;
+	ping_probe_t* failed = NULL;
+	DWORD failed_status = ERROR_NOT_ENOUGH_MEMORY;
+
+	__try {
+		ULONG hash = resolver_hash(probe->target);
+		if (!probe->lookups) InterlockedIncrement(&g_engine.resolving);
+
+		AcquireSRWLockExclusive(&g_resolver_pool.lock);
+		lock_held = true;
+
+		// No worker would ever pick it up
+		if (g_resolver_pool.stop) {
+			probe->next = NULL;
+			failed = probe;
+			failed_status = ERROR_CANCELLED;
+			__leave;
+		}
+
+		resolver_request_t** bucket = &g_resolver_pool.inflight[hash & (RESOLVER_INFLIGHT_BUCKETS - 1)];
+		for (resolver_request_t* request = *bucket; request; request = request->chain) {
+			if (request->hash == hash && _stricmp(request->name, probe->target) == 0) {
+				probe->next = request->waiters;
+				request->waiters = probe;
+				InterlockedIncrement64(&g_resolver.coalesced);
+				__leave;
+			}
+		}
+
+		resolver_request_t* request = (resolver_request_t*)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(resolver_request_t));
+		if (!request) {
+			probe->next = NULL;
+			failed = probe;
+			__leave;
+		}
+
+		request->hash = hash;
+		strncpy_s(request->name, sizeof(request->name), probe->target, _TRUNCATE);
+		probe->next = NULL;
+		request->waiters = probe;
+		request->chain = *bucket;
+		*bucket = request;
+
+		if (g_resolver_pool.queue_tail) {
+			g_resolver_pool.queue_tail->next = request;
+		}
+		else {
+			g_resolver_pool.queue_head = request;
+		}
+		g_resolver_pool.queue_tail = request;
+
+		// Threads are started as lookups queue up, never more than the limit allows
+		if (g_resolver_pool.thread_count < resolver_thread_limit()) {
+			HANDLE thread = CreateThread(NULL, 0, resolver_thread_proc, NULL, 0, NULL);
+			if (thread) {
+				g_resolver_pool.threads[g_resolver_pool.thread_count++] = thread;
+			}
+		}
+
+		WakeConditionVariable(&g_resolver_pool.work_ready);
+	}
+	__finally {
+		if (lock_held) ReleaseSRWLockExclusive(&g_resolver_pool.lock);
+		if (failed) resolver_deliver(failed, INADDR_NONE, failed_status);
+	}
+}
+
+static void resolver_pool_start(void) {
+	InitializeSRWLock(&g_resolver_pool.lock);
+	InitializeConditionVariable(&g_resolver_pool.work_ready);
+	g_resolver_pool.queue_head = NULL;
+	g_resolver_pool.queue_tail = NULL;
+	memset(g_resolver_pool.inflight, 0, sizeof(g_resolver_pool.inflight));
+	g_resolver_pool.thread_count = 0;
+	g_resolver_pool.active = 0;
+	g_resolver_pool.stop = false;
+}
+
+// Queued lookups are cancelled, the ones already on the wire are bounded by the system DNS timeout
+static void resolver_pool_stop(void) {
+	AcquireSRWLockExclusive(&g_resolver_pool.lock);
+	g_resolver_pool.stop = true;
+	ReleaseSRWLockExclusive(&g_resolver_pool.lock);
+	WakeAllConditionVariable(&g_resolver_pool.work_ready);
+
+	for (DWORD i = 0; i < g_resolver_pool.thread_count; i++) {
+		WaitForSingleObject(g_resolver_pool.threads[i], INFINITE);
+		CloseHandle(g_resolver_pool.threads[i]);
+		g_resolver_pool.threads[i] = NULL;
+	}
+	g_resolver_pool.thread_count = 0;
+}
+
+static void resolver_flush(void) {
+	AcquireSRWLockExclusive(&g_resolver.lock);
+	memset(g_resolver.entries, 0, sizeof(g_resolver.entries));
+	g_resolver.entry_count = 0;
+	ReleaseSRWLockExclusive(&g_resolver.lock);
+}
+
+#pragma endregion
+
+#pragma region Ping_Implementation
+
+// Perform single ping operation
+static bool perform_ping(const char* target, ping_result_ex_t* result_ex) {
+	int ping_result = 0;
+	LPVOID reply_buffer = NULL;
+	ping_result_t* result = &result_ex->base;
+
+	__try {
+		memset(result_ex, 0, sizeof(ping_result_ex_t));
+		GetSystemTime(&result->timestamp);
+
+		// Resolve target to IP if needed
+		char target_ip[16] = { 0 };
+		if (resolve_hostname(target, target_ip, sizeof(target_ip)) != ERROR_SUCCESS) {
+			result->success = false;
+			result->status = IP_DEST_HOST_UNREACHABLE;
+			__leave;
+		}
+
+		strncpy_s(result->target_ip, sizeof(result->target_ip), target_ip, _TRUNCATE);
+
+		// Convert IP string to address
+		ULONG dest_addr = inet_addr(target_ip);
+		if (dest_addr == INADDR_NONE) {
+			result->success = false;
+			result->status = IP_BAD_DESTINATION;
+			__leave;
+		}
+
+		// Allocate reply buffer
+		DWORD reply_size = sizeof(ICMP_ECHO_REPLY) + PING_DATA_SIZE;
+		reply_buffer = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, reply_size);
+		if (!reply_buffer) {
+			result->success = false;
+			result->status = IP_NO_RESOURCES;
+			__leave;
+		}
+
+		config_ref_t ref;
+		DWORD timeout_ms = config_acquire(&ref)->timeout_ms;
+		config_release(&ref);
+
+		// Perform the ping
+		result_ex->send_time_ns = monotonic_ns();
+		DWORD reply_count = IcmpSendEcho(
+			g_icmp_handle,
+			dest_addr,
+			g_ping_payload,
+			sizeof(g_ping_payload),
+			NULL,
+			reply_buffer,
+			reply_size,
+			timeout_ms
+		);
+		result_ex->recv_time_ns = monotonic_ns();
+
+		if (reply_count > 0) {
+			PICMP_ECHO_REPLY echo_reply = (PICMP_ECHO_REPLY)reply_buffer;
+			result->success = (echo_reply->Status == IP_SUCCESS);
+			result->status = echo_reply->Status;
+			result->rtt_ms = echo_reply->RoundTripTime;
+			set_rtt_ns(result_ex, echo_reply->RoundTripTime);
+		}
+		else {
+			result->success = false;
+			result->status = GetLastError();
+		}
+
+		ping_result = result->success ? 1 : 0;
+	}
+	__finally {
+		if (reply_buffer) {
+			HeapFree(GetProcessHeap(), 0, reply_buffer);
+		}
+	}
+
+	return ping_result != 0;
+}
+
+// Issue one asynchronous echo request, returns false if the probe completed without going pending
+static bool probe_start(ping_probe_t* probe, const char* target) {
+	int pending = 0;
+
+	__try {
+		ping_result_t* result = &probe->outcome.base;
+		memset(&probe->outcome, 0, sizeof(ping_result_ex_t));
+		GetSystemTime(&result->timestamp);
+
+		// The engine resolves ahead of time, batch callers resolve here
+		if (!probe->resolved) {
+			probe->resolve_status = resolver_lookup(target, &probe->addr);
+			probe->resolved = true;
+		}
+		if (probe->resolve_status != ERROR_SUCCESS) {
+			dbj_log(LOG_ERROR, "Name resolution failed for %s: %lu", target, probe->resolve_status);
+			result->status = IP_DEST_HOST_UNREACHABLE;
+			__leave;
+		}
+
+		IPAddr dest_addr = probe->addr;
+		if (dest_addr == INADDR_NONE) {
+			result->status = IP_BAD_DESTINATION;
+			__leave;
+		}
+
+		IN_ADDR dest_in_addr;
+		dest_in_addr.s_addr = dest_addr;
+		inet_ntop(AF_INET, &dest_in_addr, result->target_ip, sizeof(result->target_ip));
+
+		config_ref_t ref;
+		DWORD timeout_ms = config_acquire(&ref)->timeout_ms;
+		config_release(&ref);
+
+		// The reply is delivered as an APC to this thread once it waits alertably
+		probe->outcome.send_time_ns = monotonic_ns();
+		DWORD reply_count = IcmpSendEcho2(
+			g_icmp_handle,
+			NULL,
+			probe_apc_routine,
+			probe,
+			dest_addr,
+			g_ping_payload,
+			sizeof(g_ping_payload),
+			NULL,
+			probe->reply_buffer,
+			sizeof(probe->reply_buffer),
+			timeout_ms
+		);
+
+		if (reply_count == 0 && GetLastError() == ERROR_IO_PENDING) {
+			pending = 1;
+			__leave;
+		}
+
+		probe->outcome.recv_time_ns = monotonic_ns();
+		if (reply_count > 0) {
+			PICMP_ECHO_REPLY echo_reply = (PICMP_ECHO_REPLY)probe->reply_buffer;
+			result->success = (echo_reply->Status == IP_SUCCESS);
+			result->status = echo_reply->Status;
+			result->rtt_ms = echo_reply->RoundTripTime;
+			set_rtt_ns(&probe->outcome, echo_reply->RoundTripTime);
+		}
+		else {
+			result->status = GetLastError();
+		}
+	}
+	__finally {
+		// Nothing to cleanup here
+	}
+
+	return pending != 0;
+}
+
+// Completion of an asynchronous echo request, runs on the thread that issued it
+static void NTAPI probe_apc_routine(PVOID context, PIO_STATUS_BLOCK io_status, ULONG reserved) {
+	ping_probe_t* probe = (ping_probe_t*)context;
+
+	UNREFERENCED_PARAMETER(io_status);
+	UNREFERENCED_PARAMETER(reserved);
+
+	__try {
+		// Stamp first, everything after this is our own overhead
+		probe->outcome.recv_time_ns = monotonic_ns();
+
+		ping_result_t* result = &probe->outcome.base;
+		PICMP_ECHO_REPLY echo_reply = (PICMP_ECHO_REPLY)probe->reply_buffer;
+
+		if (IcmpParseReplies(probe->reply_buffer, sizeof(probe->reply_buffer)) > 0) {
+			result->success = (echo_reply->Status == IP_SUCCESS);
+			result->status = echo_reply->Status;
+			result->rtt_ms = echo_reply->RoundTripTime;
+			set_rtt_ns(&probe->outcome, echo_reply->RoundTripTime);
+		}
+		else {
+			result->success = false;
+			result->status = (echo_reply->Status != IP_SUCCESS) ? echo_reply->Status : IP_REQ_TIMED_OUT;
+		}
+	}
+	__finally {
+		InterlockedDecrement(probe->pending);
+		if (probe->on_complete) {
+			probe->on_complete(probe);
+		}
+	}
+}
+
+#pragma endregion
+
+#pragma region Probe_Engine
+
+// Take a probe from the free list, growing the pool by a slab when it runs dry
+static ping_probe_t* engine_acquire_probe(void) {
+	ping_probe_t* probe = NULL;
+	bool lock_held = false;
+
+	__try {
+		probe = (ping_probe_t*)InterlockedPopEntrySList(&g_engine.free_probes);
+		if (probe) {
+			__leave;
+		}
+
+		EnterCriticalSection(&g_cs);
+		lock_held = true;
+
+		// Another thread may have grown the pool while we waited
+		probe = (ping_probe_t*)InterlockedPopEntrySList(&g_engine.free_probes);
+		if (probe) {
+			__leave;
+		}
+
+		ping_probe_slab_t* slab = (ping_probe_slab_t*)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(ping_probe_slab_t));
+		if (!slab) {
+			__leave;
+		}
+
+		slab->next = g_engine.slabs;
+		g_engine.slabs = slab;
+
+		for (int i = 1; i < ENGINE_SLAB_PROBES; i++) {
+			InterlockedPushEntrySList(&g_engine.free_probes, &slab->probes[i].entry);
+		}
+		probe = &slab->probes[0];
+	}
+	__finally {
+		if (lock_held) LeaveCriticalSection(&g_cs);
+	}
+
+	return probe;
+}
+
+static void engine_release_probe(ping_probe_t* probe) {
+	InterlockedPushEntrySList(&g_engine.free_probes, &probe->entry);
+}
+
+static DWORD engine_batch_size(void) {
+	config_ref_t ref;
+	DWORD batch_size = config_acquire(&ref)->engine_batch_size;
+	config_release(&ref);
+	if (batch_size < 1) return 1;
+	if (batch_size > ENGINE_MAX_BATCH) return ENGINE_MAX_BATCH;
+	return batch_size;
+}
+
+static DWORD engine_scheduled_limit(void) {
+	config_ref_t ref;
+	DWORD limit = config_acquire(&ref)->scheduled_completions;
+	config_release(&ref);
+	return limit;
+}
+
+// Hand the staged completions to the caller-visible queue in one step
+// Scheduled completions past the limit are dropped oldest first, a caller that never drains costs nothing
+static void engine_publish_completions(void) {
+	ping_probe_t* dropped = NULL;
+	bool lock_held = false;
+
+	__try {
+		if (!g_engine.staged_head) {
+			__leave;
+		}
+
+		DWORD limit = engine_scheduled_limit();
+
+		AcquireSRWLockExclusive(&g_engine.completion_lock);
+		lock_held = true;
+
+		if (g_engine.completion_tail) {
+			g_engine.completion_tail->next = g_engine.staged_head;
+		}
+		else {
+			// The event is already signalled unless the queue was empty
+			g_engine.completion_head = g_engine.staged_head;
+			InterlockedIncrement64(&g_engine.engine_calls);
+			SetEvent(g_engine.completion_event);
+		}
+		g_engine.completion_tail = g_engine.staged_tail;
+		g_engine.scheduled_queued += g_engine.staged_scheduled;
+
+		g_engine.staged_head = NULL;
+		g_engine.staged_tail = NULL;
+		g_engine.staged_count = 0;
+		g_engine.staged_scheduled = 0;
+
+		// Submitted probes stay, their callers wait on the ticket
+		ping_probe_t** link = &g_engine.completion_head;
+		ping_probe_t* previous = NULL;
+		while (g_engine.scheduled_queued > limit && *link) {
+			ping_probe_t* probe = *link;
+			if (!probe->deadline_ns) {
+				previous = probe;
+				link = &probe->next;
+				continue;
+			}
+
+			*link = probe->next;
+			if (g_engine.completion_tail == probe) g_engine.completion_tail = previous;
+			probe->next = dropped;
+			dropped = probe;
+			g_engine.scheduled_queued--;
+			InterlockedIncrement64(&g_engine.scheduled_dropped);
+		}
+
+		if (!g_engine.completion_head) {
+			ResetEvent(g_engine.completion_event);
+		}
+	}
+	__finally {
+		if (lock_held) ReleaseSRWLockExclusive(&g_engine.completion_lock);
+
+		while (dropped) {
+			ping_probe_t* next = dropped->next;
+			engine_release_probe(dropped);
+			dropped = next;
+		}
+	}
+}
+
+// Start every submission queued since the last wake, in submission order
+static void engine_drain_submissions(void) {
+	__try {
+		PSLIST_ENTRY entries = InterlockedFlushSList(&g_engine.submissions);
+
+		// The SLIST hands entries back newest first
+		PSLIST_ENTRY ordered = NULL;
+		while (entries) {
+			PSLIST_ENTRY next = entries->Next;
+			entries->Next = ordered;
+			ordered = entries;
+			entries = next;
+		}
+
+		DWORD batch_size = engine_batch_size();
+		DWORD burst = 0;
+
+		while (ordered) {
+			ping_probe_t* probe = (ping_probe_t*)ordered;
+			ordered = ordered->Next;
+
+			// Back from the resolver a probe may carry an address or a lookup error, none of it was sent
+			if (g_engine.stop) {
+				memset(&probe->outcome, 0, sizeof(probe->outcome));
+				probe->outcome.base.status = ERROR_CANCELLED;
+				engine_complete_probe(probe);
+				continue;
+			}
+
+			// A cold name must not hold up the probes behind it
+			if (!probe->resolved) {
+				if (!resolver_lookup_cached(probe->target, &probe->addr, &probe->resolve_status)) {
+					resolver_submit(probe);
+					continue;
+				}
+				probe->resolved = true;
+			}
+
+			InterlockedIncrement(&g_engine.inflight);
+			InterlockedIncrement64(&g_engine.engine_calls);
+			bool started = probe_start(probe, probe->target);
+			if (probe->deadline_ns) {
+				schedule_record_send(probe);
+			}
+			if (!started) {
+				InterlockedDecrement(&g_engine.inflight);
+				engine_complete_probe(probe);
+			}
+
+			// Between bursts, collect whatever replies arrived meanwhile in one alertable call
+			if (++burst == batch_size && ordered) {
+				burst = 0;
+				InterlockedIncrement64(&g_engine.engine_calls);
+				SleepEx(0, TRUE);
+			}
+		}
+	}
+	__finally {
+		engine_publish_completions();
+	}
+}
+
+static DWORD WINAPI engine_thread_proc(LPVOID param) {
+	UNREFERENCED_PARAMETER(param);
+
+	__try {
+		// Alertable wait, so reply APCs for in-flight probes run here too
+		// One wait delivers every reply APC queued since the last one
+		while (!g_engine.stop || g_engine.inflight > 0 || g_engine.resolving > 0) {
+			InterlockedIncrement64(&g_engine.engine_calls);
+			WaitForSingleObjectEx(g_engine.wake_event, INFINITE, TRUE);
+			engine_publish_completions();
+			engine_drain_submissions();
+		}
+	}
+	__finally {
+		// Nothing to cleanup here
+	}
+
+	return 0;
+}
+
+// Stage a finished probe, staged completions are published once per burst
+static void engine_complete_probe(ping_probe_t* probe) {
+	__try {
+		InterlockedIncrement64(&g_engine.probes_completed);
+
+		// Judged here, scheduled targets must be analysed whether or not anyone drains their results
+		// A probe cancelled by engine_stop was never sent, it counts for nothing
+		if (probe->outcome.base.status != ERROR_CANCELLED) {
+			IPAddr addr = probe_address(probe);
+			if (record_ping_result(&probe->outcome, addr)) {
+				analyze_network_health(addr);
+			}
+		}
+
+		probe->next = NULL;
+		if (g_engine.staged_tail) {
+			g_engine.staged_tail->next = probe;
+		}
+		else {
+			g_engine.staged_head = probe;
+		}
+		g_engine.staged_tail = probe;
+		if (probe->deadline_ns) g_engine.staged_scheduled++;
+
+		if (++g_engine.staged_count >= engine_batch_size()) {
+			engine_publish_completions();
+		}
+	}
+	__finally {
+		// Nothing to cleanup here
+	}
+}
+
+static bool engine_start(void) {
+	int result = 0;
+
+	__try {
+		InitializeSListHead(&g_engine.submissions);
+		InitializeSListHead(&g_engine.free_probes);
+		InitializeSRWLock(&g_engine.completion_lock);
+		g_engine.slabs = NULL;
+		g_engine.completion_head = NULL;
+		g_engine.completion_tail = NULL;
+		g_engine.staged_head = NULL;
+		g_engine.staged_tail = NULL;
+		g_engine.staged_count = 0;
+		g_engine.staged_scheduled = 0;
+		g_engine.scheduled_queued = 0;
+		g_engine.scheduled_dropped = 0;
+		g_engine.inflight = 0;
+		g_engine.resolving = 0;
+		g_engine.stop = 0;
+		g_engine.probes_submitted = 0;
+		g_engine.probes_completed = 0;
+		g_engine.engine_calls = 0;
+		QueryPerformanceCounter(&g_engine.stats_start);
+
+		// Register the first slab up front so early submissions never allocate
+		ping_probe_t* probe = engine_acquire_probe();
+		if (!probe) {
+			dbj_log(LOG_ERROR, "Failed to allocate probe engine buffers");
+			__leave;
+		}
+		engine_release_probe(probe);
+
+		g_engine.wake_event = CreateEventA(NULL, FALSE, FALSE, NULL);
+		g_engine.completion_event = CreateEventA(NULL, TRUE, FALSE, NULL);
+		if (!g_engine.wake_event || !g_engine.completion_event) {
+			dbj_log(LOG_ERROR, "Failed to create probe engine events: %lu", GetLastError());
+			__leave;
+		}
+
+		resolver_pool_start();
+
+		g_engine.thread = CreateThread(NULL, 0, engine_thread_proc, NULL, 0, NULL);
+		if (!g_engine.thread) {
+			dbj_log(LOG_ERROR, "Failed to start probe engine thread: %lu", GetLastError());
+			__leave;
+		}
+
+		result = 1;
+	}
+	__finally {
+		if (!result) {
+			while (g_engine.slabs) {
+				ping_probe_slab_t* next = g_engine.slabs->next;
+				HeapFree(GetProcessHeap(), 0, g_engine.slabs);
+				g_engine.slabs = next;
+			}
+			if (g_engine.wake_event) CloseHandle(g_engine.wake_event);
+			if (g_engine.completion_event) CloseHandle(g_engine.completion_event);
+			g_engine.wake_event = NULL;
+			g_engine.completion_event = NULL;
+		}
+	}
+
+	return result != 0;
+}
+
+static void engine_stop(void) {
+	__try {
+		if (!g_engine.thread) {
+			__leave;
+		}
+
+		// Parked probes come back cancelled and have to be completed by the engine thread
+		resolver_pool_stop();
+
+		// The thread leaves once every in-flight probe has completed, each echo request completes or times out by itself.
+		// Not bounded: a reply APC still pending would write into the slabs freed below
+		InterlockedExchange(&g_engine.stop, 1);
+		SetEvent(g_engine.wake_event);
+		WaitForSingleObject(g_engine.thread, INFINITE);
+		CloseHandle(g_engine.thread);
+		g_engine.thread = NULL;
+
+		// The thread has exited, completions nobody drained live in the slabs, releasing those releases them too
+		g_engine.completion_head = NULL;
+		g_engine.completion_tail = NULL;
+		g_engine.staged_head = NULL;
+		g_engine.staged_tail = NULL;
+		g_engine.staged_count = 0;
+		InitializeSListHead(&g_engine.free_probes);
+
+		while (g_engine.slabs) {
+			ping_probe_slab_t* next = g_engine.slabs->next;
+			HeapFree(GetProcessHeap(), 0, g_engine.slabs);
+			g_engine.slabs = next;
+		}
+
+		CloseHandle(g_engine.wake_event);
+		CloseHandle(g_engine.completion_event);
+		g_engine.wake_event = NULL;
+		g_engine.completion_event = NULL;
+	}
+	__finally {
+		// Nothing to cleanup here
+	}
+}
+
+#pragma endregion
+
+#pragma region Probe_Scheduler
+
+// Engine thread only, right after the probe went out
+static void schedule_record_send(const ping_probe_t* probe) {
+	if (probe->outcome.send_time_ns < probe->deadline_ns) {
+		return;
+	}
+
+	LONG64 error_ns = (LONG64)(probe->outcome.send_time_ns - probe->deadline_ns);
+	InterlockedAdd64(&g_schedule.send_error_sum_ns, error_ns);
+	if (error_ns > g_schedule.send_error_max_ns) {
+		InterlockedExchange64(&g_schedule.send_error_max_ns, error_ns);
+	}
+	InterlockedIncrement64(&g_schedule.probes_sent);
+}
+
+// Hand one probe to the engine, it completes like any submitted probe
+static bool schedule_submit(const char* target, ULONGLONG deadline_ns) {
+	ping_probe_t* probe = engine_acquire_probe();
+	if (!probe) {
+		return false;
+	}
+
+	strncpy_s(probe->target, sizeof(probe->target), target, _TRUNCATE);
+	probe->next = NULL;
+	probe->ticket = (ULONGLONG)InterlockedIncrement64(&g_engine.next_ticket);
+	probe->pending = &g_engine.inflight;
+	probe->on_complete = engine_complete_probe;
+	probe->resolved = false;
+	probe->lookups = NULL;
+	probe->deadline_ns = deadline_ns;
+
+	InterlockedIncrement64(&g_engine.probes_submitted);
+
+	if (InterlockedPushEntrySList(&g_engine.submissions, &probe->entry) == NULL) {
+		InterlockedIncrement64(&g_engine.engine_calls);
+		SetEvent(g_engine.wake_event);
+	}
+
+	return true;
+}
+
+// First level 0 slot at or after from that holds entries
+static bool wheel_next_occupied(const timing_wheel_t* wheel, DWORD from, DWORD* slot) {
+	for (DWORD word = from >> 5; word < WHEEL_SLOTS / 32; word++) {
+		DWORD bits = wheel->occupied[word];
+		if (word == from >> 5) bits &= ~0u << (from & 31);
+
+		unsigned long bit;
+		if (_BitScanForward(&bit, bits)) {
+			*slot = word * 32 + bit;
+			return true;
+		}
+	}
+	return false;
+}
+
+// O(1): the level follows from how far away the deadline is, the slot from its tick bits
+static void wheel_insert(timing_wheel_t* wheel, schedule_entry_t* entry) {
+	ULONGLONG expires = entry->deadline_ns >> WHEEL_TICK_SHIFT;
+	if (expires < wheel->now_tick) expires = wheel->now_tick;
+
+	// Beyond the top level the entry parks at its far end and is placed again when that cascades
+	ULONGLONG delta = expires - wheel->now_tick;
+	if (delta >= 1ULL << (WHEEL_LEVEL_BITS * WHEEL_LEVELS)) {
+		delta = (1ULL << (WHEEL_LEVEL_BITS * WHEEL_LEVELS)) - 1;
+		expires = wheel->now_tick + delta;
+	}
+
+	int level = 0;
+	while (delta >= 1ULL << (WHEEL_LEVEL_BITS * (level + 1))) level++;
+
+	DWORD slot = (DWORD)(expires >> (WHEEL_LEVEL_BITS * level)) & WHEEL_SLOT_MASK;
+	entry->next = wheel->slots[level][slot];
+	wheel->slots[level][slot] = entry;
+	if (level == 0) {
+		wheel->occupied[slot >> 5] |= 1u << (slot & 31);
+	}
+	wheel->entries++;
+}
+
+// Fire every tick up to until_tick, due entries are appended to the expired chain in tick order
+static void wheel_advance(timing_wheel_t* wheel, ULONGLONG until_tick, schedule_entry_t*** expired_tail) {
+	while (wheel->now_tick <= until_tick) {
+		ULONGLONG tick = wheel->now_tick;
+		DWORD slot = (DWORD)tick & WHEEL_SLOT_MASK;
+
+		// On a level boundary the coarser slot that starts here moves down, coarsest first
+		if (slot == 0) {
+			for (int level = WHEEL_LEVELS - 1; level > 0; level--) {
+				if (tick & ((1ULL << (WHEEL_LEVEL_BITS * level)) - 1)) continue;
+
+				DWORD index = (DWORD)(tick >> (WHEEL_LEVEL_BITS * level)) & WHEEL_SLOT_MASK;
+				schedule_entry_t* list = wheel->slots[level][index];
+				wheel->slots[level][index] = NULL;
+				while (list) {
+					schedule_entry_t* next = list->next;
+					wheel->entries--;
+					wheel_insert(wheel, list);
+					list = next;
+				}
+			}
+		}
+
+		schedule_entry_t* due = wheel->slots[0][slot];
+		if (due) {
+			wheel->slots[0][slot] = NULL;
+			wheel->occupied[slot >> 5] &= ~(1u << (slot & 31));
+			**expired_tail = due;
+			while (due) {
+				wheel->entries--;
+				*expired_tail = &due->next;
+				due = due->next;
+			}
+		}
+
+		// Empty slots are skipped, but never past a rotation boundary, it may have cascading to do
+		DWORD next_slot;
+		ULONGLONG next_tick = wheel_next_occupied(wheel, slot + 1, &next_slot)
+			? tick - slot + next_slot
+			: (tick | WHEEL_SLOT_MASK) + 1;
+		wheel->now_tick = (next_tick > until_tick + 1) ? until_tick + 1 : next_tick;
+	}
+}
+
+// Tick the scheduler has to be awake for, the next occupied slot or the next cascade
+static ULONGLONG wheel_next_tick(const timing_wheel_t* wheel) {
+	DWORD slot = (DWORD)wheel->now_tick & WHEEL_SLOT_MASK;
+	DWORD next_slot;
+
+	if (wheel_next_occupied(wheel, slot, &next_slot)) {
+		return wheel->now_tick - slot + next_slot;
+	}
+	return (wheel->now_tick | WHEEL_SLOT_MASK) + 1;
+}
+
+// Take an entry from the free list, growing the table by a slab when it runs dry
+static schedule_entry_t* schedule_acquire_entry(void) {
+	schedule_entry_t* entry = NULL;
+	bool lock_held = false;
+
+	__try {
+		entry = (schedule_entry_t*)InterlockedPopEntrySList(&g_schedule.free_entries);
+		if (entry) {
+			__leave;
+		}
+
+		AcquireSRWLockExclusive(&g_schedule.table_lock);
+		lock_held = true;
+
+		entry = (schedule_entry_t*)InterlockedPopEntrySList(&g_schedule.free_entries);
+		if (entry || g_schedule.slab_count >= SCHEDULE_MAX_SLABS) {
+			__leave;
+		}
+
+		schedule_entry_t* slab = (schedule_entry_t*)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(schedule_entry_t) * SCHEDULE_SLAB_ENTRIES);
+		if (!slab) {
+			__leave;
+		}
+
+		DWORD base = g_schedule.slab_count * SCHEDULE_SLAB_ENTRIES;
+		g_schedule.slabs[g_schedule.slab_count++] = slab;
+
+		for (int i = 0; i < SCHEDULE_SLAB_ENTRIES; i++) {
+			slab[i].index = base + i;
+			slab[i].generation = 1;
+			if (i > 0) InterlockedPushEntrySList(&g_schedule.free_entries, &slab[i].entry);
+		}
+		entry = &slab[0];
+	}
+	__finally {
+		if (lock_held) ReleaseSRWLockExclusive(&g_schedule.table_lock);
+	}
+
+	return entry;
+}
+
+// The schedule stops counting as active, exactly once whether removed or run out
+static void schedule_retire(schedule_entry_t* entry) {
+	if (InterlockedExchange(&entry->cancelled, 1) == 0) {
+		InterlockedDecrement(&g_schedule.active);
+	}
+}
+
+// Scheduler thread only, the entry is out of the wheel
+static void schedule_release_entry(schedule_entry_t* entry) {
+	schedule_retire(entry);
+
+	// Ids handed out for this use go stale before the entry can be reused
+	AcquireSRWLockExclusive(&g_schedule.table_lock);
+	entry->generation++;
+	HeapFree(GetProcessHeap(), 0, entry->target);
+	entry->target = NULL;
+	ReleaseSRWLockExclusive(&g_schedule.table_lock);
+
+	InterlockedPushEntrySList(&g_schedule.free_entries, &entry->entry);
+}
+
+// Queue a target for the scheduler thread, it enters the wheel on the next wakeup
+static DWORD schedule_add(const char* target, ULONGLONG interval_ns, DWORD count, ULONGLONG start_ns, ULONGLONG* schedule_id) {
+	schedule_entry_t* entry = schedule_acquire_entry();
+	if (!entry) {
+		return ERROR_NOT_ENOUGH_MEMORY;
+	}
+
+	size_t length = strlen(target) + 1;
+	entry->target = (char*)HeapAlloc(GetProcessHeap(), 0, length);
+	if (!entry->target) {
+		InterlockedPushEntrySList(&g_schedule.free_entries, &entry->entry);
+		return ERROR_NOT_ENOUGH_MEMORY;
+	}
+	memcpy(entry->target, target, length);
+
+	entry->next = NULL;
+	entry->start_ns = start_ns;
+	entry->interval_ns = interval_ns;
+	entry->deadline_ns = start_ns;
+	entry->sequence = 0;
+	entry->count = count;
+	entry->cancelled = 0;
+
+	if (schedule_id) {
+		*schedule_id = ((ULONGLONG)entry->generation << 32) | entry->index;
+	}
+
+	InterlockedIncrement(&g_schedule.active);
+	if (InterlockedPushEntrySList(&g_schedule.additions, &entry->entry) == NULL) {
+		SetEvent(g_schedule.wake_event);
+	}
+
+	return ERROR_SUCCESS;
+}
+
+// Random offset into the first interval so targets added together do not fire together
+static ULONGLONG schedule_phase(ULONGLONG interval_ns) {
+	// splitmix64 over a shared counter, callers may add from any thread
+	ULONGLONG z = (ULONGLONG)InterlockedAdd64(&g_schedule.phase_seed, (LONG64)0x9E3779B97F4A7C15ULL);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	z ^= z >> 31;
+	return z % interval_ns;
+}
+
+// Move newly added targets into the wheel
+static void schedule_take_additions(void) {
+	PSLIST_ENTRY entries = InterlockedFlushSList(&g_schedule.additions);
+	if (!entries) {
+		return;
+	}
+
+	ULONGLONG begin = monotonic_ns();
+	LONG64 added = 0;
+	while (entries) {
+		schedule_entry_t* entry = (schedule_entry_t*)entries;
+		entries = entries->Next;
+		wheel_insert(&g_schedule.wheel, entry);
+		added++;
+	}
+
+	InterlockedAdd64(&g_schedule.add_ns, (LONG64)(monotonic_ns() - begin));
+	InterlockedAdd64(&g_schedule.targets_added, added);
+}
+
+// Send a due probe and put the target back in the wheel at its next deadline
+static void schedule_fire(schedule_entry_t* entry) {
+	if (entry->cancelled) {
+		schedule_release_entry(entry);
+		return;
+	}
+
+	// Only ticks already over are fired, every deadline in the batch has passed
+	if (!schedule_submit(entry->target, entry->deadline_ns)) {
+		dbj_log(LOG_ERROR, "Scheduled probe %llu to %s could not be allocated", entry->sequence, entry->target);
+	}
+	entry->sequence++;
+
+	if (entry->count != 0 && entry->sequence >= entry->count) {
+		schedule_release_entry(entry);
+		return;
+	}
+
+	ULONGLONG begin = monotonic_ns();
+
+	// After a stall (suspend, debugger) skip the slots already gone rather than sending a burst
+	ULONGLONG next_ns = entry->start_ns + entry->sequence * entry->interval_ns;
+	if (begin > next_ns + entry->interval_ns) {
+		ULONGLONG skipped = (begin - next_ns) / entry->interval_ns;
+		InterlockedAdd64(&g_schedule.deadlines_missed, (LONG64)skipped);
+		entry->sequence += skipped;
+		next_ns = entry->start_ns + entry->sequence * entry->interval_ns;
+	}
+
+	entry->deadline_ns = next_ns;
+	wheel_insert(&g_schedule.wheel, entry);
+
+	InterlockedAdd64(&g_schedule.timer_ns, (LONG64)(monotonic_ns() - begin));
+	InterlockedIncrement64(&g_schedule.timer_events);
+}
+
+// Sleep until the deadline, new additions or a stop request, false if stopped
+// A deadline of 0 waits for additions only
+static bool schedule_wait_until(ULONGLONG deadline_ns) {
+	ULONGLONG spin_ns = g_schedule.high_resolution ? SCHEDULE_SPIN_NS : 0;
+	ULONGLONG now = monotonic_ns();
+	HANDLE handles[3] = { g_schedule.stop_event, g_schedule.wake_event, g_schedule.timer };
+	DWORD handle_count = 2;
+
+	if (deadline_ns == 0 || deadline_ns > now + spin_ns) {
+		if (deadline_ns != 0) {
+			// Relative due time in 100 ns units, recomputed from the absolute deadline every wakeup
+			LARGE_INTEGER due;
+			due.QuadPart = -(LONGLONG)((deadline_ns - now - spin_ns) / 100);
+			SetWaitableTimer(g_schedule.timer, &due, 0, NULL, NULL, FALSE);
+			handle_count = 3;
+		}
+
+		DWORD wait = WaitForMultipleObjects(handle_count, handles, FALSE, INFINITE);
+		if (wait == WAIT_OBJECT_0) {
+			return false;
+		}
+		if (wait == WAIT_OBJECT_0 + 1) {
+			// New targets may be due before the deadline we were waiting for
+			return true;
+		}
+	}
+
+	// Timer resolution is far coarser than a microsecond, spin the final stretch
+	// The spin is scheduler overhead and is counted with the wheel upkeep
+	ULONGLONG begin = monotonic_ns();
+	while (begin < deadline_ns && monotonic_ns() < deadline_ns) {
+		YieldProcessor();
+	}
+	InterlockedAdd64(&g_schedule.timer_ns, (LONG64)(monotonic_ns() - begin));
+
+	return WaitForSingleObject(g_schedule.stop_event, 0) != WAIT_OBJECT_0;
+}
+
+static DWORD WINAPI schedule_thread_proc(LPVOID param) {
+	UNREFERENCED_PARAMETER(param);
+
+	__try {
+		// Ahead of ordinary work, but a short spin per tick never starves the rest of the process
+		SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_ABOVE_NORMAL);
+
+		timing_wheel_t* wheel = &g_schedule.wheel;
+		for (;;) {
+			schedule_take_additions();
+
+			ULONGLONG begin = monotonic_ns();
+			schedule_entry_t* expired = NULL;
+			schedule_entry_t** expired_tail = &expired;
+			wheel_advance(wheel, (begin >> WHEEL_TICK_SHIFT) - 1, &expired_tail);
+			*expired_tail = NULL;
+			InterlockedAdd64(&g_schedule.timer_ns, (LONG64)(monotonic_ns() - begin));
+
+			while (expired) {
+				schedule_entry_t* entry = expired;
+				expired = expired->next;
+				schedule_fire(entry);
+			}
+
+			// Wake as the next occupied tick ends and send all of it in one batch
+			ULONGLONG wake_ns = wheel->entries > 0 ? (wheel_next_tick(wheel) + 1) << WHEEL_TICK_SHIFT : 0;
+			if (!schedule_wait_until(wake_ns)) {
+				__leave;
+			}
+		}
+	}
+	__finally {
+		// Nothing to cleanup here
+	}
+
+	return 0;
+}
+
+static bool schedule_launch(void) {
+	int result = 0;
+
+	__try {
+		InitializeSListHead(&g_schedule.free_entries);
+		InitializeSListHead(&g_schedule.additions);
+		memset(&g_schedule.wheel, 0, sizeof(g_schedule.wheel));
+		g_schedule.wheel.now_tick = monotonic_ns() >> WHEEL_TICK_SHIFT;
+		g_schedule.slab_count = 0;
+		g_schedule.active = 0;
+		g_schedule.phase_seed = (LONG64)monotonic_ns();
+		g_schedule.start_ns = 0;
+		g_schedule.interval_ns = 0;
+		g_schedule.probes_sent = 0;
+		g_schedule.deadlines_missed = 0;
+		g_schedule.send_error_sum_ns = 0;
+		g_schedule.send_error_max_ns = 0;
+		g_schedule.timer_events = 0;
+		g_schedule.timer_ns = 0;
+		g_schedule.targets_added = 0;
+		g_schedule.add_ns = 0;
+
+		// High resolution timers need Windows 10 1803, older systems get the classic timer and no spin
+		g_schedule.timer = CreateWaitableTimerExA(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+		g_schedule.high_resolution = (g_schedule.timer != NULL);
+		if (!g_schedule.timer) {
+			g_schedule.timer = CreateWaitableTimerExA(NULL, NULL, 0, TIMER_ALL_ACCESS);
+		}
+		g_schedule.stop_event = CreateEventA(NULL, TRUE, FALSE, NULL);
+		g_schedule.wake_event = CreateEventA(NULL, FALSE, FALSE, NULL);
+		if (!g_schedule.timer || !g_schedule.stop_event || !g_schedule.wake_event) {
+			dbj_log(LOG_ERROR, "Failed to create scheduler timer and events: %lu", GetLastError());
+			__leave;
+		}
+
+		g_schedule.thread = CreateThread(NULL, 0, schedule_thread_proc, NULL, 0, NULL);
+		if (!g_schedule.thread) {
+			dbj_log(LOG_ERROR, "Failed to start scheduler thread: %lu", GetLastError());
+			__leave;
+		}
+
+		result = 1;
+	}
+	__finally {
+		if (!result) {
+			if (g_schedule.timer) CloseHandle(g_schedule.timer);
+			if (g_schedule.stop_event) CloseHandle(g_schedule.stop_event);
+			if (g_schedule.wake_event) CloseHandle(g_schedule.wake_event);
+			g_schedule.timer = NULL;
+			g_schedule.stop_event = NULL;
+			g_schedule.wake_event = NULL;
+		}
+	}
+
+	return result != 0;
+}
+
+// Stops the thread and drops every scheduled target
+static void schedule_stop(void) {
+	__try {
+		if (!g_schedule.thread) {
+			__leave;
+		}
+
+		SetEvent(g_schedule.stop_event);
+		WaitForSingleObject(g_schedule.thread, INFINITE);
+		CloseHandle(g_schedule.thread);
+		CloseHandle(g_schedule.timer);
+		CloseHandle(g_schedule.stop_event);
+		CloseHandle(g_schedule.wake_event);
+		g_schedule.thread = NULL;
+		g_schedule.timer = NULL;
+		g_schedule.stop_event = NULL;
+		g_schedule.wake_event = NULL;
+
+		// Entries in the wheel, queued or free all live in the slabs
+		for (DWORD i = 0; i < g_schedule.slab_count; i++) {
+			for (int j = 0; j < SCHEDULE_SLAB_ENTRIES; j++) {
+				if (g_schedule.slabs[i][j].target) HeapFree(GetProcessHeap(), 0, g_schedule.slabs[i][j].target);
+			}
+			HeapFree(GetProcessHeap(), 0, g_schedule.slabs[i]);
+			g_schedule.slabs[i] = NULL;
+		}
+		g_schedule.slab_count = 0;
+		InitializeSListHead(&g_schedule.free_entries);
+		InitializeSListHead(&g_schedule.additions);
+		memset(&g_schedule.wheel, 0, sizeof(g_schedule.wheel));
+		g_schedule.active = 0;
+	}
+	__finally {
+		// Nothing to cleanup here
+	}
+}
+
+#pragma endregion
+
+#pragma region Network_Health_Analysis
+
+// Analyze one target's health and trigger countermeasures if needed
+static void analyze_network_health(IPAddr addr) {
+	config_ref_t ref;
+	const ping_config_t* config = config_acquire(&ref);
+
+	__try {
+		if (!config->enable_countermeasures) {
+			__leave;
+		}
+
+		// Judged on its own recent windows, neither other targets nor its own distant past count
+		ping_target_stats_t stats;
+		ping_rtt_histogram_t histogram;
+		if (!target_stats_read(addr, &stats, &histogram)) {
+			__leave;
+		}
+
+		DWORD breached = health_check(config, &stats);
+
+		if (breached & PING_BREACH_LOSS) {
+			dbj_log(LOG_WARNING, "High packet loss to %s: %.1f%% over the last %lu ms (threshold: %lu%%)",
+				stats.target_ip, stats.short_window.loss_percent, stats.short_window.window_ms, config->loss_threshold);
+		}
+
+		if (breached & PING_BREACH_LATENCY) {
+			dbj_log(LOG_WARNING, "High latency to %s: %.1fms over the last %lu ms (threshold: %lums)",
+				stats.target_ip, stats.long_window.mean_rtt, stats.long_window.window_ms, config->latency_threshold);
+		}
+
+		if (breached & PING_BREACH_JITTER) {
+			dbj_log(LOG_WARNING, "High jitter to %s: %.1fms over the last %lu ms (threshold: %lums)",
+				stats.target_ip, stats.long_window.jitter, stats.long_window.window_ms, config->jitter_threshold);
+		}
+
+		// A change the thresholds have not caught yet, or never will on a target that runs well below them
+		DWORD changed = stats.change & ~breached;
+		if (changed) {
+			dbj_log(LOG_WARNING, "%s change to %s: %.5f confidence, detected %lu ms after onset",
+				(changed & PING_BREACH_LOSS) ? "Loss" : "Latency", stats.target_ip, stats.change_confidence, stats.change_delay_ms);
+			breached |= changed;
+		}
+
+		if (breached) {
+			trigger_countermeasures((LONG)breached, addr);
+		}
+	}
+	__finally {
+		config_release(&ref);
+	}
+}
+
+#pragma endregion
+
+#pragma region Countermeasures_Implementation
+
+// State as callers see it, a cooldown that has run out reads as idle
+static LONG countermeasure_state(void) {
+	LONG state = g_countermeasure.state;
+	if (state == PING_COUNTERMEASURE_COOLDOWN && monotonic_ns() >= (ULONGLONG)g_countermeasure.cooldown_until_ns) {
+		state = PING_COUNTERMEASURE_IDLE;
+	}
+	return state;
+}
+
+// Queue countermeasures for the worker, never blocks, a trigger while queued or running joins that run
+static void trigger_countermeasures(LONG reasons, IPAddr addr) {
+	__try {
+		InterlockedIncrement64(&g_countermeasure.triggers);
+
+		for (;;) {
+			LONG state = g_countermeasure.state;
+			if (state == PING_COUNTERMEASURE_QUEUED || state == PING_COUNTERMEASURE_RUNNING) {
+				// With several targets in trouble no single one can tell when it is over
+				if (g_countermeasure.target != (LONG)addr) InterlockedExchange(&g_countermeasure.target, 0);
+				InterlockedOr(&g_countermeasure.pending, reasons);
+				InterlockedIncrement64(&g_countermeasure.coalesced);
+				__leave;
+			}
+
+			if (countermeasure_state() == PING_COUNTERMEASURE_COOLDOWN) {
+				InterlockedIncrement64(&g_countermeasure.suppressed);
+				__leave;
+			}
+
+			// Reasons go in first, the worker takes them once it sees QUEUED
+			InterlockedExchange(&g_countermeasure.target, (LONG)addr);
+			InterlockedOr(&g_countermeasure.pending, reasons);
+			if (InterlockedCompareExchange(&g_countermeasure.state, PING_COUNTERMEASURE_QUEUED, state) == state) {
+				SetEvent(g_countermeasure.wake_event);
+				__leave;
+			}
+		}
+	}
+	__finally {
+		// Nothing to cleanup here
+	}
+}
+
+static void countermeasure_job_release(countermeasure_job_t* job) {
+	if (InterlockedDecrement(&job->refs) == 0) {
+		CloseHandle(job->done);
+		HeapFree(GetProcessHeap(), 0, job);
+	}
+}
+
+// Count a finished run against its registration, late runs after a timeout included
+static void countermeasure_job_finish(const countermeasure_job_t* job) {
+	countermeasure_entry_t* entry = &g_countermeasure_registry.entries[job->slot];
+	ULONGLONG elapsed_ns = job->end_ns - job->begin_ns;
+
+	AcquireSRWLockExclusive(&g_countermeasure_registry.lock);
+	if (entry->used && entry->generation == job->generation) {
+		entry->runs++;
+		if (job->status != NO_ERROR && job->status != ERROR_CANCELLED) entry->failures++;
+		entry->last_status = job->status;
+		entry->last_ns = elapsed_ns;
+		entry->last_end_ns = job->end_ns;
+		if (entry->runs == 1 || elapsed_ns < entry->min_ns) entry->min_ns = elapsed_ns;
+		if (elapsed_ns > entry->max_ns) entry->max_ns = elapsed_ns;
+		entry->execution_times[histogram_bucket(elapsed_ns, ACTION_HIST_SUB_BITS, ACTION_HIST_UNIT_SHIFT, ACTION_HIST_BUCKETS)]++;
+		entry->running = false;
+	}
+	ReleaseSRWLockExclusive(&g_countermeasure_registry.lock);
+}
+
+static VOID CALLBACK countermeasure_job_proc(PTP_CALLBACK_INSTANCE instance, PVOID param) {
+	UNREFERENCED_PARAMETER(instance);
+	countermeasure_job_t* job = (countermeasure_job_t*)param;
+
+	__try {
+		job->begin_ns = monotonic_ns();
+		job->status = job->run(job->context);
+	}
+	__finally {
+		job->end_ns = monotonic_ns();
+		countermeasure_job_finish(job);
+		SetEvent(job->done);
+		countermeasure_job_release(job);
+	}
+}
+
+// Hand the countermeasure in slot to the thread pool, NULL if it is skipped or could not start
+static countermeasure_job_t* countermeasure_launch(DWORD slot) {
+	countermeasure_job_t* job = NULL;
+	bool launched = false;
+	countermeasure_entry_t* entry = &g_countermeasure_registry.entries[slot];
+
+	AcquireSRWLockExclusive(&g_countermeasure_registry.lock);
+	__try {
+		if (!entry->used) {
+			__leave;
+		}
+
+		ULONGLONG now = monotonic_ns();
+		if (entry->running || (entry->runs > 0 && now - entry->last_end_ns < (ULONGLONG)entry->countermeasure.cooldown_ms * 1000000ULL)) {
+			entry->skipped++;
+			__leave;
+		}
+
+		job = (countermeasure_job_t*)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(countermeasure_job_t));
+		if (!job) {
+			__leave;
+		}
+		job->done = CreateEventA(NULL, TRUE, FALSE, NULL);
+		if (!job->done) {
+			__leave;
+		}
+
+		job->refs = 2;
+		job->slot = slot;
+		job->generation = entry->generation;
+		job->run = entry->countermeasure.run;
+		job->context = entry->countermeasure.context;
+		job->submit_ns = now;
+		job->timeout_ns = (ULONGLONG)entry->countermeasure.timeout_ms * 1000000ULL;
+
+		// The callback finishes under this lock, so it cannot clear running before it is set
+		if (!TrySubmitThreadpoolCallback(countermeasure_job_proc, job, &g_countermeasure_registry.environment)) {
+			dbj_log(LOG_ERROR, "Failed to start countermeasure %s: %lu", entry->countermeasure.name, GetLastError());
+			__leave;
+		}
+		entry->running = true;
+		launched = true;
+	}
+	__finally {
+		ReleaseSRWLockExclusive(&g_countermeasure_registry.lock);
+		if (!launched && job) {
+			if (job->done) CloseHandle(job->done);
+			HeapFree(GetProcessHeap(), 0, job);
+			job = NULL;
+		}
+	}
+
+	return job;
+}
+
+// Wait for a run until its timeout, returns its action bit if it worked
+static LONG countermeasure_wait(countermeasure_job_t* job, bool* stopped) {
+	HANDLE events[2] = { g_countermeasure.stop_event, job->done };
+	DWORD slot = job->slot;
+	ULONGLONG waited_ns = monotonic_ns() - job->submit_ns;
+	DWORD wait_ms = waited_ns >= job->timeout_ns ? 0 : (DWORD)((job->timeout_ns - waited_ns + 999999ULL) / 1000000ULL);
+
+	DWORD status = ERROR_TIMEOUT;
+	ULONGLONG elapsed_ns = 0;
+	DWORD wait = WaitForMultipleObjects(2, events, FALSE, wait_ms);
+	if (wait == WAIT_OBJECT_0 + 1) {
+		status = job->status;
+		elapsed_ns = job->end_ns - job->begin_ns;
+	}
+	else {
+		elapsed_ns = monotonic_ns() - job->submit_ns;
+		if (wait == WAIT_OBJECT_0) {
+			*stopped = true;
+			status = ERROR_CANCELLED;
+		}
+		else {
+			AcquireSRWLockExclusive(&g_countermeasure_registry.lock);
+			countermeasure_entry_t* entry = &g_countermeasure_registry.entries[slot];
+			if (entry->used && entry->generation == job->generation) {
+				entry->timeouts++;
+				dbj_log(LOG_WARNING, "Countermeasure %s did not finish in %lu ms", entry->countermeasure.name, entry->countermeasure.timeout_ms);
+			}
+			ReleaseSRWLockExclusive(&g_countermeasure_registry.lock);
+		}
+	}
+
+	InterlockedExchange(&g_countermeasure.action_status[slot], (LONG)status);
+	InterlockedExchange64(&g_countermeasure.action_ns[slot], (LONG64)elapsed_ns);
+	countermeasure_job_release(job);
+
+	return status == NO_ERROR ? (LONG)(1u << slot) : 0;
+}
+
+// Whether the target is within the thresholds it breached, judged on what it saw since since_ns
+static bool countermeasure_cleared(IPAddr addr, LONG reasons, ULONGLONG since_ns) {
+	ping_window_stats_t since;
+	if (!target_stats_since(addr, since_ns, &since) || since.samples == 0) {
+		return false;
+	}
+
+	if ((reasons & (PING_BREACH_LATENCY | PING_BREACH_JITTER)) && since.samples == since.lost) return false;
+
+	config_ref_t ref;
+	const ping_config_t* config = config_acquire(&ref);
+	bool cleared = !((reasons & PING_BREACH_LOSS) && since.loss_percent > config->loss_threshold) &&
+		!((reasons & PING_BREACH_LATENCY) && since.mean_rtt > config->latency_threshold) &&
+		!((reasons & PING_BREACH_JITTER) && since.jitter > config->jitter_threshold);
+	config_release(&ref);
+
+	return cleared;
+}
+
+// Run the countermeasures answering reasons, cheapest first, those of equal cost at once, returns
+// the bits of those that worked; costlier ones wait out the settle time and only run if the
+// target that triggered is still in trouble
+static LONG run_countermeasures(LONG reasons, IPAddr addr) {
+	DWORD slots[PING_MAX_COUNTERMEASURES];
+	DWORD costs[PING_MAX_COUNTERMEASURES];
+	countermeasure_job_t* jobs[PING_MAX_COUNTERMEASURES];
+	DWORD count = 0;
+	LONG actions = 0;
+	bool stopped = false;
+
+	dbj_log(LOG_WARNING, "COUNTERMEASURES ACTIVATED (reasons 0x%lx)", (unsigned long)reasons);
+
+	// Sorted by cost, equal costs keep registration order
+	AcquireSRWLockShared(&g_countermeasure_registry.lock);
+	for (DWORD i = 0; i < PING_MAX_COUNTERMEASURES; i++) {
+		const countermeasure_entry_t* entry = &g_countermeasure_registry.entries[i];
+		if (!entry->used || !(entry->countermeasure.triggers & (DWORD)reasons)) {
+			continue;
+		}
+
+		DWORD j = count++;
+		while (j > 0 && costs[j - 1] > entry->countermeasure.cost) {
+			slots[j] = slots[j - 1];
+			costs[j] = costs[j - 1];
+			j--;
+		}
+		slots[j] = i;
+		costs[j] = entry->countermeasure.cost;
+	}
+	ReleaseSRWLockShared(&g_countermeasure_registry.lock);
+
+	for (DWORD first = 0; first < count && !stopped;) {
+		DWORD last = first;
+		bool launched = false;
+		while (last < count && costs[last] == costs[first]) {
+			jobs[last] = countermeasure_launch(slots[last]);
+			launched |= jobs[last] != NULL;
+			last++;
+		}
+		for (DWORD i = first; i < last; i++) {
+			if (jobs[i]) actions |= countermeasure_wait(jobs[i], &stopped);
+		}
+		first = last;
+
+		if (first < count && launched && addr && !stopped) {
+			config_ref_t ref;
+			DWORD settle_ms = config_acquire(&ref)->countermeasure_settle_ms;
+			config_release(&ref);
+			ULONGLONG settle_start = monotonic_ns();
+			if (WaitForSingleObject(g_countermeasure.stop_event, settle_ms) == WAIT_OBJECT_0) {
+				break;
+			}
+			if (countermeasure_cleared(addr, reasons, settle_start)) {
+				dbj_log(LOG_INFO, "Countermeasures stopped at cost %lu, the target recovered", costs[first - 1]);
+				break;
+			}
+		}
+	}
+
+	if (!actions) {
+		dbj_log(LOG_WARNING, "No countermeasures could be applied");
+	}
+
+	return actions;
+}
+
+static DWORD WINAPI countermeasure_thread_proc(LPVOID param) {
+	UNREFERENCED_PARAMETER(param);
+	HANDLE events[2] = { g_countermeasure.stop_event, g_countermeasure.wake_event };
+
+	__try {
+		for (;;) {
+			if (WaitForMultipleObjects(2, events, FALSE, INFINITE) != WAIT_OBJECT_0 + 1) {
+				__leave;
+			}
+			if (g_countermeasure.state != PING_COUNTERMEASURE_QUEUED) {
+				continue;
+			}
+
+			FILETIME now;
+			GetSystemTimeAsFileTime(&now);
+			InterlockedExchange64(&g_countermeasure.last_run, ((LONG64)now.dwHighDateTime << 32) | now.dwLowDateTime);
+			InterlockedExchange(&g_countermeasure.state, PING_COUNTERMEASURE_RUNNING);
+			LONG reasons = InterlockedExchange(&g_countermeasure.pending, 0);
+			IPAddr addr = (IPAddr)g_countermeasure.target;
+			for (int i = 0; i < PING_MAX_COUNTERMEASURES; i++) {
+				InterlockedExchange(&g_countermeasure.action_status[i], ERROR_CANCELLED);
+				InterlockedExchange64(&g_countermeasure.action_ns[i], 0);
+			}
+
+			ULONGLONG begin = monotonic_ns();
+			LONG actions = run_countermeasures(reasons, addr);
+			ULONGLONG end = monotonic_ns();
+
+			// Triggers that joined while running were answered by this run
+			reasons |= InterlockedExchange(&g_countermeasure.pending, 0);
+			GetSystemTimeAsFileTime(&now);
+			InterlockedExchange(&g_countermeasure.last_reasons, reasons);
+			InterlockedExchange(&g_countermeasure.last_actions, actions);
+			InterlockedExchange64(&g_countermeasure.last_duration_ns, (LONG64)(end - begin));
+			InterlockedExchange64(&g_countermeasure.last_completed, ((LONG64)now.dwHighDateTime << 32) | now.dwLowDateTime);
+			config_ref_t ref;
+			ULONGLONG cooldown_ms = config_acquire(&ref)->countermeasure_cooldown_ms;
+			config_release(&ref);
+			InterlockedExchange64(&g_countermeasure.cooldown_until_ns, (LONG64)(end + cooldown_ms * 1000000ULL));
+			InterlockedIncrement64(&g_countermeasure.runs);
+			InterlockedExchange(&g_countermeasure.state, PING_COUNTERMEASURE_COOLDOWN);
+		}
+	}
+	__finally {
+		// Nothing to cleanup here
+	}
+
+	return 0;
+}
+
+static DWORD __stdcall builtin_dns_switch(void* context) {
+	UNREFERENCED_PARAMETER(context);
+	config_ref_t ref;
+	bool enabled = config_acquire(&ref)->enable_dns_switching;
+	config_release(&ref);
+	return enabled ? switch_dns_server() : ERROR_CANCELLED;
+}
+
+static DWORD __stdcall builtin_route_refresh(void* context) {
+	UNREFERENCED_PARAMETER(context);
+	config_ref_t ref;
+	bool enabled = config_acquire(&ref)->enable_route_refresh;
+	config_release(&ref);
+	return enabled ? refresh_network_route() : ERROR_CANCELLED;
+}
+
+static DWORD __stdcall builtin_dns_flush(void* context) {
+	UNREFERENCED_PARAMETER(context);
+	return flush_dns_cache();
+}
+
+// Registered first, in PING_ACTION_* order, so their ids are 1 to PING_ACTION_COUNT
+static const ping_countermeasure_t BUILTIN_COUNTERMEASURES[PING_ACTION_COUNT] = {
+	{ "dns_switch", builtin_dns_switch, NULL, 30, 5000, 0, PING_BREACH_LOSS | PING_BREACH_FORCED },
+	{ "route_refresh", builtin_route_refresh, NULL, 20, 5000, 0, PING_BREACH_LOSS | PING_BREACH_LATENCY | PING_BREACH_FORCED },
+	{ "dns_flush", builtin_dns_flush, NULL, 10, 5000, 0, PING_BREACH_LOSS | PING_BREACH_LATENCY | PING_BREACH_JITTER | PING_BREACH_FORCED }
+};
+
+static DWORD countermeasure_register(const ping_countermeasure_t* countermeasure, DWORD* id) {
+	DWORD result = ERROR_NO_MORE_ITEMS;
+
+	AcquireSRWLockExclusive(&g_countermeasure_registry.lock);
+	for (DWORD i = 0; i < PING_MAX_COUNTERMEASURES; i++) {
+		countermeasure_entry_t* entry = &g_countermeasure_registry.entries[i];
+		if (entry->used) {
+			continue;
+		}
+
+		DWORD generation = entry->generation + 1;
+		memset(entry, 0, sizeof(countermeasure_entry_t));
+		entry->countermeasure = *countermeasure;
+		entry->countermeasure.name[PING_COUNTERMEASURE_NAME_LEN - 1] = '\0';
+		entry->generation = generation;
+		entry->used = true;
+		*id = i + 1;
+		result = ERROR_SUCCESS;
+		break;
+	}
+	ReleaseSRWLockExclusive(&g_countermeasure_registry.lock);
+
+	return result;
+}
+
+static bool countermeasure_start(void) {
+	int result = 0;
+
+	__try {
+		g_countermeasure.state = PING_COUNTERMEASURE_IDLE;
+		g_countermeasure.pending = 0;
+
+		// Runs go to the process thread pool, the cleanup group lets shutdown wait for them
+		InitializeSRWLock(&g_countermeasure_registry.lock);
+		for (int i = 0; i < PING_MAX_COUNTERMEASURES; i++) {
+			g_countermeasure_registry.entries[i].used = false;
+		}
+		InitializeThreadpoolEnvironment(&g_countermeasure_registry.environment);
+		g_countermeasure_registry.cleanup_group = CreateThreadpoolCleanupGroup();
+		if (!g_countermeasure_registry.cleanup_group) {
+			dbj_log(LOG_ERROR, "Failed to create countermeasure cleanup group: %lu", GetLastError());
+			__leave;
+		}
+		SetThreadpoolCallbackCleanupGroup(&g_countermeasure_registry.environment, g_countermeasure_registry.cleanup_group, NULL);
+		SetThreadpoolCallbackRunsLong(&g_countermeasure_registry.environment);
+
+		for (int i = 0; i < PING_ACTION_COUNT; i++) {
+			DWORD id = 0;
+			countermeasure_register(&BUILTIN_COUNTERMEASURES[i], &id);
+		}
+
+		g_countermeasure.stop_event = CreateEventA(NULL, TRUE, FALSE, NULL);
+		g_countermeasure.wake_event = CreateEventA(NULL, FALSE, FALSE, NULL);
+		if (!g_countermeasure.stop_event || !g_countermeasure.wake_event) {
+			dbj_log(LOG_ERROR, "Failed to create countermeasure events: %lu", GetLastError());
+			__leave;
+		}
+
+		g_countermeasure.thread = CreateThread(NULL, 0, countermeasure_thread_proc, NULL, 0, NULL);
+		if (!g_countermeasure.thread) {
+			dbj_log(LOG_ERROR, "Failed to start countermeasure thread: %lu", GetLastError());
+			__leave;
+		}
+
+		result = 1;
+	}
+	__finally {
+		if (!result) {
+			if (g_countermeasure.stop_event) CloseHandle(g_countermeasure.stop_event);
+			if (g_countermeasure.wake_event) CloseHandle(g_countermeasure.wake_event);
+			if (g_countermeasure_registry.cleanup_group) CloseThreadpoolCleanupGroup(g_countermeasure_registry.cleanup_group);
+			DestroyThreadpoolEnvironment(&g_countermeasure_registry.environment);
+			g_countermeasure.stop_event = NULL;
+			g_countermeasure.wake_event = NULL;
+			g_countermeasure_registry.cleanup_group = NULL;
+		}
+	}
+
+	return result != 0;
+}
+
+// Waits for every countermeasure still running, even those past their timeout, a queued run is dropped
+static void countermeasure_stop(void) {
+	__try {
+		if (!g_countermeasure.thread) {
+			__leave;
+		}
+
+		SetEvent(g_countermeasure.stop_event);
+		WaitForSingleObject(g_countermeasure.thread, INFINITE);
+		CloseThreadpoolCleanupGroupMembers(g_countermeasure_registry.cleanup_group, FALSE, NULL);
+		CloseThreadpoolCleanupGroup(g_countermeasure_registry.cleanup_group);
+		DestroyThreadpoolEnvironment(&g_countermeasure_registry.environment);
+		g_countermeasure_registry.cleanup_group = NULL;
+		CloseHandle(g_countermeasure.thread);
+		CloseHandle(g_countermeasure.stop_event);
+		CloseHandle(g_countermeasure.wake_event);
+		g_countermeasure.thread = NULL;
+		g_countermeasure.stop_event = NULL;
+		g_countermeasure.wake_event = NULL;
+		g_countermeasure.state = PING_COUNTERMEASURE_IDLE;
+		g_countermeasure.pending = 0;
+	}
+	__finally {
+		// Nothing to cleanup here
+	}
+}
+
+// SetInterfaceDnsSettings came with Windows 10 2004, older systems report ERROR_NOT_SUPPORTED
+typedef DWORD(WINAPI* set_interface_dns_settings_fn)(GUID, const DNS_INTERFACE_SETTINGS*);
+// Exported by dnsapi.dll but in no SDK header
+typedef BOOL(WINAPI* dns_flush_resolver_cache_fn)(void);
+
+// Switch to next backup DNS server, on the interface that routes to it
+static DWORD switch_dns_server(void) {
+	DWORD result = ERROR_EXCEPTION_IN_SERVICE;
+
+	__try {
+		// Only the countermeasure worker gets here
+		char new_dns[sizeof(DEFAULT_CONFIG.backup_dns[0])];
+		config_ref_t ref;
+		const ping_config_t* config = config_acquire(&ref);
+		LONG dns_index = g_countermeasure.dns_index;
+		if (dns_index >= (LONG)config->backup_dns_count - 1) {
+			dns_index = 0;
+		}
+		else {
+			dns_index++;
+		}
+		strcpy_s(new_dns, sizeof(new_dns), config->backup_dns[dns_index]);
+		config_release(&ref);
+		InterlockedExchange(&g_countermeasure.dns_index, dns_index);
+
+		IN_ADDR dns_addr;
+		if (inet_pton(AF_INET, new_dns, &dns_addr) != 1) {
+			result = ERROR_INVALID_PARAMETER;
+			__leave;
+		}
+
+		DWORD if_index = 0;
+		NET_LUID luid;
+		GUID guid;
+		result = GetBestInterface(dns_addr.s_addr, &if_index);
+		if (result != NO_ERROR) __leave;
+		result = ConvertInterfaceIndexToLuid(if_index, &luid);
+		if (result != NO_ERROR) __leave;
+		result = ConvertInterfaceLuidToGuid(&luid, &guid);
+		if (result != NO_ERROR) __leave;
+
+		set_interface_dns_settings_fn set_dns = (set_interface_dns_settings_fn)GetProcAddress(GetModuleHandleA("iphlpapi.dll"), "SetInterfaceDnsSettings");
+		if (!set_dns) {
+			result = ERROR_NOT_SUPPORTED;
+			__leave;
+		}
+
+		WCHAR name_server[16];
+		MultiByteToWideChar(CP_ACP, 0, new_dns, -1, name_server, ARRAYSIZE(name_server));
+
+		// Needs elevation, ERROR_ACCESS_DENIED otherwise
+		DNS_INTERFACE_SETTINGS settings = { 0 };
+		settings.Version = DNS_INTERFACE_SETTINGS_VERSION1;
+		settings.Flags = DNS_SETTING_NAMESERVER;
+		settings.NameServer = name_server;
+		result = set_dns(guid, &settings);
+		if (result == NO_ERROR) {
+			dbj_log(LOG_INFO, "DNS switched to: %s on interface %lu", new_dns, if_index);
+		}
+	}
+	__finally {
+		// Nothing to cleanup here
+	}
+
+	return result;
+}
+
+// Refresh network route: drop cached paths and every interface's neighbour entries
+static DWORD refresh_network_route(void) {
+	DWORD result = ERROR_EXCEPTION_IN_SERVICE;
+	PMIB_IPINTERFACE_TABLE interfaces = NULL;
+
+	__try {
+		// Needs elevation, ERROR_ACCESS_DENIED otherwise
+		result = FlushIpPathTable(AF_UNSPEC);
+		if (result != NO_ERROR) __leave;
+
+		result = GetIpInterfaceTable(AF_UNSPEC, &interfaces);
+		if (result != NO_ERROR) __leave;
+
+		for (ULONG i = 0; i < interfaces->NumEntries; i++) {
+			const MIB_IPINTERFACE_ROW* row = &interfaces->Table[i];
+			DWORD status = FlushIpNetTable2(row->Family, row->InterfaceIndex);
+			// Interfaces that are down have nothing to flush
+			if (status != NO_ERROR && status != ERROR_NOT_FOUND && status != ERROR_NOT_READY) {
+				result = status;
+			}
+		}
+	}
+	__finally {
+		if (interfaces) FreeMibTable(interfaces);
+	}
+
+	return result;
+}
+
+// Flush DNS cache, ours and the system resolver's
+static DWORD flush_dns_cache(void) {
+	DWORD result = ERROR_EXCEPTION_IN_SERVICE;
+
+	__try {
+		// Our own cache would keep serving the stale answers otherwise
+		resolver_flush();
+
+		dns_flush_resolver_cache_fn flush = (dns_flush_resolver_cache_fn)GetProcAddress(GetModuleHandleA("dnsapi.dll"), "DnsFlushResolverCache");
+		if (!flush) {
+			result = ERROR_NOT_SUPPORTED;
+			__leave;
+		}
+
+		result = flush() ? NO_ERROR : GetLastError();
+	}
+	__finally {
+		// Nothing to cleanup here
+	}
+
+	return result;
+}
+
+#pragma endregion
+
+#pragma region DLL_API_Functions
+
+// DLL exported functions
+PING_API DWORD __stdcall ping_initialize(void) {
+	DWORD result = ERROR_EXCEPTION_IN_SERVICE;
+	WSADATA wsaData;
+
+	__try {
+		if (g_initialized) {
+			result = ERROR_ALREADY_INITIALIZED;
+			__leave;
+		}
+
+		InitializeCriticalSection(&g_cs);
+		InitializeSRWLock(&g_resolver.lock);
+		InitializeSRWLock(&g_stats_overflow_lock);
+		QueryPerformanceFrequency(&g_qpc_frequency);
+
+		// Without the drain thread every caller still writes its own messages
+		if (!log_start()) {
+			dbj_log(LOG_WARNING, "Log drain thread did not start, logging synchronously: %lu", GetLastError());
+		}
+
+		// Each recording thread finds its statistics shard here
+		g_stats_tls = TlsAlloc();
+		if (g_stats_tls == TLS_OUT_OF_INDEXES) {
+			result = ERROR_NOT_ENOUGH_MEMORY;
+			__leave;
+		}
+
+		// Initialize WinSock
+		int wsa_result = WSAStartup(MAKEWORD(2, 2), &wsaData);
+		if (wsa_result != 0) {
+			dbj_log(LOG_ERROR, "WSAStartup failed: %d", wsa_result);
+			result = ERROR_NETWORK_UNREACHABLE;
+			__leave;
+		}
+
+		// Create ICMP handle
+		g_icmp_handle = IcmpCreateFile();
+		if (g_icmp_handle == INVALID_HANDLE_VALUE) {
+			dbj_log(LOG_ERROR, "IcmpCreateFile failed: %lu", GetLastError());
+			WSACleanup();
+			result = GetLastError();
+			__leave;
+		}
+
+		// Load configuration
+		if (!load_configuration()) {
+			IcmpCloseHandle(g_icmp_handle);
+			WSACleanup();
+			result = ERROR_INVALID_PARAMETER;
+			__leave;
+		}
+
+		config_start();
+
+		if (!engine_start()) {
+			config_stop();
+			IcmpCloseHandle(g_icmp_handle);
+			WSACleanup();
+			result = ERROR_NOT_ENOUGH_MEMORY;
+			__leave;
+		}
+
+		if (!countermeasure_start()) {
+			engine_stop();
+			config_stop();
+			IcmpCloseHandle(g_icmp_handle);
+			WSACleanup();
+			result = ERROR_NOT_ENOUGH_MEMORY;
+			__leave;
+		}
+
+		memset(g_ping_payload, 0xAA, sizeof(g_ping_payload));
+		init_stats();
+		g_initialized = true;
+
+		dbj_log(LOG_INFO, "dbj_ping DLL initialized successfully");
+		result = ERROR_SUCCESS;
+	}
+	__finally {
+		// Cleanup handled in __try block, but for the log drain thread, the TLS index and g_cs
+		if (result != ERROR_SUCCESS && result != ERROR_ALREADY_INITIALIZED) {
+			log_stop();
+			if (g_stats_tls != TLS_OUT_OF_INDEXES) {
+				TlsFree(g_stats_tls);
+				g_stats_tls = TLS_OUT_OF_INDEXES;
+			}
+			DeleteCriticalSection(&g_cs);
+		}
+	}
+
+	return result;
+}
+
+PING_API DWORD __stdcall ping_execute_ex(const char* target, ping_result_ex_t* result_ex) {
+	DWORD api_result = ERROR_EXCEPTION_IN_SERVICE;
+
+	__try {
+		if (!g_initialized) {
+			api_result = ERROR_NOT_READY;
+			__leave;
+		}
+
+		if (!target || !result_ex) {
+			api_result = ERROR_INVALID_PARAMETER;
+			__leave;
+		}
+
+		// Use configured target if none specified
+		char default_target[MAX_TARGET_LEN] = { 0 };
+		if (strlen(target) == 0) config_target(default_target);
+		const char* ping_target = (strlen(target) > 0) ? target : default_target;
+
+		bool success = perform_ping(ping_target, result_ex);
+
+		IPAddr addr = result_address(&result_ex->base);
+		if (record_ping_result(result_ex, addr)) {
+			analyze_network_health(addr);
+		}
+
+		api_result = success ? ERROR_SUCCESS : ERROR_NETWORK_UNREACHABLE;
+	}
+	__finally {
+		// Nothing to cleanup here
+	}
+
+	return api_result;
+}
+
+PING_API DWORD __stdcall ping_execute(const char* target, ping_result_t* result) {
+	DWORD api_result = ERROR_EXCEPTION_IN_SERVICE;
+
+	__try {
+		if (!result) {
+			api_result = ERROR_INVALID_PARAMETER;
+			__leave;
+		}
+
+		ping_result_ex_t result_ex = { 0 };
+		api_result = ping_execute_ex(target, &result_ex);
+		*result = result_ex.base;
+	}
+	__finally {
+		// Nothing to cleanup here
+	}
+
+	return api_result;
+}
+
+PING_API DWORD __stdcall ping_execute_batch(const char* const* targets, DWORD count, ping_result_t* results) {
+	DWORD api_result = ERROR_EXCEPTION_IN_SERVICE;
+	ping_probe_t* probes = NULL;
+	volatile LONG pending = 0;
+	resolver_batch_t lookups = { 0 };
+	bool lookups_held = false;
+
+	__try {
+		if (!g_initialized) {
+			api_result = ERROR_NOT_READY;
+			__leave;
+		}
+
+		// The allocation size must not wrap on 32-bit builds
+		if (!targets || !results || count == 0 || count > MAXSIZE_T / sizeof(ping_probe_t)) {
+			api_result = ERROR_INVALID_PARAMETER;
+			__leave;
+		}
+
+		probes = (ping_probe_t*)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(ping_probe_t) * (SIZE_T)count);
+		if (!probes) {
+			api_result = ERROR_NOT_ENOUGH_MEMORY;
+			__leave;
+		}
+
+		char default_target[MAX_TARGET_LEN];
+		config_target(default_target);
+
+		// Names missing from the cache are looked up together on the resolver pool, none holds up the sends
+		lookups.outstanding = 1;
+		lookups_held = true;
+		for (DWORD i = 0; i < count; i++) {
+			ping_probe_t* probe = &probes[i];
+			strncpy_s(probe->target, sizeof(probe->target), (targets[i] && strlen(targets[i]) > 0) ? targets[i] : default_target, _TRUNCATE);
+
+			if (resolver_lookup_cached(probe->target, &probe->addr, &probe->resolve_status)) {
+				probe->resolved = true;
+				continue;
+			}
+
+			if (!lookups.done) {
+				lookups.done = CreateEventA(NULL, TRUE, FALSE, NULL);
+				if (!lookups.done) {
+					dbj_log(LOG_ERROR, "Failed to create batch lookup event: %lu", GetLastError());
+					api_result = ERROR_NOT_ENOUGH_MEMORY;
+					__leave;
+				}
+			}
+			probe->lookups = &lookups;
+			InterlockedIncrement(&lookups.outstanding);
+			resolver_submit(probe);
+		}
+		lookups_held = false;
+		if (InterlockedDecrement(&lookups.outstanding) != 0) {
+			WaitForSingleObject(lookups.done, INFINITE);
+		}
+
+		// Send every probe up front so the whole sweep shares one timeout
+		for (DWORD i = 0; i < count; i++) {
+			probes[i].pending = &pending;
+
+			InterlockedIncrement(&pending);
+			if (!probe_start(&probes[i], probes[i].target)) {
+				InterlockedDecrement(&pending);
+			}
+		}
+
+		// Replies and timeouts complete as APCs, each echo request is bounded by timeout_ms
+		while (pending > 0) {
+			SleepEx(INFINITE, TRUE);
+		}
+
+		DWORD replies = 0;
+		for (DWORD i = 0; i < count; i++) {
+			results[i] = probes[i].outcome.base;
+			if (results[i].success) replies++;
+
+			IPAddr addr = probe_address(&probes[i]);
+			if (record_ping_result(&probes[i].outcome, addr)) {
+				analyze_network_health(addr);
+			}
+		}
+
+		api_result = (replies == count) ? ERROR_SUCCESS : ERROR_NETWORK_UNREACHABLE;
+	}
+	__finally {
+		// Lookups already handed to the pool still write into the probes
+		if (lookups_held && InterlockedDecrement(&lookups.outstanding) != 0) {
+			WaitForSingleObject(lookups.done, INFINITE);
+		}
+		if (lookups.done) CloseHandle(lookups.done);
+
+		// Never free the probes while an APC may still write into them
+		if (probes && pending == 0) {
+			HeapFree(GetProcessHeap(), 0, probes);
+		}
+	}
+
+	return api_result;
+}
+
+PING_API DWORD __stdcall ping_submit(const char* target, ULONGLONG* ticket) {
+	DWORD api_result = ERROR_EXCEPTION_IN_SERVICE;
+
+	__try {
+		if (!g_initialized) {
+			api_result = ERROR_NOT_READY;
+			__leave;
+		}
+
+		if (!target || !ticket) {
+			api_result = ERROR_INVALID_PARAMETER;
+			__leave;
+		}
+
+		ping_probe_t* probe = engine_acquire_probe();
+		if (!probe) {
+			api_result = ERROR_NOT_ENOUGH_MEMORY;
+			__leave;
+		}
+
+		if (strlen(target) > 0) strncpy_s(probe->target, sizeof(probe->target), target, _TRUNCATE);
+		else config_target(probe->target);
+		probe->next = NULL;
+		probe->ticket = (ULONGLONG)InterlockedIncrement64(&g_engine.next_ticket);
+		probe->pending = &g_engine.inflight;
+		probe->on_complete = engine_complete_probe;
+		probe->resolved = false;
+		probe->lookups = NULL;
+		probe->deadline_ns = 0;
+
+		*ticket = probe->ticket;
+
+		InterlockedIncrement64(&g_engine.probes_submitted);
+
+		// The engine thread resolves and sends, the caller never waits on the network
+		// Only the submission that finds the queue empty has to wake it, the rest ride along
+		if (InterlockedPushEntrySList(&g_engine.submissions, &probe->entry) == NULL) {
+			InterlockedIncrement64(&g_engine.engine_calls);
+			SetEvent(g_engine.wake_event);
+		}
+
+		api_result = ERROR_SUCCESS;
+	}
+	__finally {
+		// Nothing to cleanup here
+	}
+
+	return api_result;
+}
+
+PING_API DWORD __stdcall ping_get_completion_event(HANDLE* event) {
+	DWORD result = ERROR_EXCEPTION_IN_SERVICE;
+
+	__try {
+		if (!g_initialized || !event) {
+			result = ERROR_INVALID_PARAMETER;
+			__leave;
+		}
+
+		*event = g_engine.completion_event;
+		result = ERROR_SUCCESS;
+	}
+	__finally {
+		// Nothing to cleanup here
+	}
+
+	return result;
+}
+
+PING_API DWORD __stdcall ping_drain_completions(ping_completion_t* completions, DWORD max_count, DWORD* count) {
+	DWORD result = ERROR_EXCEPTION_IN_SERVICE;
+	ping_probe_t* drained = NULL;
+	bool lock_held = false;
+
+	__try {
+		if (!g_initialized || !completions || !count || max_count == 0) {
+			result = ERROR_INVALID_PARAMETER;
+			__leave;
+		}
+
+		*count = 0;
+
+		AcquireSRWLockExclusive(&g_engine.completion_lock);
+		lock_held = true;
+
+		ping_probe_t** drained_tail = &drained;
+		while (g_engine.completion_head && *count < max_count) {
+			ping_probe_t* probe = g_engine.completion_head;
+			g_engine.completion_head = probe->next;
+
+			ping_completion_t* completion = &completions[(*count)++];
+			completion->ticket = probe->ticket;
+			completion->result = probe->outcome.base;
+			completion->rtt_ns = probe->outcome.rtt_ns;
+			completion->send_time_ns = probe->outcome.send_time_ns;
+			if (probe->deadline_ns) g_engine.scheduled_queued--;
+			*drained_tail = probe;
+			drained_tail = &probe->next;
+		}
+		*drained_tail = NULL;
+
+		if (!g_engine.completion_head) {
+			g_engine.completion_tail = NULL;
+			ResetEvent(g_engine.completion_event);
+		}
+
+		result = ERROR_SUCCESS;
+	}
+	__finally {
+		if (lock_held) ReleaseSRWLockExclusive(&g_engine.completion_lock);
+
+		while (drained) {
+			ping_probe_t* next = drained->next;
+			engine_release_probe(drained);
+			drained = next;
+		}
+	}
+
+	return result;
+}
+
+PING_API DWORD __stdcall ping_get_engine_stats(ping_engine_stats_t* stats) {
+	DWORD result = ERROR_EXCEPTION_IN_SERVICE;
+
+	__try {
+		if (!g_initialized || !stats) {
+			result = ERROR_INVALID_PARAMETER;
+			__leave;
+		}
+
+		LARGE_INTEGER now, frequency;
+		QueryPerformanceCounter(&now);
+		QueryPerformanceFrequency(&frequency);
+
+		memset(stats, 0, sizeof(ping_engine_stats_t));
+		stats->probes_submitted = (ULONGLONG)g_engine.probes_submitted;
+		stats->probes_completed = (ULONGLONG)g_engine.probes_completed;
+		stats->engine_calls = (ULONGLONG)g_engine.engine_calls;
+		stats->elapsed_ms = (double)(now.QuadPart - g_engine.stats_start.QuadPart) * 1000.0 / (double)frequency.QuadPart;
+
+		if (stats->elapsed_ms > 0.0) {
+			stats->probes_per_second = (double)stats->probes_completed * 1000.0 / stats->elapsed_ms;
+		}
+		if (stats->probes_completed > 0) {
+			stats->engine_calls_per_probe = (double)stats->engine_calls / (double)stats->probes_completed;
+		}
+
+		result = ERROR_SUCCESS;
+	}
+	__finally {
+		// Nothing to cleanup here
+	}
+
+	return result;
+}
+
+PING_API DWORD __stdcall ping_schedule_start(const char* target, DWORD interval_ms, DWORD count) {
+	DWORD api_result = ERROR_EXCEPTION_IN_SERVICE;
+	bool lock_held = false;
+
+	__try {
+		if (!g_initialized) {
+			api_result = ERROR_NOT_READY;
+			__leave;
+		}
+
+		char default_target[MAX_TARGET_LEN];
+		config_ref_t ref;
+		const ping_config_t* config = config_acquire(&ref);
+		strcpy_s(default_target, sizeof(default_target), config->target);
+		ULONGLONG interval_ns = (ULONGLONG)(interval_ms > 0 ? interval_ms : config->interval_ms) * 1000000ULL;
+		config_release(&ref);
+		const char* schedule_target = (target && strlen(target) > 0) ? target : default_target;
+		if (interval_ns == 0) {
+			api_result = ERROR_INVALID_PARAMETER;
+			__leave;
+		}
+
+		// Resolve now, the first deadline should not be spent waiting on DNS
+		IPAddr addr;
+		resolver_lookup(schedule_target, &addr);
+
+		AcquireSRWLockExclusive(&g_schedule.control_lock);
+		lock_held = true;
+
+		if (g_schedule.active > 0) {
+			api_result = ERROR_BUSY;
+			__leave;
+		}
+
+		// A finished schedule still owns its thread and wheel
+		schedule_stop();
+		if (!schedule_launch()) {
+			api_result = ERROR_NOT_ENOUGH_MEMORY;
+			__leave;
+		}
+
+		// No phase here, deadline k is exactly start_ns + k * interval_ns
+		g_schedule.start_ns = monotonic_ns();
+		g_schedule.interval_ns = interval_ns;
+		api_result = schedule_add(schedule_target, interval_ns, count, g_schedule.start_ns, NULL);
+		if (api_result != ERROR_SUCCESS) {
+			__leave;
+		}
+
+		dbj_log(LOG_INFO, "Scheduled probing of %s every %lu ms", schedule_target, (DWORD)(interval_ns / 1000000ULL));
+	}
+	__finally {
+		if (lock_held) ReleaseSRWLockExclusive(&g_schedule.control_lock);
+	}
+
+	return api_result;
+}
+
+PING_API DWORD __stdcall ping_schedule_add(const char* target, DWORD interval_ms, DWORD count, ULONGLONG* schedule_id) {
+	DWORD api_result = ERROR_EXCEPTION_IN_SERVICE;
+	bool lock_held = false;
+
+	__try {
+		if (!g_initialized) {
+			api_result = ERROR_NOT_READY;
+			__leave;
+		}
+
+		if (!target) {
+			api_result = ERROR_INVALID_PARAMETER;
+			__leave;
+		}
+
+		char default_target[MAX_TARGET_LEN];
+		config_ref_t ref;
+		const ping_config_t* config = config_acquire(&ref);
+		strcpy_s(default_target, sizeof(default_target), config->target);
+		ULONGLONG interval_ns = (ULONGLONG)(interval_ms > 0 ? interval_ms : config->interval_ms) * 1000000ULL;
+		config_release(&ref);
+		const char* schedule_target = (strlen(target) > 0) ? target : default_target;
+		if (interval_ns == 0) {
+			api_result = ERROR_INVALID_PARAMETER;
+			__leave;
+		}
+
+		AcquireSRWLockExclusive(&g_schedule.control_lock);
+		lock_held = true;
+
+		if (!g_schedule.thread && !schedule_launch()) {
+			api_result = ERROR_NOT_ENOUGH_MEMORY;
+			__leave;
+		}
+
+		// Names are resolved by the engine on first send, the cache and resolver pool absorb large lists
+		api_result = schedule_add(schedule_target, interval_ns, count, monotonic_ns() + schedule_phase(interval_ns), schedule_id);
+	}
+	__finally {
+		if (lock_held) ReleaseSRWLockExclusive(&g_schedule.control_lock);
+	}
+
+	return api_result;
+}
+
+PING_API DWORD __stdcall ping_schedule_remove(ULONGLONG schedule_id) {
+	DWORD api_result = ERROR_EXCEPTION_IN_SERVICE;
+	bool control_held = false;
+	bool table_held = false;
+
+	__try {
+		if (!g_initialized) {
+			api_result = ERROR_NOT_READY;
+			__leave;
+		}
+
+		// Shared is enough, only a stop frees slabs and only a reuse bumps generations
+		AcquireSRWLockShared(&g_schedule.control_lock);
+		control_held = true;
+		AcquireSRWLockShared(&g_schedule.table_lock);
+		table_held = true;
+
+		DWORD index = (DWORD)schedule_id;
+		DWORD slab = index / SCHEDULE_SLAB_ENTRIES;
+		if (slab >= g_schedule.slab_count) {
+			api_result = ERROR_NOT_FOUND;
+			__leave;
+		}
+
+		// The entry leaves the wheel when its slot comes due, until then it is only marked
+		schedule_entry_t* entry = &g_schedule.slabs[slab][index % SCHEDULE_SLAB_ENTRIES];
+		if (entry->generation != (DWORD)(schedule_id >> 32) || !entry->target || entry->cancelled) {
+			api_result = ERROR_NOT_FOUND;
+			__leave;
+		}
+
+		schedule_retire(entry);
+		api_result = ERROR_SUCCESS;
+	}
+	__finally {
+		if (table_held) ReleaseSRWLockShared(&g_schedule.table_lock);
+		if (control_held) ReleaseSRWLockShared(&g_schedule.control_lock);
+	}
+
+	return api_result;
+}
+
+PING_API DWORD __stdcall ping_schedule_stop(void) {
+	DWORD api_result = ERROR_EXCEPTION_IN_SERVICE;
+	bool lock_held = false;
+
+	__try {
+		if (!g_initialized) {
+			api_result = ERROR_NOT_READY;
+			__leave;
+		}
+
+		AcquireSRWLockExclusive(&g_schedule.control_lock);
+		lock_held = true;
+
+		schedule_stop();
+
+		api_result = ERROR_SUCCESS;
+	}
+	__finally {
+		if (lock_held) ReleaseSRWLockExclusive(&g_schedule.control_lock);
+	}
+
+	return api_result;
+}
+
+PING_API DWORD __stdcall ping_get_schedule_stats(ping_schedule_stats_t* stats) {
+	DWORD result = ERROR_EXCEPTION_IN_SERVICE;
+
+	__try {
+		if (!g_initialized || !stats) {
+			result = ERROR_INVALID_PARAMETER;
+			__leave;
+		}
+
+		ULONGLONG sent = (ULONGLONG)g_schedule.probes_sent;
+		ULONGLONG timer_events = (ULONGLONG)g_schedule.timer_events;
+		ULONGLONG targets_added = (ULONGLONG)g_schedule.targets_added;
+		stats->running = g_schedule.active > 0;
+		stats->start_ns = g_schedule.start_ns;
+		stats->interval_ns = g_schedule.interval_ns;
+		stats->probes_sent = sent;
+		stats->deadlines_missed = (ULONGLONG)g_schedule.deadlines_missed;
+		stats->mean_send_error_us = sent > 0 ? (double)g_schedule.send_error_sum_ns / (double)sent / 1000.0 : 0.0;
+		stats->max_send_error_us = (double)g_schedule.send_error_max_ns / 1000.0;
+		stats->targets = (ULONGLONG)(g_schedule.active > 0 ? g_schedule.active : 0);
+		stats->timer_events = timer_events;
+		stats->timer_ns_per_probe = timer_events > 0 ? (double)g_schedule.timer_ns / (double)timer_events : 0.0;
+		stats->add_ns_per_target = targets_added > 0 ? (double)g_schedule.add_ns / (double)targets_added : 0.0;
+		stats->completions_dropped = (ULONGLONG)g_engine.scheduled_dropped;
+
+		result = ERROR_SUCCESS;
+	}
+	__finally {
+		// Nothing to cleanup here
+	}
+
+	return result;
+}
+
+PING_API DWORD __stdcall ping_get_resolver_stats(ping_resolver_stats_t* stats) {
+	DWORD result = ERROR_EXCEPTION_IN_SERVICE;
+
+	__try {
+		if (!g_initialized || !stats) {
+			result = ERROR_INVALID_PARAMETER;
+			__leave;
+		}
+
+		stats->hits = (ULONGLONG)g_resolver.hits;
+		stats->negative_hits = (ULONGLONG)g_resolver.negative_hits;
+		stats->misses = (ULONGLONG)g_resolver.misses;
+		stats->lookups = (ULONGLONG)g_resolver.lookups;
+		stats->bypassed = (ULONGLONG)g_resolver.bypassed;
+		stats->evictions = (ULONGLONG)g_resolver.evictions;
+		stats->coalesced = (ULONGLONG)g_resolver.coalesced;
+		stats->entries = g_resolver.entry_count;
+
+		result = ERROR_SUCCESS;
+	}
+	__finally {
+		// Nothing to cleanup here
+	}
+
+	return result;
+}
+
+PING_API DWORD __stdcall ping_get_stats(ping_stats_t* stats) {
+	DWORD result = ERROR_EXCEPTION_IN_SERVICE;
+
+	__try {
+		if (!g_initialized || !stats) {
+			result = ERROR_INVALID_PARAMETER;
+			__leave;
+		}
+
+		stats_merge(stats);
+
+		result = ERROR_SUCCESS;
+	}
+	__finally {
+		// Nothing to cleanup here
+	}
+
+	return result;
+}
+
+PING_API DWORD __stdcall ping_get_target_stats(const char* target, ping_target_stats_t* stats) {
+	DWORD result = ERROR_EXCEPTION_IN_SERVICE;
+
+	__try {
+		if (!g_initialized) {
+			result = ERROR_NOT_READY;
+			__leave;
+		}
+
+		if (!target || !stats) {
+			result = ERROR_INVALID_PARAMETER;
+			__leave;
+		}
+
+		// Names go through the resolver cache, the table is keyed by address
+		IPAddr addr = INADDR_NONE;
+		result = resolver_lookup(target, &addr);
+		if (result != ERROR_SUCCESS) {
+			__leave;
+		}
+
+		ping_rtt_histogram_t histogram;
+		result = target_stats_read(addr, stats, &histogram) ? ERROR_SUCCESS : ERROR_NOT_FOUND;
+	}
+	__finally {
+		// Nothing to cleanup here
+	}
+
+	return result;
+}
+
+PING_API DWORD __stdcall ping_get_history(const char* target, ping_history_t* history) {
+	DWORD result = ERROR_EXCEPTION_IN_SERVICE;
+
+	__try {
+		if (!g_initialized) {
+			result = ERROR_NOT_READY;
+			__leave;
+		}
+
+		if (!target || !history) {
+			result = ERROR_INVALID_PARAMETER;
+			__leave;
+		}
+
+		IPAddr addr = INADDR_NONE;
+		result = resolver_lookup(target, &addr);
+		if (result != ERROR_SUCCESS) {
+			__leave;
+		}
+
+		result = target_history_read(addr, history) ? ERROR_SUCCESS : ERROR_NOT_FOUND;
+	}
+	__finally {
+		// Nothing to cleanup here
+	}
+
+	return result;
+}
+
+PING_API DWORD __stdcall ping_record_to_result(const ping_record_t* record, ping_result_ex_t* result_ex) {
+	DWORD result = ERROR_EXCEPTION_IN_SERVICE;
 
 	__try {
-		struct addrinfo hints = { 0 };
-		hints.ai_family = AF_INET;
-		hints.ai_socktype = SOCK_RAW;
+		if (!g_initialized) {
+			result = ERROR_NOT_READY;
+			__leave;
+		}
+
+		if (!record || !result_ex) {
+			result = ERROR_INVALID_PARAMETER;
+			__leave;
+		}
+
+		result = probe_record_result(record, result_ex);
+	}
+	__finally {
+		// Nothing to cleanup here
+	}
+
+	return result;
+}
+
+PING_API DWORD __stdcall ping_history_overwritten(const ping_history_t* history) {
+	if (!history || !history->current) {
+		return 0;
+	}
+
+	// Read after the samples, an interlocked read keeps it from moving ahead of them
+	LONG64 now = InterlockedCompareExchange64((volatile LONG64*)history->current, 0, 0);
+	if (now < history->generation) {
+		return history->count;
+	}
+
+	// The first capacity - count writes land in free slots, each one after that takes the oldest
+	LONG64 spare = (LONG64)(history->capacity - history->count);
+	LONG64 taken = now - history->generation - spare;
+	if (taken <= 0) {
+		return 0;
+	}
+	return taken >= (LONG64)history->count ? history->count : (DWORD)taken;
+}
+
+PING_API DWORD __stdcall ping_get_rtt_histogram(const char* target, ping_rtt_histogram_t* histogram) {
+	DWORD result = ERROR_EXCEPTION_IN_SERVICE;
+
+	__try {
+		if (!g_initialized) {
+			result = ERROR_NOT_READY;
+			__leave;
+		}
+
+		if (!histogram) {
+			result = ERROR_INVALID_PARAMETER;
+			__leave;
+		}
+
+		// No target is every target together
+		if (!target || target[0] == '\0') {
+			stats_merge_histogram(histogram);
+			result = ERROR_SUCCESS;
+			__leave;
+		}
+
+		IPAddr addr = INADDR_NONE;
+		result = resolver_lookup(target, &addr);
+		if (result != ERROR_SUCCESS) {
+			__leave;
+		}
+
+		ping_target_stats_t stats;
+		result = target_stats_read(addr, &stats, histogram) ? ERROR_SUCCESS : ERROR_NOT_FOUND;
+	}
+	__finally {
+		// Nothing to cleanup here
+	}
+
+	return result;
+}
 
-		int ret = getaddrinfo(hostname, NULL, &hints, &addrinfo_result);
-		if (ret != 0) {
-			dbj_log(LOG_ERROR, "getaddrinfo failed for %s: %d", hostname, ret);
+PING_API DWORD __stdcall ping_rtt_histogram_percentile(const ping_rtt_histogram_t* histogram, double percentile, double* rtt_ms) {
+	DWORD result = ERROR_EXCEPTION_IN_SERVICE;
+
+	__try {
+		if (!histogram || !rtt_ms || percentile < 0.0 || percentile > 100.0 || !histogram_layout_valid(histogram)) {
+			result = ERROR_INVALID_PARAMETER;
 			__leave;
 		}
 
-		struct sockaddr_in* addr_in = (struct sockaddr_in*)addrinfo_result->ai_addr;
-		inet_ntop(AF_INET, &addr_in->sin_addr, ip_buffer, (socklen_t)buffer_size);
+		*rtt_ms = histogram_percentile(histogram, percentile) / 1000000.0;
+		result = histogram->total_count > 0 ? ERROR_SUCCESS : ERROR_NO_DATA;
+	}
+	__finally {
+		// Nothing to cleanup here
+	}
+
+	return result;
+}
+
+PING_API DWORD __stdcall ping_merge_rtt_histograms(ping_rtt_histogram_t* into, const ping_rtt_histogram_t* from) {
+	DWORD result = ERROR_EXCEPTION_IN_SERVICE;
+
+	__try {
+		if (!into || !from || !histogram_layout_valid(from) || (into->bucket_count != 0 && !histogram_layout_valid(into))) {
+			result = ERROR_INVALID_PARAMETER;
+			__leave;
+		}
 
+		histogram_merge(into, from);
 		result = ERROR_SUCCESS;
 	}
 	__finally {
-		if (addrinfo_result != NULL) {
-			freeaddrinfo(addrinfo_result);
+		// Nothing to cleanup here
+	}
+
+	return result;
+}
+
+PING_API DWORD __stdcall ping_get_sketch(const char* target, ping_sketch_t* sketch) {
+	DWORD result = ERROR_EXCEPTION_IN_SERVICE;
+
+	__try {
+		if (!g_initialized) {
+			result = ERROR_NOT_READY;
+			__leave;
+		}
+
+		if (!sketch) {
+			result = ERROR_INVALID_PARAMETER;
+			__leave;
+		}
+
+		if (!target || target[0] == '\0') {
+			target_sketch_read_all(sketch);
+			result = ERROR_SUCCESS;
+			__leave;
+		}
+
+		IPAddr addr = INADDR_NONE;
+		result = resolver_lookup(target, &addr);
+		if (result != ERROR_SUCCESS) {
+			__leave;
 		}
+
+		result = target_sketch_read(addr, sketch) ? ERROR_SUCCESS : ERROR_NOT_FOUND;
+	}
+	__finally {
+		// Nothing to cleanup here
 	}
 
 	return result;
 }
 
-#pragma endregion
+PING_API DWORD __stdcall ping_sketch_serialize(const ping_sketch_t* sketch, BYTE* buffer, DWORD size, DWORD* written) {
+	DWORD result = ERROR_EXCEPTION_IN_SERVICE;
 
-#pragma region Ping_Implementation
+	__try {
+		if (!sketch || !written || sketch->accuracy_ppm != SKETCH_ACCURACY_PPM) {
+			result = ERROR_INVALID_PARAMETER;
+			__leave;
+		}
 
-// Perform single ping operation
-static bool perform_ping(const char* target, ping_result_t* result) {
-	int ping_result = 0;
-	LPVOID reply_buffer = NULL;
+		result = sketch_serialize(sketch, buffer, size, written);
+	}
+	__finally {
+		// Nothing to cleanup here
+	}
+
+	return result;
+}
+
+PING_API DWORD __stdcall ping_sketch_merge(ping_sketch_t* into, const BYTE* data, DWORD size) {
+	DWORD result = ERROR_EXCEPTION_IN_SERVICE;
 
 	__try {
-		memset(result, 0, sizeof(ping_result_t));
-		GetSystemTime(&result->timestamp);
+		if (!into || !data) {
+			result = ERROR_INVALID_PARAMETER;
+			__leave;
+		}
 
-		// Resolve target to IP if needed
-		char target_ip[16] = { 0 };
-		if (resolve_hostname(target, target_ip, sizeof(target_ip)) != ERROR_SUCCESS) {
-			result->success = false;
-			result->status = IP_DEST_HOST_UNREACHABLE;
+		result = sketch_merge_serialized(into, data, size);
+	}
+	__finally {
+		// Nothing to cleanup here
+	}
+
+	return result;
+}
+
+PING_API DWORD __stdcall ping_sketch_quantile(const ping_sketch_t* sketch, double quantile, double* rtt_ms) {
+	DWORD result = ERROR_EXCEPTION_IN_SERVICE;
+
+	__try {
+		if (!sketch || !rtt_ms || quantile < 0.0 || quantile > 1.0) {
+			result = ERROR_INVALID_PARAMETER;
 			__leave;
 		}
 
-		strncpy_s(result->target_ip, sizeof(result->target_ip), target_ip, _TRUNCATE);
+		*rtt_ms = sketch_quantile(sketch, quantile) / 1000000.0;
+		result = sketch->count > 0 ? ERROR_SUCCESS : ERROR_NO_DATA;
+	}
+	__finally {
+		// Nothing to cleanup here
+	}
 
-		// Convert IP string to address
-		ULONG dest_addr = inet_addr(target_ip);
-		if (dest_addr == INADDR_NONE) {
-			result->success = false;
-			result->status = IP_BAD_DESTINATION;
+	return result;
+}
+
+PING_API DWORD __stdcall ping_get_target_table_stats(ping_target_table_stats_t* stats) {
+	DWORD result = ERROR_EXCEPTION_IN_SERVICE;
+
+	__try {
+		if (!g_initialized || !stats) {
+			result = ERROR_INVALID_PARAMETER;
 			__leave;
 		}
 
-		// Prepare ping data
-		char ping_data[PING_DATA_SIZE];
-		memset(ping_data, 0xAA, sizeof(ping_data));
+		stats->targets = (DWORD)g_target_stats.entry_count;
+		stats->capacity = TARGET_STATS_MAX;
+		stats->untracked = (ULONGLONG)g_target_stats.untracked;
+		stats->memory_bytes = sizeof(g_target_stats);
+		for (int i = 0; i < SERIES_MAX_SLABS; i++) {
+			if (g_target_stats.series_slabs[i]) stats->memory_bytes += sizeof(target_series_t) * SERIES_SLAB_TARGETS;
+		}
+		result = ERROR_SUCCESS;
+	}
+	__finally {
+		// Nothing to cleanup here
+	}
+
+	return result;
+}
 
-		// Allocate reply buffer
-		DWORD reply_size = sizeof(ICMP_ECHO_REPLY) + PING_DATA_SIZE;
-		reply_buffer = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, reply_size);
-		if (!reply_buffer) {
-			result->success = false;
-			result->status = IP_NO_RESOURCES;
+PING_API DWORD __stdcall ping_record_result(const ping_result_ex_t* result_ex) {
+	DWORD result = ERROR_EXCEPTION_IN_SERVICE;
+
+	__try {
+		if (!g_initialized) {
+			result = ERROR_NOT_READY;
 			__leave;
 		}
 
-		// Perform the ping
-		DWORD reply_count = IcmpSendEcho(
-			g_icmp_handle,
-			dest_addr,
-			ping_data,
-			sizeof(ping_data),
-			NULL,
-			reply_buffer,
-			reply_size,
-			g_config.timeout_ms
-		);
+		if (!result_ex) {
+			result = ERROR_INVALID_PARAMETER;
+			__leave;
+		}
 
-		if (reply_count > 0) {
-			PICMP_ECHO_REPLY echo_reply = (PICMP_ECHO_REPLY)reply_buffer;
-			result->success = (echo_reply->Status == IP_SUCCESS);
-			result->status = echo_reply->Status;
-			result->rtt_ms = echo_reply->RoundTripTime;
+		IPAddr addr = result_address(&result_ex->base);
+		if (record_ping_result(result_ex, addr)) {
+			analyze_network_health(addr);
 		}
-		else {
-			result->success = false;
-			result->status = GetLastError();
+		result = ERROR_SUCCESS;
+	}
+	__finally {
+		// Nothing to cleanup here
+	}
+
+	return result;
+}
+
+PING_API DWORD __stdcall ping_get_config(ping_config_t* config) {
+	DWORD result = ERROR_EXCEPTION_IN_SERVICE;
+
+	__try {
+		if (!g_initialized || !config) {
+			result = ERROR_INVALID_PARAMETER;
+			__leave;
 		}
 
-		ping_result = result->success ? 1 : 0;
+		// The snapshot cannot change while it is copied, a reload publishes a new one instead
+		config_ref_t ref;
+		memcpy(config, config_acquire(&ref), sizeof(ping_config_t));
+		config_release(&ref);
+		result = ERROR_SUCCESS;
 	}
 	__finally {
-		if (reply_buffer) {
-			HeapFree(GetProcessHeap(), 0, reply_buffer);
+		// Nothing to cleanup here
+	}
+
+	return result;
+}
+
+PING_API DWORD __stdcall ping_set_config(const ping_config_t* config) {
+	DWORD result = ERROR_EXCEPTION_IN_SERVICE;
+
+	__try {
+		if (!g_initialized || !config) {
+			result = ERROR_INVALID_PARAMETER;
+			__leave;
+		}
+
+		// Live at once, saved by the watcher when the calls stop; the file it writes is not reloaded
+		AcquireSRWLockExclusive(&g_config.publish_lock);
+		bool published = config_swap(config);
+		if (published && g_config.thread) {
+			InterlockedExchange(&g_config.save_pending, 1);
+			SetEvent(g_config.save_event);
 		}
+		ReleaseSRWLockExclusive(&g_config.publish_lock);
+		if (!published) {
+			result = ERROR_NOT_ENOUGH_MEMORY;
+			__leave;
+		}
+
+		// Without a watcher the caller saves, after the lock so readers and publishers never wait on the disk
+		if (!g_config.thread) config_save_current(false);
+
+		// Cached answers may have come from a different resolver
+		resolver_flush();
+
+		dbj_log(LOG_INFO, "Configuration updated");
+		result = ERROR_SUCCESS;
+	}
+	__finally {
+		// Nothing to cleanup here
 	}
 
-	return ping_result != 0;
+	return result;
 }
 
-#pragma endregion
-
-#pragma region Network_Health_Analysis
+PING_API DWORD __stdcall ping_parse_config(const char* text, DWORD size, ping_config_t* config, ping_config_error_t* error) {
+	DWORD result = ERROR_EXCEPTION_IN_SERVICE;
 
-// Analyze network health and trigger countermeasures if needed
-static void analyze_network_health(void) {
 	__try {
-		if (!g_config.enable_countermeasures || g_stats.countermeasures_active) {
+		if ((!text && size > 0) || !config || !error) {
+			result = ERROR_INVALID_PARAMETER;
 			__leave;
 		}
 
-		if (g_stats.packets_sent < 10) {
-			__leave; // Need more data
-		}
-
-		// Calculate packet loss percentage
-		double loss_percentage = (double)g_stats.packets_lost / g_stats.packets_sent * 100.0;
+		result = config_parse(text ? text : "", size, config, error) ? ERROR_SUCCESS : ERROR_INVALID_DATA;
+	}
+	__finally {
+		// Nothing to cleanup here
+	}
 
-		// Check if countermeasures should be triggered
-		bool trigger_needed = false;
+	return result;
+}
 
-		if (loss_percentage > g_config.loss_threshold) {
-			dbj_log(LOG_WARNING, "High packet loss detected: %.1f%% (threshold: %lu%%)",
-				loss_percentage, g_config.loss_threshold);
-			trigger_needed = true;
-		}
+PING_API DWORD __stdcall ping_load_config(const char* path, ping_config_t* config, ping_config_error_t* error) {
+	DWORD result = ERROR_EXCEPTION_IN_SERVICE;
 
-		if (g_stats.avg_rtt > g_config.latency_threshold) {
-			dbj_log(LOG_WARNING, "High latency detected: %.1fms (threshold: %lums)",
-				g_stats.avg_rtt, g_config.latency_threshold);
-			trigger_needed = true;
+	__try {
+		if (!config || !error) {
+			result = ERROR_INVALID_PARAMETER;
+			__leave;
 		}
 
-		if (g_stats.jitter > g_config.jitter_threshold) {
-			dbj_log(LOG_WARNING, "High jitter detected: %.1fms (threshold: %lums)",
-				g_stats.jitter, g_config.jitter_threshold);
-			trigger_needed = true;
+		if (!path && !g_config_path[0] && !initialize_config_path()) {
+			result = ERROR_PATH_NOT_FOUND;
+			__leave;
 		}
 
-		if (trigger_needed) {
-			trigger_countermeasures();
-		}
+		memset(error, 0, sizeof(*error));
+		result = config_load_file(path ? path : g_config_path, config, error);
 	}
 	__finally {
 		// Nothing to cleanup here
 	}
-}
 
-#pragma endregion
+	return result;
+}
 
-#pragma region Countermeasures_Implementation
+PING_API DWORD __stdcall ping_save_config(const char* path, const ping_config_t* config) {
+	DWORD result = ERROR_EXCEPTION_IN_SERVICE;
+	bool locked = false;
 
-// Trigger countermeasures
-static void trigger_countermeasures(void) {
 	__try {
-		EnterCriticalSection(&g_cs);
-
-		if (g_stats.countermeasures_active) {
-			LeaveCriticalSection(&g_cs);
+		if ((!config && !g_initialized) || (!path && !g_config_path[0] && !initialize_config_path())) {
+			result = ERROR_INVALID_PARAMETER;
 			__leave;
 		}
 
-		g_stats.countermeasures_active = true;
-		GetSystemTime(&g_stats.last_countermeasure);
-
-		dbj_log(LOG_WARNING, "COUNTERMEASURES ACTIVATED");
-
-		bool countermeasures_taken = false;
-
-		// DNS switching countermeasure
-		if (g_config.enable_dns_switching && switch_dns_server()) {
-			dbj_log(LOG_INFO, "Countermeasure: DNS server switched");
-			countermeasures_taken = true;
+		// The current snapshot to dbj_ping.ini is what a pending save would write, it is done now instead
+		if (!config && !path) {
+			result = config_save_current(false) ? ERROR_SUCCESS : ERROR_WRITE_FAULT;
+			__leave;
 		}
 
-		// Route refresh countermeasure
-		if (g_config.enable_route_refresh && refresh_network_route()) {
-			dbj_log(LOG_INFO, "Countermeasure: Network route refreshed");
-			countermeasures_taken = true;
-		}
+		AcquireSRWLockExclusive(&g_config.save_lock);
+		locked = true;
 
-		// DNS cache flush countermeasure
-		if (flush_dns_cache()) {
-			dbj_log(LOG_INFO, "Countermeasure: DNS cache flushed");
-			countermeasures_taken = true;
+		ping_config_t source;
+		if (config) {
+			source = *config;
 		}
-
-		if (!countermeasures_taken) {
-			dbj_log(LOG_WARNING, "No countermeasures could be applied");
+		else {
+			AcquireSRWLockExclusive(&g_config.publish_lock);
+			source = g_config.current ? g_config.current->config : DEFAULT_CONFIG;
+			ReleaseSRWLockExclusive(&g_config.publish_lock);
 		}
 
-		LeaveCriticalSection(&g_cs);
-
-		// Reset countermeasures flag after 30 seconds
-		Sleep(30000);
-		g_stats.countermeasures_active = false;
+		// Another configuration written to dbj_ping.ini is left for the watcher to reload
+		if (!save_configuration(path ? path : g_config_path, &source)) {
+			result = ERROR_WRITE_FAULT;
+			__leave;
+		}
+		result = ERROR_SUCCESS;
 	}
 	__finally {
-		// Ensure we leave critical section on any exit
-		if (g_stats.countermeasures_active) {
-			g_stats.countermeasures_active = false;
-		}
+		if (locked) ReleaseSRWLockExclusive(&g_config.save_lock);
 	}
+
+	return result;
 }
 
-// Switch to next backup DNS server
-static bool switch_dns_server(void) {
-	int result = 0;
-	HANDLE hProcess = NULL;
-	HANDLE hThread = NULL;
+PING_API DWORD __stdcall ping_get_config_stats(ping_config_stats_t* stats) {
+	DWORD result = ERROR_EXCEPTION_IN_SERVICE;
 
 	__try {
-		if (g_stats.current_dns_index >= g_config.backup_dns_count - 1) {
-			g_stats.current_dns_index = 0;
-		}
-		else {
-			g_stats.current_dns_index++;
+		if (!stats) {
+			result = ERROR_INVALID_PARAMETER;
+			__leave;
 		}
 
-		const char* new_dns = g_config.backup_dns[g_stats.current_dns_index];
+		config_ref_t ref;
+		config_acquire(&ref);
+		stats->version = ref.snapshot ? ref.snapshot->version : 0;
+		config_release(&ref);
+		stats->reloads = (ULONGLONG)g_config.reloads;
+		stats->reload_failures = (ULONGLONG)g_config.reload_failures;
+		stats->reclaimed = (ULONGLONG)g_config.reclaimed;
+		stats->saves = (ULONGLONG)g_config.saves;
+		result = ERROR_SUCCESS;
+	}
+	__finally {
+		// Nothing to cleanup here
+	}
 
-		// Attempt to change DNS via netsh (requires elevated privileges)
-		char command[256];
-		snprintf(command, sizeof(command),
-			"netsh interface ip set dns \"Local Area Connection\" static %s", new_dns);
+	return result;
+}
 
-		STARTUPINFOA si = { 0 };
-		PROCESS_INFORMATION pi = { 0 };
-		si.cb = sizeof(si);
-		si.dwFlags = STARTF_USESHOWWINDOW;
-		si.wShowWindow = SW_HIDE;
+PING_API DWORD __stdcall ping_reset_stats(void) {
+	DWORD result = ERROR_EXCEPTION_IN_SERVICE;
 
-		if (!CreateProcessA(NULL, command, NULL, NULL, FALSE, 0, NULL, NULL, &si, &pi)) {
+	__try {
+		if (!g_initialized) {
+			result = ERROR_NOT_READY;
 			__leave;
 		}
 
-		hProcess = pi.hProcess;
-		hThread = pi.hThread;
+		init_stats();
 
-		WaitForSingleObject(pi.hProcess, 5000);
+		InterlockedExchange64(&g_engine.probes_submitted, 0);
+		InterlockedExchange64(&g_engine.probes_completed, 0);
+		InterlockedExchange64(&g_engine.engine_calls, 0);
+		QueryPerformanceCounter(&g_engine.stats_start);
 
-		dbj_log(LOG_INFO, "DNS switched to: %s", new_dns);
-		result = 1;
+		dbj_log(LOG_INFO, "Statistics reset");
+		result = ERROR_SUCCESS;
 	}
 	__finally {
-		if (hProcess) CloseHandle(hProcess);
-		if (hThread) CloseHandle(hThread);
+		// Nothing to cleanup here
 	}
 
-	return result != 0;
+	return result;
 }
 
-// Refresh network route
-static bool refresh_network_route(void) {
-	int result = 0;
-	HANDLE hProcess = NULL;
-	HANDLE hThread = NULL;
+PING_API DWORD __stdcall ping_force_countermeasures(void) {
+	DWORD result = ERROR_EXCEPTION_IN_SERVICE;
 
 	__try {
-		// Flush ARP table
-		STARTUPINFOA si = { 0 };
-		PROCESS_INFORMATION pi = { 0 };
-		si.cb = sizeof(si);
-		si.dwFlags = STARTF_USESHOWWINDOW;
-		si.wShowWindow = SW_HIDE;
-
-		char command[] = "arp -d *";
-		if (!CreateProcessA(NULL, command, NULL, NULL, FALSE, 0, NULL, NULL, &si, &pi)) {
+		if (!g_initialized) {
+			result = ERROR_NOT_READY;
 			__leave;
 		}
 
-		hProcess = pi.hProcess;
-		hThread = pi.hThread;
-
-		WaitForSingleObject(pi.hProcess, 5000);
-		result = 1;
+		dbj_log(LOG_INFO, "Forcing countermeasures activation");
+		trigger_countermeasures(PING_BREACH_FORCED, 0);
+		result = ERROR_SUCCESS;
 	}
 	__finally {
-		if (hProcess) CloseHandle(hProcess);
-		if (hThread) CloseHandle(hThread);
+		// Nothing to cleanup here
 	}
 
-	return result != 0;
+	return result;
 }
 
-// Flush DNS cache
-static bool flush_dns_cache(void) {
-	int result = 0;
-	HANDLE hProcess = NULL;
-	HANDLE hThread = NULL;
+PING_API DWORD __stdcall ping_get_countermeasure_status(ping_countermeasure_status_t* status) {
+	DWORD result = ERROR_EXCEPTION_IN_SERVICE;
 
 	__try {
-		STARTUPINFOA si = { 0 };
-		PROCESS_INFORMATION pi = { 0 };
-		si.cb = sizeof(si);
-		si.dwFlags = STARTF_USESHOWWINDOW;
-		si.wShowWindow = SW_HIDE;
+		if (!g_initialized) {
+			result = ERROR_NOT_READY;
+			__leave;
+		}
 
-		char command[] = "ipconfig /flushdns";
-		if (!CreateProcessA(NULL, command, NULL, NULL, FALSE, 0, NULL, NULL, &si, &pi)) {
+		if (!status) {
+			result = ERROR_INVALID_PARAMETER;
 			__leave;
 		}
 
-		hProcess = pi.hProcess;
-		hThread = pi.hThread;
+		memset(status, 0, sizeof(ping_countermeasure_status_t));
+		status->state = (DWORD)countermeasure_state();
+		status->pending_reasons = (DWORD)g_countermeasure.pending;
+		status->last_reasons = (DWORD)g_countermeasure.last_reasons;
+		status->last_actions = (DWORD)g_countermeasure.last_actions;
+		if (status->state == PING_COUNTERMEASURE_COOLDOWN) {
+			status->cooldown_remaining_ms = (DWORD)(((ULONGLONG)g_countermeasure.cooldown_until_ns - monotonic_ns()) / 1000000ULL);
+		}
+		status->triggers = (ULONGLONG)g_countermeasure.triggers;
+		status->runs = (ULONGLONG)g_countermeasure.runs;
+		status->coalesced = (ULONGLONG)g_countermeasure.coalesced;
+		status->suppressed = (ULONGLONG)g_countermeasure.suppressed;
+		status->last_duration_ms = (double)g_countermeasure.last_duration_ns / 1000000.0;
+		for (int i = 0; i < PING_MAX_COUNTERMEASURES; i++) {
+			status->action_status[i] = (DWORD)g_countermeasure.action_status[i];
+			status->action_ms[i] = (double)g_countermeasure.action_ns[i] / 1000000.0;
+		}
 
-		WaitForSingleObject(pi.hProcess, 5000);
-		result = 1;
+		LONG64 last_completed = g_countermeasure.last_completed;
+		FILETIME last_completed_time;
+		last_completed_time.dwLowDateTime = (DWORD)last_completed;
+		last_completed_time.dwHighDateTime = (DWORD)(last_completed >> 32);
+		FileTimeToSystemTime(&last_completed_time, &status->last_completed);
+		result = ERROR_SUCCESS;
 	}
 	__finally {
-		if (hProcess) CloseHandle(hProcess);
-		if (hThread) CloseHandle(hThread);
+		// Nothing to cleanup here
 	}
 
-	return result != 0;
+	return result;
 }
 
-#pragma endregion
-
-#pragma region DLL_API_Functions
-
-// DLL exported functions
-PING_API DWORD __stdcall ping_initialize(void) {
+PING_API DWORD __stdcall ping_register_countermeasure(const ping_countermeasure_t* countermeasure, DWORD* id) {
 	DWORD result = ERROR_EXCEPTION_IN_SERVICE;
-	WSADATA wsaData;
 
 	__try {
-		if (g_initialized) {
-			result = ERROR_ALREADY_INITIALIZED;
+		if (!g_initialized) {
+			result = ERROR_NOT_READY;
 			__leave;
 		}
 
-		InitializeCriticalSection(&g_cs);
-
-		// Initialize WinSock
-		int wsa_result = WSAStartup(MAKEWORD(2, 2), &wsaData);
-		if (wsa_result != 0) {
-			dbj_log(LOG_ERROR, "WSAStartup failed: %d", wsa_result);
-			result = ERROR_NETWORK_UNREACHABLE;
+		if (!countermeasure || !countermeasure->run || !countermeasure->triggers || !id) {
+			result = ERROR_INVALID_PARAMETER;
 			__leave;
 		}
 
-		// Create ICMP handle
-		g_icmp_handle = IcmpCreateFile();
-		if (g_icmp_handle == INVALID_HANDLE_VALUE) {
-			dbj_log(LOG_ERROR, "IcmpCreateFile failed: %lu", GetLastError());
-			WSACleanup();
-			result = GetLastError();
+		result = countermeasure_register(countermeasure, id);
+	}
+	__finally {
+		// Nothing to cleanup here
+	}
+
+	return result;
+}
+
+PING_API DWORD __stdcall ping_unregister_countermeasure(DWORD id) {
+	DWORD result = ERROR_EXCEPTION_IN_SERVICE;
+
+	__try {
+		if (!g_initialized) {
+			result = ERROR_NOT_READY;
 			__leave;
 		}
 
-		// Load configuration
-		if (!load_configuration()) {
-			IcmpCloseHandle(g_icmp_handle);
-			WSACleanup();
+		if (id == 0 || id > PING_MAX_COUNTERMEASURES) {
 			result = ERROR_INVALID_PARAMETER;
 			__leave;
 		}
 
-		init_stats();
-		g_initialized = true;
-
-		dbj_log(LOG_INFO, "dbj_ping DLL initialized successfully");
-		result = ERROR_SUCCESS;
+		// A run in progress carries on, it is no longer counted
+		AcquireSRWLockExclusive(&g_countermeasure_registry.lock);
+		countermeasure_entry_t* entry = &g_countermeasure_registry.entries[id - 1];
+		result = entry->used ? ERROR_SUCCESS : ERROR_NOT_FOUND;
+		entry->used = false;
+		ReleaseSRWLockExclusive(&g_countermeasure_registry.lock);
 	}
 	__finally {
-		// Cleanup handled in __try block
+		// Nothing to cleanup here
 	}
 
 	return result;
 }
 
-PING_API DWORD __stdcall ping_execute(const char* target, ping_result_t* result) {
-	DWORD api_result = ERROR_EXCEPTION_IN_SERVICE;
+PING_API DWORD __stdcall ping_get_countermeasure_info(DWORD id, ping_countermeasure_info_t* info) {
+	DWORD result = ERROR_EXCEPTION_IN_SERVICE;
+	bool locked = false;
 
 	__try {
 		if (!g_initialized) {
-			api_result = ERROR_NOT_READY;
+			result = ERROR_NOT_READY;
 			__leave;
 		}
 
-		if (!target || !result) {
-			api_result = ERROR_INVALID_PARAMETER;
+		if (id == 0 || id > PING_MAX_COUNTERMEASURES || !info) {
+			result = ERROR_INVALID_PARAMETER;
 			__leave;
 		}
 
-		// Use configured target if none specified
-		const char* ping_target = (strlen(target) > 0) ? target : g_config.target;
-
-		bool success = perform_ping(ping_target, result);
-
-		// Update statistics
-		EnterCriticalSection(&g_cs);
-		g_stats.packets_sent++;
+		AcquireSRWLockShared(&g_countermeasure_registry.lock);
+		locked = true;
+		const countermeasure_entry_t* entry = &g_countermeasure_registry.entries[id - 1];
+		if (!entry->used) {
+			result = ERROR_NOT_FOUND;
+			__leave;
+		}
 
-		if (success) {
-			g_stats.packets_received++;
+		memset(info, 0, sizeof(ping_countermeasure_info_t));
+		info->countermeasure = entry->countermeasure;
+		info->runs = entry->runs;
+		info->failures = entry->failures;
+		info->timeouts = entry->timeouts;
+		info->skipped = entry->skipped;
+		info->last_status = entry->last_status;
+		info->last_ms = entry->last_ns / 1000000.0;
+
+		ping_rtt_histogram_t* histogram = &info->execution_times;
+		histogram->sub_bucket_bits = ACTION_HIST_SUB_BITS;
+		histogram->unit_shift = ACTION_HIST_UNIT_SHIFT;
+		histogram->bucket_count = ACTION_HIST_BUCKETS;
+		histogram->min_rtt_ns = entry->min_ns;
+		histogram->max_rtt_ns = entry->max_ns;
+		for (int i = 0; i < ACTION_HIST_BUCKETS; i++) {
+			histogram->counts[i] = entry->execution_times[i];
+			histogram->total_count += entry->execution_times[i];
+		}
+		result = ERROR_SUCCESS;
+	}
+	__finally {
+		if (locked) ReleaseSRWLockShared(&g_countermeasure_registry.lock);
+	}
 
-			// Update RTT statistics
-			double rtt = (double)result->rtt_ms;
-			if (rtt < g_stats.min_rtt) g_stats.min_rtt = rtt;
-			if (rtt > g_stats.max_rtt) g_stats.max_rtt = rtt;
+	return result;
+}
 
-			// Calculate running average
-			g_stats.avg_rtt = ((g_stats.avg_rtt * (g_stats.packets_received - 1)) + rtt) / g_stats.packets_received;
+PING_API void __cdecl ping_log(log_kind_t kind, const char* format, ...) {
+	__try {
+		if (!format) {
+			__leave;
+		}
 
-			// Simple jitter calculation (standard deviation approximation)
-			if (g_stats.packets_received > 1) {
-				double diff = rtt - g_stats.avg_rtt;
-				g_stats.jitter = (g_stats.jitter * 0.9) + (fabs(diff) * 0.1);
-			}
+		// The caller's buffer may be gone by the time the drain thread formats, only the library's copy goes in.
+		// Past the intern table the text is formatted now and goes in as a string argument
+		va_list args;
+		va_start(args, format);
+		const char* interned = log_intern(format);
+		if (interned) {
+			log_enqueue(kind, interned, args);
 		}
 		else {
-			g_stats.packets_lost++;
+			char text[MAX_LOG_MSG];
+			vsnprintf_s(text, sizeof(text), _TRUNCATE, format, args);
+			dbj_log(kind, "%s", text);
 		}
+		va_end(args);
+	}
+	__finally {
+		// Nothing to cleanup here
+	}
+}
 
-		LeaveCriticalSection(&g_cs);
-
-		// Analyze network health every 5 pings
-		if (g_stats.packets_sent % 5 == 0) {
-			analyze_network_health();
-		}
+PING_API DWORD __stdcall ping_set_log_sink(ping_log_sink_fn sink, void* context) {
+	DWORD result = ERROR_EXCEPTION_IN_SERVICE;
 
-		api_result = success ? ERROR_SUCCESS : ERROR_NETWORK_UNREACHABLE;
+	__try {
+		log_set_sink(sink, context, NULL, NULL);
+		result = ERROR_SUCCESS;
 	}
 	__finally {
 		// Nothing to cleanup here
 	}
 
-	return api_result;
+	return result;
 }
 
-PING_API DWORD __stdcall ping_get_stats(ping_stats_t* stats) {
+PING_API DWORD __stdcall ping_set_log_file(const char* path) {
 	DWORD result = ERROR_EXCEPTION_IN_SERVICE;
 
 	__try {
-		if (!g_initialized || !stats) {
-			result = ERROR_INVALID_PARAMETER;
+		if (!path || !path[0]) {
+			log_set_sink(NULL, NULL, NULL, NULL);
+			result = ERROR_SUCCESS;
 			__leave;
 		}
 
-		EnterCriticalSection(&g_cs);
-		memcpy(stats, &g_stats, sizeof(ping_stats_t));
-		LeaveCriticalSection(&g_cs);
+		// Appends from wherever the file ends, others may read or rotate it meanwhile
+		HANDLE file = CreateFileA(path, FILE_APPEND_DATA, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+			NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (file == INVALID_HANDLE_VALUE) {
+			result = GetLastError();
+			__leave;
+		}
 
+		log_set_sink(log_sink_file, file, file, NULL);
 		result = ERROR_SUCCESS;
 	}
 	__finally {
@@ -927,61 +7199,191 @@ PING_API DWORD __stdcall ping_get_stats(ping_stats_t* stats) {
 	return result;
 }
 
-PING_API DWORD __stdcall ping_get_config(ping_config_t* config) {
+PING_API DWORD __stdcall ping_set_log_binary_file(const char* path) {
 	DWORD result = ERROR_EXCEPTION_IN_SERVICE;
+	log_binary_t* binary = NULL;
 
 	__try {
-		if (!g_initialized || !config) {
+		if (!path || !path[0]) {
 			result = ERROR_INVALID_PARAMETER;
 			__leave;
 		}
 
-		memcpy(config, &g_config, sizeof(ping_config_t));
+		binary = (log_binary_t*)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(log_binary_t));
+		if (!binary) {
+			result = ERROR_NOT_ENOUGH_MEMORY;
+			__leave;
+		}
+
+		// Every opening starts with the magic, format ids written after it start again from 0
+		binary->file = CreateFileA(path, FILE_APPEND_DATA, FILE_SHARE_READ | FILE_SHARE_DELETE,
+			NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (binary->file == INVALID_HANDLE_VALUE) {
+			result = GetLastError();
+			__leave;
+		}
+		memcpy(binary->buffer, LOG_FILE_MAGIC, LOG_FILE_MAGIC_SIZE);
+		binary->used = LOG_FILE_MAGIC_SIZE;
+
+		log_set_sink(NULL, NULL, NULL, binary);
+		binary = NULL;
 		result = ERROR_SUCCESS;
 	}
 	__finally {
-		// Nothing to cleanup here
+		if (binary) {
+			if (binary->file != INVALID_HANDLE_VALUE) CloseHandle(binary->file);
+			HeapFree(GetProcessHeap(), 0, binary);
+		}
 	}
 
 	return result;
 }
 
-PING_API DWORD __stdcall ping_set_config(const ping_config_t* config) {
+PING_API DWORD __stdcall ping_decode_log(const char* binary_path, const char* text_path) {
 	DWORD result = ERROR_EXCEPTION_IN_SERVICE;
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = NULL;
+	const BYTE* view = NULL;
+	HANDLE out = INVALID_HANDLE_VALUE;
+	const char** formats = NULL;
+	BYTE* buffer = NULL;
 
 	__try {
-		if (!g_initialized || !config) {
+		if (!binary_path) {
 			result = ERROR_INVALID_PARAMETER;
 			__leave;
 		}
 
-		memcpy(&g_config, config, sizeof(ping_config_t));
-		save_configuration();
+		file = CreateFileA(binary_path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (file == INVALID_HANDLE_VALUE) {
+			result = GetLastError();
+			__leave;
+		}
+		LARGE_INTEGER file_size;
+		if (!GetFileSizeEx(file, &file_size)) {
+			result = GetLastError();
+			__leave;
+		}
+		if (file_size.QuadPart < LOG_FILE_MAGIC_SIZE || (ULONGLONG)file_size.QuadPart > (SIZE_T)-1) {
+			result = ERROR_INVALID_DATA;
+			__leave;
+		}
+		size_t size = (size_t)file_size.QuadPart;
+
+		mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		view = mapping ? (const BYTE*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+		if (!view) {
+			result = GetLastError();
+			__leave;
+		}
+		if (memcmp(view, LOG_FILE_MAGIC, LOG_FILE_MAGIC_SIZE) != 0) {
+			result = ERROR_INVALID_DATA;
+			__leave;
+		}
+
+		out = text_path ? CreateFileA(text_path, GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL)
+			: GetStdHandle(STD_OUTPUT_HANDLE);
+		formats = (const char**)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(const char*) * LOG_MAX_FORMATS);
+		buffer = (BYTE*)HeapAlloc(GetProcessHeap(), 0, LOG_FILE_BUFFER);
+		if (out == INVALID_HANDLE_VALUE || !formats || !buffer) {
+			result = out == INVALID_HANDLE_VALUE ? GetLastError() : ERROR_NOT_ENOUGH_MEMORY;
+			__leave;
+		}
 
-		dbj_log(LOG_INFO, "Configuration updated");
+		// A record cut short at the end is what a process that died mid-write leaves, it ends the file
+		DWORD used = 0;
+		size_t offset = 0;
 		result = ERROR_SUCCESS;
+		while (offset < size) {
+			// Record types are small numbers, the magic never looks like a header
+			if (size - offset >= LOG_FILE_MAGIC_SIZE && memcmp(view + offset, LOG_FILE_MAGIC, LOG_FILE_MAGIC_SIZE) == 0) {
+				memset((void*)formats, 0, sizeof(const char*) * LOG_MAX_FORMATS);
+				offset += LOG_FILE_MAGIC_SIZE;
+				continue;
+			}
+			if (size - offset < sizeof(log_file_record_t)) {
+				break;
+			}
+
+			log_file_record_t header;
+			memcpy(&header, view + offset, sizeof(header));
+			const char* payload = (const char*)view + offset + sizeof(header);
+			if (offset + sizeof(header) + header.size > size) {
+				break;
+			}
+
+			char text[MAX_LOG_MSG];
+			if (header.type == LOG_FILE_FORMAT) {
+				if (header.format_id >= LOG_MAX_FORMATS || header.size == 0 || payload[header.size - 1] != '\0') {
+					result = ERROR_INVALID_DATA;
+					__leave;
+				}
+				formats[header.format_id] = payload;
+			}
+			else if (header.type == LOG_FILE_MESSAGE || header.type == LOG_FILE_TEXT) {
+				if (header.type == LOG_FILE_TEXT) {
+					size_t length = header.size < sizeof(text) ? header.size : sizeof(text) - 1;
+					memcpy(text, payload, length);
+					text[length] = '\0';
+				}
+				else if (header.format_id >= LOG_MAX_FORMATS || !formats[header.format_id] ||
+					!log_render(formats[header.format_id], (const BYTE*)payload, header.size, text, sizeof(text))) {
+					result = ERROR_INVALID_DATA;
+					__leave;
+				}
+
+				FILETIME time;
+				time.dwLowDateTime = (DWORD)header.time;
+				time.dwHighDateTime = (DWORD)(header.time >> 32);
+				if (used + MAX_LOG_MSG + 48 > LOG_FILE_BUFFER) {
+					DWORD written = 0;
+					WriteFile(out, buffer, used, &written, NULL);
+					used = 0;
+				}
+				int length = log_format_line((char*)buffer + used, LOG_FILE_BUFFER - used, (log_kind_t)header.kind, &time, text);
+				if (length > 0) used += (DWORD)length;
+			}
+			else {
+				result = ERROR_INVALID_DATA;
+				__leave;
+			}
+			offset += sizeof(header) + header.size;
+		}
+
+		if (used > 0) {
+			DWORD written = 0;
+			WriteFile(out, buffer, used, &written, NULL);
+		}
 	}
 	__finally {
-		// Nothing to cleanup here
+		if (buffer) HeapFree(GetProcessHeap(), 0, buffer);
+		if (formats) HeapFree(GetProcessHeap(), 0, (void*)formats);
+		if (out != INVALID_HANDLE_VALUE && text_path) CloseHandle(out);
+		if (view) UnmapViewOfFile(view);
+		if (mapping) CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
 	}
 
 	return result;
 }
 
-PING_API DWORD __stdcall ping_reset_stats(void) {
+PING_API DWORD __stdcall ping_get_log_stats(ping_log_stats_t* stats) {
 	DWORD result = ERROR_EXCEPTION_IN_SERVICE;
 
 	__try {
-		if (!g_initialized) {
-			result = ERROR_NOT_READY;
+		if (!stats) {
+			result = ERROR_INVALID_PARAMETER;
 			__leave;
 		}
 
-		EnterCriticalSection(&g_cs);
-		init_stats();
-		LeaveCriticalSection(&g_cs);
+		LONG64 dequeued = log_read64(&g_log.dequeue.position);
+		LONG64 enqueued = log_read64(&g_log.enqueue.position);
+		stats->enqueued = (ULONGLONG)enqueued;
+		stats->written = (ULONGLONG)dequeued;
+		stats->dropped = (ULONGLONG)log_read64(&g_log.dropped);
+		stats->capacity = LOG_RING_RECORDS;
+		stats->pending = enqueued > dequeued ? (DWORD)(enqueued - dequeued) : 0;
 
-		dbj_log(LOG_INFO, "Statistics reset");
 		result = ERROR_SUCCESS;
 	}
 	__finally {
@@ -991,17 +7393,26 @@ PING_API DWORD __stdcall ping_reset_stats(void) {
 	return result;
 }
 
-PING_API DWORD __stdcall ping_force_countermeasures(void) {
+PING_API DWORD __stdcall ping_flush_log(DWORD timeout_ms) {
 	DWORD result = ERROR_EXCEPTION_IN_SERVICE;
 
 	__try {
-		if (!g_initialized) {
-			result = ERROR_NOT_READY;
-			__leave;
+		// Everything enqueued before the call, later messages are not waited for
+		LONG64 target = log_read64(&g_log.enqueue.position);
+		ULONGLONG deadline = GetTickCount64() + timeout_ms;
+		while (g_log.running && log_read64(&g_log.dequeue.position) < target) {
+			if (GetTickCount64() >= deadline) {
+				result = ERROR_TIMEOUT;
+				__leave;
+			}
+			if (InterlockedExchange(&g_log.sleeping, 0)) SetEvent(g_log.wake_event);
+			Sleep(1);
 		}
 
-		dbj_log(LOG_INFO, "Forcing countermeasures activation");
-		trigger_countermeasures();
+		// The drain pass that wrote them holds the lock until its binary buffer is on disk
+		AcquireSRWLockExclusive(&g_log.sink_lock);
+		ReleaseSRWLockExclusive(&g_log.sink_lock);
+
 		result = ERROR_SUCCESS;
 	}
 	__finally {
@@ -1019,6 +7430,12 @@ PING_API void __stdcall ping_cleanup(void) {
 
 		g_initialized = false;
 
+		schedule_stop();
+		engine_stop();
+		countermeasure_stop();
+		target_series_free();
+		config_stop();
+
 		if (g_icmp_handle != INVALID_HANDLE_VALUE) {
 			IcmpCloseHandle(g_icmp_handle);
 			g_icmp_handle = INVALID_HANDLE_VALUE;
@@ -1027,7 +7444,16 @@ PING_API void __stdcall ping_cleanup(void) {
 		WSACleanup();
 		DeleteCriticalSection(&g_cs);
 
+		// Shards keep their counts, the next initialize moves past them with a new epoch
+		DWORD stats_tls = g_stats_tls;
+		g_stats_tls = TLS_OUT_OF_INDEXES;
+		TlsFree(stats_tls);
+		for (int i = 0; i < STATS_SHARDS; i++) {
+			InterlockedExchange(&g_stats_shards[i].owner, 0);
+		}
+
 		dbj_log(LOG_INFO, "dbj_ping DLL cleaned up");
+		log_stop();
 	}
 	__finally {
 		// Nothing to cleanup here
@@ -1048,9 +7474,14 @@ BOOL APIENTRY DllMain(HMODULE hModule, DWORD ul_reason_for_call, LPVOID lpReserv
 		case DLL_THREAD_ATTACH:
 			break;
 		case DLL_THREAD_DETACH:
+			stats_release_shard();
 			break;
 		case DLL_PROCESS_DETACH:
-			ping_cleanup();
+			// No joins under the loader lock, an exiting thread needs it. At process exit (lpReserved set)
+			// the threads are gone already, on FreeLibrary the caller must have called ping_cleanup
+			if (g_initialized && !lpReserved) {
+				OutputDebugStringA("dbj_ping: unloaded without ping_cleanup, its threads are still running\n");
+			}
 			break;
 		}
 	}
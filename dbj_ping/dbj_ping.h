@@ -18,6 +18,34 @@ extern "C" {
 #define MAX_TARGET_LEN 256
 #define MAX_BACKUP_DNS 8
 #define MAX_LOG_MSG 0xFF
+#define PING_HISTOGRAM_MAX_BUCKETS 1024
+#define PING_SKETCH_BINS 1280
+#define PING_SKETCH_MAX_BYTES (48 + PING_SKETCH_BINS * 12)
+#define PING_HISTORY_SAMPLES 320
+
+// Probe record status: 0 for a reply, IP_STATUS_BASE + n for IP status n, PING_RECORD_OTHER for any other error
+#define PING_RECORD_OK 0
+#define PING_RECORD_OTHER 0xFF
+
+// Why countermeasures were triggered
+#define PING_BREACH_LOSS 0x1
+#define PING_BREACH_LATENCY 0x2
+#define PING_BREACH_JITTER 0x4
+#define PING_BREACH_FORCED 0x8
+
+// Countermeasure worker states
+#define PING_COUNTERMEASURE_IDLE 0
+#define PING_COUNTERMEASURE_QUEUED 1
+#define PING_COUNTERMEASURE_RUNNING 2
+#define PING_COUNTERMEASURE_COOLDOWN 3
+
+// Countermeasures a run applied, bit id - 1 of each, the built-in ones take the first ids
+#define PING_ACTION_DNS_SWITCH 0x1
+#define PING_ACTION_ROUTE_REFRESH 0x2
+#define PING_ACTION_DNS_FLUSH 0x4
+#define PING_ACTION_COUNT 3
+#define PING_MAX_COUNTERMEASURES 16
+#define PING_COUNTERMEASURE_NAME_LEN 32
 
 // Log levels
 typedef enum {
@@ -42,8 +70,34 @@ typedef struct {
     bool enable_logging;
     char backup_dns[MAX_BACKUP_DNS][16];
     DWORD backup_dns_count;
+    DWORD engine_batch_size;
+    char resolver_dns[16];
+    DWORD resolver_threads;
+    DWORD short_window_ms;
+    DWORD long_window_ms;
+    DWORD countermeasure_cooldown_ms;
+    DWORD countermeasure_settle_ms;
+    DWORD scheduled_completions;
 } ping_config_t;
 
+// First problem found in a configuration file, and how many there were
+typedef struct {
+    DWORD line;
+    DWORD column;
+    DWORD errors; // bad values and lines, the file fails to parse
+    DWORD warnings; // unknown keys, skipped, the file still parses
+    char message[128]; // the first error, or the first warning if there was no error
+} ping_config_error_t;
+
+// Configuration counters since the DLL was loaded
+typedef struct {
+    ULONGLONG version; // of the snapshot readers get now
+    ULONGLONG reloads; // snapshots published because dbj_ping.ini changed
+    ULONGLONG reload_failures; // changes that could not be read or parsed, the running snapshot stayed
+    ULONGLONG reclaimed; // snapshots freed after their last reader left
+    ULONGLONG saves; // writes of a whole configuration file
+} ping_config_stats_t;
+
 // Ping statistics
 typedef struct {
     DWORD packets_sent;
@@ -58,6 +112,37 @@ typedef struct {
     SYSTEMTIME last_countermeasure;
 } ping_stats_t;
 
+// Where countermeasures stand and how they went
+typedef struct {
+    DWORD state; // PING_COUNTERMEASURE_*
+    DWORD pending_reasons; // PING_BREACH_* waiting for the worker
+    DWORD last_reasons; // PING_BREACH_* that caused the last run
+    DWORD last_actions; // bit id - 1 of each countermeasure the last run applied
+    DWORD cooldown_remaining_ms;
+    ULONGLONG triggers;
+    ULONGLONG runs;
+    ULONGLONG coalesced; // triggers folded into a queued or running one
+    ULONGLONG suppressed; // triggers that arrived during the cooldown
+    double last_duration_ms;
+    SYSTEMTIME last_completed;
+    DWORD action_status[PING_MAX_COUNTERMEASURES]; // by id - 1 for the last run, ERROR_CANCELLED if it did not run, ERROR_TIMEOUT if not back in time
+    double action_ms[PING_MAX_COUNTERMEASURES];
+} ping_countermeasure_status_t;
+
+// A countermeasure, returns a Win32 status, runs on a thread pool thread
+typedef DWORD(__stdcall* ping_countermeasure_fn)(void* context);
+
+// Registration of a countermeasure
+typedef struct {
+    char name[PING_COUNTERMEASURE_NAME_LEN];
+    ping_countermeasure_fn run;
+    void* context;
+    DWORD cost; // cheaper ones run first, those of equal cost run concurrently
+    DWORD timeout_ms; // the run is not waited for longer, it is left to finish on its own
+    DWORD cooldown_ms; // after its own last run, on top of the shared cooldown
+    DWORD triggers; // PING_BREACH_* it answers
+} ping_countermeasure_t;
+
 // Ping result structure
 typedef struct {
     bool success;
@@ -67,6 +152,171 @@ typedef struct {
     SYSTEMTIME timestamp;
 } ping_result_t;
 
+// Ping result with nanosecond timing on the monotonic clock
+typedef struct {
+    ping_result_t base;
+    ULONGLONG rtt_ns;
+    ULONGLONG send_time_ns;
+    ULONGLONG recv_time_ns;
+} ping_result_ex_t;
+
+// Asynchronous probe completion
+typedef struct {
+    ULONGLONG ticket;
+    ping_result_t result;
+    ULONGLONG rtt_ns;
+    ULONGLONG send_time_ns;
+} ping_completion_t;
+
+// Probe engine throughput counters, engine_calls counts the wake, wait and send calls the engine makes,
+// tallied at each call site rather than measured as kernel transitions
+typedef struct {
+    ULONGLONG probes_submitted;
+    ULONGLONG probes_completed;
+    ULONGLONG engine_calls;
+    double elapsed_ms;
+    double probes_per_second;
+    double engine_calls_per_probe;
+} ping_engine_stats_t;
+
+// Periodic probing counters, send error is the send stamp minus the deadline
+typedef struct {
+    bool running;
+    ULONGLONG start_ns;
+    ULONGLONG interval_ns;
+    ULONGLONG probes_sent;
+    ULONGLONG deadlines_missed;
+    double mean_send_error_us;
+    double max_send_error_us;
+    ULONGLONG targets;
+    ULONGLONG timer_events;
+    double timer_ns_per_probe;
+    double add_ns_per_target;
+    ULONGLONG completions_dropped; // scheduled results dropped past Engine ScheduledCompletions
+} ping_schedule_stats_t;
+
+// Resolver cache counters, lookups counts queries that actually left the process
+typedef struct {
+    ULONGLONG hits;
+    ULONGLONG negative_hits;
+    ULONGLONG misses;
+    ULONGLONG lookups;
+    ULONGLONG bypassed;
+    ULONGLONG evictions;
+    ULONGLONG coalesced;
+    DWORD entries;
+} ping_resolver_stats_t;
+
+// Loss, RTT and jitter over one window of recent samples
+typedef struct {
+    DWORD window_ms; // the configured span, or less when the window holds all PING_HISTORY_SAMPLES of the ring
+    DWORD samples;
+    DWORD lost;
+    double loss_percent;
+    double mean_rtt;
+    double stddev_rtt;
+    double jitter; // mean RFC 3550 transit difference between consecutive replies
+} ping_window_stats_t;
+
+// Statistics of one target address
+typedef struct {
+    char target_ip[16];
+    DWORD packets_sent;
+    DWORD packets_received;
+    DWORD packets_lost;
+    double min_rtt;
+    double max_rtt;
+    double avg_rtt;
+    double jitter;
+    double rtt_p50;
+    double rtt_p99;
+    double rtt_p999;
+    ping_window_stats_t short_window;
+    ping_window_stats_t long_window;
+    DWORD change; // PING_BREACH_LOSS and PING_BREACH_LATENCY the change detector holds
+    double change_confidence; // 1 - bound on the false alarm probability of the strongest score
+    DWORD change_detected_ms; // monotonic time of the last alarm
+    DWORD change_delay_ms; // from the estimated onset to that alarm
+    DWORD change_alarms;
+    bool degraded; // a window is past a threshold or a change is held, what health analysis acts on
+} ping_target_stats_t;
+
+// Raw RTT histogram: below 2^sub_bucket_bits units each unit has a bucket, above that every
+// power of two is split in 2^sub_bucket_bits buckets; a unit is 2^unit_shift nanoseconds
+typedef struct {
+    DWORD sub_bucket_bits;
+    DWORD unit_shift;
+    DWORD bucket_count;
+    ULONGLONG total_count;
+    ULONGLONG min_rtt_ns;
+    ULONGLONG max_rtt_ns;
+    ULONGLONG counts[PING_HISTOGRAM_MAX_BUCKETS];
+} ping_rtt_histogram_t;
+
+// A registered countermeasure and how its runs went
+typedef struct {
+    ping_countermeasure_t countermeasure;
+    ULONGLONG runs;
+    ULONGLONG failures;
+    ULONGLONG timeouts;
+    ULONGLONG skipped; // in its cooldown, or a timed out run had not returned yet
+    DWORD last_status;
+    double last_ms;
+    ping_rtt_histogram_t execution_times;
+} ping_countermeasure_info_t;
+
+// A log sink, called on the drain thread one message at a time, time is UTC
+typedef void(__stdcall* ping_log_sink_fn)(void* context, log_kind_t kind, const FILETIME* time, const char* text);
+
+// Log ring counters, dropped messages found the ring full
+typedef struct {
+    ULONGLONG enqueued;
+    ULONGLONG written;
+    ULONGLONG dropped;
+    DWORD capacity;
+    DWORD pending;
+} ping_log_stats_t;
+
+// Relative-error quantile sketch (1%), bins[i] counts RTTs in (gamma^(i-1), gamma^i] ns, gamma = 1.01 / 0.99
+// A zeroed sketch is a valid empty merge target
+typedef struct {
+    DWORD accuracy_ppm;
+    DWORD reserved;
+    ULONGLONG count;
+    ULONGLONG min_rtt_ns;
+    ULONGLONG max_rtt_ns;
+    ULONGLONG sum_rtt_ns;
+    ULONGLONG bins[PING_SKETCH_BINS];
+} ping_sketch_t;
+
+// One probe outcome packed for storage, 16 bytes, ping_record_to_result makes a ping_result_ex_t of it
+typedef struct {
+    ULONGLONG send_ns : 56; // monotonic send time like send_time_ns, wraps after 2.28 years
+    ULONGLONG status : 8; // PING_RECORD_OK, IP status - IP_STATUS_BASE or PING_RECORD_OTHER
+    DWORD target : 18; // slot in the per-target table
+    DWORD epoch : 14; // ping_reset_stats calls when recorded, after another one the record no longer names a target
+    DWORD rtt_us; // 0 unless status is PING_RECORD_OK
+} ping_record_t;
+
+// Read-only view of a target's history ring, record i of count is records[(first + i) % capacity]
+// The records are the library's own, valid until ping_cleanup; check ping_history_overwritten after reading
+typedef struct {
+    const ping_record_t* records;
+    DWORD capacity;
+    DWORD first; // the oldest
+    DWORD count;
+    LONG64 generation; // records ever written to the ring when the view was taken
+    const volatile LONG64* current; // the ring's generation now, bumped before a record is overwritten
+} ping_history_t;
+
+// Per-target table occupancy, untracked counts results dropped because the table was full
+typedef struct {
+    DWORD targets;
+    DWORD capacity;
+    ULONGLONG untracked;
+    ULONGLONG memory_bytes;
+} ping_target_table_stats_t;
+
 // DLL Function Declarations
 #ifdef DBJ_PING_EXPORTS
 #define PING_API __declspec(dllexport)
@@ -80,22 +330,150 @@ PING_API DWORD __stdcall ping_initialize(void);
 // Execute a single ping
 PING_API DWORD __stdcall ping_execute(const char* target, ping_result_t* result);
 
-// Get current statistics
+// Execute a single ping, RTT measured in nanoseconds
+PING_API DWORD __stdcall ping_execute_ex(const char* target, ping_result_ex_t* result_ex);
+
+// Ping many targets at once, all echo requests are in flight together
+// results[i] receives the outcome for targets[i]
+// Names not in the resolver cache are looked up in parallel first, the call returns after the slowest lookup and one timeout
+// Returns ERROR_SUCCESS only when every target replied
+PING_API DWORD __stdcall ping_execute_batch(const char* const* targets, DWORD count, ping_result_t* results);
+
+// Queue a ping and return immediately, the ticket identifies its completion
+// Names not in the resolver cache are looked up in the background, other probes go out meanwhile
+PING_API DWORD __stdcall ping_submit(const char* target, ULONGLONG* ticket);
+
+// Event signalled while completions are queued, owned by the DLL (do not close)
+PING_API DWORD __stdcall ping_get_completion_event(HANDLE* event);
+
+// Move up to max_count queued completions into the caller's array
+PING_API DWORD __stdcall ping_drain_completions(ping_completion_t* completions, DWORD max_count, DWORD* count);
+
+// Probe engine throughput since initialization or the last ping_reset_stats
+PING_API DWORD __stdcall ping_get_engine_stats(ping_engine_stats_t* stats);
+
+// Probe target every interval_ms on absolute monotonic deadlines, count 0 runs until stopped
+// Results arrive through ping_drain_completions, an empty target or 0 interval use the configuration
+// Only the newest Engine ScheduledCompletions results are kept undrained, older ones are dropped and counted
+PING_API DWORD __stdcall ping_schedule_start(const char* target, DWORD interval_ms, DWORD count);
+PING_API DWORD __stdcall ping_schedule_stop(void);
+
+// Add one more target to the schedule, its first deadline falls at a random point of the first interval
+// Any number of targets share one timing wheel, ping_schedule_start fails with ERROR_BUSY while any remain
+PING_API DWORD __stdcall ping_schedule_add(const char* target, DWORD interval_ms, DWORD count, ULONGLONG* schedule_id);
+PING_API DWORD __stdcall ping_schedule_remove(ULONGLONG schedule_id);
+
+// Deadline accuracy and timing wheel cost of the current or last schedule
+PING_API DWORD __stdcall ping_get_schedule_stats(ping_schedule_stats_t* stats);
+
+// RTT histogram of one target, or of all of them when target is NULL or empty
+// Global buckets are under 3.2% wide, per-target ones under 12.5%
+PING_API DWORD __stdcall ping_get_rtt_histogram(const char* target, ping_rtt_histogram_t* histogram);
+
+// RTT at or below which percentile (0..100) of the histogram's replies fall
+PING_API DWORD __stdcall ping_rtt_histogram_percentile(const ping_rtt_histogram_t* histogram, double percentile, double* rtt_ms);
+
+// Add from into into, a zeroed into takes from's layout, differing layouts are re-bucketed
+PING_API DWORD __stdcall ping_merge_rtt_histograms(ping_rtt_histogram_t* into, const ping_rtt_histogram_t* from);
+
+// Quantile sketch of one target, or of all of them when target is NULL or empty
+PING_API DWORD __stdcall ping_get_sketch(const char* target, ping_sketch_t* sketch);
+
+// Stable little-endian serialisation, at most PING_SKETCH_MAX_BYTES; *written is the size needed
+// ERROR_INSUFFICIENT_BUFFER when buffer is short
+PING_API DWORD __stdcall ping_sketch_serialize(const ping_sketch_t* sketch, BYTE* buffer, DWORD size, DWORD* written);
+
+// Add a serialised sketch from any host into into, a damaged one is refused whole
+PING_API DWORD __stdcall ping_sketch_merge(ping_sketch_t* into, const BYTE* data, DWORD size);
+
+// RTT at quantile (0..1), within 1% of the true value
+PING_API DWORD __stdcall ping_sketch_quantile(const ping_sketch_t* sketch, double quantile, double* rtt_ms);
+
+// Per-target table occupancy and its fixed memory footprint
+PING_API DWORD __stdcall ping_get_target_table_stats(ping_target_table_stats_t* stats);
+
+// Resolver cache counters since initialization
+PING_API DWORD __stdcall ping_get_resolver_stats(ping_resolver_stats_t* stats);
+
+// Get current statistics, RTT figures are milliseconds at nanosecond resolution
 PING_API DWORD __stdcall ping_get_stats(ping_stats_t* stats);
 
-// Get current configuration
+// Fold a result measured elsewhere into the statistics, safe from any number of threads
+PING_API DWORD __stdcall ping_record_result(const ping_result_ex_t* result_ex);
+
+// Statistics of one target, by name or address, ERROR_NOT_FOUND if it was never pinged since the last reset
+PING_API DWORD __stdcall ping_get_target_stats(const char* target, ping_target_stats_t* stats);
+
+// View of a target's last PING_HISTORY_SAMPLES records, nothing is copied, ERROR_NOT_FOUND as for ping_get_target_stats
+PING_API DWORD __stdcall ping_get_history(const char* target, ping_history_t* history);
+
+// Unpack a record into the API's result, RTT at microsecond resolution and the wall clock taken back from now
+// ERROR_NOT_FOUND with target_ip empty when the statistics were reset since the record was made
+PING_API DWORD __stdcall ping_record_to_result(const ping_record_t* record, ping_result_ex_t* result_ex);
+
+// How many of the view's oldest samples were overwritten or reset since it was taken, call after reading them
+PING_API DWORD __stdcall ping_history_overwritten(const ping_history_t* history);
+
+// Get current configuration, a consistent copy of one published snapshot
 PING_API DWORD __stdcall ping_get_config(ping_config_t* config);
 
-// Set new configuration
+// Set new configuration, live at once and saved to dbj_ping.ini 200 ms after the last of a burst of calls
 PING_API DWORD __stdcall ping_set_config(const ping_config_t* config);
 
+// Write config, NULL for the current one, to path, NULL for dbj_ping.ini, now: one write to path.tmp and a rename over path
+PING_API DWORD __stdcall ping_save_config(const char* path, const ping_config_t* config);
+
+// Parse INI text in one pass, ERROR_INVALID_DATA with the first problem's line and column,
+// config is filled either way and keys that were absent or bad keep their defaults; unknown keys are only warnings
+PING_API DWORD __stdcall ping_parse_config(const char* text, DWORD size, ping_config_t* config, ping_config_error_t* error);
+
+// Read an INI file with a single read and parse it without applying it, NULL path is dbj_ping.ini
+PING_API DWORD __stdcall ping_load_config(const char* path, ping_config_t* config, ping_config_error_t* error);
+
+// Snapshot version and hot reload counters, edits to dbj_ping.ini are picked up while initialized
+PING_API DWORD __stdcall ping_get_config_stats(ping_config_stats_t* stats);
+
 // Reset statistics
 PING_API DWORD __stdcall ping_reset_stats(void);
 
-// Force countermeasures activation (for testing)
+// Force countermeasures activation, queued for the worker thread, returns at once
 PING_API DWORD __stdcall ping_force_countermeasures(void);
 
-// Cleanup and release resources
+// State of the countermeasure worker and how its last run went
+PING_API DWORD __stdcall ping_get_countermeasure_status(ping_countermeasure_status_t* status);
+
+// Add a countermeasure to the registry, id identifies it to the calls below
+PING_API DWORD __stdcall ping_register_countermeasure(const ping_countermeasure_t* countermeasure, DWORD* id);
+
+// Remove a countermeasure, a run in progress is left to finish
+PING_API DWORD __stdcall ping_unregister_countermeasure(DWORD id);
+
+// A countermeasure's registration, run counts and execution time histogram
+PING_API DWORD __stdcall ping_get_countermeasure_info(DWORD id, ping_countermeasure_info_t* info);
+
+// Log through the library's ring: the caller only copies the arguments, the drain thread formats them
+// format may be any buffer, the library keeps its own copy of each distinct format; dropped if the ring is full
+PING_API void __cdecl ping_log(log_kind_t kind, const char* format, ...);
+
+// Where the drain thread writes, NULL for the Windows Event Log
+PING_API DWORD __stdcall ping_set_log_sink(ping_log_sink_fn sink, void* context);
+
+// Append to a file instead, NULL or "" goes back to the Windows Event Log
+PING_API DWORD __stdcall ping_set_log_file(const char* path);
+
+// Append binary records instead: each format once, then per message only its id and raw arguments
+PING_API DWORD __stdcall ping_set_log_binary_file(const char* path);
+
+// Turn a binary log file into text lines, to stdout when text_path is NULL
+PING_API DWORD __stdcall ping_decode_log(const char* binary_path, const char* text_path);
+
+PING_API DWORD __stdcall ping_get_log_stats(ping_log_stats_t* stats);
+
+// Wait until every message logged before the call is written
+PING_API DWORD __stdcall ping_flush_log(DWORD timeout_ms);
+
+// Cleanup and release resources, joins the library's threads
+// Call it before FreeLibrary, DllMain cannot join threads under the loader lock and does not clean up
 PING_API void __stdcall ping_cleanup(void);
 
 // Logging function (must be implemented by user)
@@ -38,6 +38,8 @@ typedef struct {
     int interval;           // -i interval (in ms)
     bool infinite;          // continuous ping
     bool help;              // -h or -?
+    char decode_path[MAX_PATH];  // -decode binary log
+    char decode_output[MAX_PATH]; // text file, stdout if empty
 } ping_options_t;
 
 static volatile bool g_interrupted = false;
@@ -108,6 +110,7 @@ void print_usage(void) {
     printf("    -i interval    Interval between pings in seconds (Unix-style)\n");
     printf("    -q             Quiet output\n");
     printf("    -v             Verbose output\n");
+    printf("    -decode log [out] Turn a binary dbj_ping log into text, to stdout without out\n");
     printf("    -h, -?, --help Show this help\n\n");
     printf("Examples:\n");
     printf("    dbj_ping google.com\n");
@@ -217,6 +220,18 @@ bool parse_arguments(int argc, char* argv[]) {
                     return false;
                 }
             }
+            else if (strcmp(arg, "decode") == 0) {
+                if (i + 1 < argc) {
+                    strncpy_s(g_options.decode_path, sizeof(g_options.decode_path), argv[++i], _TRUNCATE);
+                    if (i + 1 < argc && argv[i + 1][0] != '-' && argv[i + 1][0] != '/') {
+                        strncpy_s(g_options.decode_output, sizeof(g_options.decode_output), argv[++i], _TRUNCATE);
+                    }
+                }
+                else {
+                    printf("Error: -decode requires a log file\n");
+                    return false;
+                }
+            }
             else if (strcmp(arg, "version") == 0) {
                 print_version();
                 return false;
@@ -238,7 +253,7 @@ bool parse_arguments(int argc, char* argv[]) {
         }
     }
 
-    if (strlen(g_options.target) == 0 && !g_options.help) {
+    if (strlen(g_options.target) == 0 && !g_options.help && !g_options.decode_path[0]) {
         printf("Error: No target specified\n");
         return false;
     }
@@ -321,35 +336,39 @@ void print_statistics(void) {
 int execute_ping(void) {
     print_ping_header();
 
-    int pings_sent = 0;
+    int pings_received = 0;
     int max_pings = g_options.infinite ? INT_MAX : g_options.count;
+    ping_completion_t completions[16];
+
+    // The DLL sends on its own deadlines, this loop only prints what comes back
+    HANDLE completion_event = NULL;
+    if (ping_get_completion_event(&completion_event) != ERROR_SUCCESS ||
+        ping_schedule_start(g_options.target, g_options.interval, g_options.infinite ? 0 : g_options.count) != ERROR_SUCCESS) {
+        printf("Error: Failed to start pinging %s\n", g_options.target);
+        return 1;
+    }
 
-    while (pings_sent < max_pings && !g_interrupted) {
-        ping_result_t result;
-        DWORD status = ping_execute(g_options.target, &result);
-
-        pings_sent++;
-        print_ping_result(&result, pings_sent);
-
-        // Check if we should continue
-        if (pings_sent >= max_pings || g_interrupted) {
-            break;
+    while (pings_received < max_pings && !g_interrupted) {
+        // The timeout only bounds how late ESC is noticed, it does not pace the pings
+        if (WaitForSingleObject(completion_event, 50) == WAIT_OBJECT_0) {
+            DWORD count = 0;
+            ping_drain_completions(completions, sizeof(completions) / sizeof(completions[0]), &count);
+            for (DWORD i = 0; i < count; i++) {
+                pings_received++;
+                print_ping_result(&completions[i].result, pings_received);
+            }
         }
 
-        // Wait for next ping
-        DWORD wait_start = GetTickCount();
-        while ((GetTickCount() - wait_start) < (DWORD)g_options.interval && !g_interrupted) {
-            Sleep(50);
-            if (_kbhit()) {
-                int ch = _getch();
-                if (ch == 3 || ch == 27) { // Ctrl+C or ESC
-                    g_interrupted = true;
-                    break;
-                }
+        if (_kbhit()) {
+            int ch = _getch();
+            if (ch == 3 || ch == 27) { // Ctrl+C or ESC
+                g_interrupted = true;
             }
         }
     }
 
+    ping_schedule_stop();
+
     // Get final statistics
     ping_get_stats(&g_final_stats);
     print_statistics();
@@ -378,6 +397,16 @@ int main(int argc, char* argv[]) {
             return 0;
         }
 
+        // Decoding needs no network, the DLL is not initialized for it
+        if (g_options.decode_path[0]) {
+            DWORD status = ping_decode_log(g_options.decode_path, g_options.decode_output[0] ? g_options.decode_output : NULL);
+            if (status != ERROR_SUCCESS) {
+                printf("Error: Failed to decode %s (error %lu)\n", g_options.decode_path, status);
+                return 1;
+            }
+            return 0;
+        }
+
         // Initialize the DLL
         DWORD init_result = ping_initialize();
         if (init_result != ERROR_SUCCESS) {
@@ -7,17 +7,97 @@
 #pragma region Headers_and_Definitions
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#define WIN32_LEAN_AND_MEAN
 #include <windows.h>
+#include <winsock2.h>
 #include <conio.h>
 #include <time.h>
 #include <stdarg.h>
+#include <math.h>
 #include "dbj_ping.h"
 #include "minidump_writer.h"
 
 #pragma comment(lib, "dbj_ping.lib")
+#pragma comment(lib, "ws2_32.lib")
 
 #define TEST_TARGET_DEFAULT "8.8.8.8"
 #define STATS_DISPLAY_INTERVAL 10
+#define LOOPBACK_TARGET_COUNT 64
+#define SUBMIT_TEST_COUNT 1000
+#define DRAIN_BATCH_SIZE 64
+#define ENGINE_BENCH_COUNT 20000
+#define ENGINE_BENCH_WINDOW 1000
+#define RTT_TEST_COUNT 200
+#define RESOLVER_TEST_NAME "resolver-cache.dbj-ping.test"
+#define RESOLVER_TEST_PINGS 20
+#define RESOLVER_TEST_TTL 300
+#define RESOLVER_BATCH_NAMES 32
+#define RESOLVER_BENCH_NAMES 10000
+#define RESOLVER_BENCH_REPEATS 1000
+#define DRIFT_TEST_INTERVAL_MS 1000
+#define DRIFT_QUICK_SECONDS 20
+#define DRIFT_LONG_SECONDS 600
+#define BOUNDED_TEST_PROBES 40
+#define BOUNDED_TEST_LIMIT 8
+#define BOUNDED_TEST_INTERVAL_MS 10
+#define WHEEL_BENCH_ACTIVE 1000
+#define WHEEL_BENCH_INTERVAL_MS 1000
+#define WHEEL_BENCH_IDLE_INTERVAL_MS 3600000
+#define WHEEL_BENCH_SECONDS 3
+#define WHEEL_BENCH_PEAK_PER_MS 20
+#define STATS_BENCH_UPDATES 1000000
+#define STATS_BENCH_MAX_THREADS 8
+#define TARGET_STATS_PINGS 10
+#define TARGET_BENCH_COUNT 100000
+#define HISTORY_TEST_TARGET "10.248.0.1"
+#define HISTORY_TEST_START_NS 1000000000000ULL
+#define HISTORY_TEST_EXTRA 80
+#define HISTORY_TEST_LATE 5
+#define HISTORY_TEST_LONG_WINDOW_MS 600000
+#define HISTORY_TEST_TABLE_BITS 18 // TARGET_STATS_BITS of the DLL
+#define HISTORY_BENCH_TARGETS 1000
+#define RECORD_BENCH_SAMPLES 1000000
+#define HISTOGRAM_TEST_TARGET "10.250.0.1"
+#define HISTOGRAM_TEST_COUNT 1000
+#define SKETCH_TEST_SKETCHES 1000
+#define SKETCH_TEST_SAMPLES 1000
+#define SKETCH_TEST_BLOB_BYTES 4096
+#define SKETCH_TEST_ACCURACY 0.01
+#define OUTAGE_TEST_MAX_LOST 60
+#define CHANGE_BENCH_TRACES 20
+#define CHANGE_BENCH_HEALTHY_S 3600
+#define CHANGE_BENCH_LEAD_S 600
+#define CHANGE_BENCH_MAX_S 300
+#define CHANGE_BENCH_MIN_SAMPLES 10
+#define CHANGE_BENCH_MAX_FALSE_PER_HOUR 0.5
+#define CADENCE_INTERVAL_MS 50
+#define CADENCE_MAX_GAP_MS 250
+#define CADENCE_COOLDOWN_MS 1000
+#define CADENCE_TIMEOUT_MS 20000
+#define ACTION_MAX_MS 1000
+#define MOCK_COUNT 6
+#define MOCK_DELAY_MS 200
+#define MOCK_SLOW_MS 1500
+#define MOCK_TIMEOUT_MS 200
+#define LOG_BENCH_CALLS 1000000
+#define LOG_BENCH_THREADS 4
+#define LOG_BENCH_FILE_LINES 20000
+#define LOG_BENCH_MAX_NS 200
+#define LOG_BINARY_RECORDS 20000
+#define CONFIG_BENCH_LOADS 200
+#define CONFIG_SNAPSHOT_READERS 4
+#define CONFIG_SNAPSHOT_GENERATIONS 100
+#define CONFIG_SNAPSHOT_QUIET_MS 200
+#define CONFIG_SNAPSHOT_RELOAD_MS 5000
+#define CONFIG_SNAPSHOT_EDIT "4321"
+#define CONFIG_SAVE_BENCH_SAVES 20
+#define CONFIG_SAVE_BENCH_BURST 50
+#define CONFIG_SAVE_BENCH_SETTLE_MS 1000
+#define CONFIG_CRASH_ROUNDS 20
+#define CONFIG_CRASH_MIN_MS 20
+#define CONFIG_CRASH_SPREAD_MS 30
 
 #pragma endregion
 
@@ -63,11 +143,17 @@ static void print_config(const ping_config_t* config) {
         printf("Loss Threshold: %lu%%\n", config->loss_threshold);
         printf("Latency Threshold: %lu ms\n", config->latency_threshold);
         printf("Jitter Threshold: %lu ms\n", config->jitter_threshold);
+        printf("Health Windows: %lu ms / %lu ms\n", config->short_window_ms, config->long_window_ms);
+        printf("Countermeasure Cooldown: %lu ms, settle %lu ms\n", config->countermeasure_cooldown_ms, config->countermeasure_settle_ms);
         printf("Max Retries: %lu\n", config->max_retries);
         printf("Countermeasures: %s\n", config->enable_countermeasures ? "Enabled" : "Disabled");
         printf("DNS Switching: %s\n", config->enable_dns_switching ? "Enabled" : "Disabled");
         printf("Route Refresh: %s\n", config->enable_route_refresh ? "Enabled" : "Disabled");
         printf("Logging: %s\n", config->enable_logging ? "Enabled" : "Disabled");
+        printf("Engine Batch Size: %lu\n", config->engine_batch_size);
+        printf("Scheduled Completions Kept: %lu\n", config->scheduled_completions);
+        printf("Resolver Server: %s\n", strlen(config->resolver_dns) > 0 ? config->resolver_dns : "System");
+        printf("Resolver Threads: %lu\n", config->resolver_threads);
         printf("Backup DNS Servers: %lu configured\n", config->backup_dns_count);
         
         for (DWORD i = 0; i < config->backup_dns_count && i < 4; i++) {
@@ -212,6 +298,2885 @@ static DWORD test_basic_functionality(const char* target) {
     return result;
 }
 
+static double elapsed_ms(LARGE_INTEGER start, LARGE_INTEGER end) {
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    return (double)(end.QuadPart - start.QuadPart) * 1000.0 / (double)frequency.QuadPart;
+}
+
+// Every address in 127.0.0.0/8 answers locally, which gives us many distinct targets
+static void make_loopback_targets(char storage[][16], const char** targets, DWORD count) {
+    for (DWORD i = 0; i < count; i++) {
+        sprintf_s(storage[i], 16, "127.0.%lu.%lu", (i / 254) % 256, (i % 254) + 1);
+        targets[i] = storage[i];
+    }
+}
+
+static DWORD test_batch_loopback(void) {
+    DWORD result = ERROR_EXCEPTION_IN_SERVICE;
+    static char storage[LOOPBACK_TARGET_COUNT][16];
+    static const char* targets[LOOPBACK_TARGET_COUNT];
+    static ping_result_t results[LOOPBACK_TARGET_COUNT];
+    
+    __try {
+        printf("Testing batch ping against %d loopback targets...\n", LOOPBACK_TARGET_COUNT);
+        make_loopback_targets(storage, targets, LOOPBACK_TARGET_COUNT);
+        
+        LARGE_INTEGER start, end;
+        QueryPerformanceCounter(&start);
+        for (DWORD i = 0; i < LOOPBACK_TARGET_COUNT; i++) {
+            ping_execute(targets[i], &results[i]);
+        }
+        QueryPerformanceCounter(&end);
+        double sequential_ms = elapsed_ms(start, end);
+        
+        memset(results, 0, sizeof(results));
+        QueryPerformanceCounter(&start);
+        DWORD batch_status = ping_execute_batch(targets, LOOPBACK_TARGET_COUNT, results);
+        QueryPerformanceCounter(&end);
+        double batch_ms = elapsed_ms(start, end);
+        
+        if (batch_status != ERROR_SUCCESS) {
+            printf("✗ Batch ping failed: error %lu\n", batch_status);
+            __leave;
+        }
+        
+        for (DWORD i = 0; i < LOOPBACK_TARGET_COUNT; i++) {
+            if (!results[i].success || strcmp(results[i].target_ip, targets[i]) != 0) {
+                printf("✗ Batch result %lu does not match target %s (got %s)\n",
+                       i, targets[i], results[i].target_ip);
+                __leave;
+            }
+        }
+        
+        printf("✓ Batch ping successful: sequential %.2f ms, batch %.2f ms (%.1fx)\n",
+               sequential_ms, batch_ms, batch_ms > 0.0 ? sequential_ms / batch_ms : 0.0);
+        result = ERROR_SUCCESS;
+    }
+    __finally {
+        // Nothing to cleanup here
+    }
+    
+    return result;
+}
+
+static DWORD test_submit_loopback(void) {
+    DWORD result = ERROR_EXCEPTION_IN_SERVICE;
+    static char storage[SUBMIT_TEST_COUNT][16];
+    static const char* targets[SUBMIT_TEST_COUNT];
+    static bool completed[SUBMIT_TEST_COUNT];
+    ping_completion_t completions[DRAIN_BATCH_SIZE];
+    
+    __try {
+        printf("Testing submit/complete interface with %d loopback probes...\n", SUBMIT_TEST_COUNT);
+        make_loopback_targets(storage, targets, SUBMIT_TEST_COUNT);
+        memset(completed, 0, sizeof(completed));
+        
+        HANDLE completion_event = NULL;
+        if (ping_get_completion_event(&completion_event) != ERROR_SUCCESS) {
+            printf("✗ Failed to get completion event\n");
+            __leave;
+        }
+        
+        // Submission must not wait for replies, measure each call while earlier ones are pending
+        ULONGLONG first_ticket = 0;
+        double total_us = 0.0, max_us = 0.0;
+        for (DWORD i = 0; i < SUBMIT_TEST_COUNT; i++) {
+            ULONGLONG ticket = 0;
+            LARGE_INTEGER start, end;
+            QueryPerformanceCounter(&start);
+            DWORD submit_status = ping_submit(targets[i], &ticket);
+            QueryPerformanceCounter(&end);
+            
+            if (submit_status != ERROR_SUCCESS) {
+                printf("✗ ping_submit failed: error %lu\n", submit_status);
+                __leave;
+            }
+            if (i == 0) first_ticket = ticket;
+            
+            double us = elapsed_ms(start, end) * 1000.0;
+            total_us += us;
+            if (us > max_us) max_us = us;
+        }
+        
+        DWORD received = 0;
+        while (received < SUBMIT_TEST_COUNT) {
+            if (WaitForSingleObject(completion_event, 10000) != WAIT_OBJECT_0) {
+                printf("✗ Timed out waiting for completions (%lu of %d)\n", received, SUBMIT_TEST_COUNT);
+                __leave;
+            }
+            
+            DWORD count = 0;
+            if (ping_drain_completions(completions, DRAIN_BATCH_SIZE, &count) != ERROR_SUCCESS) {
+                printf("✗ ping_drain_completions failed\n");
+                __leave;
+            }
+            
+            for (DWORD i = 0; i < count; i++) {
+                ULONGLONG index = completions[i].ticket - first_ticket;
+                if (index >= SUBMIT_TEST_COUNT || completed[index]) {
+                    printf("✗ Unexpected completion ticket %llu\n", completions[i].ticket);
+                    __leave;
+                }
+                if (!completions[i].result.success || strcmp(completions[i].result.target_ip, targets[index]) != 0) {
+                    printf("✗ Completion for %s failed: status=0x%08lX\n", targets[index], completions[i].result.status);
+                    __leave;
+                }
+                completed[index] = true;
+                received++;
+            }
+        }
+        
+        double avg_us = total_us / SUBMIT_TEST_COUNT;
+        if (avg_us > 50.0) {
+            printf("✗ Average submission latency too high: %.2f us\n", avg_us);
+            __leave;
+        }
+        
+        printf("✓ Submit/complete successful: submit avg %.2f us, max %.2f us\n", avg_us, max_us);
+        result = ERROR_SUCCESS;
+    }
+    __finally {
+        // Nothing to cleanup here
+    }
+    
+    return result;
+}
+
+// Keep a window of probes outstanding and drain until every one has completed
+static DWORD drive_engine(const char** targets, DWORD target_count, DWORD total, DWORD window) {
+    DWORD result = ERROR_EXCEPTION_IN_SERVICE;
+    ping_completion_t completions[DRAIN_BATCH_SIZE];
+    
+    __try {
+        HANDLE completion_event = NULL;
+        if (ping_get_completion_event(&completion_event) != ERROR_SUCCESS) __leave;
+        
+        DWORD submitted = 0, received = 0;
+        while (received < total) {
+            while (submitted < total && submitted - received < window) {
+                ULONGLONG ticket;
+                if (ping_submit(targets[submitted % target_count], &ticket) != ERROR_SUCCESS) __leave;
+                submitted++;
+            }
+            
+            if (WaitForSingleObject(completion_event, 10000) != WAIT_OBJECT_0) __leave;
+            
+            DWORD count = 0;
+            if (ping_drain_completions(completions, DRAIN_BATCH_SIZE, &count) != ERROR_SUCCESS) __leave;
+            received += count;
+        }
+        
+        result = ERROR_SUCCESS;
+    }
+    __finally {
+        // Nothing to cleanup here
+    }
+    
+    return result;
+}
+
+static DWORD bench_engine_loopback(void) {
+    DWORD result = ERROR_EXCEPTION_IN_SERVICE;
+    static char storage[LOOPBACK_TARGET_COUNT][16];
+    static const char* targets[LOOPBACK_TARGET_COUNT];
+    
+    __try {
+        printf("Benchmarking probe engine with %d loopback probes...\n", ENGINE_BENCH_COUNT);
+        make_loopback_targets(storage, targets, LOOPBACK_TARGET_COUNT);
+        
+        ping_reset_stats();
+        if (drive_engine(targets, LOOPBACK_TARGET_COUNT, ENGINE_BENCH_COUNT, ENGINE_BENCH_WINDOW) != ERROR_SUCCESS) {
+            printf("✗ Engine benchmark did not complete\n");
+            __leave;
+        }
+        
+        ping_engine_stats_t engine_stats;
+        if (ping_get_engine_stats(&engine_stats) != ERROR_SUCCESS) {
+            printf("✗ Engine statistics retrieval failed\n");
+            __leave;
+        }
+        
+        printf("✓ Engine: %llu probes, %.0f probes/s, %.3f engine calls/probe\n",
+               engine_stats.probes_completed, engine_stats.probes_per_second, engine_stats.engine_calls_per_probe);
+        result = ERROR_SUCCESS;
+    }
+    __finally {
+        // Nothing to cleanup here
+    }
+    
+    return result;
+}
+
+static ULONGLONG process_cpu_100ns(void) {
+    FILETIME creation, exit_time, kernel, user;
+    GetProcessTimes(GetCurrentProcess(), &creation, &exit_time, &kernel, &user);
+    ULARGE_INTEGER k, u;
+    k.LowPart = kernel.dwLowDateTime; k.HighPart = kernel.dwHighDateTime;
+    u.LowPart = user.dwLowDateTime; u.HighPart = user.dwHighDateTime;
+    return k.QuadPart + u.QuadPart;
+}
+
+static DWORD bench_engine_batch_sizes(void) {
+    DWORD result = ERROR_EXCEPTION_IN_SERVICE;
+    static char storage[LOOPBACK_TARGET_COUNT][16];
+    static const char* targets[LOOPBACK_TARGET_COUNT];
+    static const DWORD batch_sizes[] = { 1, 8, 32, 64 };
+    ping_config_t config = {0};
+    DWORD original_batch_size = 0;
+    bool config_changed = false;
+    
+    __try {
+        printf("Benchmarking per-probe CPU cost by engine batch size...\n");
+        make_loopback_targets(storage, targets, LOOPBACK_TARGET_COUNT);
+        
+        if (ping_get_config(&config) != ERROR_SUCCESS) __leave;
+        original_batch_size = config.engine_batch_size;
+        
+        for (int i = 0; i < (int)(sizeof(batch_sizes) / sizeof(batch_sizes[0])); i++) {
+            config.engine_batch_size = batch_sizes[i];
+            ping_set_config(&config);
+            config_changed = true;
+            
+            ping_reset_stats();
+            ULONGLONG cpu_start = process_cpu_100ns();
+            if (drive_engine(targets, LOOPBACK_TARGET_COUNT, ENGINE_BENCH_COUNT, ENGINE_BENCH_WINDOW) != ERROR_SUCCESS) {
+                printf("✗ Engine benchmark did not complete at batch size %lu\n", batch_sizes[i]);
+                __leave;
+            }
+            ULONGLONG cpu_used = process_cpu_100ns() - cpu_start;
+            
+            ping_engine_stats_t engine_stats;
+            ping_get_engine_stats(&engine_stats);
+            printf("  batch %2lu: %.2f us CPU/probe, %.3f engine calls/probe, %.0f probes/s\n",
+                   batch_sizes[i], (double)cpu_used / 10.0 / ENGINE_BENCH_COUNT,
+                   engine_stats.engine_calls_per_probe, engine_stats.probes_per_second);
+        }
+        
+        printf("✓ Batch size benchmark complete\n");
+        result = ERROR_SUCCESS;
+    }
+    __finally {
+        if (config_changed) {
+            config.engine_batch_size = original_batch_size;
+            ping_set_config(&config);
+        }
+    }
+    
+    return result;
+}
+
+static int compare_ulonglong(const void* a, const void* b) {
+    ULONGLONG x = *(const ULONGLONG*)a, y = *(const ULONGLONG*)b;
+    return (x > y) - (x < y);
+}
+
+static DWORD test_rtt_resolution(void) {
+    DWORD result = ERROR_EXCEPTION_IN_SERVICE;
+    static ULONGLONG rtts[RTT_TEST_COUNT];
+    
+    __try {
+        printf("Testing nanosecond RTT resolution on loopback...\n");
+        ping_reset_stats();
+        
+        for (int i = 0; i < RTT_TEST_COUNT; i++) {
+            ping_result_ex_t result_ex;
+            if (ping_execute_ex("127.0.0.1", &result_ex) != ERROR_SUCCESS) {
+                printf("✗ Loopback ping failed: status=0x%08lX\n", result_ex.base.status);
+                __leave;
+            }
+            
+            // A whole-millisecond clock reports loopback as 0, we must not
+            if (result_ex.rtt_ns == 0 || result_ex.recv_time_ns <= result_ex.send_time_ns) {
+                printf("✗ Loopback RTT not resolved: %llu ns\n", result_ex.rtt_ns);
+                __leave;
+            }
+            rtts[i] = result_ex.rtt_ns;
+        }
+        
+        qsort(rtts, RTT_TEST_COUNT, sizeof(rtts[0]), compare_ulonglong);
+        ULONGLONG median_ns = rtts[RTT_TEST_COUNT / 2];
+        if (median_ns >= 1000000ULL) {
+            printf("✗ Loopback median RTT %.1f us is not sub-millisecond\n", median_ns / 1000.0);
+            __leave;
+        }
+        
+        ping_stats_t stats;
+        if (ping_get_stats(&stats) != ERROR_SUCCESS || stats.avg_rtt <= 0.0 || stats.min_rtt <= 0.0) {
+            printf("✗ Statistics do not carry sub-millisecond RTTs\n");
+            __leave;
+        }
+        
+        printf("✓ Loopback RTT min/median/max: %.1f/%.1f/%.1f us, stats avg %.3f ms, jitter %.3f ms\n",
+               rtts[0] / 1000.0, median_ns / 1000.0, rtts[RTT_TEST_COUNT - 1] / 1000.0,
+               stats.avg_rtt, stats.jitter);
+        result = ERROR_SUCCESS;
+    }
+    __finally {
+        // Nothing to cleanup here
+    }
+    
+    return result;
+}
+
+// Stand-in DNS server on 127.0.0.1:53, answers every A query with 127.0.0.1
+typedef struct {
+    SOCKET socket;
+    HANDLE thread;
+    bool wsa_started;
+    volatile LONG queries;
+} dns_responder_t;
+
+static DWORD WINAPI dns_responder_proc(LPVOID param) {
+    dns_responder_t* responder = (dns_responder_t*)param;
+    unsigned char packet[512];
+    
+    for (;;) {
+        struct sockaddr_in peer;
+        int peer_len = sizeof(peer);
+        int len = recvfrom(responder->socket, (char*)packet, sizeof(packet) - 16, 0, (struct sockaddr*)&peer, &peer_len);
+        if (len == SOCKET_ERROR) break;
+        if (len < 12) continue;
+        
+        InterlockedIncrement(&responder->queries);
+        
+        // Response flags, one answer pointing back at the question name
+        packet[2] = 0x81; packet[3] = 0x80;
+        packet[6] = 0; packet[7] = 1;
+        packet[8] = packet[9] = packet[10] = packet[11] = 0;
+        
+        static const unsigned char answer[16] = {
+            0xC0, 0x0C, 0x00, 0x01, 0x00, 0x01,
+            (RESOLVER_TEST_TTL >> 24) & 0xFF, (RESOLVER_TEST_TTL >> 16) & 0xFF,
+            (RESOLVER_TEST_TTL >> 8) & 0xFF, RESOLVER_TEST_TTL & 0xFF,
+            0x00, 0x04, 127, 0, 0, 1
+        };
+        memcpy(packet + len, answer, sizeof(answer));
+        sendto(responder->socket, (const char*)packet, len + (int)sizeof(answer), 0, (struct sockaddr*)&peer, peer_len);
+    }
+    
+    return 0;
+}
+
+// False if port 53 on loopback is taken, the caller skips its test then
+static bool dns_responder_start(dns_responder_t* responder) {
+    WSADATA wsa;
+    memset(responder, 0, sizeof(*responder));
+    responder->socket = INVALID_SOCKET;
+    
+    if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) return false;
+    responder->wsa_started = true;
+    
+    responder->socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    struct sockaddr_in bind_addr = {0};
+    bind_addr.sin_family = AF_INET;
+    bind_addr.sin_port = htons(53);
+    bind_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (responder->socket == INVALID_SOCKET ||
+        bind(responder->socket, (struct sockaddr*)&bind_addr, sizeof(bind_addr)) == SOCKET_ERROR) {
+        return false;
+    }
+    
+    responder->thread = CreateThread(NULL, 0, dns_responder_proc, responder, 0, NULL);
+    return responder->thread != NULL;
+}
+
+static void dns_responder_stop(dns_responder_t* responder) {
+    if (responder->socket != INVALID_SOCKET) closesocket(responder->socket);
+    if (responder->thread) {
+        WaitForSingleObject(responder->thread, INFINITE);
+        CloseHandle(responder->thread);
+    }
+    if (responder->wsa_started) WSACleanup();
+    memset(responder, 0, sizeof(*responder));
+    responder->socket = INVALID_SOCKET;
+}
+
+static DWORD test_resolver_cache(void) {
+    DWORD result = ERROR_EXCEPTION_IN_SERVICE;
+    dns_responder_t responder = { INVALID_SOCKET };
+    ping_config_t config = {0};
+    char original_dns[16] = {0};
+    bool config_changed = false;
+    
+    __try {
+        printf("Testing resolver cache against a local DNS responder...\n");
+        
+        if (!dns_responder_start(&responder)) {
+            printf("⚠ Port 53 on loopback unavailable, resolver cache test skipped\n");
+            result = ERROR_SUCCESS;
+            __leave;
+        }
+        
+        if (ping_get_config(&config) != ERROR_SUCCESS) __leave;
+        strcpy_s(original_dns, sizeof(original_dns), config.resolver_dns);
+        strcpy_s(config.resolver_dns, sizeof(config.resolver_dns), "127.0.0.1");
+        if (ping_set_config(&config) != ERROR_SUCCESS) __leave;
+        config_changed = true;
+        
+        ping_result_t ping_result;
+        if (ping_execute(RESOLVER_TEST_NAME, &ping_result) != ERROR_SUCCESS || responder.queries == 0) {
+            printf("✗ %s did not resolve through the local responder\n", RESOLVER_TEST_NAME);
+            __leave;
+        }
+        
+        ping_resolver_stats_t before, after;
+        LONG queries_before = responder.queries;
+        ping_get_resolver_stats(&before);
+        
+        for (int i = 0; i < RESOLVER_TEST_PINGS; i++) {
+            if (ping_execute(RESOLVER_TEST_NAME, &ping_result) != ERROR_SUCCESS) {
+                printf("✗ Cached ping %d failed: status=0x%08lX\n", i, ping_result.status);
+                __leave;
+            }
+        }
+        ping_execute("127.0.0.1", &ping_result);
+        ping_get_resolver_stats(&after);
+        
+        // Within the TTL every ping must be answered from the cache
+        if (responder.queries != queries_before || after.lookups != before.lookups ||
+            after.hits - before.hits != RESOLVER_TEST_PINGS) {
+            printf("✗ Resolver went to the network inside the TTL: %ld queries, %llu hits\n",
+                   responder.queries - queries_before, after.hits - before.hits);
+            __leave;
+        }
+        if (after.bypassed <= before.bypassed) {
+            printf("✗ Literal address was not bypassed\n");
+            __leave;
+        }
+        
+        // A batch of cold names, each twice, is resolved up front with one query per name
+        static char batch_names[RESOLVER_BATCH_NAMES][48];
+        static const char* batch_targets[RESOLVER_BATCH_NAMES * 2];
+        static ping_result_t batch_results[RESOLVER_BATCH_NAMES * 2];
+        for (int i = 0; i < RESOLVER_BATCH_NAMES; i++) {
+            sprintf_s(batch_names[i], sizeof(batch_names[i]), "batch-%02d.dbj-ping.test", i);
+            batch_targets[i] = batch_targets[RESOLVER_BATCH_NAMES + i] = batch_names[i];
+        }
+        queries_before = responder.queries;
+        DWORD batch_status = ping_execute_batch(batch_targets, RESOLVER_BATCH_NAMES * 2, batch_results);
+        if (batch_status != ERROR_SUCCESS || responder.queries - queries_before != RESOLVER_BATCH_NAMES) {
+            printf("✗ Batch of cold names: error %lu, %ld DNS queries for %d names\n",
+                   batch_status, responder.queries - queries_before, RESOLVER_BATCH_NAMES);
+            __leave;
+        }
+        
+        printf("✓ %d pings by name resolved from cache, %ld DNS queries total\n",
+               RESOLVER_TEST_PINGS, responder.queries);
+        result = ERROR_SUCCESS;
+    }
+    __finally {
+        if (config_changed) {
+            strcpy_s(config.resolver_dns, sizeof(config.resolver_dns), original_dns);
+            ping_set_config(&config);
+        }
+        dns_responder_stop(&responder);
+    }
+    
+    return result;
+}
+
+// Time a cold start over 10k names, and how long a literal target waits behind them
+static DWORD bench_resolver_cold_start(void) {
+    DWORD result = ERROR_EXCEPTION_IN_SERVICE;
+    static const DWORD thread_counts[] = { 1, 16 };
+    static char names[RESOLVER_BENCH_NAMES][48];
+    ping_completion_t completions[DRAIN_BATCH_SIZE];
+    dns_responder_t responder = { INVALID_SOCKET };
+    ping_config_t config = {0};
+    ping_config_t original = {0};
+    bool config_changed = false;
+    
+    __try {
+        printf("Benchmarking cold start resolution of %d names...\n", RESOLVER_BENCH_NAMES);
+        
+        if (!dns_responder_start(&responder)) {
+            printf("⚠ Port 53 on loopback unavailable, resolver benchmark skipped\n");
+            result = ERROR_SUCCESS;
+            __leave;
+        }
+        
+        for (int i = 0; i < RESOLVER_BENCH_NAMES; i++) {
+            sprintf_s(names[i], sizeof(names[i]), "cold-%05d.dbj-ping.test", i);
+        }
+        
+        HANDLE completion_event = NULL;
+        if (ping_get_completion_event(&completion_event) != ERROR_SUCCESS) __leave;
+        if (ping_get_config(&original) != ERROR_SUCCESS) __leave;
+        
+        for (int t = 0; t < (int)(sizeof(thread_counts) / sizeof(thread_counts[0])); t++) {
+            // Setting the configuration also empties the resolver cache, every name starts cold
+            config = original;
+            strcpy_s(config.resolver_dns, sizeof(config.resolver_dns), "127.0.0.1");
+            config.resolver_threads = thread_counts[t];
+            if (ping_set_config(&config) != ERROR_SUCCESS) __leave;
+            config_changed = true;
+            
+            ping_resolver_stats_t before, after;
+            ping_get_resolver_stats(&before);
+            LONG queries_before = responder.queries;
+            
+            LARGE_INTEGER start, end, literal_done = {0};
+            QueryPerformanceCounter(&start);
+            
+            ULONGLONG ticket, literal_ticket;
+            DWORD total = 0;
+            for (int i = 0; i < RESOLVER_BENCH_NAMES; i++) {
+                if (ping_submit(names[i], &ticket) != ERROR_SUCCESS) __leave;
+                total++;
+            }
+            // Repeats of names still being looked up must share the lookup
+            for (int i = 0; i < RESOLVER_BENCH_REPEATS; i++) {
+                if (ping_submit(names[i], &ticket) != ERROR_SUCCESS) __leave;
+                total++;
+            }
+            if (ping_submit("127.0.0.1", &literal_ticket) != ERROR_SUCCESS) __leave;
+            total++;
+            
+            DWORD received = 0, failures = 0;
+            while (received < total) {
+                if (WaitForSingleObject(completion_event, 30000) != WAIT_OBJECT_0) {
+                    printf("✗ Timed out waiting for completions (%lu of %lu)\n", received, total);
+                    __leave;
+                }
+                
+                DWORD count = 0;
+                if (ping_drain_completions(completions, DRAIN_BATCH_SIZE, &count) != ERROR_SUCCESS) __leave;
+                for (DWORD i = 0; i < count; i++) {
+                    if (!completions[i].result.success) failures++;
+                    if (completions[i].ticket == literal_ticket) QueryPerformanceCounter(&literal_done);
+                }
+                received += count;
+            }
+            QueryPerformanceCounter(&end);
+            ping_get_resolver_stats(&after);
+            
+            double total_ms = elapsed_ms(start, end);
+            double literal_ms = elapsed_ms(start, literal_done);
+            LONG queries = responder.queries - queries_before;
+            printf("  %2lu resolver threads: %.0f ms for %lu probes, literal target done after %.1f ms, %ld DNS queries, %llu coalesced\n",
+                   thread_counts[t], total_ms, total, literal_ms, queries, after.coalesced - before.coalesced);
+            
+            if (failures > 0) {
+                printf("✗ %lu probes failed\n", failures);
+                __leave;
+            }
+            if (queries > RESOLVER_BENCH_NAMES + RESOLVER_BENCH_REPEATS / 2) {
+                printf("✗ Repeated names were not coalesced: %ld queries\n", queries);
+                __leave;
+            }
+            if (literal_ms >= total_ms / 2) {
+                printf("✗ Literal target waited behind unresolved names\n");
+                __leave;
+            }
+        }
+        
+        printf("✓ Resolver cold start benchmark complete\n");
+        result = ERROR_SUCCESS;
+    }
+    __finally {
+        if (config_changed) {
+            ping_set_config(&original);
+        }
+        dns_responder_stop(&responder);
+    }
+    
+    return result;
+}
+
+// One probe per interval, each sent within a millisecond of its absolute deadline
+static DWORD test_schedule_drift(DWORD seconds) {
+    DWORD result = ERROR_EXCEPTION_IN_SERVICE;
+    static ULONGLONG send_times[DRIFT_LONG_SECONDS];
+    ping_completion_t completions[DRAIN_BATCH_SIZE];
+    bool scheduled = false;
+    
+    __try {
+        printf("Testing scheduled probing, %lu s at %d ms on loopback...\n", seconds, DRIFT_TEST_INTERVAL_MS);
+        if (seconds > DRIFT_LONG_SECONDS) __leave;
+        
+        HANDLE completion_event = NULL;
+        if (ping_get_completion_event(&completion_event) != ERROR_SUCCESS) __leave;
+        
+        if (ping_schedule_start("127.0.0.1", DRIFT_TEST_INTERVAL_MS, seconds) != ERROR_SUCCESS) {
+            printf("✗ ping_schedule_start failed\n");
+            __leave;
+        }
+        scheduled = true;
+        
+        DWORD received = 0;
+        while (received < seconds) {
+            if (WaitForSingleObject(completion_event, DRIFT_TEST_INTERVAL_MS * 3) != WAIT_OBJECT_0) {
+                printf("✗ Scheduled probe %lu never completed\n", received);
+                __leave;
+            }
+            
+            DWORD count = 0;
+            if (ping_drain_completions(completions, DRAIN_BATCH_SIZE, &count) != ERROR_SUCCESS) __leave;
+            for (DWORD i = 0; i < count && received < seconds; i++) {
+                send_times[received++] = completions[i].send_time_ns;
+            }
+        }
+        
+        ping_schedule_stats_t schedule_stats;
+        if (ping_get_schedule_stats(&schedule_stats) != ERROR_SUCCESS) __leave;
+        
+        // Probe k belongs to deadline start + k * interval, nothing may be skipped or doubled
+        qsort(send_times, seconds, sizeof(send_times[0]), compare_ulonglong);
+        double max_error_us = 0.0;
+        for (DWORD k = 0; k < seconds; k++) {
+            ULONGLONG deadline_ns = schedule_stats.start_ns + (ULONGLONG)k * schedule_stats.interval_ns;
+            if (send_times[k] < deadline_ns) {
+                printf("✗ Probe %lu sent %.1f us before its deadline\n", k, (deadline_ns - send_times[k]) / 1000.0);
+                __leave;
+            }
+            double error_us = (send_times[k] - deadline_ns) / 1000.0;
+            if (error_us > max_error_us) max_error_us = error_us;
+        }
+        
+        if (max_error_us >= 1000.0 || schedule_stats.deadlines_missed > 0 || schedule_stats.probes_sent != seconds) {
+            printf("✗ Send error %.1f us, %llu deadlines missed, %llu sent\n",
+                   max_error_us, schedule_stats.deadlines_missed, schedule_stats.probes_sent);
+            __leave;
+        }
+        
+        printf("✓ %lu probes on schedule, send error mean %.1f us, max %.1f us\n",
+               seconds, schedule_stats.mean_send_error_us, max_error_us);
+        result = ERROR_SUCCESS;
+    }
+    __finally {
+        if (scheduled) ping_schedule_stop();
+    }
+    
+    return result;
+}
+
+// A caller that never drains keeps only the newest scheduled completions, the rest are dropped and counted
+static DWORD test_schedule_bounded(void) {
+    DWORD result = ERROR_EXCEPTION_IN_SERVICE;
+    ping_completion_t completions[DRAIN_BATCH_SIZE];
+    ping_config_t config = {0};
+    bool config_changed = false;
+    bool scheduled = false;
+    
+    __try {
+        printf("Testing the bound on undrained scheduled completions...\n");
+        
+        if (ping_get_config(&config) != ERROR_SUCCESS) __leave;
+        ping_config_t bounded = config;
+        bounded.scheduled_completions = BOUNDED_TEST_LIMIT;
+        ping_set_config(&bounded);
+        config_changed = true;
+        
+        // Start from an empty queue
+        DWORD count = 0;
+        do {
+            if (ping_drain_completions(completions, DRAIN_BATCH_SIZE, &count) != ERROR_SUCCESS) __leave;
+        } while (count > 0);
+        
+        ping_schedule_stats_t before, after;
+        if (ping_get_schedule_stats(&before) != ERROR_SUCCESS) __leave;
+        if (ping_schedule_start("127.0.0.1", BOUNDED_TEST_INTERVAL_MS, BOUNDED_TEST_PROBES) != ERROR_SUCCESS) __leave;
+        scheduled = true;
+        
+        ULONGLONG expected = BOUNDED_TEST_PROBES - BOUNDED_TEST_LIMIT;
+        for (int waited = 0; waited < 100; waited++) {
+            Sleep(50);
+            if (ping_get_schedule_stats(&after) != ERROR_SUCCESS) __leave;
+            if (after.completions_dropped - before.completions_dropped >= expected) break;
+        }
+        
+        DWORD kept = 0;
+        do {
+            if (ping_drain_completions(completions, DRAIN_BATCH_SIZE, &count) != ERROR_SUCCESS) __leave;
+            kept += count;
+        } while (count > 0);
+        
+        ULONGLONG dropped = after.completions_dropped - before.completions_dropped;
+        if (kept != BOUNDED_TEST_LIMIT || dropped != expected) {
+            printf("✗ %lu completions kept and %llu dropped, expected %d and %llu\n", kept, dropped, BOUNDED_TEST_LIMIT, expected);
+            __leave;
+        }
+        
+        printf("✓ %lu newest scheduled completions kept, %llu dropped\n", kept, dropped);
+        result = ERROR_SUCCESS;
+    }
+    __finally {
+        if (scheduled) ping_schedule_stop();
+        if (config_changed) ping_set_config(&config);
+    }
+    
+    return result;
+}
+
+// Timer upkeep per fired probe with 1k to 1M targets in the wheel, the active ones phase-spread
+static DWORD bench_schedule_wheel(void) {
+    DWORD result = ERROR_EXCEPTION_IN_SERVICE;
+    static const DWORD scheduled_counts[] = { 1000, 10000, 100000, 1000000 };
+    static char storage[LOOPBACK_TARGET_COUNT][16];
+    static const char* targets[LOOPBACK_TARGET_COUNT];
+    static DWORD sends_per_ms[WHEEL_BENCH_INTERVAL_MS];
+    ping_completion_t completions[DRAIN_BATCH_SIZE];
+    double first_ns_per_probe = 0.0;
+    
+    __try {
+        printf("Benchmarking timing wheel from 1k to 1M scheduled targets...\n");
+        make_loopback_targets(storage, targets, LOOPBACK_TARGET_COUNT);
+        
+        HANDLE completion_event = NULL;
+        if (ping_get_completion_event(&completion_event) != ERROR_SUCCESS) __leave;
+        
+        for (int n = 0; n < (int)(sizeof(scheduled_counts) / sizeof(scheduled_counts[0])); n++) {
+            DWORD scheduled = scheduled_counts[n];
+            ping_schedule_stop();
+            
+            // Hour-long intervals keep the bulk of the targets parked in the coarse levels
+            LARGE_INTEGER start, end;
+            ULONGLONG schedule_id;
+            QueryPerformanceCounter(&start);
+            for (DWORD i = 0; i < scheduled - WHEEL_BENCH_ACTIVE; i++) {
+                if (ping_schedule_add(targets[i % LOOPBACK_TARGET_COUNT], WHEEL_BENCH_IDLE_INTERVAL_MS, 0, &schedule_id) != ERROR_SUCCESS) {
+                    printf("✗ ping_schedule_add failed at %lu targets\n", i);
+                    __leave;
+                }
+            }
+            for (DWORD i = 0; i < WHEEL_BENCH_ACTIVE; i++) {
+                if (ping_schedule_add(targets[i % LOOPBACK_TARGET_COUNT], WHEEL_BENCH_INTERVAL_MS, 0, &schedule_id) != ERROR_SUCCESS) __leave;
+            }
+            QueryPerformanceCounter(&end);
+            double add_call_ns = elapsed_ms(start, end) * 1000000.0 / scheduled;
+            
+            // Sends of the active targets bucketed by millisecond of their interval
+            memset(sends_per_ms, 0, sizeof(sends_per_ms));
+            QueryPerformanceCounter(&start);
+            for (;;) {
+                QueryPerformanceCounter(&end);
+                if (elapsed_ms(start, end) >= WHEEL_BENCH_SECONDS * 1000.0) break;
+                if (WaitForSingleObject(completion_event, 100) != WAIT_OBJECT_0) continue;
+                
+                DWORD count = 0;
+                if (ping_drain_completions(completions, DRAIN_BATCH_SIZE, &count) != ERROR_SUCCESS) __leave;
+                for (DWORD i = 0; i < count; i++) {
+                    sends_per_ms[(completions[i].send_time_ns / 1000000ULL) % WHEEL_BENCH_INTERVAL_MS]++;
+                }
+            }
+            
+            ping_schedule_stats_t schedule_stats;
+            if (ping_get_schedule_stats(&schedule_stats) != ERROR_SUCCESS) __leave;
+            
+            DWORD peak = 0;
+            for (int i = 0; i < WHEEL_BENCH_INTERVAL_MS; i++) {
+                if (sends_per_ms[i] > peak) peak = sends_per_ms[i];
+            }
+            
+            printf("  %7lu targets: %.1f ns timer upkeep/probe over %llu probes, %.1f ns wheel insert, %.1f ns add call, peak %lu sends/ms\n",
+                   scheduled, schedule_stats.timer_ns_per_probe, schedule_stats.timer_events,
+                   schedule_stats.add_ns_per_target, add_call_ns, peak / WHEEL_BENCH_SECONDS);
+            
+            if (schedule_stats.targets != scheduled || schedule_stats.timer_events == 0) {
+                printf("✗ Wheel holds %llu targets, fired %llu\n", schedule_stats.targets, schedule_stats.timer_events);
+                __leave;
+            }
+            // Phase randomisation, 1000 targets at 1 s must not land in the same millisecond
+            if (peak / WHEEL_BENCH_SECONDS > WHEEL_BENCH_PEAK_PER_MS) {
+                printf("✗ Scheduled sends are bunched, %lu in one millisecond\n", peak / WHEEL_BENCH_SECONDS);
+                __leave;
+            }
+            if (n == 0) {
+                first_ns_per_probe = schedule_stats.timer_ns_per_probe;
+            } else if (schedule_stats.timer_ns_per_probe > first_ns_per_probe * 4.0) {
+                printf("✗ Timer upkeep grew from %.1f to %.1f ns/probe\n", first_ns_per_probe, schedule_stats.timer_ns_per_probe);
+                __leave;
+            }
+        }
+        
+        printf("✓ Timing wheel benchmark complete\n");
+        result = ERROR_SUCCESS;
+    }
+    __finally {
+        ping_schedule_stop();
+    }
+    
+    return result;
+}
+
+typedef struct {
+    HANDLE start;
+    DWORD failures;
+} stats_bench_worker_t;
+
+static DWORD WINAPI stats_bench_worker(LPVOID param) {
+    stats_bench_worker_t* worker = (stats_bench_worker_t*)param;
+    ping_result_ex_t result_ex = {0};
+    result_ex.base.success = true;
+    strcpy_s(result_ex.base.target_ip, sizeof(result_ex.base.target_ip), "127.0.0.1");
+    
+    WaitForSingleObject(worker->start, INFINITE);
+    for (DWORD i = 0; i < STATS_BENCH_UPDATES; i++) {
+        result_ex.rtt_ns = 40000 + (i & 1023) * 10;
+        if (ping_record_result(&result_ex) != ERROR_SUCCESS) worker->failures++;
+    }
+    return 0;
+}
+
+static DWORD bench_stats_threads(void) {
+    DWORD result = ERROR_EXCEPTION_IN_SERVICE;
+    static const DWORD thread_counts[] = { 1, 2, 4, STATS_BENCH_MAX_THREADS };
+    HANDLE start = NULL;
+    HANDLE threads[STATS_BENCH_MAX_THREADS] = {0};
+    stats_bench_worker_t workers[STATS_BENCH_MAX_THREADS];
+    double single_rate = 0.0;
+    
+    __try {
+        printf("Benchmarking statistics updates from 1 to %d threads...\n", STATS_BENCH_MAX_THREADS);
+        DWORD processors = GetActiveProcessorCount(ALL_PROCESSOR_GROUPS);
+        
+        start = CreateEventA(NULL, TRUE, FALSE, NULL);
+        if (!start) __leave;
+        
+        for (int n = 0; n < (int)(sizeof(thread_counts) / sizeof(thread_counts[0])); n++) {
+            DWORD thread_count = thread_counts[n];
+            if (thread_count > processors) break;
+            
+            ping_reset_stats();
+            ResetEvent(start);
+            for (DWORD t = 0; t < thread_count; t++) {
+                workers[t].start = start;
+                workers[t].failures = 0;
+                threads[t] = CreateThread(NULL, 0, stats_bench_worker, &workers[t], 0, NULL);
+                if (!threads[t]) __leave;
+            }
+            
+            LARGE_INTEGER begin, end;
+            QueryPerformanceCounter(&begin);
+            SetEvent(start);
+            WaitForMultipleObjects(thread_count, threads, TRUE, INFINITE);
+            QueryPerformanceCounter(&end);
+            
+            DWORD failures = 0;
+            for (DWORD t = 0; t < thread_count; t++) {
+                failures += workers[t].failures;
+                CloseHandle(threads[t]);
+                threads[t] = NULL;
+            }
+            
+            double rate = (double)thread_count * STATS_BENCH_UPDATES / elapsed_ms(begin, end) * 1000.0;
+            if (n == 0) single_rate = rate;
+            printf("  %lu threads: %.1f M updates/s, %.2fx one thread\n", thread_count, rate / 1000000.0, rate / single_rate);
+            
+            ping_stats_t stats;
+            if (ping_get_stats(&stats) != ERROR_SUCCESS) __leave;
+            if (failures || stats.packets_sent != thread_count * STATS_BENCH_UPDATES || stats.packets_lost != 0) {
+                printf("✗ Merged %lu updates, expected %lu (%lu failed)\n", stats.packets_sent, thread_count * STATS_BENCH_UPDATES, failures);
+                __leave;
+            }
+            // Shards share nothing, so anything under half of linear means writers contend
+            if (rate < single_rate * thread_count * 0.5) {
+                printf("✗ Updates do not scale, %lu threads reach %.2fx one thread\n", thread_count, rate / single_rate);
+                __leave;
+            }
+        }
+        
+        printf("✓ Statistics benchmark complete\n");
+        result = ERROR_SUCCESS;
+    }
+    __finally {
+        if (start) SetEvent(start);
+        for (int t = 0; t < STATS_BENCH_MAX_THREADS; t++) {
+            if (threads[t]) {
+                WaitForSingleObject(threads[t], INFINITE);
+                CloseHandle(threads[t]);
+            }
+        }
+        if (start) CloseHandle(start);
+        ping_reset_stats();
+    }
+    
+    return result;
+}
+
+static DWORD test_target_stats(void) {
+    DWORD result = ERROR_EXCEPTION_IN_SERVICE;
+    
+    __try {
+        printf("Testing per-target statistics...\n");
+        ping_reset_stats();
+        
+        // 127.0.0.1 gets every ping, 127.0.0.2 every other one
+        ping_result_t ping_result;
+        for (int i = 0; i < TARGET_STATS_PINGS; i++) {
+            ping_execute("127.0.0.1", &ping_result);
+            if (i % 2 == 0) ping_execute("127.0.0.2", &ping_result);
+        }
+        
+        ping_target_stats_t first, second;
+        if (ping_get_target_stats("127.0.0.1", &first) != ERROR_SUCCESS ||
+            ping_get_target_stats("127.0.0.2", &second) != ERROR_SUCCESS) {
+            printf("✗ Loopback targets missing from the table\n");
+            __leave;
+        }
+        if (first.packets_sent != TARGET_STATS_PINGS || second.packets_sent != TARGET_STATS_PINGS / 2) {
+            printf("✗ Targets mixed: %s %lu sent, %s %lu sent\n",
+                   first.target_ip, first.packets_sent, second.target_ip, second.packets_sent);
+            __leave;
+        }
+        if (ping_get_target_stats("127.0.0.3", &first) != ERROR_NOT_FOUND) {
+            printf("✗ Never pinged target reported statistics\n");
+            __leave;
+        }
+        
+        printf("✓ Per-target statistics kept apart\n");
+        result = ERROR_SUCCESS;
+    }
+    __finally {
+        ping_reset_stats();
+    }
+    
+    return result;
+}
+
+static DWORD bench_target_stats(void) {
+    DWORD result = ERROR_EXCEPTION_IN_SERVICE;
+    static char storage[TARGET_BENCH_COUNT][16];
+    
+    __try {
+        printf("Benchmarking per-target statistics with %d targets...\n", TARGET_BENCH_COUNT);
+        ping_reset_stats();
+        
+        for (DWORD i = 0; i < TARGET_BENCH_COUNT; i++) {
+            snprintf(storage[i], sizeof(storage[i]), "10.%lu.%lu.%lu", (i >> 16) & 0xFF, (i >> 8) & 0xFF, (i & 0xFF) + 1);
+        }
+        
+        ping_result_ex_t result_ex = {0};
+        result_ex.base.success = true;
+        result_ex.rtt_ns = 250000;
+        
+        LARGE_INTEGER start, end;
+        QueryPerformanceCounter(&start);
+        for (DWORD i = 0; i < TARGET_BENCH_COUNT; i++) {
+            strcpy_s(result_ex.base.target_ip, sizeof(result_ex.base.target_ip), storage[i]);
+            if (ping_record_result(&result_ex) != ERROR_SUCCESS) __leave;
+        }
+        QueryPerformanceCounter(&end);
+        double record_ns = elapsed_ms(start, end) * 1000000.0 / TARGET_BENCH_COUNT;
+        
+        ping_target_stats_t target_stats;
+        QueryPerformanceCounter(&start);
+        for (DWORD i = 0; i < TARGET_BENCH_COUNT; i++) {
+            if (ping_get_target_stats(storage[i], &target_stats) != ERROR_SUCCESS || target_stats.packets_sent != 1) {
+                printf("✗ Target %s lost from the table\n", storage[i]);
+                __leave;
+            }
+        }
+        QueryPerformanceCounter(&end);
+        double lookup_ns = elapsed_ms(start, end) * 1000000.0 / TARGET_BENCH_COUNT;
+        
+        ping_target_table_stats_t table_stats;
+        if (ping_get_target_table_stats(&table_stats) != ERROR_SUCCESS) __leave;
+        printf("  %lu targets of %lu, %.1f MiB, %.1f ns/record, %.1f ns/lookup by name\n",
+               table_stats.targets, table_stats.capacity, table_stats.memory_bytes / (1024.0 * 1024.0), record_ns, lookup_ns);
+        
+        if (table_stats.targets != TARGET_BENCH_COUNT || table_stats.untracked != 0) {
+            printf("✗ Table holds %lu targets, %llu untracked\n", table_stats.targets, table_stats.untracked);
+            __leave;
+        }
+        
+        printf("✓ Per-target statistics benchmark complete\n");
+        result = ERROR_SUCCESS;
+    }
+    __finally {
+        ping_reset_stats();
+    }
+    
+    return result;
+}
+
+// Result i of the history test: RTT i + 1 us, every 10th timed out
+static void history_test_record(const char* target, DWORD i) {
+    ping_result_ex_t result_ex = {0};
+    strcpy_s(result_ex.base.target_ip, sizeof(result_ex.base.target_ip), target);
+    result_ex.send_time_ns = HISTORY_TEST_START_NS + i * 1000000000ULL;
+    result_ex.base.success = i % 10 != 9;
+    result_ex.base.status = result_ex.base.success ? IP_SUCCESS : IP_REQ_TIMED_OUT;
+    result_ex.rtt_ns = (i + 1) * 1000ULL;
+    ping_record_result(&result_ex);
+}
+
+// Another 10.x.y.z taking the same slot as target in an empty table, the DLL's hash of the address in network order
+static bool history_test_collision(const char* target, char* collision, size_t size) {
+    unsigned a, b, c, d;
+    if (sscanf_s(target, "%u.%u.%u.%u", &a, &b, &c, &d) != 4) return false;
+    DWORD slot = ((DWORD)(a | b << 8 | c << 16 | d << 24) * 2654435761u) >> (32 - HISTORY_TEST_TABLE_BITS);
+    for (DWORD low = 1; low < 0x1000000; low++) {
+        DWORD addr = 10 | low << 8;
+        if (addr == (DWORD)(a | b << 8 | c << 16 | d << 24) || (addr * 2654435761u) >> (32 - HISTORY_TEST_TABLE_BITS) != slot) continue;
+        sprintf_s(collision, size, "10.%lu.%lu.%lu", low & 0xFF, low >> 8 & 0xFF, low >> 16);
+        return true;
+    }
+    return false;
+}
+
+static DWORD test_history(void) {
+    DWORD result = ERROR_EXCEPTION_IN_SERVICE;
+    ping_config_t config = {0};
+    bool config_changed = false;
+    
+    __try {
+        printf("Testing the zero-copy history view...\n");
+        ping_reset_stats();
+        
+        // Lost probes and a rising RTT, countermeasures must stay out of it
+        if (ping_get_config(&config) != ERROR_SUCCESS) __leave;
+        ping_config_t quiet = config;
+        quiet.enable_countermeasures = false;
+        // A long window wider than the ring, one record a second, fills all of it
+        quiet.long_window_ms = HISTORY_TEST_LONG_WINDOW_MS;
+        ping_set_config(&quiet);
+        config_changed = true;
+        
+        ping_history_t history;
+        if (ping_get_history(HISTORY_TEST_TARGET, &history) != ERROR_NOT_FOUND) {
+            printf("✗ History of a target never recorded\n");
+            __leave;
+        }
+        
+        for (DWORD i = 0; i < PING_HISTORY_SAMPLES + HISTORY_TEST_EXTRA; i++) history_test_record(HISTORY_TEST_TARGET, i);
+        if (ping_get_history(HISTORY_TEST_TARGET, &history) != ERROR_SUCCESS || history.count != PING_HISTORY_SAMPLES) {
+            printf("✗ A full ring must show %d records\n", PING_HISTORY_SAMPLES);
+            __leave;
+        }
+        
+        // The long window holds the whole ring and says how far back that reaches, not what was configured
+        ping_target_stats_t target_stats;
+        if (ping_get_target_stats(HISTORY_TEST_TARGET, &target_stats) != ERROR_SUCCESS ||
+            target_stats.long_window.samples != PING_HISTORY_SAMPLES ||
+            target_stats.long_window.window_ms != (PING_HISTORY_SAMPLES - 1) * 1000 ||
+            target_stats.short_window.window_ms != quiet.short_window_ms) {
+            printf("✗ Windows report %lu ms over %lu samples and %lu ms\n", target_stats.long_window.window_ms,
+                   target_stats.long_window.samples, target_stats.short_window.window_ms);
+            __leave;
+        }
+        
+        // Oldest first, the first HISTORY_TEST_EXTRA results were overwritten
+        for (DWORD k = 0; k < history.count; k++) {
+            const ping_record_t* record = &history.records[(history.first + k) % history.capacity];
+            DWORD i = HISTORY_TEST_EXTRA + k;
+            bool lost = i % 10 == 9;
+            ULONGLONG send_ns = HISTORY_TEST_START_NS + i * 1000000000ULL;
+            if (record->send_ns != send_ns || record->rtt_us != (lost ? 0 : i + 1) ||
+                record->status != (lost ? IP_REQ_TIMED_OUT - IP_STATUS_BASE : PING_RECORD_OK)) {
+                printf("✗ Record %lu: %lu us, status %lu, expected %lu us\n", k, record->rtt_us, (DWORD)record->status, lost ? 0 : i + 1);
+                __leave;
+            }
+            
+            // Back to the API's result only here, at the edge
+            ping_result_ex_t result_ex;
+            if (ping_record_to_result(record, &result_ex) != ERROR_SUCCESS ||
+                strcmp(result_ex.base.target_ip, HISTORY_TEST_TARGET) != 0 || result_ex.send_time_ns != send_ns ||
+                result_ex.base.success == lost || result_ex.base.status != (lost ? IP_REQ_TIMED_OUT : IP_SUCCESS) ||
+                result_ex.rtt_ns != (lost ? 0 : (i + 1) * 1000ULL)) {
+                printf("✗ Record %lu unpacked to %s, status %lu, %llu ns\n", k, result_ex.base.target_ip, result_ex.base.status, result_ex.rtt_ns);
+                __leave;
+            }
+        }
+        if (ping_history_overwritten(&history) != 0) {
+            printf("✗ Nothing was recorded after the view was taken\n");
+            __leave;
+        }
+        
+        for (DWORD i = 0; i < HISTORY_TEST_LATE; i++) history_test_record(HISTORY_TEST_TARGET, PING_HISTORY_SAMPLES + HISTORY_TEST_EXTRA + i);
+        DWORD overwritten = ping_history_overwritten(&history);
+        if (overwritten != HISTORY_TEST_LATE) {
+            printf("✗ %d later results took %lu samples of the view\n", HISTORY_TEST_LATE, overwritten);
+            __leave;
+        }
+        
+        ping_record_t old = history.records[history.first];
+        ping_reset_stats();
+        ping_result_ex_t result_ex;
+        if (ping_history_overwritten(&history) != history.count || ping_record_to_result(&old, &result_ex) != ERROR_NOT_FOUND) {
+            printf("✗ A reset must leave the whole view stale\n");
+            __leave;
+        }
+        
+        // Another address in the same slot must not adopt the records made before the reset
+        char collision[16];
+        if (!history_test_collision(HISTORY_TEST_TARGET, collision, sizeof(collision))) {
+            printf("✗ No address shares the slot of %s\n", HISTORY_TEST_TARGET);
+            __leave;
+        }
+        history_test_record(collision, 0);
+        if (ping_record_to_result(&old, &result_ex) != ERROR_NOT_FOUND) {
+            printf("✗ A record from before the reset unpacked to %s\n", result_ex.base.target_ip);
+            __leave;
+        }
+        
+        printf("✓ History view matches the results, overwritten records are reported\n");
+        result = ERROR_SUCCESS;
+    }
+    __finally {
+        if (config_changed) ping_set_config(&config);
+        ping_reset_stats();
+    }
+    
+    return result;
+}
+
+// Full rings for many targets, read through views against copying every record out
+static DWORD bench_history(void) {
+    DWORD result = ERROR_EXCEPTION_IN_SERVICE;
+    static char storage[HISTORY_BENCH_TARGETS][16];
+    static ping_record_t copy[PING_HISTORY_SAMPLES];
+    
+    __try {
+        printf("Benchmarking history views with %d targets...\n", HISTORY_BENCH_TARGETS);
+        ping_reset_stats();
+        
+        ping_result_ex_t result_ex = {0};
+        result_ex.base.success = true;
+        result_ex.rtt_ns = 250000;
+        for (DWORD i = 0; i < HISTORY_BENCH_TARGETS; i++) {
+            snprintf(storage[i], sizeof(storage[i]), "10.247.%lu.%lu", i >> 8, (i & 0xFF) + 1);
+            strcpy_s(result_ex.base.target_ip, sizeof(result_ex.base.target_ip), storage[i]);
+            for (DWORD k = 0; k < PING_HISTORY_SAMPLES; k++) {
+                result_ex.send_time_ns = HISTORY_TEST_START_NS + k * 1000000000ULL;
+                if (ping_record_result(&result_ex) != ERROR_SUCCESS) __leave;
+            }
+        }
+        
+        ping_history_t history;
+        ULONGLONG sum = 0, copied = 0;
+        LARGE_INTEGER start, end;
+        QueryPerformanceCounter(&start);
+        for (DWORD i = 0; i < HISTORY_BENCH_TARGETS; i++) {
+            if (ping_get_history(storage[i], &history) != ERROR_SUCCESS || history.count != PING_HISTORY_SAMPLES) {
+                printf("✗ Target %s lost its history\n", storage[i]);
+                __leave;
+            }
+            sum += history.count;
+        }
+        QueryPerformanceCounter(&end);
+        double view_ns = elapsed_ms(start, end) * 1000000.0 / HISTORY_BENCH_TARGETS;
+        
+        // What a copying API costs at the least: the same lookup, then every sample into the caller's buffer
+        QueryPerformanceCounter(&start);
+        for (DWORD i = 0; i < HISTORY_BENCH_TARGETS; i++) {
+            if (ping_get_history(storage[i], &history) != ERROR_SUCCESS) __leave;
+            DWORD head = history.capacity - history.first < history.count ? history.capacity - history.first : history.count;
+            memcpy(copy, history.records + history.first, head * sizeof(ping_record_t));
+            memcpy(copy + head, history.records, (history.count - head) * sizeof(ping_record_t));
+            copied += history.count;
+            sum += copy[i % history.count].rtt_us;
+        }
+        QueryPerformanceCounter(&end);
+        double copy_ns = elapsed_ms(start, end) * 1000000.0 / HISTORY_BENCH_TARGETS;
+        
+        printf("  view: %.1f ns/target, copy of %d records (%zu bytes): %.1f ns/target\n",
+               view_ns, PING_HISTORY_SAMPLES, PING_HISTORY_SAMPLES * sizeof(ping_record_t), copy_ns);
+        printf("  every target's history: %.2f ms as views, %.2f ms copied, %.1f MiB copied\n",
+               view_ns * HISTORY_BENCH_TARGETS / 1000000.0, copy_ns * HISTORY_BENCH_TARGETS / 1000000.0,
+               copied * sizeof(ping_record_t) / (1024.0 * 1024.0));
+        if (sum == 0 || view_ns >= copy_ns) {
+            printf("✗ A view must cost less than copying the records\n");
+            __leave;
+        }
+        
+        printf("✓ History benchmark complete\n");
+        result = ERROR_SUCCESS;
+    }
+    __finally {
+        ping_reset_stats();
+    }
+    
+    return result;
+}
+
+// The history ring's sample before probe records: send ms, RTT ns and its delta
+typedef struct {
+    DWORD at_ms;
+    DWORD rtt_ns;
+    DWORD delta_ns;
+} record_bench_sample_t;
+
+// Memory per million samples and a sequential scan for loss and mean RTT, ping_result_ex_t against ping_record_t
+static DWORD bench_probe_records(void) {
+    DWORD result = ERROR_EXCEPTION_IN_SERVICE;
+    ping_result_ex_t* results = NULL;
+    ping_record_t* records = NULL;
+    
+    __try {
+        printf("Benchmarking probe records with %d samples...\n", RECORD_BENCH_SAMPLES);
+        results = (ping_result_ex_t*)HeapAlloc(GetProcessHeap(), 0, sizeof(ping_result_ex_t) * RECORD_BENCH_SAMPLES);
+        records = (ping_record_t*)HeapAlloc(GetProcessHeap(), 0, sizeof(ping_record_t) * RECORD_BENCH_SAMPLES);
+        if (!results || !records) {
+            printf("✗ Out of memory\n");
+            __leave;
+        }
+        
+        // The same trace both ways, 2% lost and RTTs around 20 ms
+        ULONGLONG seed = 0x9E3779B97F4A7C15ULL;
+        for (DWORD i = 0; i < RECORD_BENCH_SAMPLES; i++) {
+            seed ^= seed << 13;
+            seed ^= seed >> 7;
+            seed ^= seed << 17;
+            ping_result_ex_t* result_ex = &results[i];
+            memset(result_ex, 0, sizeof(ping_result_ex_t));
+            result_ex->base.success = seed % 50 != 0;
+            result_ex->base.status = result_ex->base.success ? IP_SUCCESS : IP_REQ_TIMED_OUT;
+            result_ex->rtt_ns = result_ex->base.success ? 15000000ULL + seed % 10000000ULL / 1000 * 1000 : 0;
+            result_ex->base.rtt_ms = (DWORD)(result_ex->rtt_ns / 1000000ULL);
+            result_ex->send_time_ns = HISTORY_TEST_START_NS + i * 1000000ULL;
+            strcpy_s(result_ex->base.target_ip, sizeof(result_ex->base.target_ip), "10.246.0.1");
+            
+            ping_record_t* record = &records[i];
+            memset(record, 0, sizeof(ping_record_t));
+            record->send_ns = result_ex->send_time_ns;
+            record->status = result_ex->base.success ? PING_RECORD_OK : IP_REQ_TIMED_OUT - IP_STATUS_BASE;
+            record->rtt_us = (DWORD)(result_ex->rtt_ns / 1000);
+        }
+        
+        LARGE_INTEGER start, end;
+        ULONGLONG lost_results = 0, rtt_results_us = 0;
+        QueryPerformanceCounter(&start);
+        for (DWORD i = 0; i < RECORD_BENCH_SAMPLES; i++) {
+            if (!results[i].base.success) lost_results++;
+            else rtt_results_us += results[i].rtt_ns / 1000;
+        }
+        QueryPerformanceCounter(&end);
+        double results_ms = elapsed_ms(start, end);
+        
+        ULONGLONG lost_records = 0, rtt_records_us = 0;
+        QueryPerformanceCounter(&start);
+        for (DWORD i = 0; i < RECORD_BENCH_SAMPLES; i++) {
+            if (records[i].status != PING_RECORD_OK) lost_records++;
+            else rtt_records_us += records[i].rtt_us;
+        }
+        QueryPerformanceCounter(&end);
+        double records_ms = elapsed_ms(start, end);
+        
+        const double mib = 1024.0 * 1024.0 / RECORD_BENCH_SAMPLES;
+        printf("  per million samples: ping_result_t %.1f MiB, ping_result_ex_t %.1f MiB, history sample before %.1f MiB, ping_record_t %.1f MiB\n",
+               sizeof(ping_result_t) / mib, sizeof(ping_result_ex_t) / mib, sizeof(record_bench_sample_t) / mib, sizeof(ping_record_t) / mib);
+        printf("  scan for loss and mean RTT: %.2f ms over results, %.2f ms over records\n", results_ms, records_ms);
+        if (sizeof(ping_record_t) > 16) {
+            printf("✗ A probe record takes %zu bytes\n", sizeof(ping_record_t));
+            __leave;
+        }
+        if (lost_records != lost_results || rtt_records_us != rtt_results_us) {
+            printf("✗ Records and results disagree: %llu and %llu lost\n", lost_records, lost_results);
+            __leave;
+        }
+        
+        printf("✓ Probe record benchmark complete\n");
+        result = ERROR_SUCCESS;
+    }
+    __finally {
+        if (results) HeapFree(GetProcessHeap(), 0, results);
+        if (records) HeapFree(GetProcessHeap(), 0, records);
+    }
+    
+    return result;
+}
+
+static bool within_percent(double value, double expected, double percent) {
+    return value >= expected * (1.0 - percent / 100.0) && value <= expected * (1.0 + percent / 100.0);
+}
+
+static DWORD test_rtt_histogram(void) {
+    DWORD result = ERROR_EXCEPTION_IN_SERVICE;
+    static ping_rtt_histogram_t global, merged;
+    ping_config_t config = {0};
+    bool config_changed = false;
+    
+    __try {
+        printf("Testing RTT histograms and percentiles...\n");
+        ping_reset_stats();
+        
+        // The 50 ms tail is a latency change to the detector, it must not reach the real network
+        if (ping_get_config(&config) != ERROR_SUCCESS) __leave;
+        bool countermeasures = config.enable_countermeasures;
+        config.enable_countermeasures = false;
+        ping_set_config(&config);
+        config.enable_countermeasures = countermeasures;
+        config_changed = true;
+        
+        // 99% of replies at 100 us, the last 1% at 50 ms: the mean hides the tail, p99.9 must not
+        ping_result_ex_t result_ex = {0};
+        result_ex.base.success = true;
+        strcpy_s(result_ex.base.target_ip, sizeof(result_ex.base.target_ip), HISTOGRAM_TEST_TARGET);
+        for (int i = 0; i < HISTOGRAM_TEST_COUNT; i++) {
+            result_ex.rtt_ns = (i < HISTOGRAM_TEST_COUNT * 99 / 100) ? 100000 : 50000000;
+            if (ping_record_result(&result_ex) != ERROR_SUCCESS) __leave;
+        }
+        
+        ping_target_stats_t target_stats;
+        if (ping_get_target_stats(HISTOGRAM_TEST_TARGET, &target_stats) != ERROR_SUCCESS) __leave;
+        printf("  target p50 %.3f ms, p99 %.3f ms, p99.9 %.3f ms, avg %.3f ms\n",
+               target_stats.rtt_p50, target_stats.rtt_p99, target_stats.rtt_p999, target_stats.avg_rtt);
+        if (!within_percent(target_stats.rtt_p50, 0.1, 12.5) || !within_percent(target_stats.rtt_p99, 0.1, 12.5) ||
+            !within_percent(target_stats.rtt_p999, 50.0, 12.5)) {
+            printf("✗ Per-target percentiles off\n");
+            __leave;
+        }
+        
+        double p999 = 0.0;
+        if (ping_get_rtt_histogram(NULL, &global) != ERROR_SUCCESS || global.total_count != HISTOGRAM_TEST_COUNT ||
+            ping_rtt_histogram_percentile(&global, 99.9, &p999) != ERROR_SUCCESS || !within_percent(p999, 50.0, 3.2)) {
+            printf("✗ Global histogram holds %llu replies, p99.9 %.3f ms\n", global.total_count, p999);
+            __leave;
+        }
+        
+        // Two processes' exports merge into one with the same shape, a per-target one re-buckets into it
+        memset(&merged, 0, sizeof(merged));
+        ping_merge_rtt_histograms(&merged, &global);
+        ping_merge_rtt_histograms(&merged, &global);
+        double merged_p50 = 0.0, merged_p999 = 0.0;
+        ping_rtt_histogram_percentile(&merged, 50.0, &merged_p50);
+        ping_rtt_histogram_percentile(&merged, 99.9, &merged_p999);
+        if (merged.total_count != 2 * HISTOGRAM_TEST_COUNT || !within_percent(merged_p50, 0.1, 3.2) || !within_percent(merged_p999, 50.0, 3.2)) {
+            printf("✗ Merged histogram holds %llu replies, p50 %.3f ms, p99.9 %.3f ms\n", merged.total_count, merged_p50, merged_p999);
+            __leave;
+        }
+        
+        printf("✓ RTT histograms report the tail the mean hides\n");
+        result = ERROR_SUCCESS;
+    }
+    __finally {
+        if (config_changed) ping_set_config(&config);
+        ping_reset_stats();
+    }
+    
+    return result;
+}
+
+static DWORD test_sketch_merge(void) {
+    DWORD result = ERROR_EXCEPTION_IN_SERVICE;
+    static ULONGLONG samples[SKETCH_TEST_SKETCHES * SKETCH_TEST_SAMPLES];
+    static BYTE blobs[SKETCH_TEST_SKETCHES][SKETCH_TEST_BLOB_BYTES];
+    static DWORD blob_sizes[SKETCH_TEST_SKETCHES];
+    static ping_sketch_t sketch, merged;
+    static const double quantiles[] = { 0.01, 0.5, 0.9, 0.99, 0.999 };
+    ping_config_t config = {0};
+    bool config_changed = false;
+    
+    __try {
+        printf("Testing quantile sketches merged from %d targets...\n", SKETCH_TEST_SKETCHES);
+        ping_reset_stats();
+        
+        // Wide synthetic tails would otherwise set off real countermeasures
+        if (ping_get_config(&config) != ERROR_SUCCESS) __leave;
+        bool countermeasures = config.enable_countermeasures;
+        config.enable_countermeasures = false;
+        ping_set_config(&config);
+        config.enable_countermeasures = countermeasures;
+        config_changed = true;
+        
+        // Each target, standing in for one host, gets its own base RTT and a tail up to 55x that
+        srand(7);
+        ping_result_ex_t result_ex = {0};
+        result_ex.base.success = true;
+        DWORD sample_count = 0;
+        for (DWORD t = 0; t < SKETCH_TEST_SKETCHES; t++) {
+            char target[16];
+            snprintf(target, sizeof(target), "10.251.%lu.%lu", t / 250, t % 250 + 1);
+            strcpy_s(result_ex.base.target_ip, sizeof(result_ex.base.target_ip), target);
+            
+            double base_ns = 200000.0 + (t % 50) * 100000.0;
+            for (DWORD k = 0; k < SKETCH_TEST_SAMPLES; k++) {
+                double u = rand() / (double)RAND_MAX;
+                result_ex.rtt_ns = (ULONGLONG)(base_ns * exp(u * u * 4.0));
+                samples[sample_count++] = result_ex.rtt_ns;
+                ping_record_result(&result_ex);
+            }
+            
+            if (ping_get_sketch(target, &sketch) != ERROR_SUCCESS ||
+                ping_sketch_serialize(&sketch, blobs[t], SKETCH_TEST_BLOB_BYTES, &blob_sizes[t]) != ERROR_SUCCESS) {
+                printf("✗ Sketch of %s could not be exported\n", target);
+                __leave;
+            }
+        }
+        
+        // The collector's side: bytes in, one fleet-wide sketch out
+        LARGE_INTEGER start, end;
+        memset(&merged, 0, sizeof(merged));
+        QueryPerformanceCounter(&start);
+        for (DWORD t = 0; t < SKETCH_TEST_SKETCHES; t++) {
+            if (ping_sketch_merge(&merged, blobs[t], blob_sizes[t]) != ERROR_SUCCESS) {
+                printf("✗ Sketch %lu did not merge\n", t);
+                __leave;
+            }
+        }
+        QueryPerformanceCounter(&end);
+        printf("  %d sketches, %lu bytes each on the wire, merged in %.2f ms\n",
+               SKETCH_TEST_SKETCHES, blob_sizes[0], elapsed_ms(start, end));
+        
+        if (merged.count != sample_count) {
+            printf("✗ Merged sketch counts %llu of %lu samples\n", merged.count, sample_count);
+            __leave;
+        }
+        
+        qsort(samples, sample_count, sizeof(samples[0]), compare_ulonglong);
+        for (int i = 0; i < (int)(sizeof(quantiles) / sizeof(quantiles[0])); i++) {
+            double exact_ms = samples[(size_t)(quantiles[i] * (sample_count - 1))] / 1000000.0;
+            double sketch_ms = 0.0;
+            ping_sketch_quantile(&merged, quantiles[i], &sketch_ms);
+            double error = fabs(sketch_ms - exact_ms) / exact_ms;
+            printf("  q%.3f: exact %.3f ms, sketch %.3f ms, error %.2f%%\n", quantiles[i], exact_ms, sketch_ms, error * 100.0);
+            if (error > SKETCH_TEST_ACCURACY * 1.001) {
+                printf("✗ Relative error above %.0f%%\n", SKETCH_TEST_ACCURACY * 100.0);
+                __leave;
+            }
+        }
+        
+        // A damaged blob must be refused whole
+        ULONGLONG count_before = merged.count;
+        blobs[0][blob_sizes[0] / 2] ^= 0xFF;
+        if (ping_sketch_merge(&merged, blobs[0], blob_sizes[0]) == ERROR_SUCCESS || merged.count != count_before) {
+            printf("✗ Corrupt sketch was merged\n");
+            __leave;
+        }
+        
+        printf("✓ Merged sketches hold their relative error\n");
+        result = ERROR_SUCCESS;
+    }
+    __finally {
+        if (config_changed) ping_set_config(&config);
+        ping_reset_stats();
+    }
+    
+    return result;
+}
+
+// Feed a target uptime_s healthy one-second results, then lost ones until it is degraded
+static DWORD outage_probes_to_detect(const char* target, DWORD uptime_s, DWORD* lost, double* lifetime_loss) {
+    ping_result_ex_t result_ex = {0};
+    ping_target_stats_t stats;
+    strcpy_s(result_ex.base.target_ip, sizeof(result_ex.base.target_ip), target);
+    
+    ULONGLONG at_ns = 1000000000ULL;
+    result_ex.base.success = true;
+    for (DWORD k = 0; k < uptime_s; k++, at_ns += 1000000000ULL) {
+        result_ex.send_time_ns = at_ns;
+        result_ex.rtt_ns = 20000000ULL + (k % 7) * 1000000ULL;
+        ping_record_result(&result_ex);
+    }
+    
+    ping_get_target_stats(target, &stats);
+    if (stats.degraded) {
+        return ERROR_INVALID_STATE;
+    }
+    
+    result_ex.base.success = false;
+    result_ex.rtt_ns = 0;
+    for (*lost = 1; *lost <= OUTAGE_TEST_MAX_LOST; (*lost)++, at_ns += 1000000000ULL) {
+        result_ex.send_time_ns = at_ns;
+        ping_record_result(&result_ex);
+        ping_get_target_stats(target, &stats);
+        if (stats.degraded) {
+            *lifetime_loss = (double)stats.packets_lost / stats.packets_sent * 100.0;
+            break;
+        }
+    }
+    if (!stats.degraded) {
+        return ERROR_TIMEOUT;
+    }
+    
+    // Once replies are back the outage must age out of the short window too
+    result_ex.base.success = true;
+    result_ex.rtt_ns = 20000000ULL;
+    for (DWORD k = 0; k <= OUTAGE_TEST_MAX_LOST && stats.degraded; k++, at_ns += 1000000000ULL) {
+        result_ex.send_time_ns = at_ns;
+        ping_record_result(&result_ex);
+        ping_get_target_stats(target, &stats);
+    }
+    
+    return stats.degraded ? ERROR_TIMEOUT : ERROR_SUCCESS;
+}
+
+static DWORD test_outage_detection(void) {
+    DWORD result = ERROR_EXCEPTION_IN_SERVICE;
+    static const DWORD uptimes[] = { 60, 86400 };
+    static const char* targets[] = { "10.249.0.1", "10.249.0.2" };
+    DWORD lost[2] = {0};
+    ping_config_t config = {0};
+    bool config_changed = false;
+    
+    __try {
+        printf("Testing outage detection against uptime...\n");
+        ping_reset_stats();
+        
+        // Detection is read off degraded, the injected outage must not reach the real network
+        if (ping_get_config(&config) != ERROR_SUCCESS) __leave;
+        ping_config_t quiet = config;
+        quiet.enable_countermeasures = false;
+        quiet.loss_threshold = 30;
+        quiet.short_window_ms = 30000;
+        quiet.long_window_ms = 300000;
+        ping_set_config(&quiet);
+        config_changed = true;
+        
+        for (int i = 0; i < 2; i++) {
+            double lifetime_loss = 0.0;
+            DWORD status = outage_probes_to_detect(targets[i], uptimes[i], &lost[i], &lifetime_loss);
+            if (status != ERROR_SUCCESS) {
+                printf("✗ %s after %lu s uptime: %s\n", targets[i], uptimes[i],
+                       status == ERROR_INVALID_STATE ? "degraded before the outage" : "outage not detected or never cleared");
+                __leave;
+            }
+            printf("  %lu s uptime: detected after %lu lost probes, lifetime loss only %.2f%%\n",
+                   uptimes[i], lost[i], lifetime_loss);
+        }
+        
+        if (lost[0] != lost[1]) {
+            printf("✗ Detection took %lu probes after a minute but %lu after a day\n", lost[0], lost[1]);
+            __leave;
+        }
+        
+        printf("✓ Outage detected after %lu lost probes regardless of uptime\n", lost[0]);
+        result = ERROR_SUCCESS;
+    }
+    __finally {
+        if (config_changed) ping_set_config(&config);
+        ping_reset_stats();
+    }
+    
+    return result;
+}
+
+static ULONGLONG change_bench_seed;
+
+// xorshift, the traces are the same on every run
+static double change_bench_uniform(void) {
+    change_bench_seed ^= change_bench_seed << 13;
+    change_bench_seed ^= change_bench_seed >> 7;
+    change_bench_seed ^= change_bench_seed << 17;
+    return ((change_bench_seed >> 11) + 0.5) / 9007199254740992.0;
+}
+
+// Lognormal RTT around base_ms with an occasional spike, lost with probability loss
+static void change_bench_probe(const char* target, ULONGLONG at_ns, double loss, double base_ms, ping_target_stats_t* stats) {
+    ping_result_ex_t result_ex = {0};
+    strcpy_s(result_ex.base.target_ip, sizeof(result_ex.base.target_ip), target);
+    result_ex.send_time_ns = at_ns;
+    result_ex.base.success = change_bench_uniform() >= loss;
+    if (result_ex.base.success) {
+        double normal = sqrt(-2.0 * log(change_bench_uniform())) * cos(6.283185307179586 * change_bench_uniform());
+        double rtt_ms = base_ms * exp(0.15 * normal);
+        if (change_bench_uniform() < 0.01) rtt_ms += base_ms * 5.0 * change_bench_uniform();
+        result_ex.rtt_ns = (ULONGLONG)(rtt_ms * 1000000.0);
+    }
+    ping_record_result(&result_ex);
+    ping_get_target_stats(target, stats);
+}
+
+// The window thresholds alone, as health analysis judged a target before the change detector
+static bool change_bench_thresholds(const ping_target_stats_t* stats, const ping_config_t* config) {
+    const ping_window_stats_t* recent = &stats->short_window;
+    const ping_window_stats_t* sustained = &stats->long_window;
+    if (recent->samples >= CHANGE_BENCH_MIN_SAMPLES && recent->loss_percent > config->loss_threshold) return true;
+    if (sustained->samples - sustained->lost < CHANGE_BENCH_MIN_SAMPLES) return false;
+    return sustained->mean_rtt > config->latency_threshold || sustained->jitter > config->jitter_threshold;
+}
+
+// Detection delay and false alarms of the change detector against the window thresholds, one-second probes
+static DWORD bench_change_detection(void) {
+    DWORD result = ERROR_EXCEPTION_IN_SERVICE;
+    static const struct { const char* name; double loss; double rtt_scale; } changes[] = {
+        { "outage", 1.0, 1.0 }, { "40% loss", 0.4, 1.0 }, { "RTT x2", 0.01, 2.0 }, { "RTT x30", 0.01, 30.0 }
+    };
+    ping_config_t config = {0};
+    ping_target_stats_t stats;
+    bool config_changed = false;
+    
+    __try {
+        printf("Benchmarking change detection on synthetic traces...\n");
+        ping_reset_stats();
+        
+        if (ping_get_config(&config) != ERROR_SUCCESS) __leave;
+        ping_config_t quiet = config;
+        quiet.enable_countermeasures = false;
+        quiet.loss_threshold = 30;
+        quiet.latency_threshold = 500;
+        quiet.jitter_threshold = 100;
+        quiet.short_window_ms = 30000;
+        quiet.long_window_ms = 300000;
+        ping_set_config(&quiet);
+        config_changed = true;
+        change_bench_seed = 88172645463325252ULL;
+        
+        // Healthy 20 ms targets with 1% loss, every alarm is a false one
+        DWORD detector_false = 0, threshold_false = 0;
+        for (DWORD t = 0; t < CHANGE_BENCH_TRACES; t++) {
+            char target[16];
+            snprintf(target, sizeof(target), "10.247.0.%lu", t + 1);
+            bool breached = false;
+            for (DWORD k = 0; k < CHANGE_BENCH_HEALTHY_S; k++) {
+                change_bench_probe(target, (k + 1) * 1000000000ULL, 0.01, 20.0, &stats);
+                bool now = change_bench_thresholds(&stats, &quiet);
+                if (now && !breached) threshold_false++;
+                breached = now;
+            }
+            detector_false += stats.change_alarms;
+        }
+        double hours = CHANGE_BENCH_TRACES * CHANGE_BENCH_HEALTHY_S / 3600.0;
+        printf("  healthy: %.2f false alarms/hour detector, %.2f thresholds, over %.0f hours\n",
+               detector_false / hours, threshold_false / hours, hours);
+        if (detector_false / hours > CHANGE_BENCH_MAX_FALSE_PER_HOUR) {
+            printf("✗ Detector alarms on healthy targets\n");
+            __leave;
+        }
+        
+        // Ten healthy minutes, then the change; delay is probes from its start to the first verdict
+        for (int c = 0; c < (int)(sizeof(changes) / sizeof(changes[0])); c++) {
+            DWORD detector_total = 0, threshold_total = 0, detector_missed = 0, threshold_missed = 0;
+            double confidence = 0.0;
+            for (DWORD t = 0; t < CHANGE_BENCH_TRACES; t++) {
+                char target[16];
+                snprintf(target, sizeof(target), "10.247.%d.%lu", c + 1, t + 1);
+                ULONGLONG at_ns = 1000000000ULL;
+                for (DWORD k = 0; k < CHANGE_BENCH_LEAD_S; k++, at_ns += 1000000000ULL) {
+                    change_bench_probe(target, at_ns, 0.01, 20.0, &stats);
+                }
+                
+                DWORD detector_delay = 0, threshold_delay = 0;
+                for (DWORD k = 1; k <= CHANGE_BENCH_MAX_S && !(detector_delay && threshold_delay); k++, at_ns += 1000000000ULL) {
+                    change_bench_probe(target, at_ns, changes[c].loss, 20.0 * changes[c].rtt_scale, &stats);
+                    if (!detector_delay && stats.change) {
+                        detector_delay = k;
+                        confidence += stats.change_confidence;
+                    }
+                    if (!threshold_delay && change_bench_thresholds(&stats, &quiet)) threshold_delay = k;
+                }
+                if (detector_delay) detector_total += detector_delay; else detector_missed++;
+                if (threshold_delay) threshold_total += threshold_delay; else threshold_missed++;
+            }
+            
+            DWORD detected = CHANGE_BENCH_TRACES - detector_missed;
+            DWORD thresholded = CHANGE_BENCH_TRACES - threshold_missed;
+            printf("  %-9s detector %6.1f probes (%lu missed, confidence %.5f), thresholds %6.1f probes (%lu missed)\n",
+                   changes[c].name, detected ? (double)detector_total / detected : 0.0, detector_missed,
+                   detected ? confidence / detected : 0.0, thresholded ? (double)threshold_total / thresholded : 0.0, threshold_missed);
+            
+            // Every change must be caught, and no later than the thresholds catch it
+            if (detector_missed || (thresholded && (double)detector_total / detected > (double)threshold_total / thresholded)) {
+                printf("✗ Detector slower than the thresholds on %s\n", changes[c].name);
+                __leave;
+            }
+        }
+        
+        printf("✓ Change detection benchmark complete\n");
+        result = ERROR_SUCCESS;
+    }
+    __finally {
+        if (config_changed) ping_set_config(&config);
+        ping_reset_stats();
+    }
+    
+    return result;
+}
+
+// Countermeasures run on their worker while the caller keeps probing at its own cadence
+static DWORD test_countermeasure_cadence(void) {
+    DWORD result = ERROR_EXCEPTION_IN_SERVICE;
+    ping_config_t config = {0};
+    ping_countermeasure_status_t status = {0};
+    ping_result_t ping_result;
+    bool config_changed = false;
+    
+    __try {
+        printf("Testing probe cadence while countermeasures run...\n");
+        
+        // Only the DNS cache flush runs, it leaves the system's settings as they were
+        if (ping_get_config(&config) != ERROR_SUCCESS) __leave;
+        ping_config_t quiet = config;
+        quiet.enable_countermeasures = false;
+        quiet.enable_dns_switching = false;
+        quiet.enable_route_refresh = false;
+        quiet.countermeasure_cooldown_ms = CADENCE_COOLDOWN_MS;
+        ping_set_config(&quiet);
+        config_changed = true;
+        ping_reset_stats();
+        
+        LARGE_INTEGER start, end, last, now;
+        QueryPerformanceCounter(&start);
+        ping_force_countermeasures();
+        ping_force_countermeasures();
+        QueryPerformanceCounter(&end);
+        double trigger_ms = elapsed_ms(start, end);
+        
+        double max_gap_ms = 0.0;
+        DWORD probes = 0;
+        last = end;
+        for (;;) {
+            ping_execute("127.0.0.1", &ping_result);
+            probes++;
+            
+            ping_get_countermeasure_status(&status);
+            if (status.state != PING_COUNTERMEASURE_QUEUED && status.state != PING_COUNTERMEASURE_RUNNING) break;
+            
+            QueryPerformanceCounter(&now);
+            if (elapsed_ms(start, now) > CADENCE_TIMEOUT_MS) {
+                printf("✗ Countermeasures still running after %d ms\n", CADENCE_TIMEOUT_MS);
+                __leave;
+            }
+            
+            Sleep(CADENCE_INTERVAL_MS);
+            QueryPerformanceCounter(&now);
+            double gap_ms = elapsed_ms(last, now);
+            if (gap_ms > max_gap_ms) max_gap_ms = gap_ms;
+            last = now;
+        }
+        
+        printf("  Two triggers returned in %.3f ms, %lu probes every %d ms meanwhile, longest gap %.1f ms\n",
+               trigger_ms, probes, CADENCE_INTERVAL_MS, max_gap_ms);
+        printf("  Countermeasures took %.1f ms, actions 0x%lx, %llu run(s), %llu coalesced\n",
+               status.last_duration_ms, status.last_actions, status.runs, status.coalesced);
+        
+        if (max_gap_ms > CADENCE_MAX_GAP_MS) {
+            printf("✗ Probing stalled for %.1f ms\n", max_gap_ms);
+            __leave;
+        }
+        if (status.runs != 1 || status.coalesced != 1 || !(status.last_reasons & PING_BREACH_FORCED)) {
+            printf("✗ Expected one forced run with the second trigger coalesced\n");
+            __leave;
+        }
+        
+        // Inside the cooldown a trigger is only counted, after it the worker is idle again
+        ping_force_countermeasures();
+        ping_get_countermeasure_status(&status);
+        if (status.state != PING_COUNTERMEASURE_COOLDOWN || status.suppressed != 1) {
+            printf("✗ Trigger during the cooldown was not suppressed\n");
+            __leave;
+        }
+        
+        Sleep(status.cooldown_remaining_ms + CADENCE_INTERVAL_MS);
+        ping_get_countermeasure_status(&status);
+        if (status.state != PING_COUNTERMEASURE_IDLE || status.runs != 1) {
+            printf("✗ Cooldown did not end\n");
+            __leave;
+        }
+        
+        printf("✓ Probe cadence held while countermeasures ran\n");
+        result = ERROR_SUCCESS;
+    }
+    __finally {
+        if (config_changed) ping_set_config(&config);
+        ping_reset_stats();
+    }
+    
+    return result;
+}
+
+// Time each in-process countermeasure against spawning ipconfig the way they used to run
+static DWORD bench_countermeasure_actions(void) {
+    DWORD result = ERROR_EXCEPTION_IN_SERVICE;
+    static const char* names[PING_ACTION_COUNT] = { "DNS switch", "Route refresh", "DNS flush" };
+    ping_config_t config = {0};
+    ping_countermeasure_status_t status = {0};
+    HANDLE process = NULL;
+    HANDLE thread = NULL;
+    bool config_changed = false;
+    
+    __try {
+        printf("Benchmarking countermeasure actions...\n");
+        
+        // Switching DNS would change the system's settings, route refresh and DNS flush only drop caches
+        if (ping_get_config(&config) != ERROR_SUCCESS) __leave;
+        ping_config_t quiet = config;
+        quiet.enable_countermeasures = false;
+        quiet.enable_dns_switching = false;
+        quiet.enable_route_refresh = true;
+        quiet.countermeasure_cooldown_ms = 0;
+        ping_set_config(&quiet);
+        config_changed = true;
+        ping_reset_stats();
+        
+        ping_force_countermeasures();
+        for (DWORD waited = 0; waited < CADENCE_TIMEOUT_MS; waited += 10) {
+            ping_get_countermeasure_status(&status);
+            if (status.runs > 0) break;
+            Sleep(10);
+        }
+        if (status.runs == 0) {
+            printf("✗ Countermeasures did not complete\n");
+            __leave;
+        }
+        
+        for (int i = 0; i < PING_ACTION_COUNT; i++) {
+            DWORD action_status = status.action_status[i];
+            const char* outcome = action_status == NO_ERROR ? "ok" :
+                action_status == ERROR_CANCELLED ? "disabled" :
+                action_status == ERROR_ACCESS_DENIED ? "needs elevation" :
+                action_status == ERROR_NOT_SUPPORTED ? "not supported" : "failed";
+            printf("  %-14s %8.3f ms  %s (%lu)\n", names[i], status.action_ms[i], outcome, action_status);
+            if (status.action_ms[i] > ACTION_MAX_MS) {
+                printf("✗ %s took longer than %d ms\n", names[i], ACTION_MAX_MS);
+                __leave;
+            }
+        }
+        
+        // The baseline, one child process waited for
+        STARTUPINFOA si = {0};
+        PROCESS_INFORMATION pi = {0};
+        si.cb = sizeof(si);
+        si.dwFlags = STARTF_USESHOWWINDOW;
+        si.wShowWindow = SW_HIDE;
+        char command[] = "ipconfig /flushdns";
+        LARGE_INTEGER start, end;
+        QueryPerformanceCounter(&start);
+        if (CreateProcessA(NULL, command, NULL, NULL, FALSE, 0, NULL, NULL, &si, &pi)) {
+            process = pi.hProcess;
+            thread = pi.hThread;
+            WaitForSingleObject(process, 5000);
+            QueryPerformanceCounter(&end);
+            printf("  ipconfig /flushdns spawned: %.3f ms\n", elapsed_ms(start, end));
+        }
+        
+        printf("✓ Countermeasures ran in-process in %.3f ms\n", status.last_duration_ms);
+        result = ERROR_SUCCESS;
+    }
+    __finally {
+        if (process) CloseHandle(process);
+        if (thread) CloseHandle(thread);
+        if (config_changed) ping_set_config(&config);
+        ping_reset_stats();
+    }
+    
+    return result;
+}
+
+// Stand-in countermeasure, sleeps, then reports when it ran
+typedef struct {
+    DWORD delay_ms;
+    volatile LONG calls;
+    volatile LONG64 begin_ns;
+    volatile LONG64 end_ns;
+    volatile LONG* fixes; // set once it returns, when not NULL
+} mock_countermeasure_t;
+
+static LONG64 mock_now_ns(void) {
+    LARGE_INTEGER counter, frequency;
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    return (LONG64)((double)counter.QuadPart * 1e9 / (double)frequency.QuadPart);
+}
+
+static DWORD __stdcall mock_countermeasure(void* context) {
+    mock_countermeasure_t* mock = (mock_countermeasure_t*)context;
+    InterlockedIncrement(&mock->calls);
+    InterlockedExchange64(&mock->begin_ns, mock_now_ns());
+    Sleep(mock->delay_ms);
+    InterlockedExchange64(&mock->end_ns, mock_now_ns());
+    if (mock->fixes) InterlockedExchange(mock->fixes, 1);
+    return ERROR_SUCCESS;
+}
+
+static DWORD register_mock(const char* name, mock_countermeasure_t* mock, DWORD cost, DWORD timeout_ms, DWORD cooldown_ms, DWORD triggers, DWORD* id) {
+    ping_countermeasure_t countermeasure = {0};
+    strcpy_s(countermeasure.name, sizeof(countermeasure.name), name);
+    countermeasure.run = mock_countermeasure;
+    countermeasure.context = mock;
+    countermeasure.cost = cost;
+    countermeasure.timeout_ms = timeout_ms;
+    countermeasure.cooldown_ms = cooldown_ms;
+    countermeasure.triggers = triggers;
+    return ping_register_countermeasure(&countermeasure, id);
+}
+
+static bool wait_countermeasure_runs(ULONGLONG runs, ping_countermeasure_status_t* status) {
+    for (DWORD waited = 0; waited < CADENCE_TIMEOUT_MS; waited += 10) {
+        ping_get_countermeasure_status(status);
+        if (status->runs >= runs && status->state != PING_COUNTERMEASURE_RUNNING) return true;
+        Sleep(10);
+    }
+    return false;
+}
+
+// Mock countermeasures with artificial delays: equal costs overlap, a slow one is cut off at its
+// timeout, its own cooldown skips it, and costlier ones wait until the cheap one failed to help
+static DWORD test_countermeasure_registry(void) {
+    DWORD result = ERROR_EXCEPTION_IN_SERVICE;
+    static mock_countermeasure_t mocks[MOCK_COUNT];
+    static ping_countermeasure_info_t info;
+    static volatile LONG fixed = 0;
+    DWORD ids[MOCK_COUNT] = {0};
+    ping_config_t config = {0};
+    ping_countermeasure_status_t status = {0};
+    bool config_changed = false;
+    
+    __try {
+        printf("Testing the countermeasure registry with mock actions...\n");
+        memset(mocks, 0, sizeof(mocks));
+        
+        if (ping_get_config(&config) != ERROR_SUCCESS) __leave;
+        ping_config_t quiet = config;
+        quiet.enable_countermeasures = false;
+        quiet.enable_dns_switching = false;
+        quiet.enable_route_refresh = false;
+        quiet.countermeasure_cooldown_ms = 0;
+        quiet.countermeasure_settle_ms = MOCK_DELAY_MS;
+        quiet.loss_threshold = 30;
+        quiet.short_window_ms = 30000;
+        ping_set_config(&quiet);
+        config_changed = true;
+        ping_reset_stats();
+        
+        mocks[0].delay_ms = MOCK_DELAY_MS;
+        mocks[1].delay_ms = MOCK_DELAY_MS;
+        mocks[2].delay_ms = MOCK_SLOW_MS;
+        mocks[3].delay_ms = 0;
+        if (register_mock("parallel_a", &mocks[0], 0, 1000, 0, PING_BREACH_FORCED, &ids[0]) != ERROR_SUCCESS ||
+            register_mock("parallel_b", &mocks[1], 0, 1000, 0, PING_BREACH_FORCED, &ids[1]) != ERROR_SUCCESS ||
+            register_mock("slow", &mocks[2], 1, MOCK_TIMEOUT_MS, 0, PING_BREACH_FORCED, &ids[2]) != ERROR_SUCCESS ||
+            register_mock("once_a_minute", &mocks[3], 1, 1000, 60000, PING_BREACH_FORCED, &ids[3]) != ERROR_SUCCESS) {
+            printf("✗ Mock countermeasures could not be registered\n");
+            __leave;
+        }
+        
+        ping_force_countermeasures();
+        if (!wait_countermeasure_runs(1, &status)) {
+            printf("✗ Countermeasures did not complete\n");
+            __leave;
+        }
+        
+        bool overlapped = mocks[0].begin_ns < mocks[1].end_ns && mocks[1].begin_ns < mocks[0].end_ns;
+        printf("  Run took %.1f ms: two %d ms actions %s, a %d ms one given %d ms\n", status.last_duration_ms,
+               MOCK_DELAY_MS, overlapped ? "overlapped" : "ran in turn", MOCK_SLOW_MS, MOCK_TIMEOUT_MS);
+        if (!overlapped || status.last_duration_ms > MOCK_SLOW_MS * 0.75) {
+            printf("✗ Equal cost actions must run together and a slow one must not hold up the run\n");
+            __leave;
+        }
+        if (status.action_status[ids[2] - 1] != ERROR_TIMEOUT || ping_get_countermeasure_info(ids[2], &info) != ERROR_SUCCESS || info.timeouts != 1) {
+            printf("✗ Slow action was not timed out\n");
+            __leave;
+        }
+        
+        double p50 = 0.0;
+        ping_get_countermeasure_info(ids[0], &info);
+        ping_rtt_histogram_percentile(&info.execution_times, 50.0, &p50);
+        printf("  parallel_a: %llu run(s), median execution %.1f ms\n", info.runs, p50);
+        if (info.runs != 1 || p50 < MOCK_DELAY_MS * 0.9 || p50 > MOCK_DELAY_MS * 1.5) {
+            printf("✗ Execution time histogram is off\n");
+            __leave;
+        }
+        
+        // Only the shared cooldown is zero, the once-a-minute action must sit the second run out
+        ping_force_countermeasures();
+        if (!wait_countermeasure_runs(2, &status)) {
+            printf("✗ Second run did not complete\n");
+            __leave;
+        }
+        ping_get_countermeasure_info(ids[3], &info);
+        if (info.runs != 1 || info.skipped != 1) {
+            printf("✗ Action in its cooldown ran again\n");
+            __leave;
+        }
+        
+        for (int i = 0; i < 4; i++) {
+            ping_unregister_countermeasure(ids[i]);
+            ids[i] = 0;
+        }
+        
+        // A real trigger: the cheap fix brings replies back, the expensive one must never run
+        ping_reset_stats();
+        quiet.enable_countermeasures = true;
+        quiet.countermeasure_cooldown_ms = MOCK_SLOW_MS;
+        ping_set_config(&quiet);
+        mocks[4].delay_ms = 50;
+        mocks[4].fixes = &fixed;
+        if (register_mock("cheap_fix", &mocks[4], 0, 1000, 0, PING_BREACH_LOSS, &ids[4]) != ERROR_SUCCESS ||
+            register_mock("expensive", &mocks[5], 100, 1000, 0, PING_BREACH_LOSS, &ids[5]) != ERROR_SUCCESS) {
+            printf("✗ Mock countermeasures could not be registered\n");
+            __leave;
+        }
+        
+        ping_result_ex_t result_ex = {0};
+        strcpy_s(result_ex.base.target_ip, sizeof(result_ex.base.target_ip), "10.248.0.1");
+        for (DWORD waited = 0; waited < CADENCE_TIMEOUT_MS; waited += 20) {
+            result_ex.base.success = fixed != 0;
+            result_ex.rtt_ns = fixed ? 20000000ULL : 0;
+            ping_record_result(&result_ex);
+            ping_get_countermeasure_status(&status);
+            if (status.runs > 0 && status.state != PING_COUNTERMEASURE_RUNNING) break;
+            Sleep(20);
+        }
+        
+        ping_get_countermeasure_info(ids[5], &info);
+        printf("  Loss trigger: cheap fix ran %ld time(s), expensive one %llu, run took %.1f ms\n",
+               mocks[4].calls, info.runs, status.last_duration_ms);
+        if (status.runs != 1 || mocks[4].calls != 1 || info.runs != 0 || mocks[5].calls != 0) {
+            printf("✗ Escalated although the cheap countermeasure cleared the loss\n");
+            __leave;
+        }
+        
+        printf("✓ Countermeasure registry ran mock actions by cost, timeout and cooldown\n");
+        result = ERROR_SUCCESS;
+    }
+    __finally {
+        for (int i = 0; i < MOCK_COUNT; i++) {
+            if (ids[i]) ping_unregister_countermeasure(ids[i]);
+        }
+        if (config_changed) ping_set_config(&config);
+        ping_reset_stats();
+    }
+    
+    return result;
+}
+
+// Counts what the drain thread hands over, nothing is written anywhere
+static void __stdcall log_bench_sink(void* context, log_kind_t kind, const FILETIME* time, const char* text) {
+    UNREFERENCED_PARAMETER(kind);
+    UNREFERENCED_PARAMETER(time);
+    UNREFERENCED_PARAMETER(text);
+    (*(ULONGLONG*)context)++;
+}
+
+typedef struct {
+    HANDLE start;
+    bool formatted;
+} log_bench_worker_t;
+
+static DWORD WINAPI log_bench_worker(LPVOID param) {
+    log_bench_worker_t* worker = (log_bench_worker_t*)param;
+    WaitForSingleObject(worker->start, INFINITE);
+    for (DWORD i = 0; i < LOG_BENCH_CALLS; i++) {
+        if (worker->formatted) {
+            ping_log(LOG_WARNING, "High latency to %s: %.1fms over the last %lu ms", "10.0.0.1", 512.5, i);
+        }
+        else {
+            ping_log(LOG_INFO, "Probe sent");
+        }
+    }
+    return 0;
+}
+
+// Callers only enqueue: per-call cost from 1 and 4 threads, then a file sink against writing each line in place
+static DWORD bench_log_ring(void) {
+    DWORD result = ERROR_EXCEPTION_IN_SERVICE;
+    static const DWORD thread_counts[] = { 1, LOG_BENCH_THREADS };
+    HANDLE start = NULL;
+    HANDLE threads[LOG_BENCH_THREADS] = {0};
+    HANDLE direct = INVALID_HANDLE_VALUE;
+    log_bench_worker_t workers[LOG_BENCH_THREADS];
+    ULONGLONG sunk = 0;
+    char ring_path[MAX_PATH] = {0}, direct_path[MAX_PATH] = {0};
+    
+    __try {
+        printf("Benchmarking the log ring...\n");
+        start = CreateEventA(NULL, TRUE, FALSE, NULL);
+        if (!start) __leave;
+        ping_set_log_sink(log_bench_sink, &sunk);
+        
+        for (int formatted = 0; formatted < 2; formatted++) {
+            for (int n = 0; n < 2; n++) {
+                DWORD thread_count = thread_counts[n];
+                ping_log_stats_t before, after;
+                ping_flush_log(10000);
+                ping_get_log_stats(&before);
+                ULONGLONG sunk_before = sunk;
+                
+                ResetEvent(start);
+                for (DWORD t = 0; t < thread_count; t++) {
+                    workers[t].start = start;
+                    workers[t].formatted = formatted != 0;
+                    threads[t] = CreateThread(NULL, 0, log_bench_worker, &workers[t], 0, NULL);
+                    if (!threads[t]) __leave;
+                }
+                
+                LARGE_INTEGER begin, end;
+                QueryPerformanceCounter(&begin);
+                SetEvent(start);
+                WaitForMultipleObjects(thread_count, threads, TRUE, INFINITE);
+                QueryPerformanceCounter(&end);
+                for (DWORD t = 0; t < thread_count; t++) {
+                    CloseHandle(threads[t]);
+                    threads[t] = NULL;
+                }
+                
+                if (ping_flush_log(10000) != ERROR_SUCCESS) {
+                    printf("✗ Log ring did not drain\n");
+                    __leave;
+                }
+                ping_get_log_stats(&after);
+                
+                // Each thread made every call, the time per call is what one caller pays
+                double call_ns = elapsed_ms(begin, end) * 1000000.0 / LOG_BENCH_CALLS;
+                ULONGLONG calls = (ULONGLONG)thread_count * LOG_BENCH_CALLS;
+                ULONGLONG enqueued = after.enqueued - before.enqueued;
+                ULONGLONG dropped = after.dropped - before.dropped;
+                printf("  %s, %lu thread(s): %.1f ns/call, %llu written, %llu dropped\n",
+                       formatted ? "formatted" : "plain", thread_count, call_ns, enqueued, dropped);
+                
+                if (enqueued + dropped < calls || sunk - sunk_before != after.written - before.written) {
+                    printf("✗ %llu calls, %llu enqueued, %llu dropped, %llu reached the sink\n", calls, enqueued, dropped, sunk - sunk_before);
+                    __leave;
+                }
+                if (!formatted && n == 0 && call_ns > LOG_BENCH_MAX_NS) {
+                    printf("✗ Logging costs the caller %.1f ns\n", call_ns);
+                    __leave;
+                }
+            }
+        }
+        
+        // The same lines through the file sink, and formatted and written on the calling thread
+        GetTempPathA(MAX_PATH, ring_path);
+        strcpy_s(direct_path, sizeof(direct_path), ring_path);
+        strcat_s(ring_path, sizeof(ring_path), "dbj_ping_log_ring.log");
+        strcat_s(direct_path, sizeof(direct_path), "dbj_ping_log_direct.log");
+        DeleteFileA(ring_path);
+        ping_flush_log(10000);
+        if (ping_set_log_file(ring_path) != ERROR_SUCCESS) {
+            printf("✗ Log file %s could not be opened\n", ring_path);
+            __leave;
+        }
+        
+        ping_log_stats_t before, after;
+        ping_get_log_stats(&before);
+        LARGE_INTEGER begin, end;
+        QueryPerformanceCounter(&begin);
+        for (DWORD i = 0; i < LOG_BENCH_FILE_LINES; i++) {
+            ping_log(LOG_WARNING, "High latency to %s: %.1fms over the last %lu ms", "10.0.0.1", 512.5, i);
+        }
+        QueryPerformanceCounter(&end);
+        double ring_ns = elapsed_ms(begin, end) * 1000000.0 / LOG_BENCH_FILE_LINES;
+        
+        // A format in the caller's own buffer, rewritten before the drain thread gets to it
+        char transient[64];
+        strcpy_s(transient, sizeof(transient), "Transient format %lu");
+        ping_log(LOG_INFO, transient, 7ul);
+        strcpy_s(transient, sizeof(transient), "Overwritten before the drain");
+        ping_flush_log(10000);
+        ping_get_log_stats(&after);
+        ping_set_log_sink(NULL, NULL);
+        
+        direct = CreateFileA(direct_path, FILE_APPEND_DATA, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (direct == INVALID_HANDLE_VALUE) __leave;
+        QueryPerformanceCounter(&begin);
+        for (DWORD i = 0; i < LOG_BENCH_FILE_LINES; i++) {
+            char line[MAX_LOG_MSG + 48];
+            int length = sprintf_s(line, sizeof(line), "WARN High latency to %s: %.1fms over the last %lu ms\r\n", "10.0.0.1", 512.5, i);
+            DWORD written = 0;
+            WriteFile(direct, line, (DWORD)length, &written, NULL);
+        }
+        QueryPerformanceCounter(&end);
+        double direct_ns = elapsed_ms(begin, end) * 1000000.0 / LOG_BENCH_FILE_LINES;
+        
+        // Every line the ring did not drop must be in the file
+        DWORD lines = 0;
+        bool transient_found = false;
+        FILE* file = NULL;
+        if (fopen_s(&file, ring_path, "r") == 0 && file) {
+            char line[MAX_LOG_MSG + 48];
+            while (fgets(line, sizeof(line), file)) {
+                lines++;
+                if (strstr(line, "Transient format 7")) transient_found = true;
+            }
+            fclose(file);
+        }
+        printf("  file: %.1f ns/call through the ring, %.1f ns/call written in place, %lu lines, %llu dropped\n",
+               ring_ns, direct_ns, lines, after.dropped - before.dropped);
+        if (lines + (after.dropped - before.dropped) < LOG_BENCH_FILE_LINES) {
+            printf("✗ %lu lines in the file, %llu dropped of %d\n", lines, after.dropped - before.dropped, LOG_BENCH_FILE_LINES);
+            __leave;
+        }
+        if (!transient_found && after.dropped == before.dropped) {
+            printf("✗ A format from the caller's buffer was not written as it was at the call\n");
+            __leave;
+        }
+        
+        printf("✓ Log ring benchmark complete\n");
+        result = ERROR_SUCCESS;
+    }
+    __finally {
+        if (start) SetEvent(start);
+        for (int t = 0; t < LOG_BENCH_THREADS; t++) {
+            if (threads[t]) {
+                WaitForSingleObject(threads[t], INFINITE);
+                CloseHandle(threads[t]);
+            }
+        }
+        if (start) CloseHandle(start);
+        if (direct != INVALID_HANDLE_VALUE) CloseHandle(direct);
+        ping_flush_log(10000);
+        ping_set_log_sink(NULL, NULL);
+        if (ring_path[0]) DeleteFileA(ring_path);
+        if (direct_path[0]) DeleteFileA(direct_path);
+    }
+    
+    return result;
+}
+
+// What every caller paid before: the whole message formatted on its own thread
+static int log_format_in_place(char* text, size_t size, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf_s(text, size, _TRUNCATE, format, args);
+    va_end(args);
+    return length;
+}
+
+static ULONGLONG file_bytes(const char* path) {
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    if (!GetFileAttributesExA(path, GetFileExInfoStandard, &data)) return 0;
+    return ((ULONGLONG)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+}
+
+// Log one record format through the text file sink or the binary one, bytes and ns per record
+static DWORD log_binary_run(const char* path, bool binary, double* call_ns, double* record_bytes, ULONGLONG* written) {
+    ping_log_stats_t before, after;
+    DeleteFileA(path);
+    ping_flush_log(10000);
+    DWORD status = binary ? ping_set_log_binary_file(path) : ping_set_log_file(path);
+    if (status != ERROR_SUCCESS) return status;
+    
+    ping_get_log_stats(&before);
+    LARGE_INTEGER begin, end;
+    QueryPerformanceCounter(&begin);
+    for (DWORD i = 0; i < LOG_BINARY_RECORDS; i++) {
+        ping_log(LOG_WARNING, "High latency to %s: %.1fms over the last %lu ms (threshold: %lums)", "10.0.0.1", 512.5, i, 500);
+    }
+    QueryPerformanceCounter(&end);
+    ping_flush_log(10000);
+    ping_get_log_stats(&after);
+    ping_set_log_sink(NULL, NULL);
+    
+    *call_ns = elapsed_ms(begin, end) * 1000000.0 / LOG_BINARY_RECORDS;
+    *written = after.written - before.written;
+    *record_bytes = *written ? (double)file_bytes(path) / *written : 0.0;
+    return ERROR_SUCCESS;
+}
+
+// Binary records against text: caller cost, size on disk, and the decoder must give back the text
+static DWORD bench_log_binary(void) {
+    DWORD result = ERROR_EXCEPTION_IN_SERVICE;
+    char text_path[MAX_PATH] = {0}, binary_path[MAX_PATH] = {0}, decoded_path[MAX_PATH] = {0};
+    
+    __try {
+        printf("Benchmarking binary log records against formatted text...\n");
+        GetTempPathA(MAX_PATH, text_path);
+        strcpy_s(binary_path, sizeof(binary_path), text_path);
+        strcpy_s(decoded_path, sizeof(decoded_path), text_path);
+        strcat_s(text_path, sizeof(text_path), "dbj_ping_log_text.log");
+        strcat_s(binary_path, sizeof(binary_path), "dbj_ping_log_binary.bin");
+        strcat_s(decoded_path, sizeof(decoded_path), "dbj_ping_log_decoded.log");
+        
+        char text[MAX_LOG_MSG];
+        LARGE_INTEGER begin, end;
+        QueryPerformanceCounter(&begin);
+        for (DWORD i = 0; i < LOG_BINARY_RECORDS; i++) {
+            log_format_in_place(text, sizeof(text), "High latency to %s: %.1fms over the last %lu ms (threshold: %lums)", "10.0.0.1", 512.5, i, 500);
+        }
+        QueryPerformanceCounter(&end);
+        double vsnprintf_ns = elapsed_ms(begin, end) * 1000000.0 / LOG_BINARY_RECORDS;
+        
+        double text_ns = 0.0, text_bytes = 0.0, binary_ns = 0.0, binary_bytes = 0.0;
+        ULONGLONG text_written = 0, binary_written = 0;
+        if (log_binary_run(text_path, false, &text_ns, &text_bytes, &text_written) != ERROR_SUCCESS ||
+            log_binary_run(binary_path, true, &binary_ns, &binary_bytes, &binary_written) != ERROR_SUCCESS) {
+            printf("✗ Log files could not be opened in %s\n", text_path);
+            __leave;
+        }
+        printf("  vsnprintf on the caller %.1f ns/record\n", vsnprintf_ns);
+        printf("  text sink: %.1f ns/call, %.1f bytes/record, %llu written\n", text_ns, text_bytes, text_written);
+        printf("  binary sink: %.1f ns/call, %.1f bytes/record, %llu written\n", binary_ns, binary_bytes, binary_written);
+        
+        if (binary_written == 0 || binary_bytes >= text_bytes) {
+            printf("✗ Binary records are no smaller than text lines\n");
+            __leave;
+        }
+        if (binary_ns >= vsnprintf_ns) {
+            printf("✗ Capturing the arguments costs as much as formatting them\n");
+            __leave;
+        }
+        
+        // Decoded, the binary file must read like the text one, line for line
+        DWORD status = ping_decode_log(binary_path, decoded_path);
+        DWORD lines = 0;
+        bool matches = false;
+        FILE* file = NULL;
+        if (status == ERROR_SUCCESS && fopen_s(&file, decoded_path, "r") == 0 && file) {
+            char line[MAX_LOG_MSG + 48];
+            while (fgets(line, sizeof(line), file)) {
+                if (strstr(line, "WARN High latency to 10.0.0.1: 512.5ms over the last ") && strstr(line, " ms (threshold: 500ms)")) {
+                    if (lines == 0) matches = true;
+                    lines++;
+                }
+            }
+            fclose(file);
+        }
+        printf("  decoded %lu lines\n", lines);
+        if (status != ERROR_SUCCESS || !matches || lines != binary_written) {
+            printf("✗ Decoding returned %lu, %lu of %llu records came back as text\n", status, lines, binary_written);
+            __leave;
+        }
+        
+        printf("✓ Binary log benchmark complete\n");
+        result = ERROR_SUCCESS;
+    }
+    __finally {
+        ping_set_log_sink(NULL, NULL);
+        if (text_path[0]) DeleteFileA(text_path);
+        if (binary_path[0]) DeleteFileA(binary_path);
+        if (decoded_path[0]) DeleteFileA(decoded_path);
+    }
+    
+    return result;
+}
+
+// Every key away from its default, so a key the loader misses shows up as a mismatch
+static const char CONFIG_BENCH_TEXT[] =
+    "; written by the configuration benchmark\r\n"
+    "[Ping]\r\nTarget=config-bench.dbj-ping.test\r\nTimeoutMs=1500\r\nIntervalMs=250\r\nMaxRetries=5\r\n\r\n"
+    "[Thresholds]\r\nLossThreshold=12\r\nLatencyThreshold=321\r\nJitterThreshold=45\r\nShortWindowMs=15000\r\nLongWindowMs=120000\r\n\r\n"
+    "[Features]\r\nEnableCountermeasures=0\r\nEnableDnsSwitching=0\r\nEnableRouteRefresh=0\r\nEnableLogging=1\r\n"
+    "CountermeasureCooldownMs=45000\r\nCountermeasureSettleMs=2500\r\n\r\n"
+    "[Engine]\r\nBatchSize=48\r\nScheduledCompletions=4096\r\n\r\n"
+    "[DNS]\r\nResolverServer=10.1.2.3\r\nResolverThreads=6\r\nBackupDns1=10.0.0.53\r\nBackupDns2=10.0.1.53\r\nBackupDns3=10.0.2.53\r\n";
+
+// The loader as it was: one GetPrivateProfile* call per key, each opening and scanning the file again
+static void config_legacy_load(const char* path, ping_config_t* config) {
+    memset(config, 0, sizeof(*config));
+    config->timeout_ms = GetPrivateProfileIntA("Ping", "TimeoutMs", 3000, path);
+    config->interval_ms = GetPrivateProfileIntA("Ping", "IntervalMs", 1000, path);
+    config->loss_threshold = GetPrivateProfileIntA("Thresholds", "LossThreshold", 30, path);
+    config->latency_threshold = GetPrivateProfileIntA("Thresholds", "LatencyThreshold", 500, path);
+    config->jitter_threshold = GetPrivateProfileIntA("Thresholds", "JitterThreshold", 100, path);
+    config->max_retries = GetPrivateProfileIntA("Ping", "MaxRetries", 3, path);
+    config->enable_countermeasures = GetPrivateProfileIntA("Features", "EnableCountermeasures", 1, path);
+    config->enable_dns_switching = GetPrivateProfileIntA("Features", "EnableDnsSwitching", 1, path);
+    config->enable_route_refresh = GetPrivateProfileIntA("Features", "EnableRouteRefresh", 1, path);
+    config->enable_logging = GetPrivateProfileIntA("Features", "EnableLogging", 1, path);
+    config->countermeasure_cooldown_ms = GetPrivateProfileIntA("Features", "CountermeasureCooldownMs", 30000, path);
+    config->countermeasure_settle_ms = GetPrivateProfileIntA("Features", "CountermeasureSettleMs", 5000, path);
+    config->engine_batch_size = GetPrivateProfileIntA("Engine", "BatchSize", 32, path);
+    config->scheduled_completions = GetPrivateProfileIntA("Engine", "ScheduledCompletions", 65536, path);
+    GetPrivateProfileStringA("Ping", "Target", "8.8.8.8", config->target, sizeof(config->target), path);
+    GetPrivateProfileStringA("DNS", "ResolverServer", "", config->resolver_dns, sizeof(config->resolver_dns), path);
+    config->resolver_threads = GetPrivateProfileIntA("DNS", "ResolverThreads", 16, path);
+    config->short_window_ms = GetPrivateProfileIntA("Thresholds", "ShortWindowMs", 30000, path);
+    config->long_window_ms = GetPrivateProfileIntA("Thresholds", "LongWindowMs", 300000, path);
+    for (int i = 0; i < MAX_BACKUP_DNS; i++) {
+        char key_name[32];
+        snprintf(key_name, sizeof(key_name), "BackupDns%d", i + 1);
+        GetPrivateProfileStringA("DNS", key_name, "", config->backup_dns[config->backup_dns_count], sizeof(config->backup_dns[0]), path);
+        if (config->backup_dns[config->backup_dns_count][0]) config->backup_dns_count++;
+    }
+}
+
+static bool config_bench_equal(const ping_config_t* a, const ping_config_t* b) {
+    if (strcmp(a->target, b->target) != 0 || strcmp(a->resolver_dns, b->resolver_dns) != 0) return false;
+    if (a->timeout_ms != b->timeout_ms || a->interval_ms != b->interval_ms || a->max_retries != b->max_retries) return false;
+    if (a->loss_threshold != b->loss_threshold || a->latency_threshold != b->latency_threshold || a->jitter_threshold != b->jitter_threshold) return false;
+    if (a->short_window_ms != b->short_window_ms || a->long_window_ms != b->long_window_ms) return false;
+    if (a->enable_countermeasures != b->enable_countermeasures || a->enable_dns_switching != b->enable_dns_switching ||
+        a->enable_route_refresh != b->enable_route_refresh || a->enable_logging != b->enable_logging) return false;
+    if (a->countermeasure_cooldown_ms != b->countermeasure_cooldown_ms || a->countermeasure_settle_ms != b->countermeasure_settle_ms) return false;
+    if (a->engine_batch_size != b->engine_batch_size || a->resolver_threads != b->resolver_threads) return false;
+    if (a->scheduled_completions != b->scheduled_completions) return false;
+    if (a->backup_dns_count != b->backup_dns_count) return false;
+    for (DWORD i = 0; i < a->backup_dns_count; i++) {
+        if (strcmp(a->backup_dns[i], b->backup_dns[i]) != 0) return false;
+    }
+    return true;
+}
+
+static ULONGLONG io_operations(ULONGLONG* reads) {
+    IO_COUNTERS counters = {0};
+    GetProcessIoCounters(GetCurrentProcess(), &counters);
+    *reads = counters.ReadOperationCount;
+    return counters.ReadOperationCount + counters.WriteOperationCount + counters.OtherOperationCount;
+}
+
+// The single-pass loader against per-key profile reads, its error positions, and what a restart costs
+static DWORD bench_config_load(void) {
+    DWORD result = ERROR_EXCEPTION_IN_SERVICE;
+    char path[MAX_PATH] = {0};
+    
+    __try {
+        printf("Benchmarking the single-pass configuration loader...\n");
+        GetTempPathA(MAX_PATH, path);
+        strcat_s(path, sizeof(path), "dbj_ping_config_bench.ini");
+        
+        HANDLE file = CreateFileA(path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+        DWORD written = 0;
+        bool wrote = file != INVALID_HANDLE_VALUE && WriteFile(file, CONFIG_BENCH_TEXT, sizeof(CONFIG_BENCH_TEXT) - 1, &written, NULL);
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+        if (!wrote) {
+            printf("✗ Could not write %s\n", path);
+            __leave;
+        }
+        
+        ping_config_t legacy, loaded;
+        ping_config_error_t error;
+        ULONGLONG reads_before, reads_after;
+        LARGE_INTEGER begin, end;
+        
+        ULONGLONG ops_before = io_operations(&reads_before);
+        QueryPerformanceCounter(&begin);
+        for (DWORD i = 0; i < CONFIG_BENCH_LOADS; i++) config_legacy_load(path, &legacy);
+        QueryPerformanceCounter(&end);
+        ULONGLONG ops_after = io_operations(&reads_after);
+        double legacy_us = elapsed_ms(begin, end) * 1000.0 / CONFIG_BENCH_LOADS;
+        double legacy_ops = (double)(ops_after - ops_before) / CONFIG_BENCH_LOADS;
+        double legacy_reads = (double)(reads_after - reads_before) / CONFIG_BENCH_LOADS;
+        
+        DWORD status = ERROR_SUCCESS;
+        ops_before = io_operations(&reads_before);
+        QueryPerformanceCounter(&begin);
+        for (DWORD i = 0; i < CONFIG_BENCH_LOADS && status == ERROR_SUCCESS; i++) status = ping_load_config(path, &loaded, &error);
+        QueryPerformanceCounter(&end);
+        ops_after = io_operations(&reads_after);
+        double loader_us = elapsed_ms(begin, end) * 1000.0 / CONFIG_BENCH_LOADS;
+        double loader_ops = (double)(ops_after - ops_before) / CONFIG_BENCH_LOADS;
+        double loader_reads = (double)(reads_after - reads_before) / CONFIG_BENCH_LOADS;
+        
+        printf("  GetPrivateProfile*: %.1f us/load, %.1f I/O operations, %.1f reads\n", legacy_us, legacy_ops, legacy_reads);
+        printf("  single pass: %.1f us/load, %.1f I/O operations, %.1f reads\n", loader_us, loader_ops, loader_reads);
+        
+        if (status != ERROR_SUCCESS) {
+            printf("✗ Loading failed with %lu at %lu:%lu: %s\n", status, error.line, error.column, error.message);
+            __leave;
+        }
+        if (!config_bench_equal(&legacy, &loaded)) {
+            printf("✗ The single-pass loader read different values than GetPrivateProfile*\n");
+            __leave;
+        }
+        if (loader_us >= legacy_us) {
+            printf("✗ One read and one pass is no faster than a read per key\n");
+            __leave;
+        }
+        
+        // A bad number and an unknown key: the number is the error, reported where it is, the key only a warning
+        static const char broken[] = "[DNS]\r\nBackupDns12=10.0.0.53\r\n[Ping]\r\nTimeoutMs = 15OO\r\n";
+        status = ping_parse_config(broken, sizeof(broken) - 1, &loaded, &error);
+        if (status != ERROR_INVALID_DATA || error.line != 4 || error.column != 13 || error.errors != 1 || error.warnings != 1 || loaded.timeout_ms != 3000) {
+            printf("✗ Broken configuration reported %lu at %lu:%lu (%lu errors, %lu warnings): %s\n",
+                   status, error.line, error.column, error.errors, error.warnings, error.message);
+            __leave;
+        }
+        
+        // A newer version's key and a comment after a number do not fail the file
+        static const char newer[] = "[Ping]\r\nTimeoutMs=3500 ; ms\r\nFutureKey=1\r\n";
+        status = ping_parse_config(newer, sizeof(newer) - 1, &loaded, &error);
+        if (status != ERROR_SUCCESS || error.warnings != 1 || error.line != 3 || loaded.timeout_ms != 3500) {
+            printf("✗ Unknown key or trailing comment failed the parse: %lu at %lu:%lu: %s\n", status, error.line, error.column, error.message);
+            __leave;
+        }
+        printf("  broken file: line %lu, column %lu: %s\n", error.line, error.column, error.message);
+        
+        // Startup as a whole, the configuration is now one read of dbj_ping.ini
+        ping_cleanup();
+        ops_before = io_operations(&reads_before);
+        QueryPerformanceCounter(&begin);
+        status = ping_initialize();
+        QueryPerformanceCounter(&end);
+        ops_after = io_operations(&reads_after);
+        if (status != ERROR_SUCCESS) {
+            printf("✗ ping_initialize failed again with %lu\n", status);
+            __leave;
+        }
+        printf("  ping_initialize: %.2f ms, %llu I/O operations, %llu reads\n",
+               elapsed_ms(begin, end), ops_after - ops_before, reads_after - reads_before);
+        
+        printf("✓ Configuration loader benchmark complete\n");
+        result = ERROR_SUCCESS;
+    }
+    __finally {
+        if (path[0]) DeleteFileA(path);
+    }
+    
+    return result;
+}
+
+typedef struct {
+    HANDLE start;
+    volatile LONG* stop;
+    ULONGLONG reads;
+    ULONGLONG torn;
+} config_reader_worker_t;
+
+// Every published config carries one generation in all of these, a mix of two shows as a mismatch
+static void config_snapshot_fill(ping_config_t* config, DWORD generation) {
+    config->enable_countermeasures = false;
+    config->loss_threshold = generation;
+    config->latency_threshold = generation;
+    config->jitter_threshold = generation;
+    config->max_retries = generation;
+    config->countermeasure_settle_ms = generation;
+    snprintf(config->target, sizeof(config->target), "snapshot-%lu.dbj-ping.test", generation);
+}
+
+static bool config_snapshot_consistent(const ping_config_t* config) {
+    ping_config_t expected = *config;
+    config_snapshot_fill(&expected, config->loss_threshold);
+    return config->latency_threshold == expected.latency_threshold && config->jitter_threshold == expected.jitter_threshold &&
+        config->max_retries == expected.max_retries && config->countermeasure_settle_ms == expected.countermeasure_settle_ms &&
+        strcmp(config->target, expected.target) == 0;
+}
+
+static DWORD WINAPI config_reader_worker(LPVOID param) {
+    config_reader_worker_t* worker = (config_reader_worker_t*)param;
+    ping_config_t config;
+    WaitForSingleObject(worker->start, INFINITE);
+    while (!*worker->stop) {
+        if (ping_get_config(&config) != ERROR_SUCCESS) break;
+        if (!config_snapshot_consistent(&config)) worker->torn++;
+        worker->reads++;
+    }
+    return 0;
+}
+
+// Run the readers for a while, alone or against a writer, and report what a read cost them
+static bool config_snapshot_run(config_reader_worker_t* workers, const ping_config_t* base, DWORD generations, double* read_ns, ULONGLONG* torn) {
+    HANDLE threads[CONFIG_SNAPSHOT_READERS] = {0};
+    volatile LONG stop = 0;
+    bool started = true;
+    HANDLE start = CreateEventA(NULL, TRUE, FALSE, NULL);
+    if (!start) return false;
+    
+    for (DWORD t = 0; t < CONFIG_SNAPSHOT_READERS; t++) {
+        workers[t].start = start;
+        workers[t].stop = &stop;
+        workers[t].reads = 0;
+        workers[t].torn = 0;
+        threads[t] = CreateThread(NULL, 0, config_reader_worker, &workers[t], 0, NULL);
+        if (!threads[t]) started = false;
+    }
+    
+    LARGE_INTEGER begin, end;
+    QueryPerformanceCounter(&begin);
+    SetEvent(start);
+    if (generations == 0) {
+        Sleep(CONFIG_SNAPSHOT_QUIET_MS);
+    }
+    for (DWORD g = 1; g <= generations && started; g++) {
+        ping_config_t config = *base;
+        config_snapshot_fill(&config, g);
+        if (ping_set_config(&config) != ERROR_SUCCESS) started = false;
+    }
+    InterlockedExchange(&stop, 1);
+    for (DWORD t = 0; t < CONFIG_SNAPSHOT_READERS; t++) {
+        if (threads[t]) {
+            WaitForSingleObject(threads[t], INFINITE);
+            CloseHandle(threads[t]);
+        }
+    }
+    QueryPerformanceCounter(&end);
+    CloseHandle(start);
+    
+    ULONGLONG reads = 0;
+    *torn = 0;
+    for (DWORD t = 0; t < CONFIG_SNAPSHOT_READERS; t++) {
+        reads += workers[t].reads;
+        *torn += workers[t].torn;
+    }
+    *read_ns = reads ? elapsed_ms(begin, end) * 1000000.0 * CONFIG_SNAPSHOT_READERS / (double)reads : 0.0;
+    return started && reads > 0;
+}
+
+// Readers copy whole snapshots while a writer publishes new ones, then an edit of dbj_ping.ini must be picked up
+static DWORD test_config_snapshots(void) {
+    DWORD result = ERROR_EXCEPTION_IN_SERVICE;
+    config_reader_worker_t workers[CONFIG_SNAPSHOT_READERS];
+    ping_config_t original = {0};
+    bool changed = false;
+    
+    __try {
+        printf("Testing configuration snapshots and hot reload...\n");
+        if (ping_get_config(&original) != ERROR_SUCCESS) __leave;
+        changed = true;
+        
+        ping_config_t first = original;
+        config_snapshot_fill(&first, 0);
+        if (ping_set_config(&first) != ERROR_SUCCESS) __leave;
+        
+        ping_config_stats_t before, after;
+        double quiet_ns = 0.0, busy_ns = 0.0;
+        ULONGLONG torn = 0;
+        if (!config_snapshot_run(workers, &original, 0, &quiet_ns, &torn)) {
+            printf("✗ Reader threads did not run\n");
+            __leave;
+        }
+        ping_get_config_stats(&before);
+        if (!config_snapshot_run(workers, &original, CONFIG_SNAPSHOT_GENERATIONS, &busy_ns, &torn)) {
+            printf("✗ Publishing configurations failed\n");
+            __leave;
+        }
+        ping_get_config_stats(&after);
+        
+        printf("  %d readers: %.1f ns/read alone, %.1f ns/read during %d publications\n",
+               CONFIG_SNAPSHOT_READERS, quiet_ns, busy_ns, CONFIG_SNAPSHOT_GENERATIONS);
+        printf("  version %llu -> %llu, %llu snapshots reclaimed\n", before.version, after.version, after.reclaimed - before.reclaimed);
+        if (torn > 0) {
+            printf("✗ %llu reads saw parts of two configurations\n", torn);
+            __leave;
+        }
+        if (after.version - before.version != CONFIG_SNAPSHOT_GENERATIONS || after.reclaimed - before.reclaimed < CONFIG_SNAPSHOT_GENERATIONS) {
+            printf("✗ Every publication must make a version and reclaim the snapshot it replaced\n");
+            __leave;
+        }
+        
+        // An edit from outside, as a text editor or a deployment tool would make it
+        char path[MAX_PATH] = {0};
+        HMODULE module = GetModuleHandleA("dbj_ping.dll");
+        if (!module || !GetModuleFileNameA(module, path, sizeof(path)) || !strrchr(path, '\\')) {
+            printf("✗ Could not find dbj_ping.ini\n");
+            __leave;
+        }
+        strcpy_s(strrchr(path, '\\') + 1, sizeof(path) - (strrchr(path, '\\') + 1 - path), "dbj_ping.ini");
+        
+        // Saved now, or the save still pending from the publications would win over the edit
+        ping_save_config(NULL, NULL);
+        ping_get_config_stats(&before);
+        // A key this version does not know rides along, it must not hold the edit back
+        if (!WritePrivateProfileStringA("Thresholds", "FutureKey", "1", path) ||
+            !WritePrivateProfileStringA("Thresholds", "JitterThreshold", CONFIG_SNAPSHOT_EDIT, path)) {
+            printf("✗ Could not edit %s: %lu\n", path, GetLastError());
+            __leave;
+        }
+        LARGE_INTEGER begin, end;
+        QueryPerformanceCounter(&begin);
+        ping_config_t reloaded = {0};
+        do {
+            Sleep(10);
+            ping_get_config_stats(&after);
+            QueryPerformanceCounter(&end);
+        } while (after.reloads == before.reloads && elapsed_ms(begin, end) < CONFIG_SNAPSHOT_RELOAD_MS);
+        ping_get_config(&reloaded);
+        
+        if (after.reloads == before.reloads || reloaded.jitter_threshold != (DWORD)atoi(CONFIG_SNAPSHOT_EDIT)) {
+            printf("✗ Edit of %s not picked up in %d ms (jitter threshold %lu)\n", path, CONFIG_SNAPSHOT_RELOAD_MS, reloaded.jitter_threshold);
+            __leave;
+        }
+        printf("  edit of dbj_ping.ini live after %.0f ms as version %llu\n", elapsed_ms(begin, end), after.version);
+        
+        printf("✓ Configuration snapshots test complete\n");
+        result = ERROR_SUCCESS;
+    }
+    __finally {
+        if (changed) ping_set_config(&original);
+    }
+    
+    return result;
+}
+
+// The save as it was: the file rewritten once per key, unused BackupDns slots cleared one by one
+static bool config_legacy_save(const char* path, const ping_config_t* config) {
+    char value[32];
+    bool saved = WritePrivateProfileStringA("Ping", "Target", config->target, path);
+#define LEGACY_SAVE(section, key, format, field) \
+    sprintf_s(value, sizeof(value), format, field); \
+    saved = saved && WritePrivateProfileStringA(section, key, value, path)
+    LEGACY_SAVE("Ping", "TimeoutMs", "%lu", config->timeout_ms);
+    LEGACY_SAVE("Ping", "IntervalMs", "%lu", config->interval_ms);
+    LEGACY_SAVE("Ping", "MaxRetries", "%lu", config->max_retries);
+    LEGACY_SAVE("Thresholds", "LossThreshold", "%lu", config->loss_threshold);
+    LEGACY_SAVE("Thresholds", "LatencyThreshold", "%lu", config->latency_threshold);
+    LEGACY_SAVE("Thresholds", "JitterThreshold", "%lu", config->jitter_threshold);
+    LEGACY_SAVE("Thresholds", "ShortWindowMs", "%lu", config->short_window_ms);
+    LEGACY_SAVE("Thresholds", "LongWindowMs", "%lu", config->long_window_ms);
+    LEGACY_SAVE("Features", "EnableCountermeasures", "%d", config->enable_countermeasures);
+    LEGACY_SAVE("Features", "EnableDnsSwitching", "%d", config->enable_dns_switching);
+    LEGACY_SAVE("Features", "EnableRouteRefresh", "%d", config->enable_route_refresh);
+    LEGACY_SAVE("Features", "EnableLogging", "%d", config->enable_logging);
+    LEGACY_SAVE("Features", "CountermeasureCooldownMs", "%lu", config->countermeasure_cooldown_ms);
+    LEGACY_SAVE("Features", "CountermeasureSettleMs", "%lu", config->countermeasure_settle_ms);
+    LEGACY_SAVE("Engine", "BatchSize", "%lu", config->engine_batch_size);
+    LEGACY_SAVE("Engine", "ScheduledCompletions", "%lu", config->scheduled_completions);
+    saved = saved && WritePrivateProfileStringA("DNS", "ResolverServer", config->resolver_dns, path);
+    LEGACY_SAVE("DNS", "ResolverThreads", "%lu", config->resolver_threads);
+#undef LEGACY_SAVE
+    for (DWORD i = 0; i < MAX_BACKUP_DNS; i++) {
+        sprintf_s(value, sizeof(value), "BackupDns%lu", i + 1);
+        saved = saved && WritePrivateProfileStringA("DNS", value, i < config->backup_dns_count ? config->backup_dns[i] : NULL, path);
+    }
+    return saved;
+}
+
+// Child process of the crash test: saves generation after generation until it is killed
+static int config_crash_child(const char* path, bool legacy) {
+    ping_config_t config;
+    ping_config_error_t error;
+    ping_parse_config("", 0, &config, &error);
+    DWORD generation = 0;
+    while (true) {
+        config_snapshot_fill(&config, ++generation);
+        if (legacy) config_legacy_save(path, &config);
+        else if (ping_save_config(path, &config) != ERROR_SUCCESS) return 1;
+    }
+}
+
+// Kill children in the middle of saving, the file they leave must parse and hold one whole generation
+static DWORD config_crash_rounds(const char* path, bool legacy, DWORD* broken) {
+    char command[MAX_PATH * 2 + 64];
+    char exe[MAX_PATH];
+    ping_config_t config;
+    ping_config_error_t error;
+    
+    *broken = 0;
+    if (!GetModuleFileNameA(NULL, exe, sizeof(exe))) return GetLastError();
+    sprintf_s(command, sizeof(command), "\"%s\" %s \"%s\"", exe, legacy ? "--config-crash-legacy" : "--config-crash-child", path);
+    
+    for (DWORD round = 0; round < CONFIG_CRASH_ROUNDS; round++) {
+        STARTUPINFOA startup = { sizeof(startup) };
+        PROCESS_INFORMATION process = {0};
+        if (!CreateProcessA(NULL, command, NULL, NULL, FALSE, CREATE_NO_WINDOW, NULL, NULL, &startup, &process)) {
+            return GetLastError();
+        }
+        Sleep(CONFIG_CRASH_MIN_MS + (DWORD)rand() % CONFIG_CRASH_SPREAD_MS);
+        TerminateProcess(process.hProcess, 1);
+        WaitForSingleObject(process.hProcess, INFINITE);
+        CloseHandle(process.hThread);
+        CloseHandle(process.hProcess);
+        
+        if (ping_load_config(path, &config, &error) != ERROR_SUCCESS || !config_snapshot_consistent(&config)) {
+            (*broken)++;
+        }
+    }
+    return ERROR_SUCCESS;
+}
+
+// ping_set_config against the per-key rewrite it replaced, bursts saved once, and saves that survive being killed
+static DWORD bench_config_save(void) {
+    DWORD result = ERROR_EXCEPTION_IN_SERVICE;
+    ping_config_t original = {0};
+    bool changed = false;
+    char path[MAX_PATH] = {0}, temp_path[MAX_PATH + 4] = {0};
+    
+    __try {
+        printf("Benchmarking configuration saves...\n");
+        if (ping_get_config(&original) != ERROR_SUCCESS) __leave;
+        GetTempPathA(MAX_PATH, path);
+        strcat_s(path, sizeof(path), "dbj_ping_config_save.ini");
+        sprintf_s(temp_path, sizeof(temp_path), "%s.tmp", path);
+        
+        ping_config_t config = original;
+        LARGE_INTEGER begin, end;
+        QueryPerformanceCounter(&begin);
+        for (DWORD i = 0; i < CONFIG_SAVE_BENCH_SAVES; i++) {
+            config_snapshot_fill(&config, i);
+            config_legacy_save(path, &config);
+        }
+        QueryPerformanceCounter(&end);
+        double legacy_us = elapsed_ms(begin, end) * 1000.0 / CONFIG_SAVE_BENCH_SAVES;
+        DeleteFileA(path);
+        
+        QueryPerformanceCounter(&begin);
+        for (DWORD i = 0; i < CONFIG_SAVE_BENCH_SAVES; i++) {
+            config_snapshot_fill(&config, i);
+            if (ping_save_config(path, &config) != ERROR_SUCCESS) {
+                printf("✗ Saving to %s failed\n", path);
+                __leave;
+            }
+        }
+        QueryPerformanceCounter(&end);
+        double save_us = elapsed_ms(begin, end) * 1000.0 / CONFIG_SAVE_BENCH_SAVES;
+        
+        // A burst through the API: each call is only a publication, the watcher saves once it stops
+        ping_config_stats_t before, after;
+        ping_save_config(NULL, NULL);
+        ping_get_config_stats(&before);
+        changed = true;
+        QueryPerformanceCounter(&begin);
+        for (DWORD i = 0; i < CONFIG_SAVE_BENCH_BURST; i++) {
+            config = original;
+            config_snapshot_fill(&config, i);
+            if (ping_set_config(&config) != ERROR_SUCCESS) __leave;
+        }
+        QueryPerformanceCounter(&end);
+        double set_us = elapsed_ms(begin, end) * 1000.0 / CONFIG_SAVE_BENCH_BURST;
+        Sleep(CONFIG_SAVE_BENCH_SETTLE_MS);
+        ping_get_config_stats(&after);
+        
+        printf("  per-key WritePrivateProfileString save: %.1f us\n", legacy_us);
+        printf("  one write and a rename, flushed: %.1f us\n", save_us);
+        printf("  ping_set_config in a burst of %d: %.1f us/call, %llu saves\n", CONFIG_SAVE_BENCH_BURST, set_us, after.saves - before.saves);
+        if (set_us >= legacy_us) {
+            printf("✗ ping_set_config costs the caller as much as the save it used to make\n");
+            __leave;
+        }
+        if (after.saves - before.saves < 1 || after.saves - before.saves > 2) {
+            printf("✗ A burst must be saved once after it ends\n");
+            __leave;
+        }
+        
+        DWORD legacy_broken = 0, broken = 0;
+        config = original;
+        config_snapshot_fill(&config, 0);
+        if (ping_save_config(path, &config) != ERROR_SUCCESS ||
+            config_crash_rounds(path, true, &legacy_broken) != ERROR_SUCCESS) {
+            printf("✗ Crash rounds could not run\n");
+            __leave;
+        }
+        ping_save_config(path, &config);
+        if (config_crash_rounds(path, false, &broken) != ERROR_SUCCESS) {
+            printf("✗ Crash rounds could not run\n");
+            __leave;
+        }
+        printf("  killed while saving, %d times each: per-key saves left %lu broken files, rename saves %lu\n",
+               CONFIG_CRASH_ROUNDS, legacy_broken, broken);
+        if (broken > 0) {
+            printf("✗ A save killed halfway left a broken file\n");
+            __leave;
+        }
+        
+        printf("✓ Configuration save benchmark complete\n");
+        result = ERROR_SUCCESS;
+    }
+    __finally {
+        if (changed) {
+            ping_set_config(&original);
+            ping_save_config(NULL, NULL);
+        }
+        if (path[0]) DeleteFileA(path);
+        if (temp_path[0]) DeleteFileA(temp_path);
+    }
+    
+    return result;
+}
+
+static DWORD run_loopback_tests(void) {
+    DWORD result = ERROR_EXCEPTION_IN_SERVICE;
+    
+    __try {
+        if (test_batch_loopback() != ERROR_SUCCESS) __leave;
+        if (test_rtt_resolution() != ERROR_SUCCESS) __leave;
+        if (bench_stats_threads() != ERROR_SUCCESS) __leave;
+        if (test_target_stats() != ERROR_SUCCESS) __leave;
+        if (bench_target_stats() != ERROR_SUCCESS) __leave;
+        if (test_history() != ERROR_SUCCESS) __leave;
+        if (bench_history() != ERROR_SUCCESS) __leave;
+        if (bench_probe_records() != ERROR_SUCCESS) __leave;
+        if (test_rtt_histogram() != ERROR_SUCCESS) __leave;
+        if (test_sketch_merge() != ERROR_SUCCESS) __leave;
+        if (test_outage_detection() != ERROR_SUCCESS) __leave;
+        if (bench_change_detection() != ERROR_SUCCESS) __leave;
+        if (test_countermeasure_cadence() != ERROR_SUCCESS) __leave;
+        if (bench_countermeasure_actions() != ERROR_SUCCESS) __leave;
+        if (test_countermeasure_registry() != ERROR_SUCCESS) __leave;
+        if (bench_log_ring() != ERROR_SUCCESS) __leave;
+        if (bench_log_binary() != ERROR_SUCCESS) __leave;
+        if (test_resolver_cache() != ERROR_SUCCESS) __leave;
+        if (test_schedule_drift(DRIFT_QUICK_SECONDS) != ERROR_SUCCESS) __leave;
+        if (test_schedule_bounded() != ERROR_SUCCESS) __leave;
+        if (bench_schedule_wheel() != ERROR_SUCCESS) __leave;
+        if (bench_resolver_cold_start() != ERROR_SUCCESS) __leave;
+        if (test_submit_loopback() != ERROR_SUCCESS) __leave;
+        if (bench_engine_loopback() != ERROR_SUCCESS) __leave;
+        if (bench_engine_batch_sizes() != ERROR_SUCCESS) __leave;
+        if (test_config_snapshots() != ERROR_SUCCESS) __leave;
+        if (bench_config_save() != ERROR_SUCCESS) __leave;
+        if (bench_config_load() != ERROR_SUCCESS) __leave;
+        
+        result = ERROR_SUCCESS;
+    }
+    __finally {
+        // Nothing to cleanup here
+    }
+    
+    return result;
+}
+
 static DWORD interactive_ping_test(const char* target) {
     DWORD result = ERROR_EXCEPTION_IN_SERVICE;
     DWORD last_ping_time = 0;
@@ -321,6 +3286,11 @@ static DWORD interactive_ping_test(const char* target) {
 #pragma region Main_Function
 
 int main(int argc, char* argv[]) {
+    // Child of the configuration crash test, saves until the parent kills it
+    if (argc == 3 && (strcmp(argv[1], "--config-crash-child") == 0 || strcmp(argv[1], "--config-crash-legacy") == 0)) {
+        return config_crash_child(argv[2], strcmp(argv[1], "--config-crash-legacy") == 0);
+    }
+    
     __try {
         printf("dbj_ping DLL Test Application\n");
         printf("============================\n\n");
@@ -346,11 +3316,17 @@ int main(int argc, char* argv[]) {
             print_config(&config);
         }
         
-        // Determine target
+        // Determine target, --drift adds the ten minute scheduling run
         char target[MAX_TARGET_LEN] = {0};
-        if (argc > 1) {
-            strncpy_s(target, sizeof(target), argv[1], _TRUNCATE);
-        } else {
+        bool long_drift = false;
+        for (int i = 1; i < argc; i++) {
+            if (strcmp(argv[i], "--drift") == 0) {
+                long_drift = true;
+            } else if (!target[0]) {
+                strncpy_s(target, sizeof(target), argv[i], _TRUNCATE);
+            }
+        }
+        if (!target[0]) {
             strcpy_s(target, sizeof(target), config.target[0] ? config.target : TEST_TARGET_DEFAULT);
         }
         
@@ -367,6 +3343,23 @@ int main(int argc, char* argv[]) {
         
         printf("\n✓ All basic tests passed!\n\n");
         
+        // Run loopback tests, these need no network access
+        if (run_loopback_tests() != ERROR_SUCCESS) {
+            printf("Loopback tests failed\n");
+            ping_cleanup();
+            minidump_cleanup();
+            return -1;
+        }
+        
+        if (long_drift && test_schedule_drift(DRIFT_LONG_SECONDS) != ERROR_SUCCESS) {
+            printf("Long scheduling run failed\n");
+            ping_cleanup();
+            minidump_cleanup();
+            return -1;
+        }
+        
+        printf("\n✓ All loopback tests passed!\n\n");
+        
         // Ask user if they want to run interactive test
         printf("Run interactive ping test? (y/n): ");
         char choice = _getch();